@@ -24,6 +24,10 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 namespace libtas {
 
@@ -80,16 +84,138 @@ ssize_t Utils::readAll(int fd, void *buf, size_t count)
     return num_read;
 }
 
-/* This function detects if the given page is zero pages or not. There is
- * scope of improving this function using some optimizations.
+/* Memory page comparisons are done on every saved and loaded page, so they
+ * have vectorized versions selected at runtime. Pages may not be aligned
+ * (buffers inside worker jobs), so we use unaligned loads. */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2"))) static bool isZeroPageAVX2(const void *addr)
+{
+    const __m256i *buf = static_cast<const __m256i*>(addr);
+
+    for (int i = 0; i < 4096 / 32; i += 4) {
+        __m256i res = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256(buf + i), _mm256_loadu_si256(buf + i + 1)),
+            _mm256_or_si256(_mm256_loadu_si256(buf + i + 2), _mm256_loadu_si256(buf + i + 3)));
+        if (!_mm256_testz_si256(res, res))
+            return false;
+    }
+    return true;
+}
+
+__attribute__((target("sse2"))) static bool isZeroPageSSE2(const void *addr)
+{
+    const __m128i *buf = static_cast<const __m128i*>(addr);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int i = 0; i < 4096 / 16; i += 4) {
+        __m128i res = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128(buf + i), _mm_loadu_si128(buf + i + 1)),
+            _mm_or_si128(_mm_loadu_si128(buf + i + 2), _mm_loadu_si128(buf + i + 3)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) != 0xFFFF)
+            return false;
+    }
+    return true;
+}
+
+__attribute__((target("avx2"))) static bool isSamePageAVX2(const void *addr1, const void *addr2)
+{
+    const __m256i *buf1 = static_cast<const __m256i*>(addr1);
+    const __m256i *buf2 = static_cast<const __m256i*>(addr2);
+
+    for (int i = 0; i < 4096 / 32; i += 4) {
+        __m256i res = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_xor_si256(_mm256_loadu_si256(buf1 + i), _mm256_loadu_si256(buf2 + i)),
+                _mm256_xor_si256(_mm256_loadu_si256(buf1 + i + 1), _mm256_loadu_si256(buf2 + i + 1))),
+            _mm256_or_si256(
+                _mm256_xor_si256(_mm256_loadu_si256(buf1 + i + 2), _mm256_loadu_si256(buf2 + i + 2)),
+                _mm256_xor_si256(_mm256_loadu_si256(buf1 + i + 3), _mm256_loadu_si256(buf2 + i + 3))));
+        if (!_mm256_testz_si256(res, res))
+            return false;
+    }
+    return true;
+}
+
+__attribute__((target("sse2"))) static bool isSamePageSSE2(const void *addr1, const void *addr2)
+{
+    const __m128i *buf1 = static_cast<const __m128i*>(addr1);
+    const __m128i *buf2 = static_cast<const __m128i*>(addr2);
+
+    for (int i = 0; i < 4096 / 16; i += 2) {
+        __m128i res = _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128(buf1 + i), _mm_loadu_si128(buf2 + i)),
+            _mm_cmpeq_epi8(_mm_loadu_si128(buf1 + i + 1), _mm_loadu_si128(buf2 + i + 1)));
+        if (_mm_movemask_epi8(res) != 0xFFFF)
+            return false;
+    }
+    return true;
+}
+
+__attribute__((target("avx2"))) static void xorPageAVX2(void *dest, const void *src)
+{
+    __m256i *out = static_cast<__m256i*>(dest);
+    const __m256i *in = static_cast<const __m256i*>(src);
+
+    for (int i = 0; i < 4096 / 32; i++)
+        _mm256_storeu_si256(out + i, _mm256_xor_si256(_mm256_loadu_si256(out + i), _mm256_loadu_si256(in + i)));
+}
+
+__attribute__((target("sse2"))) static void xorPageSSE2(void *dest, const void *src)
+{
+    __m128i *out = static_cast<__m128i*>(dest);
+    const __m128i *in = static_cast<const __m128i*>(src);
+
+    for (int i = 0; i < 4096 / 16; i++)
+        _mm_storeu_si128(out + i, _mm_xor_si128(_mm_loadu_si128(out + i), _mm_loadu_si128(in + i)));
+}
+
+__attribute__((target("sse4.2"))) static uint32_t crc32cSSE42(uint32_t crc, const void *data, size_t size)
+{
+    const unsigned char *buf = static_cast<const unsigned char*>(data);
+
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, buf += 8) {
+        uint64_t value;
+        memcpy(&value, buf, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    for (; size >= 4; size -= 4, buf += 4) {
+        uint32_t value;
+        memcpy(&value, buf, 4);
+        crc = _mm_crc32_u32(crc, value);
+    }
+    for (; size > 0; size--, buf++)
+        crc = _mm_crc32_u8(crc, *buf);
+
+    return crc;
+}
+
+#endif
+
+/* This function detects if the given page is zero pages or not.
  *
  * TODO: One can use /proc/self/pagemap to detect if the page is backed by a
  * shared zero page.
  */
-bool Utils::isZeroPage(void *addr)
+bool Utils::isZeroPage(const void *addr)
 {
+#if defined(__x86_64__) || defined(__i386__)
+    static bool isAVX2Supported = __builtin_cpu_supports("avx2");
+    static bool isSSE2Supported = __builtin_cpu_supports("sse2");
+
+    if (isAVX2Supported)
+        return isZeroPageAVX2(addr);
+    if (isSSE2Supported)
+        return isZeroPageSSE2(addr);
+#endif
+
     static const size_t page_size = 4096;
-    long long *buf = (long long *)addr;
+    const long long *buf = static_cast<const long long*>(addr);
     size_t end = page_size / sizeof(*buf);
     long long res = 0;
 
@@ -103,4 +229,58 @@ bool Utils::isZeroPage(void *addr)
     return res == 0;
 }
 
+bool Utils::isSamePage(const void *addr1, const void *addr2)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static bool isAVX2Supported = __builtin_cpu_supports("avx2");
+    static bool isSSE2Supported = __builtin_cpu_supports("sse2");
+
+    if (isAVX2Supported)
+        return isSamePageAVX2(addr1, addr2);
+    if (isSSE2Supported)
+        return isSamePageSSE2(addr1, addr2);
+#endif
+
+    return 0 == memcmp(addr1, addr2, 4096);
+}
+
+void Utils::xorPage(void *dest, const void *src)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static bool isAVX2Supported = __builtin_cpu_supports("avx2");
+    static bool isSSE2Supported = __builtin_cpu_supports("sse2");
+
+    if (isAVX2Supported)
+        return xorPageAVX2(dest, src);
+    if (isSSE2Supported)
+        return xorPageSSE2(dest, src);
+#endif
+
+    long long *out = static_cast<long long*>(dest);
+    const long long *in = static_cast<const long long*>(src);
+    for (size_t i = 0; i < 4096 / sizeof(*out); i++)
+        out[i] ^= in[i];
+}
+
+uint32_t Utils::crc32c(uint32_t crc, const void *data, size_t size)
+{
+    crc = ~crc;
+
+#if defined(__x86_64__) || defined(__i386__)
+    static bool isSSE42Supported = __builtin_cpu_supports("sse4.2");
+
+    if (isSSE42Supported)
+        return ~crc32cSSE42(crc, data, size);
+#endif
+
+    /* Bitwise version, using the reversed Castagnoli polynomial */
+    const unsigned char *buf = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        crc ^= buf[i];
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
 }
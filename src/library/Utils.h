@@ -23,6 +23,7 @@
 #define LIBTAS_UTILS_H
 
 #include <cstddef> // size_t
+#include <cstdint> // uint32_t
 #include <unistd.h> // ssize_t
 
 namespace libtas {
@@ -30,7 +31,16 @@ namespace Utils
 {
     ssize_t writeAll(int fd, const void *buf, size_t count);
     ssize_t readAll(int fd, void *buf, size_t count);
-    bool isZeroPage(void *addr);
+    bool isZeroPage(const void *addr);
+
+    /* Compare two memory pages */
+    bool isSamePage(const void *addr1, const void *addr2);
+
+    /* Apply a xor of the source memory page onto the destination page */
+    void xorPage(void *dest, const void *src);
+
+    /* Update a CRC32C checksum with the data. Start with a zero crc */
+    uint32_t crc32c(uint32_t crc, const void *data, size_t size);
 }
 }
 
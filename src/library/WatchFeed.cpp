@@ -0,0 +1,237 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "WatchFeed.h"
+
+#include "logging.h"
+#include "GlobalState.h"
+#include "../shared/RamWatchFeed.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <climits>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace libtas {
+
+static RamWatchFeed* feed = nullptr;
+static int feed_fd = -1;
+static pid_t feed_pid = 0;
+
+/* Local copy of the watch list, which can be modified by the program at any
+ * time */
+static RamWatchFeed::Watch watches[RamWatchFeed::MAX_WATCHES];
+
+/* Current address of each watch while following pointer chains */
+static uintptr_t addresses[RamWatchFeed::MAX_WATCHES];
+
+int WatchFeed::init()
+{
+#ifdef __linux__
+    feed_fd = syscall(SYS_memfd_create, "libtas_ramwatch", 0);
+    if (feed_fd < 0) {
+        LOG(LL_WARN, LCF_NONE, "Could not create the ram watch memory");
+        return -1;
+    }
+
+    if (ftruncate(feed_fd, sizeof(RamWatchFeed)) < 0) {
+        LOG(LL_WARN, LCF_NONE, "Could not resize the ram watch memory");
+        closeFile();
+        return -1;
+    }
+
+    void* addr = mmap(nullptr, sizeof(RamWatchFeed), PROT_READ | PROT_WRITE, MAP_SHARED, feed_fd, 0);
+    if (addr == MAP_FAILED) {
+        LOG(LL_WARN, LCF_NONE, "Could not map the ram watch memory");
+        closeFile();
+        return -1;
+    }
+
+    /* The file is zero-filled, which is a valid empty feed */
+    feed = static_cast<RamWatchFeed*>(addr);
+    NATIVECALL(feed_pid = getpid());
+    return feed_fd;
+#else
+    return -1;
+#endif
+}
+
+void WatchFeed::closeFile()
+{
+    if (feed_fd >= 0) {
+        close(feed_fd);
+        feed_fd = -1;
+    }
+}
+
+void* WatchFeed::getAddr()
+{
+    return feed;
+}
+
+#ifdef __linux__
+/* Read an array of segments of our own memory, without crashing on invalid
+ * addresses. A segment that cannot be read does not prevent the next segments
+ * from being read. */
+static void readSegments(struct iovec* local, struct iovec* remote, uint32_t* read_sizes, int count)
+{
+    int first = 0;
+    while (first < count) {
+        int iov_count = count - first;
+        if (iov_count > IOV_MAX)
+            iov_count = IOV_MAX;
+
+        ssize_t ret = process_vm_readv(feed_pid, local + first, iov_count, remote + first, iov_count, 0);
+        if (ret < 0)
+            ret = 0;
+
+        /* The read stops at the first unreadable address */
+        size_t remaining_size = ret;
+        int i;
+        for (i = first; i < first + iov_count; i++) {
+            if (remaining_size < remote[i].iov_len) {
+                read_sizes[i] = remaining_size;
+                break;
+            }
+            read_sizes[i] = remote[i].iov_len;
+            remaining_size -= remote[i].iov_len;
+        }
+
+        /* Continue after the segment that could not be fully read */
+        first = (i < first + iov_count) ? (i + 1) : i;
+    }
+}
+#endif
+
+void WatchFeed::update(uint64_t framecount)
+{
+#ifdef __linux__
+    if (!feed)
+        return;
+
+    /* Copy the watch list, and skip this update if the program was modifying
+     * it at the same time */
+    uint64_t list_sequence = feed->list_sequence.load(std::memory_order_acquire);
+    if (list_sequence & 1)
+        return;
+
+    uint64_t list_generation = feed->list_generation;
+    uint32_t watch_count = feed->watch_count;
+    if (watch_count > RamWatchFeed::MAX_WATCHES)
+        return;
+
+    memcpy(watches, feed->watches, watch_count * sizeof(RamWatchFeed::Watch));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (feed->list_sequence.load(std::memory_order_relaxed) != list_sequence)
+        return;
+
+    if (watch_count == 0)
+        return;
+
+    uint64_t frame_count = feed->frame_count.load(std::memory_order_relaxed);
+    RamWatchFeed::Frame& frame = feed->frames[frame_count % RamWatchFeed::RING_SIZE];
+
+    uint64_t frame_sequence = frame.sequence.load(std::memory_order_relaxed);
+    frame.sequence.store(frame_sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    static struct iovec local[RamWatchFeed::MAX_WATCHES], remote[RamWatchFeed::MAX_WATCHES];
+    static uint32_t read_sizes[RamWatchFeed::MAX_WATCHES];
+    static uintptr_t pointers[RamWatchFeed::MAX_WATCHES];
+    static int indexes[RamWatchFeed::MAX_WATCHES];
+
+    uint32_t max_level = 0;
+    for (uint32_t w = 0; w < watch_count; w++) {
+        addresses[w] = static_cast<uintptr_t>(watches[w].base_address);
+        frame.values[w].read_size = 0;
+        if (watches[w].level_count > max_level)
+            max_level = watches[w].level_count;
+    }
+    if (max_level > RamWatchFeed::MAX_LEVELS)
+        max_level = RamWatchFeed::MAX_LEVELS;
+
+    /* Follow all pointer chains one level at a time, so that each level is
+     * read in a single batch */
+    for (uint32_t level = 0; level < max_level; level++) {
+        int count = 0;
+        for (uint32_t w = 0; w < watch_count; w++) {
+            if (level >= watches[w].level_count || !addresses[w])
+                continue;
+
+            local[count].iov_base = &pointers[count];
+            local[count].iov_len = sizeof(uintptr_t);
+            remote[count].iov_base = reinterpret_cast<void*>(addresses[w]);
+            remote[count].iov_len = sizeof(uintptr_t);
+            indexes[count] = w;
+            count++;
+        }
+
+        readSegments(local, remote, read_sizes, count);
+
+        for (int i = 0; i < count; i++) {
+            int w = indexes[i];
+            if (read_sizes[i] != sizeof(uintptr_t))
+                addresses[w] = 0;
+            else
+                addresses[w] = pointers[i] + watches[w].offsets[level];
+        }
+    }
+
+    /* Read all values */
+    int count = 0;
+    for (uint32_t w = 0; w < watch_count; w++) {
+        frame.values[w].address = addresses[w];
+        if (!addresses[w])
+            continue;
+
+        uint32_t size = watches[w].size;
+        if (size > RamWatchFeed::VALUE_SIZE)
+            size = RamWatchFeed::VALUE_SIZE;
+
+        local[count].iov_base = frame.values[w].data;
+        local[count].iov_len = size;
+        remote[count].iov_base = reinterpret_cast<void*>(addresses[w]);
+        remote[count].iov_len = size;
+        indexes[count] = w;
+        count++;
+    }
+
+    readSegments(local, remote, read_sizes, count);
+
+    for (int i = 0; i < count; i++)
+        frame.values[indexes[i]].read_size = read_sizes[i];
+
+    frame.framecount = framecount;
+    frame.list_generation = list_generation;
+    frame.watch_count = watch_count;
+
+    /* Publish the frame */
+    frame.sequence.store(frame_sequence + 2, std::memory_order_release);
+    feed->frame_count.store(frame_count + 1, std::memory_order_release);
+#endif
+}
+
+}
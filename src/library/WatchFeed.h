@@ -0,0 +1,47 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_WATCHFEED_H_INCL
+#define LIBTAS_WATCHFEED_H_INCL
+
+#include <stdint.h>
+
+namespace libtas {
+
+/* Copy of ram watch values into memory shared with the program */
+namespace WatchFeed {
+
+/* Create the shared memory. Returns its file descriptor, so that the program
+ * can map it, or -1 if it could not be created */
+int init();
+
+/* Close the file descriptor of the shared memory once the program mapped it */
+void closeFile();
+
+/* Address of the shared memory, which must not be saved in savestates */
+void* getAddr();
+
+/* Follow pointer chains and copy the value of all watches */
+void update(uint64_t framecount);
+
+}
+}
+
+#endif
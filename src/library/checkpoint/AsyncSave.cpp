@@ -0,0 +1,227 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AsyncSave.h"
+#include "ReservedMemory.h"
+#include "SaveStateSaving.h"
+#include "StateHeader.h"
+#include "MemArea.h"
+#include "WorkerPool.h"
+#include "PageStore.h"
+#include "CheckpointStats.h"
+
+#include "logging.h"
+#include "GlobalState.h"
+#include "TimeHolder.h"
+#include "../shared/SharedConfig.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace libtas {
+
+static AsyncSave::Control* control = nullptr;
+static bool thread_created = false;
+
+/* Transcode the staged savestate into the savestate files. The pagemap arena
+ * has the layout of a pagemap file without the area index, and the pages arena
+ * contains all saved pages uncompressed, in order. */
+static size_t writeState(AsyncSave::Request& request, int sfd)
+{
+    SaveStateSaving state(request.pmfd, request.pfd, -1);
+    state.setSettings(request.savestate_settings);
+    state.setPageStore(sfd);
+
+    const char* pagemaps = request.pagemaps.data();
+    size_t pagemaps_size = request.pagemaps.size();
+    char* pages = request.pages.data();
+
+    StateHeader header;
+    memcpy(&header, pagemaps, sizeof(StateHeader));
+
+    StateThreadList threads;
+    threads.thread_count = header.thread_count;
+    for (uint32_t t = 0; t < header.thread_count; t++) {
+        StateThread thread;
+        memcpy(&thread, pagemaps + sizeof(StateHeader) + t * sizeof(StateThread), sizeof(StateThread));
+        threads.pthread_ids[t] = static_cast<pthread_t>(thread.pthread_id);
+        threads.tids[t] = thread.tid;
+        threads.states[t] = thread.state;
+    }
+
+    state.saveHeader(&threads);
+    size_t pagemaps_off = header.areasOffset();
+    size_t savestate_size = pagemaps_off;
+
+    while (pagemaps_off + sizeof(Area) <= pagemaps_size) {
+        Area area;
+        memcpy(&area, pagemaps + pagemaps_off, sizeof(Area));
+        pagemaps_off += sizeof(Area);
+
+        if (!area)
+            break;
+
+        state.saveArea(&area);
+        savestate_size += sizeof(Area);
+
+        if (area.skip || area.uncommitted)
+            continue;
+
+        size_t nb_pages = (area.size + 4095) / 4096;
+        for (size_t p = 0; p < nb_pages; p++) {
+            char flag = pagemaps[pagemaps_off + p];
+            if (flag == Area::FULL_PAGE) {
+                savestate_size += state.queuePageSave(pages);
+                pages += 4096;
+            }
+            else {
+                state.savePageFlag(flag);
+            }
+        }
+        pagemaps_off += nb_pages;
+
+        savestate_size += state.finishSave();
+        savestate_size += nb_pages;
+    }
+
+    state.finishState();
+    savestate_size += sizeof(Area);
+
+    return savestate_size;
+}
+
+static void* writerLoop(void*)
+{
+    while (true) {
+        if (sem_wait(&control->start) != 0)
+            continue;
+
+        AsyncSave::Request& request = control->request;
+
+        TimeHolder old_time = TimeHolder::now();
+
+        bool dedup = request.savestate_settings & SharedConfig::SS_DEDUP;
+        int sfd = dedup ? PageStore::open(true) : -1;
+
+        size_t savestate_size = writeState(request, sfd);
+
+        NATIVECALL(close(request.pmfd));
+        NATIVECALL(close(request.pfd));
+
+        if (dedup) {
+            PageStore::close(sfd);
+
+            PageStore::removeState(request.oldpagemappath, request.oldpagespath);
+            if (request.unlink_old) {
+                NATIVECALL(unlink(request.oldpagemappath));
+                NATIVECALL(unlink(request.oldpagespath));
+            }
+        }
+
+        if (request.temppagemappath[0] != '\0') {
+            NATIVECALL(rename(request.temppagemappath, request.pagemappath));
+            NATIVECALL(rename(request.temppagespath, request.pagespath));
+        }
+
+        size_t raw_size = request.pages.size();
+        request.pagemaps.release();
+        request.pages.release();
+
+        TimeHolder delta_time = TimeHolder::now() - old_time;
+        NATIVECALL(LOG(LL_INFO, LCF_CHECKPOINT, "Wrote state %d of size %zu in background in %f seconds", request.slot, savestate_size, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0));
+        CheckpointStats::record("write", request.slot, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0,
+            savestate_size, raw_size);
+
+        control->completed.fetch_or(1 << request.slot);
+        control->busy.store(false);
+        sem_post(&control->done);
+    }
+
+    return nullptr;
+}
+
+void AsyncSave::init()
+{
+    if (control)
+        return;
+
+    control = static_cast<Control*>(ReservedMemory::getAddr(ReservedMemory::ASYNC_CONTROL_ADDR));
+
+    sem_init(&control->start, 0, 0);
+    sem_init(&control->done, 0, 0);
+    control->busy.store(false);
+    control->completed.store(0);
+
+    thread_created = WorkerPool::createThread(writerLoop, nullptr,
+        ReservedMemory::getAddr(ReservedMemory::ASYNC_STACK_ADDR), STACK_SIZE);
+}
+
+bool AsyncSave::available()
+{
+    return thread_created;
+}
+
+void AsyncSave::start(const Request& request)
+{
+    /* Should not happen, because callers wait for the previous savestate */
+    wait();
+
+    control->request = request;
+    control->busy.store(true);
+    sem_post(&control->start);
+}
+
+void AsyncSave::wait()
+{
+    if (!control)
+        return;
+
+    if (control->busy.load())
+        LOG(LL_DEBUG, LCF_CHECKPOINT, "Waiting for the savestate being written");
+
+    while (control->busy.load()) {
+        sem_wait(&control->done);
+    }
+
+    /* Consume any remaining post */
+    while (sem_trywait(&control->done) == 0) {}
+}
+
+void AsyncSave::markCompleted(int slot)
+{
+    if (control)
+        control->completed.fetch_or(1 << slot);
+}
+
+int AsyncSave::popCompleted()
+{
+    if (!control)
+        return -1;
+
+    int completed = control->completed.load();
+    while (completed != 0) {
+        int slot = __builtin_ctz(completed);
+        if (control->completed.compare_exchange_weak(completed, completed & ~(1 << slot)))
+            return slot;
+    }
+    return -1;
+}
+
+}
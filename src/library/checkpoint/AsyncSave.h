@@ -0,0 +1,114 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_ASYNCSAVE_H
+#define LIBTAS_ASYNCSAVE_H
+
+#include "StagingArena.h"
+
+#include <semaphore.h>
+#include <atomic>
+
+namespace libtas {
+
+/* Asynchronous savestate writing.
+ *
+ * When enabled, the checkpoint only copies the savestate into memory arenas
+ * (see SaveStateSaving::setStaging()), then the game resumes immediately. A
+ * background thread, created at startup like the worker pool, compresses and
+ * writes the arenas into the savestate files.
+ *
+ * Only one savestate can be written at a time. Any savestate saving or
+ * loading must first wait for the pending savestate to be written, which acts
+ * as a completion fence. */
+namespace AsyncSave
+{
+    enum {
+        STACK_SIZE = 1024 * 1024,
+        PATH_SIZE = 1024,
+    };
+
+    /* Description of a savestate to write */
+    struct Request {
+        /* Savestate slot, used to report completion */
+        int slot;
+
+        /* Savestate settings when the state was made */
+        int savestate_settings;
+
+        /* Already opened savestate files */
+        int pmfd, pfd;
+
+        /* If non-empty, savestate files are written into temporary files that
+         * must be renamed into the final paths. */
+        char temppagemappath[PATH_SIZE];
+        char temppagespath[PATH_SIZE];
+        char pagemappath[PATH_SIZE];
+        char pagespath[PATH_SIZE];
+
+        /* If non-empty, previous savestate files whose references to the page
+         * store must be removed after writing, and deleted if `unlink_old` */
+        char oldpagemappath[PATH_SIZE];
+        char oldpagespath[PATH_SIZE];
+        bool unlink_old;
+
+        /* Savestate content */
+        StagingArena pagemaps;
+        StagingArena pages;
+    };
+
+    struct Control {
+        /* Posted to wake up the writer thread */
+        sem_t start;
+
+        /* Posted when the writer thread finished writing */
+        sem_t done;
+
+        /* A savestate is being written */
+        std::atomic<bool> busy;
+
+        /* Bitfield of slots that were written but not reported yet */
+        std::atomic<int> completed;
+
+        Request request;
+    };
+
+    /* Spawn the writer thread. Must be called before any savestate is made */
+    void init();
+
+    /* Indicate if the writer thread is available */
+    bool available();
+
+    /* Send a savestate to be written. Ownership of the arenas and file
+     * descriptors is transfered to the writer thread. */
+    void start(const Request& request);
+
+    /* Wait for the pending savestate, if any, to be written */
+    void wait();
+
+    /* Report a savestate that was written directly, because it could not be
+     * written in background */
+    void markCompleted(int slot);
+
+    /* Get one slot whose savestate was written since the last call, or -1 */
+    int popCompleted();
+}
+}
+
+#endif
@@ -30,9 +30,15 @@
 #include "MachVmMaps.h"
 #endif
 #include "StateHeader.h"
+#include "CheckpointStats.h"
 #include "ReservedMemory.h"
 #include "SaveStateSaving.h"
 #include "SaveStateLoading.h"
+#include "WorkerPool.h"
+#include "AsyncSave.h"
+#include "PageStore.h"
+#include "RamStore.h"
+#include "LazyRestore.h"
 
 #include "TimeHolder.h"
 #include "logging.h"
@@ -103,6 +109,13 @@ static int ss_index = -1;
 static int parent_ss_index = -1;
 static int base_ss_index = -1;
 
+/* Number of /proc/self/pagemap entries read at once */
+static const int PAGEMAP_CHUNK = 2048;
+
+/* Statistics of the savestate being saved */
+static size_t saved_page_count = 0;
+static size_t parent_page_count = 0;
+
 /* Savestate ucontext (must be stored outside the alt stack) */
 static ucontext_t ss_ucontext;
 #if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
@@ -115,10 +128,12 @@ static _xstate ss_fpregset;
 
 static void readAllAreas();
 static int reallocateArea(Area *saved_area, Area *current_area);
-static void readAnArea(SaveStateLoading &saved_area, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state);
+static size_t readAnArea(SaveStateLoading &saved_area, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state, bool same_state, bool lazy_restore);
+static bool queueLazyLoad(SaveStateLoading &state, int source, char* addr);
 static void readASavefile(SaveStateLoading &saved_state);
 
 static void writeAllAreas(bool base);
+static void removeRamState(bool dedup);
 static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state, bool base);
 static size_t writeSaveFiles(SaveStateSaving &state);
 
@@ -212,23 +227,24 @@ int Checkpoint::checkCheckpoint()
 
 int Checkpoint::checkRestore()
 {
+    char statepagemappath[1024];
+    char statepagespath[1024];
+    RamStore::resolve(ss_index, pagemappath, pagespath, statepagemappath, statepagespath);
+
     /* Check that the savestate files exist */
     struct stat sb;
-    if (stat(pagemappath, &sb) == -1) {
+    if (stat(statepagemappath, &sb) == -1) {
         return SaveStateManager::ESTATE_NOSTATE;
     }
-    if (stat(pagespath, &sb) == -1) {
+    if (stat(statepagespath, &sb) == -1) {
         return SaveStateManager::ESTATE_NOSTATE;
     }
 
-    int pmfd = open(pagemappath, O_RDONLY);
-    if (pmfd == -1)
-        return SaveStateManager::ESTATE_NOSTATE;
-
-    /* Read the savestate header */
-    StateHeader sh;
-    Utils::readAll(pmfd, &sh, sizeof(sh));
-    close(pmfd);
+    /* Check the savestate header and index. Checking all pages is only
+     * done when debugging, because it reads the whole savestate. */
+    SaveStateLoading saved_state(statepagemappath, statepagespath);
+    if (!saved_state.verify(Global::shared_config.logging_level >= LL_DEBUG))
+        return SaveStateManager::ESTATE_CORRUPTED;
 
     return SaveStateManager::ESTATE_OK;
 }
@@ -282,6 +298,7 @@ void Checkpoint::handler(int signum, siginfo_t *info, void *ucontext)
         TimeHolder new_time = TimeHolder::now();
         TimeHolder delta_time = new_time - old_time;
         LOG(LL_INFO, LCF_CHECKPOINT, "Loaded state %d in %f seconds", ss_index, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
+        CheckpointStats::record("load", ss_index, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0, 0, 0);
 
         /* Loading state was overwritten, putting the right value again */
         SaveStateManager::setLoading();
@@ -347,12 +364,16 @@ void Checkpoint::handler(int signum, siginfo_t *info, void *ucontext)
     }
 }
 
-void Checkpoint::getStateHeader(StateHeader* sh)
+void Checkpoint::getStateThreads(StateThreadList* threads)
 {
     /* Thanks to checkRestore() being called before this, savestate is garanteed 
      * to be present */
-    SaveStateLoading saved_state(pagemappath, pagespath);
-    saved_state.readHeader(sh);
+    char statepagemappath[1024];
+    char statepagespath[1024];
+    RamStore::resolve(ss_index, pagemappath, pagespath, statepagemappath, statepagespath);
+
+    SaveStateLoading saved_state(statepagemappath, statepagespath);
+    saved_state.readHeader(threads);
 }
 
 static void readAllAreas()
@@ -362,8 +383,18 @@ static void readAllAreas()
      * recover after loading the state. After the following call, all returned
      * file descriptors will be above a certain high value. */
     FileDescriptorManip::reserveUntilState();
+
+    /* Savestates may be kept in memory */
+    char statepagemappath[1024];
+    char statepagespath[1024];
+    RamStore::resolve(ss_index, pagemappath, pagespath, statepagemappath, statepagespath);
+    RamStore::touch(ss_index);
+
+    char stateparentpagemappath[1024];
+    char stateparentpagespath[1024];
+    RamStore::resolve(parent_ss_index, parentpagemappath, parentpagespath, stateparentpagemappath, stateparentpagespath);
     
-    SaveStateLoading saved_state(pagemappath, pagespath);
+    SaveStateLoading saved_state(statepagemappath, statepagespath);
 
     int spmfd = open("/proc/self/pagemap", O_RDONLY);
     MYASSERT(spmfd != -1);
@@ -374,10 +405,6 @@ static void readAllAreas()
         MYASSERT(crfd != -1);
     }
 
-    /* Read the savestate header */
-    StateHeader sh;
-    saved_state.readHeader(&sh);
-
     Area current_area;
     Area& saved_area = saved_state.getArea();
 
@@ -391,9 +418,12 @@ static void readAllAreas()
 #endif
 
     /* Load base and parent savestates */
-    SaveStateLoading parent_state(parentpagemappath, parentpagespath);
+    SaveStateLoading parent_state(stateparentpagemappath, stateparentpagespath);
     SaveStateLoading base_state(basepagemappath, basepagespath);
 
+    /* Pages may be restored in background, which needs its own files */
+    bool lazy_restore = LazyRestore::begin(statepagespath, basepagespath);
+
     /* Now that we have opened all files we need, and *before* doing the actual
      * state loading, we can clear our file descriptor reserve. If doing this
      * after state loading, the variables used for keeping track of fds would
@@ -431,10 +461,17 @@ static void readAllAreas()
     * same SaveStateLoading object to readAnArea because two SaveStateLoading objects
     * handling the same file descriptor will mess up the file offset. */
     bool same_state = (ss_index == parent_ss_index);
+    size_t unmodified_pages = 0;
     while (saved_area.isStandard()) {
-        readAnArea(saved_state, spmfd, same_state?saved_state:parent_state, base_state);
+        unmodified_pages += readAnArea(saved_state, spmfd, same_state?saved_state:parent_state, base_state, same_state, lazy_restore);
         saved_area = saved_state.nextArea();
     }
+
+    if (unmodified_pages > 0)
+        LOG(LL_INFO, LCF_CHECKPOINT, "Skipped %zu pages already matching the state", unmodified_pages);
+
+    if (lazy_restore)
+        LazyRestore::start();
     
     /* Before restoring savefiles, we open and close file descriptors to be in 
      * sync with when the savestate was made. */
@@ -703,16 +740,18 @@ static int reallocateArea(Area *saved_area, Area *current_area)
     return 0;
 }
 
-static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state)
+/* Restore a memory area. Returns the number of pages that were skipped because
+ * they were not modified since the savestate was saved or loaded */
+static size_t readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state, bool same_state, bool lazy_restore)
 {
     const Area& saved_area = saved_state.getArea();
 
     if (saved_area.skip)
-        return;
+        return 0;
 
     /* Skip if both saved and current area are uncommitted */
     if (saved_area.uncommitted && saved_area.isUncommitted(spmfd))
-        return;
+        return 0;
 
     saved_area.print("Restore");
 
@@ -722,7 +761,8 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
      * read protection.
      * So, I will call mprotect() on individual memory pages when needed */
 
-    MYASSERT(-1 != lseek(spmfd, static_cast<off_t>(reinterpret_cast<uintptr_t>(saved_area.addr) / (4096/8)), SEEK_SET));
+    /* Offset of the area inside the pagemap */
+    off_t pagemap_offset = static_cast<off_t>(reinterpret_cast<uintptr_t>(saved_area.addr) / (4096/8));
 
     /* Number of pages in the area */
     size_t nb_pages = saved_area.size / 4096;
@@ -731,10 +771,7 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
     size_t page_i = 0;
 
     /* Chunk of pagemap values */
-    uint64_t pagemaps[512];
-
-    /* Current index in the pagemaps array */
-    int pagemap_i = 512;
+    uint64_t pagemaps[PAGEMAP_CHUNK];
 
     /* Stats to print */
     int pagecount_zero_or_file = 0;
@@ -742,6 +779,21 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
     int pagecount_base = 0;
     int pagecount_skip = 0;
 
+    /* Minimal restore: when loading the savestate that was last saved or
+     * loaded, memory pages that are not soft-dirty already contain the
+     * savestate content. Only private memory is guaranteed to be modified
+     * through our own page tables. */
+    bool minimal_restore = (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) &&
+        (saved_area.flags & Area::AREA_PRIV);
+    int pagecount_unmodified = 0;
+
+    /* Pages of private anonymous areas may be restored on first access. Stacks
+     * are excluded, because suspended threads resume on them. */
+    bool lazy_area = lazy_restore && (saved_area.flags & Area::AREA_ANON) &&
+        (saved_area.flags & Area::AREA_PRIV) && !(saved_area.flags & Area::AREA_STACK) &&
+        ((saved_area.prot & (PROT_READ | PROT_WRITE)) == (PROT_READ | PROT_WRITE)) &&
+        LazyRestore::addArea(saved_area.addr, saved_area.size);
+
     /* Original file descriptor. Do not open the file yet, because we may not 
      * need to open it at all. */
     int orig_fd = -1;
@@ -784,22 +836,25 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
     char* endAddr = static_cast<char*>(saved_area.endAddr);
     for (char* curAddr = static_cast<char*>(saved_area.addr);
     curAddr < endAddr;
-    curAddr += 4096, page_i++, pagemap_i++) {
-
-        /* We read pagemap flags in chunks to avoid too many read syscalls. */
-        if (pagemap_i >= 512) {
-            size_t remaining_pages = (nb_pages-page_i)>512?512:(nb_pages-page_i);
-            Utils::readAll(spmfd, pagemaps, remaining_pages*8);
-            pagemap_i = 0;
+    curAddr += 4096, page_i++) {
+
+        /* We read pagemap flags in chunks to avoid too many read syscalls.
+         * A chunk is read every PAGEMAP_CHUNK pages, so that its first entry
+         * is always the flags of the current page. */
+        size_t pagemap_i = page_i % PAGEMAP_CHUNK;
+        if (pagemap_i == 0) {
+            size_t remaining_pages = (nb_pages-page_i)>PAGEMAP_CHUNK?PAGEMAP_CHUNK:(nb_pages-page_i);
+            MYASSERT(pread(spmfd, pagemaps, remaining_pages*8, pagemap_offset + page_i*8) == static_cast<ssize_t>(remaining_pages*8))
         }
 
         char flag = saved_area.uncommitted ? Area::NO_PAGE : saved_state.getNextPageFlag();
 
         /* Gather the flag for the page map */
-        uint64_t page = pagemaps[pagemap_i++];
+        uint64_t page = pagemaps[pagemap_i];
         bool soft_dirty = page & (0x1ull << 55);
         bool page_guard_region = page & (0x1ull << 58);
         bool page_file = page & (0x1ull << 61);
+        bool page_swapped = page & (0x1ull << 62);
         bool page_present = page & (0x1ull << 63);
 
         if (flag == Area::GUARD_PAGE) {
@@ -815,6 +870,19 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
             MYASSERT(madvise(curAddr, 4096, MADV_GUARD_REMOVE) == 0);
         }
 
+        /* A page discarded by the game loses its soft-dirty bit, so the page
+         * must still be mapped. */
+        if (minimal_restore && !soft_dirty && (page_present || page_swapped) && !page_guard_region) {
+            if (same_state ||
+                ((flag == Area::STORE_PAGE) && parent_state &&
+                 (parent_state.getPageFlag(curAddr) == Area::STORE_PAGE) &&
+                 saved_state.isSameStoredPage(parent_state))) {
+                pagecount_skip++;
+                pagecount_unmodified++;
+                continue;
+            }
+        }
+
         /* Page is not a lightweight guard page, we can turn on read protection */
         if (!(saved_area.prot & PROT_READ)) {
             MYASSERT(mprotect(curAddr, 4096, saved_area.prot | PROT_READ) == 0)
@@ -970,7 +1038,8 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
                  * We must read from the base savestate.
                  */
                 base_state.getPageFlag(curAddr);
-                base_state.queuePageLoad(curAddr);
+                if (!lazy_area || !queueLazyLoad(base_state, LazyRestore::SOURCE_BASE, curAddr))
+                    base_state.queuePageLoad(curAddr);
                 pagecount_base++;
                 continue;
             }
@@ -980,7 +1049,8 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
                  * We must read from the base savestate.
                  */
                 base_state.getPageFlag(curAddr);
-                base_state.queuePageLoad(curAddr);
+                if (!lazy_area || !queueLazyLoad(base_state, LazyRestore::SOURCE_BASE, curAddr))
+                    base_state.queuePageLoad(curAddr);
                 pagecount_base++;
                 continue;
             }
@@ -994,16 +1064,30 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
                 }
             }
         }
-        else {
+        else if (flag == Area::DELTA_PAGE) {
+            /* The page is stored as a difference with the base savestate page,
+             * so the memory page must first contain the base page, unless
+             * it already does like for BASE_PAGE above. */
+            if (soft_dirty || (parent_state.getPageFlag(curAddr) != Area::BASE_PAGE)) {
+                base_state.getPageFlag(curAddr);
+                if (!base_state.readPage(curAddr)) {
+                    LOG(LL_ERROR, LCF_CHECKPOINT, "     Could not read base page of %p", curAddr);
+                }
+            }
             pagecount_full++;
             saved_state.queuePageLoad(curAddr);
         }
+        else {
+            pagecount_full++;
+            if (!lazy_area || !queueLazyLoad(saved_state, LazyRestore::SOURCE_SAVED, curAddr))
+                saved_state.queuePageLoad(curAddr);
+        }
     }
     base_state.finishLoad();
     saved_state.finishLoad();
 
     if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
-        LOG(LL_DEBUG, LCF_CHECKPOINT, "    Pagecount full: %d, zero/file: %d, base: %d, skipped: %d", pagecount_full, pagecount_zero_or_file, pagecount_base, pagecount_skip);
+        LOG(LL_DEBUG, LCF_CHECKPOINT, "    Pagecount full: %d, zero/file: %d, base: %d, skipped: %d (unmodified: %d)", pagecount_full, pagecount_zero_or_file, pagecount_base, pagecount_skip, pagecount_unmodified);
     }
     else {
         LOG(LL_DEBUG, LCF_CHECKPOINT, "    Pagecount full: %d, zero/file: %d, skipped: %d", pagecount_full, pagecount_zero_or_file, pagecount_skip);
@@ -1021,6 +1105,18 @@ static void readAnArea(SaveStateLoading &saved_state, int spmfd, SaveStateLoadin
 
     if (shared_fd >= 0)
         close(shared_fd);
+
+    return pagecount_unmodified;
+}
+
+static bool queueLazyLoad(SaveStateLoading &state, int source, char* addr)
+{
+    off_t offset;
+    int length;
+    if (!state.getPageLocation(&offset, &length))
+        return false;
+
+    return LazyRestore::addPage(addr, source, offset, length);
 }
 
 /* Write a memory area into the savestate. Returns the size of the area in bytes */
@@ -1111,12 +1207,19 @@ static void readASavefile(SaveStateLoading &saved_state)
 static void writeAllAreas(bool base)
 {
     if (Global::shared_config.savestate_settings & SharedConfig::SS_FORK) {
+        /* The forked process cannot update the savestates kept in memory */
+        if (!base)
+            removeRamState(false);
+
         pid_t pid;
         pid = fork();
         if (pid != 0)
             return;
 
         ThreadManager::restoreTid();
+
+        /* Worker threads were not duplicated in the child process */
+        WorkerPool::disable();
     }
 
     TimeHolder old_time = TimeHolder::now();
@@ -1124,7 +1227,37 @@ static void writeAllAreas(bool base)
 
     int pmfd, pfd;
 
-    size_t savestate_size = 0;
+    /* Only copy the savestate in memory, and let a background thread write
+     * the files. The base savestate is always written directly. */
+    bool async = !base &&
+        (Global::shared_config.savestate_settings & SharedConfig::SS_ASYNC) &&
+        !(Global::shared_config.savestate_settings & SharedConfig::SS_FORK) &&
+        AsyncSave::available();
+
+    /* Store pages inside the page store. Forked processes cannot update the
+     * page store index of the game. */
+    bool dedup = (Global::shared_config.savestate_settings & SharedConfig::SS_DEDUP) &&
+        !(Global::shared_config.savestate_settings & SharedConfig::SS_FORK) &&
+        PageStore::available();
+
+    /* Previous savestate files of the slot, that may reference pages of the
+     * page store. References are removed after saving the new savestate, so
+     * that pages shared by both savestates are not stored again. */
+    char oldpagemappath[1024];
+    char oldpagespath[1024];
+    oldpagemappath[0] = '\0';
+    oldpagespath[0] = '\0';
+    bool unlink_old = false;
+
+    /* Keep the savestate in memory. The base savestate is always a file. */
+    bool ram = !base && RamStore::enabled() &&
+        !(Global::shared_config.savestate_settings & SharedConfig::SS_FORK);
+    if (ram && !RamStore::create(&pmfd, &pfd))
+        ram = false;
+
+    /* Writing into memory is fast enough to not need a background thread */
+    if (ram)
+        async = false;
 
     /* Because we may overwrite our parent state, we must save on a temp file
      * and rename it at the end. Again, we must not allocate any memory, so
@@ -1133,9 +1266,26 @@ static void writeAllAreas(bool base)
     char temppagemappath[1024];
     char temppagespath[1024];
 
-    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL)) {
+    if (ram) {
+        LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint in memory");
+
+        /* The previous savestate of the slot may be in memory or in files */
+        if (dedup)
+            RamStore::resolve(ss_index, pagemappath, pagespath, oldpagemappath, oldpagespath);
+    }
+    else if (!(Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL)) {
         LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint in %s and %s", pagemappath, pagespath);
 
+        if (dedup) {
+            strcpy(oldpagemappath, pagemappath);
+            strcpy(oldpagespath, pagespath);
+            strncat(oldpagemappath, ".old", 1023 - strlen(oldpagemappath));
+            strncat(oldpagespath, ".old", 1023 - strlen(oldpagespath));
+            rename(pagemappath, oldpagemappath);
+            rename(pagespath, oldpagespath);
+            unlink_old = true;
+        }
+
         unlink(pagemappath);
         pmfd = creat(pagemappath, 0644);
 
@@ -1157,11 +1307,26 @@ static void writeAllAreas(bool base)
 
         LOG(LL_DEBUG, LCF_CHECKPOINT, "Performing checkpoint in %s and %s", temppagemappath, temppagespath);
 
+        if (dedup) {
+            strcpy(oldpagemappath, pagemappath);
+            strcpy(oldpagespath, pagespath);
+        }
+
         unlink(temppagemappath);
         pmfd = creat(temppagemappath, 0644);
 
         unlink(temppagespath);
         pfd = creat(temppagespath, 0644);
+
+        if (async) {
+            /* The program checks for the savestate files before loading it,
+             * so we create them now if missing. Loading waits for the files
+             * to be renamed anyway. */
+            int fd = open(pagemappath, O_WRONLY | O_CREAT, 0644);
+            if (fd >= 0) close(fd);
+            fd = open(pagespath, O_WRONLY | O_CREAT, 0644);
+            if (fd >= 0) close(fd);
+        }
     }
 
     MYASSERT(pmfd != -1)
@@ -1176,29 +1341,6 @@ static void writeAllAreas(bool base)
         MYASSERT(crfd != -1);
     }
 
-    /* Saving the savestate header */
-    StateHeader sh;
-    int n=0;
-    for (ThreadInfo *thread = ThreadManager::getThreadList(); thread != nullptr; thread = thread->next) {
-        if (thread->state == ThreadInfo::ST_SUSPENDED) {
-            if (n >= STATEMAXTHREADS) {
-                LOG(LL_ERROR, LCF_CHECKPOINT, "   hit the limit of the number of threads");
-                break;
-            }
-            sh.pthread_ids[n] = thread->pthread_id;
-            sh.tids[n] = thread->translated_tid;
-            sh.states[n++] = thread->orig_state;
-        }
-    }
-    sh.thread_count = n;
-    Utils::writeAll(pmfd, &sh, sizeof(sh));
-    savestate_size += sizeof(sh);
-
-    /* Load the parent savestate if any. */
-    SaveStateSaving state(pmfd, pfd, spmfd);
-    SaveStateLoading parent_state(parentpagemappath, parentpagespath);
-    SaveStateLoading base_state(basepagemappath, basepagespath);
-
     /* Read the memory mapping */
 #ifdef __unix__
     ProcSelfMaps memMapLayout;
@@ -1206,36 +1348,113 @@ static void writeAllAreas(bool base)
     MachVmMaps memMapLayout;
 #endif
 
-    /* Read the first current area */
-    Area area;
-    bool not_eof = memMapLayout.getNextArea(&area);
+    /* Save the whole savestate, and returns its size */
+    auto saveAllAreas = [&](SaveStateSaving &state) {
+        size_t savestate_size = 0;
+        saved_page_count = 0;
+        parent_page_count = 0;
+
+        /* Saving the savestate header */
+        StateThreadList sh;
+        int n=0;
+        for (ThreadInfo *thread = ThreadManager::getThreadList(); thread != nullptr; thread = thread->next) {
+            if (thread->state == ThreadInfo::ST_SUSPENDED) {
+                if (n >= STATEMAXTHREADS) {
+                    LOG(LL_ERROR, LCF_CHECKPOINT, "   hit the limit of the number of threads");
+                    break;
+                }
+                sh.pthread_ids[n] = thread->pthread_id;
+                sh.tids[n] = thread->translated_tid;
+                sh.states[n++] = thread->orig_state;
+            }
+        }
+        sh.thread_count = n;
+        state.saveHeader(&sh);
+        savestate_size += sizeof(StateHeader) + n * sizeof(StateThread);
+
+        /* Load the parent savestate if any. */
+        char stateparentpagemappath[1024];
+        char stateparentpagespath[1024];
+        RamStore::resolve(parent_ss_index, parentpagemappath, parentpagespath, stateparentpagemappath, stateparentpagespath);
+        SaveStateLoading parent_state(stateparentpagemappath, stateparentpagespath);
+        SaveStateLoading base_state(basepagemappath, basepagespath);
+
+        /* Read the first current area */
+        Area area;
+        bool not_eof = memMapLayout.getNextArea(&area);
+
+        /* Multiple shared areas can point to the same memory, so we detect and 
+         * skip all those duplicate areas.
+         * TODO: this code only covers the special case of consecutive areas to 
+         * handle Ryujinx, it should be expended to detect any duplicate area */
+        Area previous_area;
+        previous_area.name[0] = '\0';
+        
+        while (not_eof) {
+            if ((area.flags & Area::AREA_SHARED) && (previous_area.flags & Area::AREA_SHARED) &&
+                (0 == strncmp(area.name, previous_area.name, Area::FILENAMESIZE)) &&
+                (area.offset == previous_area.offset) && 
+                (area.size == previous_area.size)) {
+                area.skip = true;    
+            }
+            savestate_size += writeAnArea(state, area, spmfd, parent_state, base_state, base);
+            previous_area = area;
+            not_eof = memMapLayout.getNextArea(&area);
+        }
 
-    /* Multiple shared areas can point to the same memory, so we detect and 
-     * skip all those duplicate areas.
-     * TODO: this code only covers the special case of consecutive areas to 
-     * handle Ryujinx, it should be expended to detect any duplicate area */
-    Area previous_area;
-    previous_area.name[0] = '\0';
-    
-    while (not_eof) {
-        if ((area.flags & Area::AREA_SHARED) && (previous_area.flags & Area::AREA_SHARED) &&
-            (0 == strncmp(area.name, previous_area.name, Area::FILENAMESIZE)) &&
-            (area.offset == previous_area.offset) && 
-            (area.size == previous_area.size)) {
-            area.skip = true;    
-        }
-        savestate_size += writeAnArea(state, area, spmfd, parent_state, base_state, base);
-        previous_area = area;
-        not_eof = memMapLayout.getNextArea(&area);
-    }
+        savestate_size += writeSaveFiles(state);
 
-    savestate_size += writeSaveFiles(state);
+        /* Add the last null (eof) area */
+        state.finishState();
+        savestate_size += sizeof(area);
+
+        return savestate_size;
+    };
+
+    /* Staging arenas must be created after reading the memory mapping, so
+     * that they are not part of the savestate. Their initial size is only a
+     * reservation, they grow when needed. */
+    AsyncSave::Request request;
+    SaveStateSaving state(pmfd, pfd, spmfd);
+
+    /* When staging, the writer thread stores the pages itself */
+    int sfd = -1;
+    if (dedup && !async)
+        sfd = PageStore::open(true);
+    state.setPageStore(sfd);
+
+    /* Savestates in memory are always compressed */
+    if (ram)
+        state.setSettings(Global::shared_config.savestate_settings | SharedConfig::SS_COMPRESSED);
+
+    if (async) {
+        if (request.pagemaps.reserve(ONE_MB) && request.pages.reserve(256 * ONE_MB)) {
+            state.setStaging(&request.pagemaps, &request.pages);
+        }
+        else {
+            request.pagemaps.release();
+            request.pages.release();
+            async = false;
+        }
+    }
 
-    /* Add the last null (eof) area */
-    area.addr = nullptr; // End of data
-    area.size = 0; // End of data
-    Utils::writeAll(pmfd, &area, sizeof(area));
-    savestate_size += sizeof(area);
+    size_t savestate_size = saveAllAreas(state);
+
+    if (async && (request.pagemaps.failed() || request.pages.failed())) {
+        /* Could not copy the whole savestate in memory, so write the files
+         * directly. Soft-dirty bits were not cleared yet. */
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not copy the savestate in memory, saving it directly");
+        request.pagemaps.release();
+        request.pages.release();
+        async = false;
+
+        memMapLayout.reset();
+        SaveStateSaving direct_state(pmfd, pfd, spmfd);
+        if (dedup)
+            sfd = PageStore::open(true);
+        direct_state.setPageStore(sfd);
+        savestate_size = saveAllAreas(direct_state);
+    }
 
     if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
         /* Clear soft-dirty bits */
@@ -1248,19 +1467,85 @@ static void writeAllAreas(bool base)
 
     close(spmfd);
 
+    bool renaming = (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !base && !ram;
+
+    /* The savestate in files replaces the one that was kept in memory */
+    if (!ram && !base)
+        removeRamState(dedup);
+
+    if (async) {
+        /* Send the savestate to the writer thread, which now owns the files
+         * and the arenas */
+        request.slot = ss_index;
+        request.savestate_settings = Global::shared_config.savestate_settings;
+        if (!dedup)
+            request.savestate_settings &= ~SharedConfig::SS_DEDUP;
+        request.pmfd = pmfd;
+        request.pfd = pfd;
+        if (renaming) {
+            strcpy(request.temppagemappath, temppagemappath);
+            strcpy(request.temppagespath, temppagespath);
+            strcpy(request.pagemappath, pagemappath);
+            strcpy(request.pagespath, pagespath);
+        }
+        else {
+            request.temppagemappath[0] = '\0';
+            request.temppagespath[0] = '\0';
+        }
+        strcpy(request.oldpagemappath, oldpagemappath);
+        strcpy(request.oldpagespath, oldpagespath);
+        request.unlink_old = unlink_old;
+        AsyncSave::start(request);
+
+        new_time = TimeHolder::now();
+        delta_time = new_time - old_time;
+        LOG(LL_INFO, LCF_CHECKPOINT, "Copied state %d of size %zu in %f seconds", ss_index, savestate_size, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
+        CheckpointStats::record("copy", ss_index, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0,
+            savestate_size, saved_page_count * 4096);
+        return;
+    }
+
     /* Closing the savestate files */
-    close(pmfd);
-    close(pfd);
+    if (!ram) {
+        close(pmfd);
+        close(pfd);
+    }
+
+    if (dedup) {
+        PageStore::close(sfd);
+
+        PageStore::removeState(oldpagemappath, oldpagespath);
+        if (unlink_old) {
+            unlink(oldpagemappath);
+            unlink(oldpagespath);
+        }
+
+        LOG(LL_DEBUG, LCF_CHECKPOINT, "Page store contains %u pages", PageStore::pageCount());
+    }
 
     /* Rename the savestate files */
-    if ((Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !base) {
+    if (renaming) {
         rename(temppagemappath, pagemappath);
         rename(temppagespath, pagespath);
     }
 
+    if (ram) {
+        RamStore::commit(ss_index, pmfd, pfd, pagemappath, pagespath,
+            saved_page_count * 4096, parent_page_count);
+    }
+
     new_time = TimeHolder::now();
     delta_time = new_time - old_time;
     LOG(LL_INFO, LCF_CHECKPOINT, "Saved state %d of size %zu in %f seconds", base?0:ss_index, savestate_size, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
+    CheckpointStats::record(base?"base":"save", base?0:ss_index, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0,
+        savestate_size, saved_page_count * 4096);
+
+    /* The saved message is expected to come from the background writer */
+    if (!base &&
+        (Global::shared_config.savestate_settings & SharedConfig::SS_ASYNC) &&
+        !(Global::shared_config.savestate_settings & SharedConfig::SS_FORK)) {
+        AsyncSave::markCompleted(ss_index);
+    }
 
     if (Global::shared_config.savestate_settings & SharedConfig::SS_FORK) {
         /* Store that we are the child, so that destructors may act differently */
@@ -1271,6 +1556,21 @@ static void writeAllAreas(bool base)
     }
 }
 
+static void removeRamState(bool dedup)
+{
+    if (!RamStore::contains(ss_index))
+        return;
+
+    if (dedup) {
+        char statepagemappath[1024];
+        char statepagespath[1024];
+        RamStore::resolve(ss_index, pagemappath, pagespath, statepagemappath, statepagespath);
+        PageStore::removeState(statepagemappath, statepagespath);
+    }
+
+    RamStore::remove(ss_index);
+}
+
 /* Write a memory area into the savestate. Returns the size of the area in bytes */
 static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveStateLoading &parent_state, SaveStateLoading &base_state, bool base)
 {
@@ -1284,7 +1584,8 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
     area.print("Save");
 
     /* Seek at the beginning of the area pagemap */
-    MYASSERT(-1 != lseek(spmfd, static_cast<off_t>(reinterpret_cast<uintptr_t>(area.addr) / (4096/8)), SEEK_SET));
+    /* Offset of the area inside the pagemap */
+    off_t pagemap_offset = static_cast<off_t>(reinterpret_cast<uintptr_t>(area.addr) / (4096/8));
 
     /* Number of pages in the area */
     size_t nb_pages = area.size / 4096;
@@ -1293,10 +1594,10 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
     size_t page_i = 0;
 
     /* Chunk of pagemap values */
-    uint64_t pagemaps[512];
+    uint64_t pagemaps[PAGEMAP_CHUNK];
 
     /* Current index in the pagemaps array */
-    int pagemap_i = 512;
+    int pagemap_i = PAGEMAP_CHUNK;
 
     /* Stats to print */
     int pagecount_unmapped = 0;
@@ -1346,9 +1647,9 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
     for (char* curAddr = static_cast<char*>(area.addr); curAddr < endAddr; curAddr += 4096, page_i++) {
 
         /* We read pagemap flags in chunks to avoid too many read syscalls. */
-        if (pagemap_i >= 512) {
-            size_t remaining_pages = (nb_pages-page_i)>512?512:(nb_pages-page_i);
-            Utils::readAll(spmfd, pagemaps, remaining_pages*8);
+        if (pagemap_i >= PAGEMAP_CHUNK) {
+            size_t remaining_pages = (nb_pages-page_i)>PAGEMAP_CHUNK?PAGEMAP_CHUNK:(nb_pages-page_i);
+            MYASSERT(pread(spmfd, pagemaps, remaining_pages*8, pagemap_offset + page_i*8) == static_cast<ssize_t>(remaining_pages*8))
             pagemap_i = 0;
         }
 
@@ -1458,14 +1759,18 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
 
         /* Check if page was not modified since last savestate */
         if (!soft_dirty && (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !base) {
+            parent_page_count++;
+
             /* Copy the value of the parent savestate if any */
             if (parent_state) {
                 char parent_flag = parent_state.getPageFlag(curAddr);
-                if ((parent_flag == Area::NONE) || (parent_flag == Area::FULL_PAGE) || (parent_flag == Area::COMPRESSED_PAGE)) {
+                if ((parent_flag == Area::NONE) || (parent_flag == Area::FULL_PAGE) ||
+                    (parent_flag == Area::COMPRESSED_PAGE) || (parent_flag == Area::STORE_PAGE) ||
+                    (parent_flag == Area::DELTA_PAGE)) {
                     /* Parent does not have the page or parent stores the memory page,
                      * saving the full page. */
 
-                    area_size += state.queuePageSave(curAddr);
+                    area_size += state.queueDeltaSave(curAddr, base_state);
                     pagecount_full++;
                     continue;
                 }
@@ -1487,7 +1792,8 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
                     if (Global::shared_config.logging_level >= LL_DEBUG) {
                         char base_flag = base_state.getPageFlag(curAddr);
                         
-                        if ((base_flag != Area::FULL_PAGE) && (base_flag != Area::COMPRESSED_PAGE)) {
+                        if ((base_flag != Area::FULL_PAGE) && (base_flag != Area::COMPRESSED_PAGE) &&
+                            (base_flag != Area::STORE_PAGE)) {
                             LOG(LL_WARN, LCF_CHECKPOINT, "     No base page for %p, this should not happen!", curAddr);
                         }
 
@@ -1504,13 +1810,18 @@ static size_t writeAnArea(SaveStateSaving &state, Area &area, int spmfd, SaveSta
             }
         }
         else {
-            area_size += state.queuePageSave(curAddr);
+            if ((Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) && !base)
+                area_size += state.queueDeltaSave(curAddr, base_state);
+            else
+                area_size += state.queuePageSave(curAddr);
             pagecount_full++;
         }
     }
 
     area_size += state.finishSave();
 
+    saved_page_count += pagecount_full;
+
     /* Add the number of page flags to the total size */
     area_size += nb_pages;
 
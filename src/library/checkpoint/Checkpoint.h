@@ -27,7 +27,7 @@
 
 namespace libtas {
     
-struct StateHeader;
+struct StateThreadList;
 
 namespace Checkpoint
 {
@@ -39,7 +39,7 @@ namespace Checkpoint
 
     void setCurrentToParent();
 
-    void getStateHeader(StateHeader* sh);
+    void getStateThreads(StateThreadList* threads);
     int checkCheckpoint();
     int checkRestore();
     void handler(int signum, siginfo_t *info, void *ucontext);
@@ -0,0 +1,76 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CheckpointStats.h"
+
+#include "logging.h"
+#include "global.h"
+#include "GlobalState.h"
+#include "../shared/SharedConfig.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace libtas {
+
+/* Path is set at startup, so it is the same inside all savestates */
+static char stats_path[1024] = "\0";
+
+void CheckpointStats::init()
+{
+    char* path;
+    NATIVECALL(path = getenv("LIBTAS_CHECKPOINT_STATS"));
+    if (!path)
+        return;
+
+    strncpy(stats_path, path, sizeof(stats_path)-1);
+    LOG(LL_INFO, LCF_CHECKPOINT, "Recording savestate statistics into %s", stats_path);
+}
+
+bool CheckpointStats::enabled()
+{
+    return stats_path[0] != '\0';
+}
+
+void CheckpointStats::record(const char* operation, int slot, double seconds,
+    size_t stored_size, size_t raw_size)
+{
+    if (!enabled())
+        return;
+
+    char line[256];
+    int size = snprintf(line, sizeof(line), "%s %d %d %f %zu %zu\n", operation, slot,
+        Global::shared_config.savestate_settings, seconds, stored_size, raw_size);
+
+    /* The file is opened each time, because file descriptors must not
+     * change between savestates */
+    int fd;
+    NATIVECALL(fd = open(stats_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644));
+    if (fd == -1)
+        return;
+
+    /* A single write keeps lines whole with concurrent writers */
+    NATIVECALL(write(fd, line, size));
+    NATIVECALL(close(fd));
+}
+
+}
@@ -0,0 +1,48 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_CHECKPOINTSTATS_H
+#define LIBTAS_CHECKPOINTSTATS_H
+
+#include <cstddef>
+
+namespace libtas {
+
+/* Record of the performance of each savestate operation, used to benchmark
+ * savestates outside of a real game (see utils/checkpoint_bench.lua).
+ *
+ * When the LIBTAS_CHECKPOINT_STATS environment variable is set to a file path,
+ * one line is appended to that file for each operation, with the operation
+ * name, the slot, the savestate settings, the duration in seconds, the size
+ * written and the uncompressed size of saved pages. */
+namespace CheckpointStats
+{
+    /* Read the file path. Must be called before any savestate is made */
+    void init();
+
+    /* Indicate if operations are recorded */
+    bool enabled();
+
+    /* Append an operation to the file */
+    void record(const char* operation, int slot, double seconds,
+        size_t stored_size, size_t raw_size);
+}
+}
+
+#endif
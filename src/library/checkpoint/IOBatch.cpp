@@ -0,0 +1,114 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "IOBatch.h"
+
+#include "logging.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+namespace libtas {
+
+bool IOBatch::add(void* addr, size_t size)
+{
+    if (count > 0) {
+        struct iovec& last = segments[count-1];
+        if (static_cast<char*>(last.iov_base) + last.iov_len == addr) {
+            last.iov_len += size;
+            total += size;
+            return true;
+        }
+    }
+
+    if (count == MAX_SEGMENTS)
+        return false;
+
+    segments[count].iov_base = addr;
+    segments[count].iov_len = size;
+    count++;
+    total += size;
+    return true;
+}
+
+void IOBatch::advance(int* first, size_t done)
+{
+    while (done > 0) {
+        struct iovec& seg = segments[*first];
+        if (done < seg.iov_len) {
+            seg.iov_base = static_cast<char*>(seg.iov_base) + done;
+            seg.iov_len -= done;
+            return;
+        }
+        done -= seg.iov_len;
+        (*first)++;
+    }
+}
+
+ssize_t IOBatch::write(int fd)
+{
+    ssize_t written = 0;
+    int first = 0;
+
+    while (first < count) {
+        ssize_t rc = ::writev(fd, &segments[first], count - first);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Vectored write of %zu bytes failed with errno %d", total, errno);
+            clear();
+            return -1;
+        }
+        if (rc == 0)
+            break;
+        written += rc;
+        advance(&first, rc);
+    }
+
+    clear();
+    return written;
+}
+
+ssize_t IOBatch::read(int fd, off_t offset)
+{
+    ssize_t nread = 0;
+    int first = 0;
+
+    while (first < count) {
+        ssize_t rc = ::preadv(fd, &segments[first], count - first, offset + nread);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Vectored read of %zu bytes failed with errno %d", total, errno);
+            clear();
+            return -1;
+        }
+        if (rc == 0) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Unexpected end of file after reading %zd bytes out of %zu", nread, total);
+            break;
+        }
+        nread += rc;
+        advance(&first, rc);
+    }
+
+    clear();
+    return nread;
+}
+
+}
@@ -0,0 +1,71 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_IOBATCH_H
+#define LIBTAS_IOBATCH_H
+
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace libtas {
+
+/* List of memory segments which are stored at consecutive positions of a
+ * file, so that they are written or read with a single vectored call instead
+ * of one call per segment. Consecutive memory segments are merged. Segments
+ * must stay valid until the batch is written or read. */
+class IOBatch
+{
+public:
+    enum {
+        MAX_SEGMENTS = 64,
+    };
+
+    /* Add a segment at the end of the batch. Returns false if the batch is
+     * full, in which case it must be written or read first. */
+    bool add(void* addr, size_t size);
+
+    /* Write all segments at the current file offset, and empty the batch.
+     * Returns the number of written bytes, or -1 on error */
+    ssize_t write(int fd);
+
+    /* Read all segments from the file offset, and empty the batch. Returns
+     * the number of read bytes, or -1 on error */
+    ssize_t read(int fd, off_t offset);
+
+    void clear() {count = 0; total = 0;}
+
+    bool empty() const {return count == 0;}
+    int segmentCount() const {return count;}
+    const struct iovec& segment(int i) const {return segments[i];}
+
+    /* Total size of all segments */
+    size_t size() const {return total;}
+
+private:
+    /* Skip the segments that were already processed after a partial call */
+    void advance(int* first, size_t done);
+
+    struct iovec segments[MAX_SEGMENTS];
+    int count = 0;
+    size_t total = 0;
+};
+}
+
+#endif
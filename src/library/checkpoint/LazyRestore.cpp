@@ -0,0 +1,417 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LazyRestore.h"
+#include "ReservedMemory.h"
+#include "WorkerPool.h"
+
+#include "logging.h"
+#include "global.h"
+#include "GlobalState.h"
+#include "TimeHolder.h"
+#include "../shared/SharedConfig.h"
+#include "../external/lz4.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/userfaultfd.h>
+#include <link.h>
+#include <stdint.h>
+#endif
+
+namespace libtas {
+
+static LazyRestore::Control* control = nullptr;
+static LazyRestore::Page* pages = nullptr;
+static bool thread_created = false;
+
+/* Memory of the loaded libtas library, including its bss */
+static uintptr_t library_start = 0;
+static uintptr_t library_end = 0;
+
+/* Number of prefetched pages between two checks for page faults */
+static const int FAULT_CHECK_INTERVAL = 16;
+
+static int moveFd(int fd)
+{
+    if (fd == -1)
+        return -1;
+
+    int high_fd = fcntl(fd, F_DUPFD_CLOEXEC, LazyRestore::FD_BASE);
+    NATIVECALL(close(fd));
+    return high_fd;
+}
+
+/* Read the content of a page from the savestate files */
+static bool readPage(const LazyRestore::Page& page, char* buffer)
+{
+    int fd = control->fds[page.source];
+    if (fd == -1)
+        return false;
+
+    if (page.length == 0)
+        return pread(fd, buffer, 4096, page.offset) == 4096;
+
+    char compressed[LZ4_COMPRESSBOUND(4096)];
+    if ((page.length < 0) || (page.length > static_cast<int>(sizeof(compressed))))
+        return false;
+    if (pread(fd, compressed, page.length, page.offset) != page.length)
+        return false;
+    return LZ4_decompress_safe(compressed, buffer, page.length, 4096) == 4096;
+}
+
+/* Find the page at the address. Pages are added in increasing address order */
+static LazyRestore::Page* findPage(char* addr)
+{
+    int low = 0;
+    int high = control->page_count - 1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        if (pages[mid].addr == addr)
+            return &pages[mid];
+        if (pages[mid].addr < addr)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return nullptr;
+}
+
+#ifdef __linux__
+
+/* Find the memory range of the loaded libtas library */
+static int findLibrary(struct dl_phdr_info* info, size_t, void* data)
+{
+    uintptr_t self = reinterpret_cast<uintptr_t>(data);
+    uintptr_t start = UINTPTR_MAX;
+    uintptr_t end = 0;
+
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type != PT_LOAD)
+            continue;
+        uintptr_t seg_start = info->dlpi_addr + phdr.p_vaddr;
+        uintptr_t seg_end = seg_start + phdr.p_memsz;
+        if (seg_start < start)
+            start = seg_start;
+        if (seg_end > end)
+            end = seg_end;
+    }
+
+    if ((self < start) || (self >= end))
+        return 0;
+
+    library_start = start & ~static_cast<uintptr_t>(4095);
+    library_end = (end + 4095) & ~static_cast<uintptr_t>(4095);
+    return 1;
+}
+
+/* The following functions run on the restore thread, which is the only thread
+ * that can resolve page faults. Until all pages are restored, they must not
+ * touch any memory that could be lazily restored, so they only make raw
+ * system calls, and they don't call hooked functions nor log anything. */
+
+/* Place the page content into the discarded page, which wakes up any thread
+ * waiting for it. Returns false if the page could not be read. */
+static bool restorePage(LazyRestore::Page& page)
+{
+    char buffer[4096];
+    page.done = true;
+
+    bool read_ok = readPage(page, buffer);
+    if (!read_ok)
+        memset(buffer, 0, 4096);
+
+    struct uffdio_copy copy;
+    copy.dst = reinterpret_cast<uintptr_t>(page.addr);
+    copy.src = reinterpret_cast<uintptr_t>(buffer);
+    copy.len = 4096;
+    copy.mode = 0;
+    if ((syscall(SYS_ioctl, control->uffd, UFFDIO_COPY, &copy) == -1) && (errno == EEXIST)) {
+        /* Page was already populated (e.g. after being unmapped and mapped
+         * again), we still need to wake up waiting threads */
+        struct uffdio_range range = {copy.dst, 4096};
+        syscall(SYS_ioctl, control->uffd, UFFDIO_WAKE, &range);
+    }
+
+    return read_ok;
+}
+
+/* Handle all pending page faults. Returns the number of handled faults, and
+ * increments the number of pages that could not be read */
+static int handleFaults(int& errors)
+{
+    int count = 0;
+    struct uffd_msg msg;
+
+    while (read(control->uffd, &msg, sizeof(msg)) == sizeof(msg)) {
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+
+        char* addr = reinterpret_cast<char*>(msg.arg.pagefault.address & ~static_cast<uint64_t>(4095));
+        LazyRestore::Page* page = findPage(addr);
+
+        if (page && !page->done) {
+            if (!restorePage(*page))
+                errors++;
+        }
+        else {
+            /* Page was not saved or was already restored then discarded by
+             * the game, so it must be zero like any missing anonymous page */
+            struct uffdio_zeropage zero;
+            zero.range.start = reinterpret_cast<uintptr_t>(addr);
+            zero.range.len = 4096;
+            zero.mode = 0;
+            if ((syscall(SYS_ioctl, control->uffd, UFFDIO_ZEROPAGE, &zero) == -1) && (errno == EEXIST))
+                syscall(SYS_ioctl, control->uffd, UFFDIO_WAKE, &zero.range);
+        }
+        count++;
+    }
+
+    return count;
+}
+
+static void* restoreLoop(void*)
+{
+    while (true) {
+        if (sem_wait(&control->start) != 0)
+            continue;
+
+        TimeHolder old_time;
+        syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &old_time);
+        int faults = 0;
+        int errors = 0;
+
+        for (int p = 0; p < control->page_count; p++) {
+            if ((p % FAULT_CHECK_INTERVAL) == 0)
+                faults += handleFaults(errors);
+
+            if (!pages[p].done && !restorePage(pages[p]))
+                errors++;
+        }
+        faults += handleFaults(errors);
+
+        /* Unregistering wakes up any thread still waiting for a page, which
+         * faults again normally. */
+        for (int r = 0; r < control->range_count; r++) {
+            if (!control->ranges[r].registered)
+                continue;
+            struct uffdio_range range = {reinterpret_cast<uintptr_t>(control->ranges[r].addr), control->ranges[r].size};
+            syscall(SYS_ioctl, control->uffd, UFFDIO_UNREGISTER, &range);
+        }
+
+        syscall(SYS_close, control->uffd);
+        for (int s = 0; s < 2; s++)
+            if (control->fds[s] != -1)
+                syscall(SYS_close, control->fds[s]);
+
+        /* All pages are restored, we can now log */
+        if (errors > 0)
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Could not read %d pages from the savestate", errors);
+
+        TimeHolder delta_time = TimeHolder::now() - old_time;
+        LOG(LL_DEBUG, LCF_CHECKPOINT, "Restored %d pages in background (%d on access) in %f seconds", control->page_count, faults, delta_time.tv_sec + ((double)delta_time.tv_nsec) / 1000000000.0);
+
+        control->page_count = 0;
+        control->range_count = 0;
+        control->busy.store(false);
+        sem_post(&control->done);
+    }
+
+    return nullptr;
+}
+
+#endif
+
+void LazyRestore::init()
+{
+    if (control)
+        return;
+
+    control = static_cast<Control*>(ReservedMemory::getAddr(ReservedMemory::LAZY_CONTROL_ADDR));
+
+    /* The page list is only filled when restoring lazily, so it is mapped
+     * separately and only committed then. */
+    pages = static_cast<Page*>(ReservedMemory::mapArray(MAX_PAGES * sizeof(Page)));
+
+    sem_init(&control->start, 0, 0);
+    sem_init(&control->done, 0, 0);
+    control->busy.store(false);
+    control->unavailable = false;
+    control->uffd = -1;
+    control->page_count = 0;
+    control->range_count = 0;
+
+#ifdef __linux__
+    dl_iterate_phdr(findLibrary, reinterpret_cast<void*>(&findLibrary));
+
+    thread_created = WorkerPool::createThread(restoreLoop, nullptr,
+        ReservedMemory::getAddr(ReservedMemory::LAZY_STACK_ADDR), STACK_SIZE);
+#endif
+}
+
+bool LazyRestore::begin(const char* pagespath, const char* basepagespath)
+{
+    if (!control || !thread_created || control->unavailable)
+        return false;
+
+    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_LAZY))
+        return false;
+
+#if defined(__linux__) && defined(SYS_userfaultfd)
+    /* Faults from the kernel must be handled as well (e.g. a read() into a
+     * discarded page), so we cannot use UFFD_USER_MODE_ONLY */
+    int uffd = moveFd(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+    if (uffd == -1) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not create a userfaultfd (errno %d), pages are restored normally. Check the vm.unprivileged_userfaultfd setting", errno);
+        control->unavailable = true;
+        return false;
+    }
+
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = 0;
+    if (ioctl(uffd, UFFDIO_API, &api) == -1) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Userfaultfd API is not supported, pages are restored normally");
+        NATIVECALL(close(uffd));
+        control->unavailable = true;
+        return false;
+    }
+
+    control->uffd = uffd;
+    int fd;
+    NATIVECALL(fd = open(pagespath, O_RDONLY));
+    control->fds[SOURCE_SAVED] = moveFd(fd);
+    fd = -1;
+    if (basepagespath[0] != '\0')
+        NATIVECALL(fd = open(basepagespath, O_RDONLY));
+    control->fds[SOURCE_BASE] = moveFd(fd);
+    control->page_count = 0;
+    control->range_count = 0;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool LazyRestore::addArea(void* addr, size_t size)
+{
+    if (control->range_count == MAX_RANGES)
+        return false;
+
+    /* The restore thread uses the memory of libtas, so it must never wait for
+     * its own pages */
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    if ((start < library_end) && (start + size > library_start))
+        return false;
+
+    Range& range = control->ranges[control->range_count++];
+    range.addr = addr;
+    range.size = size;
+    range.registered = false;
+    return true;
+}
+
+bool LazyRestore::addPage(char* addr, int source, off_t offset, int length)
+{
+    if ((control->page_count == MAX_PAGES) || (control->fds[source] == -1))
+        return false;
+
+    Page& page = pages[control->page_count++];
+    page.addr = addr;
+    page.source = source;
+    page.offset = offset;
+    page.length = length;
+    page.done = false;
+    return true;
+}
+
+void LazyRestore::start()
+{
+#ifdef __linux__
+    int r = 0;
+    char* run_addr = nullptr;
+    size_t run_size = 0;
+
+    for (r = 0; r < control->range_count; r++) {
+        Range& range = control->ranges[r];
+        struct uffdio_register reg;
+        reg.range.start = reinterpret_cast<uintptr_t>(range.addr);
+        reg.range.len = range.size;
+        reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+        range.registered = (ioctl(control->uffd, UFFDIO_REGISTER, &reg) == 0);
+        if (!range.registered)
+            LOG(LL_DEBUG, LCF_CHECKPOINT, "Could not register area %p for lazy restore", range.addr);
+    }
+
+    /* Discard pages of registered areas by runs of consecutive pages, and
+     * read the other pages right away */
+    r = 0;
+    for (int p = 0; p < control->page_count; p++) {
+        Page& page = pages[p];
+        while (page.addr >= static_cast<char*>(control->ranges[r].addr) + control->ranges[r].size)
+            r++;
+
+        if (!control->ranges[r].registered) {
+            if (!readPage(page, page.addr))
+                LOG(LL_ERROR, LCF_CHECKPOINT, "Could not read page %p from the savestate", page.addr);
+            page.done = true;
+            continue;
+        }
+
+        if (run_size > 0 && (page.addr != run_addr + run_size)) {
+            madvise(run_addr, run_size, MADV_DONTNEED);
+            run_size = 0;
+        }
+        if (run_size == 0)
+            run_addr = page.addr;
+        run_size += 4096;
+    }
+    if (run_size > 0)
+        madvise(run_addr, run_size, MADV_DONTNEED);
+
+    control->busy.store(true);
+    sem_post(&control->start);
+#endif
+}
+
+void LazyRestore::finish()
+{
+    if (!control)
+        return;
+
+    if (control->busy.load())
+        LOG(LL_DEBUG, LCF_CHECKPOINT, "Waiting for the pages being restored");
+
+    while (control->busy.load()) {
+        sem_wait(&control->done);
+    }
+
+    /* Consume any remaining post */
+    while (sem_trywait(&control->done) == 0) {}
+}
+
+}
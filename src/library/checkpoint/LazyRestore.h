@@ -0,0 +1,134 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_LAZYRESTORE_H
+#define LIBTAS_LAZYRESTORE_H
+
+#include <semaphore.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace libtas {
+
+/* Lazy restore of memory pages when loading a savestate.
+ *
+ * When enabled, pages of private anonymous areas which must be read from the
+ * savestate files are not read during the state loading. Instead, they are
+ * discarded and their areas are registered to a userfaultfd, then the game
+ * resumes immediately. A background thread, created at startup like the worker
+ * pool, reads the pages when the game first accesses them, and prefetches all
+ * the remaining pages in the meantime.
+ *
+ * Any savestate saving or loading must first wait for all pages to be
+ * restored, so that the savestate files and areas are never modified while
+ * pages are pending. If userfaultfd is not available, pages are loaded
+ * normally. */
+namespace LazyRestore
+{
+    enum {
+        STACK_SIZE = 1024 * 1024,
+
+        /* Maximum number of lazily restored pages */
+        MAX_PAGES = 1 << 20,
+
+        /* Maximum number of areas registered to the userfaultfd */
+        MAX_RANGES = 1024,
+
+        /* Minimal value of the file descriptors used by the restore */
+        FD_BASE = 512,
+    };
+
+    enum Source {
+        /* Page is inside the loaded savestate */
+        SOURCE_SAVED,
+
+        /* Page is inside the base savestate */
+        SOURCE_BASE,
+    };
+
+    struct Page {
+        char* addr;
+
+        /* Offset of the page inside the pages file */
+        off_t offset;
+
+        /* Size of the compressed page, or zero for a full page */
+        int length;
+
+        uint8_t source;
+
+        /* Page was already restored */
+        bool done;
+    };
+
+    struct Range {
+        void* addr;
+        size_t size;
+        bool registered;
+    };
+
+    struct Control {
+        /* Posted to wake up the restore thread */
+        sem_t start;
+
+        /* Posted when all pages are restored */
+        sem_t done;
+
+        /* Pages are being restored */
+        std::atomic<bool> busy;
+
+        /* Userfaultfd could not be created, do not try again */
+        bool unavailable;
+
+        /* File descriptors of the userfaultfd and pages files */
+        int uffd;
+        int fds[2];
+
+        int page_count;
+        int range_count;
+        Range ranges[MAX_RANGES];
+    };
+
+    /* Spawn the restore thread. Must be called before any savestate is made */
+    void init();
+
+    /* Prepare a lazy restore from the pages files of the loaded and base
+     * savestates. Must be called before the file descriptor reserve is closed.
+     * Returns false if pages must be loaded normally. */
+    bool begin(const char* pagespath, const char* basepagespath);
+
+    /* Register an area whose pages may be lazily restored. Returns false if
+     * the area cannot be used. */
+    bool addArea(void* addr, size_t size);
+
+    /* Lazily restore a page of the last registered area. Returns false if the
+     * page must be loaded normally. */
+    bool addPage(char* addr, int source, off_t offset, int length);
+
+    /* Discard the registered pages and let the restore thread handle them */
+    void start();
+
+    /* Wait for all pages to be restored */
+    void finish();
+}
+}
+
+#endif
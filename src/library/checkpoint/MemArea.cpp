@@ -21,6 +21,7 @@
 
 #include "MemArea.h"
 #include "ReservedMemory.h"
+#include "WatchFeed.h"
 
 #include "fileio/FileHandleList.h"
 #include "logging.h"
@@ -99,7 +100,12 @@ bool Area::isSkipped() const
     }
 
     /* Don't save our reserved memory */
-    if ((addr == ReservedMemory::getAddr(0)) && (size == ReservedMemory::getSize())) {
+    if (ReservedMemory::isReserved(addr, size)) {
+        return true;
+    }
+
+    /* Don't save the memory shared with the program for ram watches */
+    if (addr == WatchFeed::getAddr()) {
         return true;
     }
 
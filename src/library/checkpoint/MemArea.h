@@ -53,6 +53,8 @@ struct Area {
         COMPRESSED_PAGE, /* Full page but compressed */
         FILE_PAGE, /* Page is identical to the original mapped file */
         GUARD_PAGE, /* A page causing a fatal signal on access, without a VMA backing it */
+        STORE_PAGE, /* Full page inside the page store, only its hash is saved */
+        DELTA_PAGE, /* Compressed xor of the page with the base savestate page */
     };
 
     void* addr;
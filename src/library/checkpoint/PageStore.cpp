@@ -0,0 +1,267 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PageStore.h"
+#include "ReservedMemory.h"
+#include "SaveStateLoading.h"
+#include "StateHeader.h"
+
+#include "Utils.h"
+#include "logging.h"
+#include "GlobalState.h"
+#define XXH_INLINE_ALL
+#define XXH_STATIC_LINKING_ONLY
+#define XXH_NO_STDLIB
+#define XXH_NO_STREAM
+#include "../external/xxhash.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+
+namespace libtas {
+
+/* Path of the store file. It is set once at startup, so it has the same value
+ * in every savestate. */
+static char storepath[1024] = "\0";
+
+static PageStore::Control* control = nullptr;
+static PageStore::Entry* entries = nullptr;
+static uint32_t* free_slots = nullptr;
+
+static uint32_t homeIndex(const PageStore::Key& key)
+{
+    return key.low & (PageStore::CAPACITY - 1);
+}
+
+static bool isSameKey(const PageStore::Key& a, const PageStore::Key& b)
+{
+    return (a.low == b.low) && (a.high == b.high);
+}
+
+/* Get the index of the entry of the key, or the index of the empty entry
+ * where it would be inserted */
+static uint32_t findIndex(const PageStore::Key& key)
+{
+    uint32_t i = homeIndex(key);
+    while (entries[i].refs != 0 && !isSameKey(entries[i].key, key))
+        i = (i + 1) & (PageStore::CAPACITY - 1);
+    return i;
+}
+
+void PageStore::flush(int fd)
+{
+    if (!control || (control->pending_count == 0))
+        return;
+
+    off_t offset = static_cast<off_t>(control->pending_slot) * 4096;
+    size_t size = static_cast<size_t>(control->pending_count) * 4096;
+    const char* addr = control->pending_addr;
+
+    while (size > 0) {
+        ssize_t ret = pwrite(fd, addr, size, offset);
+        if (ret <= 0) {
+            NATIVECALL(LOG(LL_ERROR, LCF_CHECKPOINT, "Could not write into page store %s", storepath));
+            break;
+        }
+        addr += ret;
+        offset += ret;
+        size -= ret;
+    }
+
+    control->pending_count = 0;
+}
+
+void PageStore::init()
+{
+    if (control)
+        return;
+
+    control = static_cast<Control*>(ReservedMemory::getAddr(ReservedMemory::PAGESTORE_CONTROL_ADDR));
+
+    /* The index is large and only used when deduplicating pages, so it is
+     * mapped separately and only committed once pages are stored. */
+    entries = static_cast<Entry*>(ReservedMemory::mapArray(CAPACITY * sizeof(Entry)));
+    free_slots = static_cast<uint32_t*>(ReservedMemory::mapArray(CAPACITY * sizeof(uint32_t)));
+
+    /* Reserved memory is already zeroed */
+    control->count = 0;
+    control->slot_count = 0;
+    control->free_count = 0;
+    control->pending_count = 0;
+}
+
+void PageStore::setPath(std::string path)
+{
+    strncpy(storepath, path.c_str(), 1023);
+
+    /* Start with an empty store, pages from a previous run are not
+     * referenced by the index */
+    NATIVECALL(unlink(storepath));
+}
+
+bool PageStore::available()
+{
+    return control && (storepath[0] != '\0');
+}
+
+int PageStore::open(bool write)
+{
+    if (!available())
+        return -1;
+
+    if (!write) {
+        /* The store file does not exist until a state uses it */
+        int fd;
+        NATIVECALL(fd = ::open(storepath, O_RDONLY));
+        return fd;
+    }
+
+    int fd;
+    NATIVECALL(fd = ::open(storepath, O_RDWR | O_CREAT, 0644));
+    if (fd == -1)
+        NATIVECALL(LOG(LL_WARN, LCF_CHECKPOINT, "Could not open page store %s", storepath));
+
+    return fd;
+}
+
+void PageStore::close(int fd)
+{
+    if (fd == -1)
+        return;
+
+    flush(fd);
+    NATIVECALL(::close(fd));
+}
+
+bool PageStore::addPage(int fd, const char* addr, Key* key)
+{
+    XXH128_hash_t hash = XXH3_128bits(addr, 4096);
+    key->low = hash.low64;
+    key->high = hash.high64;
+
+    uint32_t i = findIndex(*key);
+    if (entries[i].refs != 0) {
+        entries[i].refs++;
+        return true;
+    }
+
+    if (control->count >= MAX_COUNT)
+        return false;
+
+    /* Take a recycled slot first, so that the store file does not grow */
+    uint32_t slot;
+    if (control->free_count > 0)
+        slot = free_slots[--control->free_count];
+    else
+        slot = control->slot_count++;
+
+    /* Write the page, grouping runs of consecutive pages in a single call */
+    if ((control->pending_count > 0) &&
+        ((slot != control->pending_slot + control->pending_count) ||
+         (addr != control->pending_addr + static_cast<size_t>(control->pending_count) * 4096)))
+        flush(fd);
+
+    if (control->pending_count == 0) {
+        control->pending_addr = addr;
+        control->pending_slot = slot;
+    }
+    control->pending_count++;
+
+    entries[i].key = *key;
+    entries[i].slot = slot;
+    entries[i].refs = 1;
+    control->count++;
+
+    return true;
+}
+
+int64_t PageStore::findSlot(const Key& key)
+{
+    if (!control)
+        return -1;
+
+    uint32_t i = findIndex(key);
+    if (entries[i].refs == 0)
+        return -1;
+
+    return entries[i].slot;
+}
+
+void PageStore::removePage(const Key& key)
+{
+    uint32_t i = findIndex(key);
+    if (entries[i].refs == 0) {
+        NATIVECALL(LOG(LL_WARN, LCF_CHECKPOINT, "Removing a page that is not in the page store"));
+        return;
+    }
+
+    if (--entries[i].refs > 0)
+        return;
+
+    free_slots[control->free_count++] = entries[i].slot;
+    control->count--;
+
+    /* Shift back the following entries of the probe sequence, so that lookups
+     * never stop at the removed entry */
+    uint32_t j = i;
+    while (true) {
+        j = (j + 1) & (CAPACITY - 1);
+        if (entries[j].refs == 0)
+            break;
+
+        uint32_t k = homeIndex(entries[j].key);
+        bool in_place = (i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j));
+        if (in_place)
+            continue;
+
+        entries[i] = entries[j];
+        entries[j].refs = 0;
+        i = j;
+    }
+}
+
+void PageStore::removeState(const char* pagemappath, const char* pagespath)
+{
+    if (!control)
+        return;
+
+    /* Savestate files may be missing or empty (see AsyncSave) */
+    struct stat sb;
+    int ret;
+    NATIVECALL(ret = stat(pagemappath, &sb));
+    if ((ret == -1) || (sb.st_size < static_cast<off_t>(sizeof(StateHeader))))
+        return;
+    NATIVECALL(ret = stat(pagespath, &sb));
+    if (ret == -1)
+        return;
+
+    SaveStateLoading state(pagemappath, pagespath);
+    state.removeStoredPages();
+}
+
+uint32_t PageStore::pageCount()
+{
+    if (!control)
+        return 0;
+    return control->count;
+}
+
+}
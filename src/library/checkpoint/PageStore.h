@@ -0,0 +1,124 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_PAGESTORE_H
+#define LIBTAS_PAGESTORE_H
+
+#include <cstdint>
+#include <string>
+
+namespace libtas {
+
+/* Content-addressed storage of memory pages, shared by all savestate slots.
+ *
+ * Each stored page is identified by the 128-bit hash of its content, and
+ * savestates only store the hash inside their pages file (with the
+ * STORE_PAGE flag), so that a page present in several savestates is only
+ * stored once. Pages are stored uncompressed in fixed 4096-byte slots of a
+ * single store file, which is only read and written during a checkpoint.
+ *
+ * The index from hashes to store slots, with the number of references of
+ * each page, is never saved like the reserved memory, so that it is not modified
+ * by loading a savestate. It is only accessed by the checkpoint thread or by the
+ * asynchronous writer, which never run at the same time. Two pages with the
+ * same hash are considered identical. */
+namespace PageStore
+{
+    enum {
+        /* Maximum number of distinct pages in the store */
+        CAPACITY = 1 << 19,
+
+        /* Maximum number of distinct pages before refusing new pages, to
+         * keep probe sequences short */
+        MAX_COUNT = CAPACITY / 4 * 3,
+    };
+
+    struct Key {
+        uint64_t low;
+        uint64_t high;
+    };
+
+    struct Entry {
+        Key key;
+
+        /* Index of the page inside the store file */
+        uint32_t slot;
+
+        /* Number of savestate pages referencing this page. Zero means that
+         * the entry is empty. */
+        uint32_t refs;
+    };
+
+    struct Control {
+        /* Number of distinct stored pages */
+        uint32_t count;
+
+        /* Number of slots in the store file */
+        uint32_t slot_count;
+
+        /* Number of recycled slots */
+        uint32_t free_count;
+
+        /* Run of new pages, with consecutive slots and addresses, that were
+         * not written to the store file yet */
+        const char* pending_addr;
+        uint32_t pending_slot;
+        uint32_t pending_count;
+    };
+
+    /* Initialize the index. Must be called before any savestate is made */
+    void init();
+
+    /* Set the path of the store file */
+    void setPath(std::string path);
+
+    /* Indicate if a store file can be used */
+    bool available();
+
+    /* Open the store file, returns -1 if not available */
+    int open(bool write);
+
+    /* Write pending pages into the store file */
+    void flush(int fd);
+
+    /* Write pending pages and close the store file */
+    void close(int fd);
+
+    /* Add a reference to a page, storing it if not already present. Returns
+     * false if the page could not be added, in which case the page must be
+     * saved normally. The page must stay readable and unmodified until
+     * flush() is called. */
+    bool addPage(int fd, const char* addr, Key* key);
+
+    /* Get the slot of a stored page inside the store file, or -1 if the
+     * page is not stored */
+    int64_t findSlot(const Key& key);
+
+    /* Remove a reference to a page, and free it if unused */
+    void removePage(const Key& key);
+
+    /* Remove all the references of the savestate files, if present */
+    void removeState(const char* pagemappath, const char* pagespath);
+
+    /* Number of distinct stored pages */
+    uint32_t pageCount();
+}
+}
+
+#endif
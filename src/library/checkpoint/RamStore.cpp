@@ -0,0 +1,239 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "RamStore.h"
+#include "ReservedMemory.h"
+
+#include "logging.h"
+#include "global.h"
+#include "GlobalState.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+
+namespace libtas {
+
+static RamStore::Control* control = nullptr;
+
+static int createMemfd(const char* name)
+{
+    int fd = syscall(SYS_memfd_create, name, 0);
+    if (fd < 0)
+        return -1;
+
+    int high_fd = fcntl(fd, F_DUPFD_CLOEXEC, RamStore::FD_BASE);
+    NATIVECALL(close(fd));
+    return high_fd;
+}
+
+static size_t fileSize(int fd)
+{
+    struct stat sb;
+    int ret;
+    NATIVECALL(ret = fstat(fd, &sb));
+    if (ret == -1)
+        return 0;
+    return sb.st_size;
+}
+
+/* Copy the content of a memory file into a file */
+static bool copyToFile(int fd, const char* path)
+{
+    int outfd;
+    NATIVECALL(unlink(path));
+    NATIVECALL(outfd = creat(path, 0644));
+    if (outfd == -1)
+        return false;
+
+    off_t offset = 0;
+    size_t remaining = fileSize(fd);
+    while (remaining > 0) {
+        ssize_t ret = sendfile(outfd, fd, &offset, remaining);
+        if (ret <= 0) {
+            NATIVECALL(close(outfd));
+            return false;
+        }
+        remaining -= ret;
+    }
+
+    NATIVECALL(close(outfd));
+    return true;
+}
+
+static void release(RamStore::Slot& slot)
+{
+    if (slot.pmfd != -1) NATIVECALL(close(slot.pmfd));
+    if (slot.pfd != -1) NATIVECALL(close(slot.pfd));
+    slot.pmfd = -1;
+    slot.pfd = -1;
+    slot.stored_size = 0;
+}
+
+static void evict(int s)
+{
+    RamStore::Slot& slot = control->slots[s];
+
+    if (!copyToFile(slot.pmfd, slot.pagemappath) || !copyToFile(slot.pfd, slot.pagespath)) {
+        /* Keep the savestate in memory rather than losing it */
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Could not write state %d into %s", s, slot.pagemappath);
+        return;
+    }
+
+    LOG(LL_INFO, LCF_CHECKPOINT, "Moved state %d of size %zu from memory to disk", s, slot.stored_size);
+    release(slot);
+}
+
+void RamStore::init()
+{
+    if (control)
+        return;
+
+    control = static_cast<Control*>(ReservedMemory::getAddr(ReservedMemory::RAMSTORE_CONTROL_ADDR));
+
+    for (int s = 0; s < SLOT_COUNT; s++) {
+        control->slots[s].pmfd = -1;
+        control->slots[s].pfd = -1;
+        control->slots[s].stored_size = 0;
+    }
+    control->clock = 0;
+}
+
+bool RamStore::enabled()
+{
+    return control && (Global::shared_config.savestate_settings & SharedConfig::SS_RAM);
+}
+
+bool RamStore::create(int* pmfd, int* pfd)
+{
+    *pmfd = createMemfd("libtas_state_pagemap");
+    *pfd = createMemfd("libtas_state_pages");
+
+    if ((*pmfd == -1) || (*pfd == -1)) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not create memory files for the savestate");
+        if (*pmfd != -1) NATIVECALL(close(*pmfd));
+        if (*pfd != -1) NATIVECALL(close(*pfd));
+        return false;
+    }
+
+    return true;
+}
+
+void RamStore::commit(int s, int pmfd, int pfd, const char* pagemappath,
+    const char* pagespath, size_t raw_size, size_t parent_pages)
+{
+    MYASSERT((s >= 0) && (s < SLOT_COUNT))
+    Slot& slot = control->slots[s];
+
+    release(slot);
+
+    /* Savestate files are now obsolete */
+    NATIVECALL(unlink(pagemappath));
+    NATIVECALL(unlink(pagespath));
+
+    slot.pmfd = pmfd;
+    slot.pfd = pfd;
+    slot.last_use = ++control->clock;
+    strncpy(slot.pagemappath, pagemappath, PATH_SIZE-1);
+    strncpy(slot.pagespath, pagespath, PATH_SIZE-1);
+    slot.raw_size = raw_size;
+    slot.stored_size = fileSize(pmfd) + fileSize(pfd);
+    slot.parent_pages = parent_pages;
+
+    LOG(LL_INFO, LCF_CHECKPOINT, "State %d in memory: raw size %zu, compressed size %zu, %zu pages shared with parent",
+        s, slot.raw_size, slot.stored_size, slot.parent_pages);
+
+    /* Evict the least recently used savestates until we fit in the budget.
+     * The new savestate is evicted last. */
+    size_t budget = static_cast<size_t>(Global::shared_config.savestate_ram_budget) * ONE_MB;
+    while (totalSize() > budget) {
+        int victim = -1;
+        for (int v = 0; v < SLOT_COUNT; v++) {
+            if (control->slots[v].pmfd == -1)
+                continue;
+            if ((victim == -1) || (control->slots[v].last_use < control->slots[victim].last_use))
+                victim = v;
+        }
+
+        if (victim == -1)
+            break;
+
+        size_t previous_size = totalSize();
+        evict(victim);
+        if (totalSize() == previous_size)
+            break;
+    }
+
+    for (int v = 0; v < SLOT_COUNT; v++) {
+        const Slot& other = control->slots[v];
+        if (other.pmfd != -1)
+            LOG(LL_DEBUG, LCF_CHECKPOINT, "    Slot %d: raw %zu, compressed %zu, shared with parent %zu pages",
+                v, other.raw_size, other.stored_size, other.parent_pages);
+    }
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "    States in memory use %zu bytes out of %zu", totalSize(), budget);
+}
+
+void RamStore::resolve(int s, const char* pagemappath, const char* pagespath,
+    char* resolvedpagemappath, char* resolvedpagespath)
+{
+    if (!contains(s)) {
+        strncpy(resolvedpagemappath, pagemappath, PATH_SIZE-1);
+        resolvedpagemappath[PATH_SIZE-1] = '\0';
+        strncpy(resolvedpagespath, pagespath, PATH_SIZE-1);
+        resolvedpagespath[PATH_SIZE-1] = '\0';
+        return;
+    }
+
+    /* Reopening the memory files gives an independent file offset */
+    snprintf(resolvedpagemappath, PATH_SIZE, "/proc/self/fd/%d", control->slots[s].pmfd);
+    snprintf(resolvedpagespath, PATH_SIZE, "/proc/self/fd/%d", control->slots[s].pfd);
+}
+
+bool RamStore::contains(int s)
+{
+    return control && (s >= 0) && (s < SLOT_COUNT) && (control->slots[s].pmfd != -1);
+}
+
+void RamStore::remove(int s)
+{
+    if (contains(s))
+        release(control->slots[s]);
+}
+
+void RamStore::touch(int s)
+{
+    if (!control || (s < 0) || (s >= SLOT_COUNT))
+        return;
+
+    control->slots[s].last_use = ++control->clock;
+}
+
+size_t RamStore::totalSize()
+{
+    size_t total = 0;
+    for (int s = 0; s < SLOT_COUNT; s++)
+        total += control->slots[s].stored_size;
+    return total;
+}
+
+}
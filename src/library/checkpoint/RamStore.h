@@ -0,0 +1,114 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_RAMSTORE_H
+#define LIBTAS_RAMSTORE_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace libtas {
+
+/* Storage of savestates in memory instead of files.
+ *
+ * Each savestate slot kept in memory is a pair of anonymous memory files
+ * (memfd) holding exactly the content of the pagemap and pages files, so that
+ * the savestate is saved and loaded with the regular code, using the
+ * /proc/self/fd/ paths of the memory files. Pages are always compressed.
+ *
+ * File descriptors are moved to high values, so that they are not closed when
+ * syncing file descriptors after loading a savestate, and the slot list lives
+ * inside the reserved memory. When the total size of savestates in memory
+ * exceeds the memory budget, the least recently used savestates are written
+ * into their savestate files and removed from memory. */
+namespace RamStore
+{
+    enum {
+        /* Number of savestate slots */
+        SLOT_COUNT = 11,
+
+        /* Minimal value of the file descriptors of memory files */
+        FD_BASE = 512,
+
+        PATH_SIZE = 1024,
+    };
+
+    struct Slot {
+        /* Memory files of the savestate, or -1 if not in memory */
+        int pmfd, pfd;
+
+        /* Last time the slot was saved or loaded, for eviction */
+        uint64_t last_use;
+
+        /* Paths of the savestate files, used when evicting the savestate */
+        char pagemappath[PATH_SIZE];
+        char pagespath[PATH_SIZE];
+
+        /* Size of the memory pages stored in the savestate, uncompressed */
+        size_t raw_size;
+
+        /* Size of the savestate in memory */
+        size_t stored_size;
+
+        /* Number of pages that were not modified since the parent savestate */
+        size_t parent_pages;
+    };
+
+    struct Control {
+        Slot slots[SLOT_COUNT];
+
+        /* Counter for the last use of slots */
+        uint64_t clock;
+    };
+
+    /* Initialize the slot list. Must be called before any savestate is made */
+    void init();
+
+    /* Indicate if savestates must be kept in memory */
+    bool enabled();
+
+    /* Create the memory files for a new savestate. Returns false if the
+     * savestate must be saved into files instead. */
+    bool create(int* pmfd, int* pfd);
+
+    /* Store a new savestate in the slot, replacing the previous one and the
+     * savestate files if any, then evict savestates to respect the budget. */
+    void commit(int slot, int pmfd, int pfd, const char* pagemappath,
+        const char* pagespath, size_t raw_size, size_t parent_pages);
+
+    /* Get the paths to read the savestate of a slot, which are the given
+     * file paths if the savestate is not in memory */
+    void resolve(int slot, const char* pagemappath, const char* pagespath,
+        char* resolvedpagemappath, char* resolvedpagespath);
+
+    /* Indicate if the savestate of a slot is in memory */
+    bool contains(int slot);
+
+    /* Remove the savestate of a slot from memory */
+    void remove(int slot);
+
+    /* Mark the slot as used */
+    void touch(int slot);
+
+    /* Total size of savestates in memory */
+    size_t totalSize();
+}
+}
+
+#endif
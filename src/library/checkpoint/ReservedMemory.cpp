@@ -23,7 +23,6 @@
 
 #include "logging.h"
 
-#include <string.h>
 #include <sys/mman.h>
 
 namespace libtas {
@@ -31,6 +30,12 @@ namespace libtas {
 static intptr_t restoreAddr = 0;
 static size_t restoreLength = 0;
 
+/* Arrays mapped outside of the reserved memory */
+static const int MAX_ARRAYS = 4;
+static void* arrayAddrs[MAX_ARRAYS];
+static size_t arraySizes[MAX_ARRAYS];
+static int arrayCount = 0;
+
 void ReservedMemory::init()
 {
     /* Create a special place to hold restore memory.
@@ -47,8 +52,10 @@ void ReservedMemory::init()
             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
         MYASSERT(addr != MAP_FAILED)
         restoreAddr = reinterpret_cast<intptr_t>(addr) + 4096;
+        /* Anonymous memory is already zero-filled. Don't touch it here, so
+         * that pages (e.g. worker stacks and jobs) are only committed when
+         * they are actually used. */
         MYASSERT(mprotect(reinterpret_cast<void*>(restoreAddr), restoreLength, PROT_READ | PROT_WRITE) == 0)
-        memset(reinterpret_cast<void*>(restoreAddr), 0, restoreLength);
     }
 }
 
@@ -62,4 +69,38 @@ size_t ReservedMemory::getSize()
     return restoreLength;
 }
 
+void* ReservedMemory::mapArray(size_t size)
+{
+    MYASSERT(arrayCount < MAX_ARRAYS)
+
+    /* Take the next multiplier of page size */
+    size = ((size + 4095) / 4096) * 4096;
+
+    /* Surround the array with guard pages like the reserved memory, so that
+     * it is never merged with a neighbour mapping */
+    void* addr = mmap(nullptr, size + (2 * 4096), PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    MYASSERT(addr != MAP_FAILED)
+    void* arrayAddr = static_cast<char*>(addr) + 4096;
+    MYASSERT(mprotect(arrayAddr, size, PROT_READ | PROT_WRITE) == 0)
+
+    arrayAddrs[arrayCount] = arrayAddr;
+    arraySizes[arrayCount] = size;
+    arrayCount++;
+
+    return arrayAddr;
+}
+
+bool ReservedMemory::isReserved(void* addr, size_t size)
+{
+    if ((addr == getAddr(0)) && (size == getSize()))
+        return true;
+
+    for (int a = 0; a < arrayCount; a++)
+        if ((addr == arrayAddrs[a]) && (size == arraySizes[a]))
+            return true;
+
+    return false;
+}
+
 }
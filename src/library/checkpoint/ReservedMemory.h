@@ -23,6 +23,11 @@
 #define LIBTAS_RESERVEDMEMORY_H
 
 #include "StateHeader.h"
+#include "WorkerPool.h"
+#include "AsyncSave.h"
+#include "PageStore.h"
+#include "RamStore.h"
+#include "LazyRestore.h"
 
 #include <cstdint> // intptr_t
 #include <cstddef> // size_t
@@ -32,15 +37,31 @@
 namespace libtas {
 namespace ReservedMemory {
     enum Sizes {
-        COMPRESSED_SIZE = 4 * ONE_MB,
         STACK_SIZE = 5 * ONE_MB,
+        WORKER_STACKS_SIZE = WorkerPool::MAX_WORKERS * WorkerPool::STACK_SIZE,
+        WORKER_JOBS_SIZE = WorkerPool::JOB_COUNT * sizeof(WorkerPool::Job),
+        ASYNC_STACK_SIZE = AsyncSave::STACK_SIZE,
+        LAZY_STACK_SIZE = LazyRestore::STACK_SIZE,
+        WORKER_CONTROL_SIZE = sizeof(WorkerPool::Control),
+        ASYNC_CONTROL_SIZE = sizeof(AsyncSave::Control),
+        PAGESTORE_CONTROL_SIZE = sizeof(PageStore::Control),
+        RAMSTORE_CONTROL_SIZE = sizeof(RamStore::Control),
+        LAZY_CONTROL_SIZE = sizeof(LazyRestore::Control),
         SS_SLOTS_SIZE = 11*sizeof(bool),
-        SH_SIZE = sizeof(StateHeader),
+        SH_SIZE = sizeof(StateThreadList),
     };
     enum Addresses {
-        COMPRESSED_ADDR = 0,
-        STACK_ADDR = COMPRESSED_ADDR + COMPRESSED_SIZE,
-        SS_SLOTS_ADDR = STACK_ADDR + STACK_SIZE,
+        STACK_ADDR = 0,
+        WORKER_STACKS_ADDR = STACK_ADDR + STACK_SIZE,
+        ASYNC_STACK_ADDR = WORKER_STACKS_ADDR + WORKER_STACKS_SIZE,
+        LAZY_STACK_ADDR = ASYNC_STACK_ADDR + ASYNC_STACK_SIZE,
+        WORKER_JOBS_ADDR = LAZY_STACK_ADDR + LAZY_STACK_SIZE,
+        WORKER_CONTROL_ADDR = WORKER_JOBS_ADDR + WORKER_JOBS_SIZE,
+        ASYNC_CONTROL_ADDR = WORKER_CONTROL_ADDR + WORKER_CONTROL_SIZE,
+        PAGESTORE_CONTROL_ADDR = ASYNC_CONTROL_ADDR + ASYNC_CONTROL_SIZE,
+        RAMSTORE_CONTROL_ADDR = PAGESTORE_CONTROL_ADDR + PAGESTORE_CONTROL_SIZE,
+        LAZY_CONTROL_ADDR = RAMSTORE_CONTROL_ADDR + RAMSTORE_CONTROL_SIZE,
+        SS_SLOTS_ADDR = LAZY_CONTROL_ADDR + LAZY_CONTROL_SIZE,
         SH_ADDR = SS_SLOTS_ADDR + SS_SLOTS_SIZE,
         RESTORE_TOTAL_SIZE = SH_ADDR + SH_SIZE,
     };
@@ -48,6 +69,15 @@ namespace ReservedMemory {
     void init();
     void* getAddr(intptr_t offset);
     size_t getSize();
+
+    /* Map a large array outside of the reserved memory, that is not saved
+     * nor restored either. It is mapped with MAP_NORESERVE and never touched
+     * here, so its pages are only committed when used. Must be called before
+     * any savestate is made. */
+    void* mapArray(size_t size);
+
+    /* Returns if the memory area is the reserved memory or a mapped array */
+    bool isReserved(void* addr, size_t size);
 }
 }
 
@@ -20,7 +20,6 @@
 */
 
 #include "SaveStateLoading.h"
-#include "StateHeader.h"
 
 #include "Utils.h"
 #include "logging.h"
@@ -35,13 +34,23 @@
 #include "GlobalState.h"
 
 #include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 namespace libtas {
 
 SaveStateLoading::SaveStateLoading(const char* pagemappath, const char* pagespath)
 {
-    queued_size = 0;
+    readahead_size = 0;
+    current_job = nullptr;
+    inflight_first = 0;
+    inflight_count = 0;
+    sfd = -1;
+    stored_key_count = 0;
+    store_queued_count = 0;
+    index_first = 0;
+    index_count = 0;
 
     if (pagemappath[0] == '\0') {
         pmfd = -1;
@@ -54,30 +63,125 @@ SaveStateLoading::SaveStateLoading(const char* pagemappath, const char* pagespat
     NATIVECALL(pfd = open(pagespath, O_RDONLY));
     MYASSERT(pfd != -1)
 
-    memset(&lz4s, 0, sizeof(LZ4_streamDecode_t));
+    /* Savestates from another version or not completed are ignored */
+    if ((pread(pmfd, &header, sizeof(header), 0) != sizeof(header)) ||
+        !header.isValid() || (header.index_offset == 0)) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Savestate %s has an unknown format or was not completed", pagemappath);
+        NATIVECALL(close(pmfd));
+        NATIVECALL(close(pfd));
+        pmfd = -1;
+        return;
+    }
+
+    /* Open the page store now, because files cannot be opened during the
+     * state loading (see FileDescriptorManip) */
+    NATIVECALL(sfd = PageStore::open(false));
+
     restart();
 }
 
 SaveStateLoading::~SaveStateLoading()
 {
+    /* Give back all jobs to the pool */
+    submitCompressedLoad();
+    while (inflight_count > 0)
+        retireCompressedLoad();
+
     if (pmfd > 0) {
         NATIVECALL(close(pmfd));
         NATIVECALL(close(pfd));
     }
+
+    if (sfd != -1)
+        NATIVECALL(close(sfd));
 }
 
-void SaveStateLoading::readHeader(StateHeader* sh)
+void SaveStateLoading::readHeader(StateThreadList* threads)
 {
-    lseek(pmfd, 0, SEEK_SET);
-    Utils::readAll(pmfd, sh, sizeof(StateHeader));
+    threads->thread_count = header.thread_count;
+
+    for (uint32_t t = 0; t < header.thread_count; t++) {
+        StateThread thread;
+        if (pread(pmfd, &thread, sizeof(thread), sizeof(StateHeader) + t * sizeof(StateThread)) != sizeof(thread)) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Could not read the savestate thread list");
+            threads->thread_count = t;
+            return;
+        }
+        threads->pthread_ids[t] = static_cast<pthread_t>(thread.pthread_id);
+        threads->tids[t] = thread.tid;
+        threads->states[t] = thread.state;
+    }
+}
 
-    restart();
+/* Compute the checksum of a part of a file */
+static bool checksumFile(int fd, off_t offset, uint64_t size, uint32_t* crc)
+{
+    char buffer[16384];
+    *crc = 0;
+
+    while (size > 0) {
+        size_t count = (size > sizeof(buffer)) ? sizeof(buffer) : size;
+        if (pread(fd, buffer, count, offset) != static_cast<ssize_t>(count))
+            return false;
+        *crc = Utils::crc32c(*crc, buffer, count);
+        offset += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool SaveStateLoading::verify(bool full)
+{
+    if (pmfd == -1)
+        return false;
+
+    uint32_t crc;
+    if (!checksumFile(pmfd, sizeof(StateHeader), header.thread_count * sizeof(StateThread), &crc) ||
+        (crc != header.threads_crc)) {
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Savestate thread list is corrupted");
+        return false;
+    }
+
+    if (!checksumFile(pmfd, header.index_offset, header.area_count * sizeof(StateAreaIndex), &crc) ||
+        (crc != header.index_crc)) {
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Savestate area index is corrupted");
+        return false;
+    }
+
+    if (!full)
+        return true;
+
+    bool valid = true;
+    for (uint32_t i = 0; i < header.area_count; i++) {
+        StateAreaIndex entry;
+        Area saved_area;
+        if (!readIndexEntry(i, &entry) ||
+            (pread(pmfd, &saved_area, sizeof(saved_area), entry.area_offset) != sizeof(saved_area))) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Could not read area %u of the savestate", i);
+            return false;
+        }
+
+        uint64_t flag_count = (saved_area.skip || saved_area.uncommitted) ? 0 : (saved_area.size + 4095) / 4096;
+        if (!checksumFile(pmfd, entry.area_offset + sizeof(Area), flag_count, &crc) ||
+            (crc != entry.flags_crc)) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Page flags of area %p (%s) are corrupted", saved_area.addr, saved_area.name);
+            valid = false;
+        }
+
+        if (!checksumFile(pfd, entry.page_offset, entry.page_size, &crc) ||
+            (crc != entry.pages_crc)) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Pages of area %p (%s) are corrupted", saved_area.addr, saved_area.name);
+            valid = false;
+        }
+    }
+
+    return valid;
 }
 
 void SaveStateLoading::restart()
 {
-    /* Seek after the savestate header */
-    lseek(pmfd, sizeof(StateHeader), SEEK_SET);
+    /* Seek after the savestate header and thread list */
+    lseek(pmfd, header.areasOffset(), SEEK_SET);
     flags_remaining = 0;
 
     /* Read the first area */
@@ -114,7 +218,6 @@ Area& SaveStateLoading::nextArea()
     } else {
         flags_remaining = (area.size + 4095) / 4096;
     }
-    LZ4_setStreamDecode(&lz4s, nullptr, 0);
     return area;
 }
 
@@ -141,9 +244,9 @@ char SaveStateLoading::getPageFlag(char* addr)
     if (addr == (current_addr - 4096))
         return current_flag;
 
-    while ((area.addr != nullptr) && (addr >= static_cast<char*>(area.endAddr))) {
-        /* Skip areas until the one we are interested in */
-        nextArea();
+    if ((area.addr != nullptr) && (addr >= static_cast<char*>(area.endAddr))) {
+        /* Move directly to the area we are interested in */
+        jumpToArea(findArea(addr));
     }
 
     // LOG(LL_DEBUG, LCF_CHECKPOINT, "Savestate addr query %p, current area %p and size %d, with current addr %p", addr, area.addr, area.size, current_addr);
@@ -163,17 +266,99 @@ char SaveStateLoading::getPageFlag(char* addr)
         if (flag == Area::FULL_PAGE) {
             next_pfd_offset += 4096;
         }
-        else if (flag == Area::COMPRESSED_PAGE) {
-            lseek(pfd, next_pfd_offset, SEEK_SET);
-            Utils::readAll(pfd, &compressed_length, sizeof(int));
+        else if ((flag == Area::COMPRESSED_PAGE) || (flag == Area::DELTA_PAGE)) {
+            readPages(next_pfd_offset, &compressed_length, sizeof(int));
             next_pfd_offset += sizeof(int) + compressed_length;
         }
+        else if (flag == Area::STORE_PAGE) {
+            next_pfd_offset += sizeof(PageStore::Key);
+        }
         current_addr += 4096;
     } while (current_addr <= addr);
 
     return flag;
 }
 
+bool SaveStateLoading::readIndexEntry(int i, StateAreaIndex* entry)
+{
+    if ((i >= index_first) && (i < index_first + index_count)) {
+        *entry = index_entries[i - index_first];
+        return true;
+    }
+
+    off_t offset = header.index_offset + static_cast<off_t>(i) * sizeof(StateAreaIndex);
+    return pread(pmfd, entry, sizeof(*entry), offset) == sizeof(*entry);
+}
+
+int SaveStateLoading::findArea(char* addr)
+{
+    uint64_t target = reinterpret_cast<uintptr_t>(addr);
+
+    /* Memory areas are sorted, so we look for the first area ending after the
+     * address, inside [low, high] */
+    int low = 0;
+    int high = header.memory_area_count;
+
+    /* Restrict the search using the entries that we already read, so that
+     * going through areas in order does not read the index again */
+    if (index_count > 0) {
+        const StateAreaIndex& first = index_entries[0];
+        const StateAreaIndex& last = index_entries[index_count - 1];
+        if (target < first.addr + first.size)
+            high = index_first;
+        else if (target < last.addr + last.size)
+            high = index_first + index_count - 1;
+        else
+            low = index_first + index_count;
+
+        if ((target >= first.addr + first.size) && (low < index_first + 1))
+            low = index_first + 1;
+    }
+
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        StateAreaIndex entry;
+        if (!readIndexEntry(mid, &entry)) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Could not read the savestate area index");
+            return header.memory_area_count;
+        }
+
+        if (target < entry.addr + entry.size)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    /* Read the following entries at once */
+    if ((low < static_cast<int>(header.memory_area_count)) &&
+        ((low < index_first) || (low >= index_first + index_count))) {
+        int count = header.memory_area_count - low;
+        if (count > INDEX_CHUNK)
+            count = INDEX_CHUNK;
+        off_t offset = header.index_offset + static_cast<off_t>(low) * sizeof(StateAreaIndex);
+        ssize_t ret = pread(pmfd, index_entries, count * sizeof(StateAreaIndex), offset);
+        index_first = low;
+        index_count = (ret > 0) ? (ret / sizeof(StateAreaIndex)) : 0;
+    }
+
+    return low;
+}
+
+void SaveStateLoading::jumpToArea(int i)
+{
+    StateAreaIndex entry;
+    off_t offset;
+    if ((i < static_cast<int>(header.memory_area_count)) && readIndexEntry(i, &entry))
+        offset = entry.area_offset;
+    else
+        /* The null area is right before the index */
+        offset = header.index_offset - sizeof(Area);
+
+    lseek(pmfd, offset, SEEK_SET);
+    flags_remaining = 0;
+    nextArea();
+}
+
 /* Like getPageFlag(), but assumes you're going through the addresses
  * sequentially.  This means it can skip some checks and be a little faster. */
 char SaveStateLoading::getNextPageFlag()
@@ -182,22 +367,56 @@ char SaveStateLoading::getNextPageFlag()
     if (flag == Area::FULL_PAGE) {
         next_pfd_offset += 4096;
     }
-    else if (flag == Area::COMPRESSED_PAGE) {
-        lseek(pfd, next_pfd_offset, SEEK_SET);
-        Utils::readAll(pfd, &compressed_length, sizeof(int));
+    else if ((flag == Area::COMPRESSED_PAGE) || (flag == Area::DELTA_PAGE)) {
+        readPages(next_pfd_offset, &compressed_length, sizeof(int));
         next_pfd_offset += sizeof(int) + compressed_length;
     }
+    else if (flag == Area::STORE_PAGE) {
+        next_pfd_offset += sizeof(PageStore::Key);
+    }
     current_addr += 4096;
     return flag;
 }
 
-void SaveStateLoading::finishLoad()
+bool SaveStateLoading::readPages(off_t offset, void* buffer, size_t size)
 {
-    if (queued_size > 0) {
-        lseek(pfd, queued_offset, SEEK_SET);
-        Utils::readAll(pfd, queued_addr, queued_size);
-        queued_size = 0;
+    /* Large reads are not worth copying */
+    if (size > READAHEAD_SIZE / 2)
+        return pread(pfd, buffer, size, offset) == static_cast<ssize_t>(size);
+
+    if ((readahead_size == 0) || (offset < readahead_offset) ||
+        (offset + size > readahead_offset + readahead_size)) {
+        ssize_t ret = pread(pfd, readahead, READAHEAD_SIZE, offset);
+        if (ret < static_cast<ssize_t>(size)) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Could not read %zu bytes at offset %jd of the pages file", size, static_cast<intmax_t>(offset));
+            readahead_size = 0;
+            memset(buffer, 0, size);
+            return false;
+        }
+        readahead_offset = offset;
+        readahead_size = ret;
     }
+
+    memcpy(buffer, readahead + (offset - readahead_offset), size);
+    return true;
+}
+
+void SaveStateLoading::flushLoad()
+{
+    if (!queued_pages.empty())
+        queued_pages.read(pfd, queued_offset);
+}
+
+void SaveStateLoading::finishLoad()
+{
+    flushLoad();
+    flushStoredLoad();
+
+    /* Wait for all pages to be decompressed, because the caller may change
+     * the memory protection right after. */
+    submitCompressedLoad();
+    while (inflight_count > 0)
+        retireCompressedLoad();
 }
 
 void SaveStateLoading::queuePageLoad(char* addr)
@@ -205,49 +424,212 @@ void SaveStateLoading::queuePageLoad(char* addr)
     // MYASSERT(addr + 4096 == current_addr);
 
     if (current_flag == Area::FULL_PAGE) {
-        if (queued_size > 0) {
-        	if ((next_pfd_offset - 4096) == queued_offset + queued_size &&
-        	    addr == queued_addr + queued_size) {
-                queued_size += 4096;
-                return;
-        	} else {
-                lseek(pfd, queued_offset, SEEK_SET);
-                Utils::readAll(pfd, queued_addr, queued_size);
-        	}
+        /* Pages stored next to each other in the file are read with a single
+         * call, even if they are not next to each other in memory */
+        off_t offset = next_pfd_offset - 4096;
+        if (!queued_pages.empty() &&
+            (offset == queued_offset + static_cast<off_t>(queued_pages.size())) &&
+            queued_pages.add(addr, 4096))
+            return;
+
+        flushLoad();
+        queued_offset = offset;
+        queued_pages.add(addr, 4096);
+    }
+    else if ((current_flag == Area::COMPRESSED_PAGE) || (current_flag == Area::DELTA_PAGE)) {
+        /* Copy the compressed page into a job, and let the worker pool
+         * decompress it directly into the memory page. For delta pages, the
+         * memory page must already contain the base savestate page. */
+        if ((compressed_length <= 0) || (compressed_length > LZ4_COMPRESSBOUND(4096))) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Page %p has an invalid compressed size %d", addr, compressed_length);
+            return;
+        }
+
+        if (!current_job) {
+            if (inflight_count == WorkerPool::MAX_JOBS_PER_OWNER)
+                retireCompressedLoad();
+
+            current_job = WorkerPool::acquire(WorkerPool::JOB_DECOMPRESS);
+            MYASSERT(current_job != nullptr)
         }
-        queued_offset = (next_pfd_offset - 4096);
-        queued_addr = addr;
-        queued_size = 4096;
+
+        memcpy(current_job->buffer + current_job->size, &compressed_length, sizeof(int));
+        current_job->size += sizeof(int);
+        readPages(next_pfd_offset - compressed_length, current_job->buffer + current_job->size, compressed_length);
+        current_job->size += compressed_length;
+        current_job->delta[current_job->count] = (current_flag == Area::DELTA_PAGE);
+        current_job->addrs[current_job->count++] = addr;
+
+        if (current_job->count == WorkerPool::JOB_PAGES)
+            submitCompressedLoad();
     }
-    else if (current_flag == Area::COMPRESSED_PAGE) {
-        char compressed[LZ4_COMPRESSBOUND(4096)];
-        Utils::readAll(pfd, compressed, compressed_length);
-        
-        if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
-            /* For incremental savestates, block compression is independant */
-            LZ4_decompress_safe(compressed, addr, compressed_length, 4096);
+    else if (current_flag == Area::STORE_PAGE) {
+        PageStore::Key key;
+        readStoredKey(&key);
+
+        int64_t slot = PageStore::findSlot(key);
+        if ((slot < 0) || (sfd == -1)) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Page %p is missing from the page store", addr);
+            return;
         }
-        else {
-            LZ4_decompress_safe_continue(&lz4s, compressed, addr, compressed_length, 4096);
+
+        if (store_queued_count > 0) {
+            if ((slot == store_queued_slot + store_queued_count) &&
+                (addr == store_queued_addr + static_cast<size_t>(store_queued_count) * 4096)) {
+                store_queued_count++;
+                return;
+            }
+            flushStoredLoad();
         }
+        store_queued_addr = addr;
+        store_queued_slot = slot;
+        store_queued_count = 1;
     }
 }
 
-bool SaveStateLoading::debugIsMatchingPage(char* addr)
+void SaveStateLoading::readStoredKey(PageStore::Key* key)
+{
+    off_t offset = next_pfd_offset - sizeof(PageStore::Key);
+
+    /* Keys of consecutive stored pages are next to each other, so we read
+     * them in chunks */
+    if ((stored_key_count == 0) || (offset < stored_keys_offset) ||
+        (offset >= stored_keys_offset + static_cast<off_t>(stored_key_count * sizeof(PageStore::Key)))) {
+        ssize_t ret = pread(pfd, stored_keys, sizeof(stored_keys), offset);
+        if (ret < static_cast<ssize_t>(sizeof(PageStore::Key))) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Could not read the key of a stored page");
+            memset(key, 0, sizeof(PageStore::Key));
+            stored_key_count = 0;
+            return;
+        }
+        stored_keys_offset = offset;
+        stored_key_count = ret / sizeof(PageStore::Key);
+    }
+
+    *key = stored_keys[(offset - stored_keys_offset) / sizeof(PageStore::Key)];
+}
+
+void SaveStateLoading::flushStoredLoad()
+{
+    if (store_queued_count == 0)
+        return;
+
+    lseek(sfd, store_queued_slot * 4096, SEEK_SET);
+    Utils::readAll(sfd, store_queued_addr, static_cast<size_t>(store_queued_count) * 4096);
+    store_queued_count = 0;
+}
+
+void SaveStateLoading::submitCompressedLoad()
+{
+    if (!current_job)
+        return;
+
+    WorkerPool::start(current_job);
+
+    int index = (inflight_first + inflight_count) % WorkerPool::MAX_JOBS_PER_OWNER;
+    inflight_jobs[index] = current_job;
+    inflight_count++;
+    current_job = nullptr;
+}
+
+void SaveStateLoading::retireCompressedLoad()
+{
+    if (inflight_count == 0)
+        return;
+
+    WorkerPool::Job* job = inflight_jobs[inflight_first];
+    inflight_first = (inflight_first + 1) % WorkerPool::MAX_JOBS_PER_OWNER;
+    inflight_count--;
+
+    WorkerPool::wait(job);
+
+    if (job->errors)
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Could not decompress %d memory pages", job->errors);
+
+    WorkerPool::release(job);
+}
+
+bool SaveStateLoading::readPage(char* buffer)
 {
-    char current_page[4096];
-    
     if (current_flag == Area::FULL_PAGE) {
-        lseek(pfd, next_pfd_offset - 4096, SEEK_SET);
-        Utils::readAll(pfd, current_page, 4096);
+        return pread(pfd, buffer, 4096, next_pfd_offset - 4096) == 4096;
     }
     else if (current_flag == Area::COMPRESSED_PAGE) {
         char compressed[LZ4_COMPRESSBOUND(4096)];
-        Utils::readAll(pfd, compressed, compressed_length);
-        LZ4_decompress_safe(compressed, current_page, compressed_length, 4096);
+        if ((compressed_length <= 0) || (compressed_length > static_cast<int>(sizeof(compressed))))
+            return false;
+        if (pread(pfd, compressed, compressed_length, next_pfd_offset - compressed_length) != compressed_length)
+            return false;
+        return LZ4_decompress_safe(compressed, buffer, compressed_length, 4096) == 4096;
+    }
+    else if (current_flag == Area::STORE_PAGE) {
+        PageStore::Key key;
+        readStoredKey(&key);
+        int64_t slot = PageStore::findSlot(key);
+        if ((slot < 0) || (sfd == -1))
+            return false;
+        return pread(sfd, buffer, 4096, slot * 4096) == 4096;
+    }
+
+    return false;
+}
+
+bool SaveStateLoading::getPageLocation(off_t* offset, int* length)
+{
+    if (current_flag == Area::FULL_PAGE) {
+        *offset = next_pfd_offset - 4096;
+        *length = 0;
+        return true;
+    }
+    else if (current_flag == Area::COMPRESSED_PAGE) {
+        *offset = next_pfd_offset - compressed_length;
+        *length = compressed_length;
+        return true;
+    }
+
+    return false;
+}
+
+bool SaveStateLoading::debugIsMatchingPage(char* addr)
+{
+    char current_page[4096];
+
+    if (!readPage(current_page))
+        return false;
+
+    return Utils::isSamePage(addr, current_page);
+}
+
+bool SaveStateLoading::isSameStoredPage(SaveStateLoading &other)
+{
+    if ((current_flag != Area::STORE_PAGE) || (other.current_flag != Area::STORE_PAGE))
+        return false;
+
+    PageStore::Key key, other_key;
+    readStoredKey(&key);
+    other.readStoredKey(&other_key);
+
+    return (key.low == other_key.low) && (key.high == other_key.high);
+}
+
+void SaveStateLoading::removeStoredPages()
+{
+    if (pmfd == -1)
+        return;
+
+    restart();
+
+    while (area) {
+        size_t nb_pages = (area.skip || area.uncommitted) ? 0 : (area.size + 4095) / 4096;
+        for (size_t p = 0; p < nb_pages; p++) {
+            if (getNextPageFlag() == Area::STORE_PAGE) {
+                PageStore::Key key;
+                readStoredKey(&key);
+                PageStore::removePage(key);
+            }
+        }
+        nextArea();
     }
-    
-    return 0 == memcmp(addr, current_page, 4096);
 }
 
 }
@@ -23,11 +23,12 @@
 #define LIBTAS_SAVESTATELOADING_H
 
 #include "MemArea.h"
-#include "../external/lz4.h"
+#include "WorkerPool.h"
+#include "PageStore.h"
+#include "StateHeader.h"
+#include "IOBatch.h"
 
 namespace libtas {
-    
-struct StateHeader;
 
 class SaveStateLoading
 {
@@ -35,8 +36,13 @@ class SaveStateLoading
         SaveStateLoading(const char* pagemappath, const char* pagespath);
         ~SaveStateLoading();
 
-    // Also resets back to first area
-    void readHeader(StateHeader* sh);
+    /* Read the list of threads */
+    void readHeader(StateThreadList* threads);
+
+    /* Check the checksums of the thread list and of the area index, and also
+     * of all page flags and pages if `full` is set. Returns false if the
+     * savestate is corrupted. */
+    bool verify(bool full);
 
     Area& getArea();
     Area& nextArea();
@@ -51,8 +57,24 @@ class SaveStateLoading
     void queuePageLoad(char* addr);
     void finishLoad();
 
+    /* Read the current page content into the buffer. Returns false if the
+     * page content is not stored inside this savestate. */
+    bool readPage(char* buffer);
+
+    /* Get the location of the current page content inside the pages file,
+     * and its compressed size or zero if not compressed. Returns false if the
+     * page content is not directly inside the pages file. */
+    bool getPageLocation(off_t* offset, int* length);
+
     bool debugIsMatchingPage(char* addr);
 
+    /* Indicate if the current pages of both savestates are the same page of
+     * the page store */
+    bool isSameStoredPage(SaveStateLoading &other);
+
+    /* Remove from the page store all the pages referenced by this savestate */
+    void removeStoredPages();
+
     explicit operator bool() const {
         return (pmfd != -1);
     }
@@ -60,6 +82,47 @@ class SaveStateLoading
     private:
     char nextFlag();
 
+    /* Read an entry of the area index */
+    bool readIndexEntry(int i, StateAreaIndex* entry);
+
+    /* Get the first memory area ending after the address, using the area
+     * index. Returns the number of memory areas if there is none. */
+    int findArea(char* addr);
+
+    /* Move to an area from the area index, or to the last null area */
+    void jumpToArea(int i);
+
+    /* Send the current decompression job to the worker pool */
+    void submitCompressedLoad();
+
+    /* Wait for the oldest decompression job */
+    void retireCompressedLoad();
+
+    /* Read the key of the current stored page */
+    void readStoredKey(PageStore::Key* key);
+
+    /* Read the queued pages from the page store */
+    void flushStoredLoad();
+
+    /* Read the queued noncompressed pages */
+    void flushLoad();
+
+    /* Read from the pages file, through a read-ahead buffer for small reads */
+    bool readPages(off_t offset, void* buffer, size_t size);
+
+    enum {
+        KEY_CHUNK = 256,
+        INDEX_CHUNK = 64,
+        READAHEAD_SIZE = 65536,
+    };
+
+    StateHeader header;
+
+    /* Chunk of the area index, starting from entry `index_first` */
+    StateAreaIndex index_entries[INDEX_CHUNK];
+    int index_first;
+    int index_count;
+
     char flags[4096];
     char current_flag;
     int flag_i;
@@ -72,10 +135,37 @@ class SaveStateLoading
     off_t next_pfd_offset;
 
     int compressed_length;
-    char* queued_addr;
+
+    /* Noncompressed pages that are queued to be loaded, stored
+     * consecutively in the pages file from `queued_offset` */
+    IOBatch queued_pages;
     off_t queued_offset;
-    int queued_size;
-    LZ4_streamDecode_t lz4s;
+
+    /* Content of the pages file starting from `readahead_offset` */
+    char readahead[READAHEAD_SIZE];
+    off_t readahead_offset;
+    size_t readahead_size;
+
+    /* Decompression job currently being filled */
+    WorkerPool::Job* current_job;
+
+    /* Decompression jobs sent to the worker pool, in submission order */
+    WorkerPool::Job* inflight_jobs[WorkerPool::MAX_JOBS_PER_OWNER];
+    int inflight_first;
+    int inflight_count;
+
+    /* Page store file descriptor */
+    int sfd;
+
+    /* Chunk of keys of stored pages, and its offset in the pages file */
+    PageStore::Key stored_keys[KEY_CHUNK];
+    off_t stored_keys_offset;
+    int stored_key_count;
+
+    /* Run of consecutive pages to read from the page store */
+    char* store_queued_addr;
+    int64_t store_queued_slot;
+    int store_queued_count;
 };
 }
 
@@ -25,6 +25,12 @@
 #include "Checkpoint.h"
 #include "AltStack.h"
 #include "ReservedMemory.h"
+#include "WorkerPool.h"
+#include "AsyncSave.h"
+#include "PageStore.h"
+#include "RamStore.h"
+#include "LazyRestore.h"
+#include "CheckpointStats.h"
 #include "ThreadInfo.h"
 #include "clone_wrapper.h"
 
@@ -128,6 +134,15 @@ void SaveStateManager::init()
 
     state_dirty = static_cast<bool*>(ReservedMemory::getAddr(ReservedMemory::SS_SLOTS_ADDR));
     memset(state_dirty, 0, 11*sizeof(bool));
+
+    /* Worker threads must be created before any savestate is made, so that
+     * they are present in all savestates. */
+    WorkerPool::init();
+    AsyncSave::init();
+    PageStore::init();
+    RamStore::init();
+    LazyRestore::init();
+    CheckpointStats::init();
 }
 
 void SaveStateManager::initCheckpointThread()
@@ -166,6 +181,11 @@ void SaveStateManager::initThreadFromChild(ThreadInfo* thread)
 
 int SaveStateManager::waitChild()
 {
+    /* Report savestates written in background */
+    int async_slot = AsyncSave::popCompleted();
+    if (async_slot >= 0)
+        return async_slot;
+
     if (!(Global::shared_config.savestate_settings & SharedConfig::SS_FORK))
         return -1;
 
@@ -210,6 +230,13 @@ int SaveStateManager::checkpoint(int slot)
 {
     GlobalNative gn;
 
+    /* Wait for the previous savestate to be written. It may be our parent
+     * savestate, and the writer thread must not run during a checkpoint. */
+    AsyncSave::wait();
+
+    /* Wait for the pages of the last loaded savestate to be restored */
+    LazyRestore::finish();
+
     if (!stateReady(slot))
         return ESTATE_NOTCOMPLETE;
 
@@ -376,6 +403,12 @@ int SaveStateManager::restore(int slot)
 {
     GlobalNative gn;
 
+    /* Wait for the savestate being written, if any */
+    AsyncSave::wait();
+
+    /* Wait for the pages of the last loaded savestate to be restored */
+    LazyRestore::finish();
+
     if (!stateReady(slot))
         return ESTATE_NOTCOMPLETE;
 
@@ -482,8 +515,8 @@ int SaveStateManager::restore(int slot)
 
 void SaveStateManager::terminateThreads()
 {
-    StateHeader sh;
-    Checkpoint::getStateHeader(&sh);
+    StateThreadList sh;
+    Checkpoint::getStateThreads(&sh);
     
     ThreadManager::lockList();
     
@@ -761,7 +794,7 @@ void SaveStateManager::saveThreadList()
 {
     /* The thread list is saved in the reserved memory segments, meaning that
      * it will be unmodified by state loading */
-    StateHeader* sh = static_cast<StateHeader*>(ReservedMemory::getAddr(ReservedMemory::SH_ADDR));
+    StateThreadList* sh = static_cast<StateThreadList*>(ReservedMemory::getAddr(ReservedMemory::SH_ADDR));
 
     int n=0;
     for (ThreadInfo *thread = ThreadManager::getThreadList(); thread != nullptr; thread = thread->next) {
@@ -782,7 +815,7 @@ void SaveStateManager::createNewThreads()
 {
     /* Recover the thread list from before state loading, to compare with the
      * actual list */
-    StateHeader* sh = static_cast<StateHeader*>(ReservedMemory::getAddr(ReservedMemory::SH_ADDR));
+    StateThreadList* sh = static_cast<StateThreadList*>(ReservedMemory::getAddr(ReservedMemory::SH_ADDR));
     
     long returned_pid = -1;
     long clone_flags = CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM |
@@ -904,6 +937,7 @@ void SaveStateManager::printError(int err)
         "Savestate does not exist",
         "Loading not allowed because new threads were created",
         "State still saving",
+        "Savestate is corrupted",
         0 };
 
     if (err < 0) {
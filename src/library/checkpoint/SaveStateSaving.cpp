@@ -20,11 +20,10 @@
 */
 
 #include "SaveStateSaving.h"
-#include "ReservedMemory.h"
+#include "SaveStateLoading.h"
 
 #include "Utils.h"
 #include "logging.h"
-#include "../external/lz4.h"
 #include "fileio/SaveFile.h"
 #include "fileio/SaveFileList.h"
 
@@ -44,28 +43,104 @@ namespace libtas {
 SaveStateSaving::SaveStateSaving(int pagemapfd, int pagesfd, int selfpagemapfd)
 {
     ss_pagemap_i = 0;
-    queued_size = 0;
 
-    queued_compressed_base_addr = static_cast<char*>(ReservedMemory::getAddr(ReservedMemory::COMPRESSED_ADDR));
-    queued_compressed_max_size = ReservedMemory::COMPRESSED_SIZE;
-    queued_compressed_size = 0;
-    queued_target_addr = nullptr;
+    current_job = nullptr;
+    inflight_first = 0;
+    inflight_count = 0;
 
     pmfd = pagemapfd;
     pfd = pagesfd;
     spmfd = selfpagemapfd;
 
-    LZ4_initStream(&lz4s, sizeof(lz4s));
+    staging_pagemaps = nullptr;
+    staging_pages = nullptr;
+
+    sfd = -1;
+    stored_key_count = 0;
+
+    pagemaps_size = 0;
+    header.init();
+    area_open = false;
+    index.reserve(64 * sizeof(StateAreaIndex));
+
+    settings = Global::shared_config.savestate_settings;
 }
 
-void SaveStateSaving::processArea(Area* area)
+SaveStateSaving::~SaveStateSaving()
 {
-    /* Save the position of the first area page in the pages file */
-    area->page_offset = lseek(pfd, 0, SEEK_CUR);
-    MYASSERT(area->page_offset != -1)
+    index.release();
+}
+
+void SaveStateSaving::setStaging(StagingArena* pagemaps, StagingArena* pages)
+{
+    staging_pagemaps = pagemaps;
+    staging_pages = pages;
+
+    /* Pages will be compressed and stored when writing the files */
+    settings &= ~(SharedConfig::SS_COMPRESSED | SharedConfig::SS_DELTA);
+    sfd = -1;
+}
 
+void SaveStateSaving::setSettings(int savestate_settings)
+{
+    settings = savestate_settings;
+}
+
+void SaveStateSaving::setPageStore(int storefd)
+{
+    sfd = storefd;
+}
+
+void SaveStateSaving::writePagemaps(const void* data, size_t size)
+{
+    if (staging_pagemaps)
+        staging_pagemaps->append(data, size);
+    else
+        Utils::writeAll(pmfd, data, size);
+    pagemaps_size += size;
+}
+
+void SaveStateSaving::writePages(const void* data, size_t size)
+{
+    if (staging_pages) {
+        staging_pages->append(data, size);
+    }
+    else {
+        Utils::writeAll(pfd, data, size);
+        if (area_open)
+            current_index.pages_crc = Utils::crc32c(current_index.pages_crc, data, size);
+    }
+}
+
+void SaveStateSaving::writeFlags(const void* data, size_t size)
+{
+    writePagemaps(data, size);
+    if (area_open && !staging_pagemaps)
+        current_index.flags_crc = Utils::crc32c(current_index.flags_crc, data, size);
+}
+
+void SaveStateSaving::saveHeader(const StateThreadList* threads)
+{
+    header.thread_count = threads->thread_count;
+
+    /* The header is written again with the area index when finishing the
+     * savestate. Until then, the savestate is seen as incomplete. */
+    writePagemaps(&header, sizeof(StateHeader));
+
+    for (int t = 0; t < threads->thread_count; t++) {
+        StateThread thread;
+        thread.pthread_id = static_cast<uint64_t>(threads->pthread_ids[t]);
+        thread.tid = threads->tids[t];
+        thread.state = threads->states[t];
+        header.threads_crc = Utils::crc32c(header.threads_crc, &thread, sizeof(thread));
+        writePagemaps(&thread, sizeof(thread));
+    }
+}
+
+void SaveStateSaving::processArea(Area* area)
+{
     /* Write the area struct */
-    if (Global::shared_config.savestate_settings & SharedConfig::SS_PRESENT)
+    if (settings & SharedConfig::SS_PRESENT)
         area->uncommitted = area->isUncommitted(spmfd);
     else
         area->uncommitted = false;
@@ -80,16 +155,61 @@ void SaveStateSaving::processArea(Area* area)
     //         area->hash = XXH3_64bits(area->addr, area->size);
     // }
 
-    Utils::writeAll(pmfd, area, sizeof(*area));
-    
-    LZ4_resetStream_fast(&lz4s);
+    saveArea(area);
+}
+
+void SaveStateSaving::saveArea(Area* area)
+{
+    closeArea();
+
+    /* Save the position of the first area page in the pages file */
+    if (staging_pages) {
+        area->page_offset = staging_pages->size();
+    }
+    else {
+        area->page_offset = lseek(pfd, 0, SEEK_CUR);
+        MYASSERT(area->page_offset != -1)
+    }
+
+    current_index.addr = reinterpret_cast<uintptr_t>(area->addr);
+    current_index.size = area->size;
+    current_index.area_offset = pagemaps_size;
+    current_index.page_offset = area->page_offset;
+    current_index.page_size = 0;
+    current_index.flags_crc = 0;
+    current_index.pages_crc = 0;
+    area_open = true;
+
+    header.area_count++;
+    if (!(area->flags & Area::AREA_SAVEFILE))
+        header.memory_area_count++;
+
+    writePagemaps(area, sizeof(*area));
+}
+
+void SaveStateSaving::closeArea()
+{
+    if (!area_open)
+        return;
+
+    area_open = false;
+
+    /* Only files get an index */
+    if (staging_pages)
+        return;
+
+    off_t end_offset = lseek(pfd, 0, SEEK_CUR);
+    MYASSERT(end_offset != -1)
+    current_index.page_size = end_offset - current_index.page_offset;
+
+    index.append(&current_index, sizeof(current_index));
 }
 
 void SaveStateSaving::savePageFlag(char flag)
 {
     /* We write a chunk of savestate pagemaps if it is full */
     if (ss_pagemap_i >= PAGEMAP_CHUNK) {
-        Utils::writeAll(pmfd, ss_pagemaps, PAGEMAP_CHUNK);
+        writeFlags(ss_pagemaps, PAGEMAP_CHUNK);
         ss_pagemap_i = 0;
     }
 
@@ -99,84 +219,186 @@ void SaveStateSaving::savePageFlag(char flag)
 size_t SaveStateSaving::queuePageSave(char* addr)
 {
     size_t returned_size = 0;
-    
-    if (Global::shared_config.savestate_settings & SharedConfig::SS_COMPRESSED) {
-        /* Try to compress the memory page */
-        if ((queued_compressed_size > 0) && (addr != queued_target_addr)) {
-            /* Flush current buffer */
-            returned_size = flushCompressedSave();
-        }
-            
-        /* Append the compressed data to the current stream */
-        int compressed_size;
-        if (Global::shared_config.savestate_settings & SharedConfig::SS_INCREMENTAL) {
-            /* For incremental savestates, not all blocks may be decompressed, so
-             * we must compress each block independantly */
-            compressed_size = LZ4_compress_fast(addr, queued_compressed_base_addr + queued_compressed_size + sizeof(int), 4096, queued_compressed_max_size - (queued_compressed_size + sizeof(int)), 1);
-        }
-        else {
-            compressed_size = LZ4_compress_fast_continue(&lz4s, addr, queued_compressed_base_addr + queued_compressed_size + sizeof(int), 4096, queued_compressed_max_size - (queued_compressed_size + sizeof(int)), 1);
-        }
-        if (compressed_size) {
-            /* Flush the uncompressed buffer if any */
-            returned_size = flushSave();
-
-            savePageFlag(Area::COMPRESSED_PAGE);
-            memcpy(queued_compressed_base_addr + queued_compressed_size, &compressed_size, sizeof(int));
-            queued_compressed_size += compressed_size + sizeof(int);
-            queued_target_addr = addr + 4096;
-
-            /* Check for remaining size */
-            if ((queued_compressed_max_size - queued_compressed_size) < LZ4_COMPRESSBOUND(4096)) {
-                returned_size += flushCompressedSave();
-            }
-            return returned_size;
-        }
-        else {
-            /* Could not compress the memory page. Write the whole buffer and 
-             * fallback to the second part of the code to write the regular page */
+
+    if (sfd != -1) {
+        PageStore::Key key;
+        if (PageStore::addPage(sfd, addr, &key)) {
+            /* Keep the order of the pages file */
+            returned_size += flushSave();
             returned_size += flushCompressedSave();
+
+            savePageFlag(Area::STORE_PAGE);
+
+            if (stored_key_count == KEY_CHUNK)
+                returned_size += flushStoredKeys();
+            stored_keys[stored_key_count++] = key;
+
+            return returned_size;
         }
+
+        /* The store is full, save the page normally */
+        returned_size += flushStoredKeys();
+    }
+    
+    if (settings & SharedConfig::SS_COMPRESSED) {
+        /* Pages are compressed independently by the worker pool. Because the
+         * destination buffer is always large enough, compression cannot fail,
+         * so we already know the flag of the page. */
+        savePageFlag(Area::COMPRESSED_PAGE);
+
+        returned_size += acquireCompressedSave();
+
+        current_job->delta[current_job->count] = false;
+        current_job->addrs[current_job->count++] = addr;
+
+        if (current_job->count == WorkerPool::JOB_PAGES)
+            submitCompressedSave();
+
+        return returned_size;
     }
 
+    /* Delta pages are always compressed, keep the order of the pages file */
+    if (current_job || (inflight_count > 0))
+        returned_size += flushCompressedSave();
+
     /* Save regular memory page */
     savePageFlag(Area::FULL_PAGE);
     
-    /* Try to queue the page save, to reduce the number of calls */
-    if (queued_size > 0) {
-        if (addr == (queued_addr + queued_size)) {
-            queued_size += 4096;
-            return 0;
-        } else {
-            returned_size += flushSave();
-        }
+    /* Queue the page save, to write many pages with a single call */
+    if (!queued_pages.add(addr, 4096)) {
+        returned_size += flushSave();
+        queued_pages.add(addr, 4096);
     }
-    queued_addr = addr;
-    queued_size = 4096;
+
+    return returned_size;
+}
+
+size_t SaveStateSaving::queueDeltaSave(char* addr, SaveStateLoading &base_state)
+{
+    if (!(settings & SharedConfig::SS_DELTA) || !base_state)
+        return queuePageSave(addr);
+
+    char base_flag = base_state.getPageFlag(addr);
+    if ((base_flag != Area::FULL_PAGE) && (base_flag != Area::COMPRESSED_PAGE) &&
+        (base_flag != Area::STORE_PAGE))
+        return queuePageSave(addr);
+
+    /* Keep the order of the pages file */
+    size_t returned_size = flushSave();
+    returned_size += flushStoredKeys();
+
+    returned_size += acquireCompressedSave();
+
+    /* The worker computes the difference from a copy of the base page */
+    if (!base_state.readPage(current_job->pages + current_job->count * 4096))
+        return returned_size + queuePageSave(addr);
+
+    savePageFlag(Area::DELTA_PAGE);
+
+    current_job->delta[current_job->count] = true;
+    current_job->addrs[current_job->count++] = addr;
+
+    if (current_job->count == WorkerPool::JOB_PAGES)
+        submitCompressedSave();
 
     return returned_size;
 }
 
 size_t SaveStateSaving::flushSave()
 {
-    if (queued_size > 0) {
-        Utils::writeAll(pfd, queued_addr, queued_size);
-        int returned_size = queued_size;
-        queued_size = 0;
+    if (queued_pages.empty())
+        return 0;
+
+    size_t returned_size = queued_pages.size();
+
+    if (staging_pages) {
+        for (int i = 0; i < queued_pages.segmentCount(); i++)
+            writePages(queued_pages.segment(i).iov_base, queued_pages.segment(i).iov_len);
+        queued_pages.clear();
         return returned_size;
     }
-    return 0;
+
+    if (area_open) {
+        for (int i = 0; i < queued_pages.segmentCount(); i++)
+            current_index.pages_crc = Utils::crc32c(current_index.pages_crc,
+                queued_pages.segment(i).iov_base, queued_pages.segment(i).iov_len);
+    }
+
+    queued_pages.write(pfd);
+    return returned_size;
+}
+
+size_t SaveStateSaving::acquireCompressedSave()
+{
+    if (current_job)
+        return 0;
+
+    /* Make room for a new job by writing the oldest one */
+    size_t returned_size = 0;
+    if (inflight_count == WorkerPool::MAX_JOBS_PER_OWNER)
+        returned_size += retireCompressedSave();
+
+    current_job = WorkerPool::acquire(WorkerPool::JOB_COMPRESS);
+    MYASSERT(current_job != nullptr)
+
+    return returned_size;
+}
+
+void SaveStateSaving::submitCompressedSave()
+{
+    if (!current_job)
+        return;
+
+    WorkerPool::start(current_job);
+
+    int index = (inflight_first + inflight_count) % WorkerPool::MAX_JOBS_PER_OWNER;
+    inflight_jobs[index] = current_job;
+    inflight_count++;
+    current_job = nullptr;
+}
+
+size_t SaveStateSaving::retireCompressedSave()
+{
+    if (inflight_count == 0)
+        return 0;
+
+    WorkerPool::Job* job = inflight_jobs[inflight_first];
+    inflight_first = (inflight_first + 1) % WorkerPool::MAX_JOBS_PER_OWNER;
+    inflight_count--;
+
+    WorkerPool::wait(job);
+
+    if (job->errors)
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Could not compress %d memory pages", job->errors);
+
+    writePages(job->buffer, job->size);
+    size_t returned_size = job->size;
+
+    WorkerPool::release(job);
+    return returned_size;
 }
 
 size_t SaveStateSaving::flushCompressedSave()
 {
-    if (queued_compressed_size > 0) {
-        Utils::writeAll(pfd, queued_compressed_base_addr, queued_compressed_size);
-        int returned_size = queued_compressed_size;
-        queued_compressed_size = 0;
-        return returned_size;        
-    }
-    return 0;
+    size_t returned_size = 0;
+
+    submitCompressedSave();
+    while (inflight_count > 0)
+        returned_size += retireCompressedSave();
+
+    return returned_size;
+}
+
+size_t SaveStateSaving::flushStoredKeys()
+{
+    if (stored_key_count == 0)
+        return 0;
+
+    size_t returned_size = stored_key_count * sizeof(PageStore::Key);
+    writePages(stored_keys, returned_size);
+    stored_key_count = 0;
+
+    return returned_size;
 }
 
 size_t SaveStateSaving::finishSave()
@@ -186,13 +408,50 @@ size_t SaveStateSaving::finishSave()
     /* We don't care about the following order of the saves, because code
      * guarantees that at most one of those has non-zero queue size. */
     returned_size += flushSave();
+
+    /* Wait for all compression jobs, because the next area needs the current
+     * offset inside the pages file. */
     returned_size += flushCompressedSave();
+
+    returned_size += flushStoredKeys();
+
+    /* The area may be unmapped or protected after this call */
+    if (sfd != -1)
+        PageStore::flush(sfd);
     
     /* Writing the last savestate pagemap chunk */
-    Utils::writeAll(pmfd, ss_pagemaps, ss_pagemap_i);
+    writeFlags(ss_pagemaps, ss_pagemap_i);
     ss_pagemap_i = 0;
     
     return returned_size;
 }
 
+void SaveStateSaving::finishState()
+{
+    closeArea();
+
+    Area area;
+    memset(&area, 0, sizeof(area));
+    area.addr = nullptr; // End of data
+    area.size = 0; // End of data
+    writePagemaps(&area, sizeof(area));
+
+    /* Staged savestates get their index when written into files */
+    if (staging_pagemaps)
+        return;
+
+    if (index.failed() || (index.size() != header.area_count * sizeof(StateAreaIndex))) {
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Could not build the savestate area index");
+        return;
+    }
+
+    header.index_offset = pagemaps_size;
+    header.index_crc = Utils::crc32c(0, index.data(), index.size());
+    writePagemaps(index.data(), index.size());
+
+    /* Writing the complete header validates the savestate */
+    ssize_t ret = pwrite(pmfd, &header, sizeof(header), 0);
+    MYASSERT(ret == sizeof(header))
+}
+
 }
@@ -23,39 +23,93 @@
 #define LIBTAS_SAVESTATESAVING_H
 
 #include "MemArea.h"
-#include "../external/lz4.h"
+#include "WorkerPool.h"
+#include "PageStore.h"
+#include "StateHeader.h"
+#include "StagingArena.h"
+#include "IOBatch.h"
 
 namespace libtas {
 
-struct StateHeader;
+class SaveStateLoading;
 
 class SaveStateSaving
 {
 public:
     SaveStateSaving(int pagemapfd, int pagesfd, int selfpagemapfd);
+    ~SaveStateSaving();
+
+    /* Store the savestate into memory arenas instead of files. Pages are stored
+     * uncompressed, so that they can be compressed later by transcoding the
+     * arenas into files. Must be called before saving anything. */
+    void setStaging(StagingArena* pagemaps, StagingArena* pages);
+
+    /* Use different savestate settings than the current ones */
+    void setSettings(int savestate_settings);
+
+    /* Save pages inside the page store, opened with the file descriptor */
+    void setPageStore(int storefd);
+
+    /* Save the savestate header and the thread list */
+    void saveHeader(const StateThreadList* threads);
 
     /* Import an area and fill some missing members */
     void processArea(Area* area);
+
+    /* Save an area struct that was already processed, only updating the
+     * offset inside the pages file */
+    void saveArea(Area* area);
     
     /* Saving the page flag */
     void savePageFlag(char flag);
     
     /* Save the entire memory page and the associated page flag */
     size_t queuePageSave(char* addr);
+
+    /* Save the memory page as a difference with the same page in the base
+     * savestate if possible, or as the entire page otherwise */
+    size_t queueDeltaSave(char* addr, SaveStateLoading &base_state);
     
     /* Finish processing a memory area */
     size_t finishSave();
 
+    /* Add the last null area, indicating the end of the savestate, and the
+     * area index */
+    void finishState();
+
 private:
 
-    /* Flush the queue of noncompressed data, and returns the number of written bytes */
+    void writePagemaps(const void* data, size_t size);
+    void writePages(const void* data, size_t size);
+
+    /* Write a chunk of page flags */
+    void writeFlags(const void* data, size_t size);
+
+    /* Add the entry of the current area into the area index */
+    void closeArea();
+
+    /* Flush the batch of noncompressed pages, and returns the number of written bytes */
     size_t flushSave();
     
-    /* Flush the queue of compressed data, and returns the number of written bytes */
+    /* Get the compression job currently being filled, creating it if needed */
+    size_t acquireCompressedSave();
+
+    /* Send the current compression job to the worker pool */
+    void submitCompressedSave();
+
+    /* Wait for the oldest compression job and write its output. Returns the
+     * number of written bytes */
+    size_t retireCompressedSave();
+
+    /* Wait for all compression jobs and write their output */
     size_t flushCompressedSave();
 
+    /* Write the keys of stored pages */
+    size_t flushStoredKeys();
+
     enum {
-        PAGEMAP_CHUNK = 4096
+        PAGEMAP_CHUNK = 4096,
+        KEY_CHUNK = 256,
     };
 
     /* Chunk of savestate pagemap values */
@@ -64,23 +118,43 @@ private:
     /* Current index in the savestate pagemap array */
     int ss_pagemap_i = 0;
 
-    LZ4_stream_t lz4s;
+    /* Size of the pagemap data written so far */
+    uint64_t pagemaps_size;
+
+    /* Savestate header, completed when finishing the savestate */
+    StateHeader header;
+
+    /* Area index, and its entry for the area being saved */
+    StagingArena index;
+    StateAreaIndex current_index;
+    bool area_open;
 
     /* File descriptors */
     int pmfd, pfd, spmfd;
 
-    /* Address and size of the memory segment that is queued to be saved */
-    char* queued_addr;
-    size_t queued_size;
+    /* Memory arenas, when staging the savestate into memory */
+    StagingArena* staging_pagemaps;
+    StagingArena* staging_pages;
+
+    int settings;
+
+    /* Noncompressed pages that are queued to be saved */
+    IOBatch queued_pages;
+
+    /* Compression job currently being filled */
+    WorkerPool::Job* current_job;
+
+    /* Compression jobs sent to the worker pool, in submission order */
+    WorkerPool::Job* inflight_jobs[WorkerPool::MAX_JOBS_PER_OWNER];
+    int inflight_first;
+    int inflight_count;
 
-    /* Address and size of the whole memory section available to store
-     * compressed pages. */
-    char* queued_compressed_base_addr;
-    int queued_compressed_max_size;
+    /* Page store file descriptor, or -1 if not used */
+    int sfd;
 
-    /* Target address and size of the compressed memory segments that are queued to be saved */
-    char* queued_target_addr;
-    int queued_compressed_size;
+    /* Keys of stored pages that are not written yet */
+    PageStore::Key stored_keys[KEY_CHUNK];
+    int stored_key_count;
 };
 }
 
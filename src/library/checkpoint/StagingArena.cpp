@@ -0,0 +1,84 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "StagingArena.h"
+
+#include "logging.h"
+
+#include <sys/mman.h>
+#include <string.h>
+
+namespace libtas {
+
+bool StagingArena::reserve(size_t size)
+{
+    size = ((size + 4095) / 4096) * 4096;
+
+    /* Pages are only committed when written */
+    void* a = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (a == MAP_FAILED) {
+        LOG(LL_ERROR, LCF_CHECKPOINT, "Could not map staging memory of size %zu", size);
+        error = true;
+        return false;
+    }
+
+    addr = static_cast<char*>(a);
+    used = 0;
+    capacity = size;
+    error = false;
+    return true;
+}
+
+bool StagingArena::append(const void* data, size_t size)
+{
+    if (error)
+        return false;
+
+    if (used + size > capacity) {
+        size_t new_capacity = 2 * capacity;
+        if (new_capacity < used + size)
+            new_capacity = ((used + size + 4095) / 4096) * 4096;
+
+        /* Growing the mapping only moves page table entries */
+        void* a = mremap(addr, capacity, new_capacity, MREMAP_MAYMOVE);
+        if (a == MAP_FAILED) {
+            LOG(LL_ERROR, LCF_CHECKPOINT, "Could not grow staging memory to size %zu", new_capacity);
+            error = true;
+            return false;
+        }
+        addr = static_cast<char*>(a);
+        capacity = new_capacity;
+    }
+
+    memcpy(addr + used, data, size);
+    used += size;
+    return true;
+}
+
+void StagingArena::release()
+{
+    if (addr)
+        munmap(addr, capacity);
+    addr = nullptr;
+    used = 0;
+    capacity = 0;
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_STAGINGARENA_H
+#define LIBTAS_STAGINGARENA_H
+
+#include <cstddef>
+
+namespace libtas {
+
+/* Growable memory buffer used to store a savestate in memory before it is
+ * written to disk. Memory is mapped directly with mmap, so that no memory
+ * allocation is performed during a checkpoint. The arena must be created after
+ * the memory layout was read, so that it is not part of the savestate itself.
+ *
+ * The arena does not unmap its memory on destruction, because its ownership
+ * can be passed to another thread. Call release() instead. */
+class StagingArena
+{
+public:
+    /* Map the initial memory. Returns false on failure */
+    bool reserve(size_t size);
+
+    /* Append data to the arena, growing it if needed. Returns false on failure */
+    bool append(const void* data, size_t size);
+
+    /* Unmap the memory */
+    void release();
+
+    char* data() const {return addr;}
+    size_t size() const {return used;}
+
+    /* Indicate if any previous operation failed */
+    bool failed() const {return error;}
+
+private:
+    char* addr = nullptr;
+    size_t used = 0;
+    size_t capacity = 0;
+    bool error = false;
+};
+}
+
+#endif
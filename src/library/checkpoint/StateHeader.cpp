@@ -0,0 +1,49 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "StateHeader.h"
+
+#include <string.h>
+
+namespace libtas {
+
+static const char state_magic[4] = {'L', 'T', 'S', 'S'};
+
+void StateHeader::init()
+{
+    memset(this, 0, sizeof(StateHeader));
+    memcpy(magic, state_magic, sizeof(magic));
+    version = VERSION;
+    header_size = sizeof(StateHeader);
+}
+
+bool StateHeader::isValid() const
+{
+    return (memcmp(magic, state_magic, sizeof(magic)) == 0) &&
+        (version == VERSION) &&
+        (header_size == sizeof(StateHeader)) &&
+        (thread_count <= STATEMAXTHREADS);
+}
+
+uint64_t StateHeader::areasOffset() const
+{
+    return sizeof(StateHeader) + static_cast<uint64_t>(thread_count) * sizeof(StateThread);
+}
+
+}
@@ -23,11 +23,84 @@
 #define LIBTAS_STATEHEADER_H
 
 #include <pthread.h>
+#include <cstdint>
 
 #define STATEMAXTHREADS 1000
 
 namespace libtas {
+
+/* Layout of the savestate pagemap file:
+ * - StateHeader
+ * - one StateThread for each thread
+ * - for each area: the Area struct, followed by one flag per page
+ * - a null Area struct, indicating the end of areas
+ * - one StateAreaIndex for each area
+ *
+ * Memory areas come first, sorted by address, then savefile areas. Page
+ * contents of each area are stored contiguously inside the pages file. */
 struct StateHeader {
+    enum {
+        VERSION = 1,
+    };
+
+    /* Always "LTSS" */
+    char magic[4];
+
+    /* Version of the savestate layout */
+    uint32_t version;
+
+    /* Size of this struct, to detect incompatible builds */
+    uint32_t header_size;
+
+    uint32_t thread_count;
+
+    /* Number of areas, and number of memory areas which are sorted */
+    uint32_t area_count;
+    uint32_t memory_area_count;
+
+    /* Offset of the area index inside the pagemap file, or zero if the
+     * savestate was not completed */
+    uint64_t index_offset;
+
+    /* CRC32C of the thread list and of the area index */
+    uint32_t threads_crc;
+    uint32_t index_crc;
+
+    /* Fill the identification fields */
+    void init();
+
+    /* Check the identification fields */
+    bool isValid() const;
+
+    /* Offset of the first area inside the pagemap file */
+    uint64_t areasOffset() const;
+};
+
+struct StateThread {
+    uint64_t pthread_id;
+    int32_t tid;
+    int32_t state;
+};
+
+/* Entry of the area index */
+struct StateAreaIndex {
+    uint64_t addr;
+    uint64_t size;
+
+    /* Offset of the Area struct inside the pagemap file */
+    uint64_t area_offset;
+
+    /* Position and size of the area content inside the pages file */
+    uint64_t page_offset;
+    uint64_t page_size;
+
+    /* CRC32C of the page flags and of the area content */
+    uint32_t flags_crc;
+    uint32_t pages_crc;
+};
+
+/* List of threads of a savestate */
+struct StateThreadList {
     int thread_count;
     pthread_t pthread_ids[STATEMAXTHREADS];
     pid_t tids[STATEMAXTHREADS];
@@ -0,0 +1,251 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WorkerPool.h"
+#include "ReservedMemory.h"
+
+#include "Utils.h"
+#include "logging.h"
+#include "GlobalState.h"
+#include "../external/lz4.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace libtas {
+
+static WorkerPool::Control* control = nullptr;
+static WorkerPool::Job* jobs = nullptr;
+
+static void runJob(WorkerPool::Job* job)
+{
+    job->errors = 0;
+
+    if (job->type == WorkerPool::JOB_COMPRESS) {
+        /* Each page is compressed independently, so that any page can be
+         * decompressed later without decompressing the previous ones. */
+        job->size = 0;
+        for (int i = 0; i < job->count; i++) {
+            const char* source = job->addrs[i];
+            if (job->delta[i]) {
+                /* Unmodified bytes become zeros, which compress very well */
+                char* reference = job->pages + i * 4096;
+                Utils::xorPage(reference, source);
+                source = reference;
+            }
+
+            int compressed_size = LZ4_compress_fast(source,
+                job->buffer + job->size + sizeof(int), 4096,
+                WorkerPool::JOB_BUFFER_SIZE - (job->size + sizeof(int)), 1);
+            if (compressed_size <= 0)
+                job->errors++;
+            memcpy(job->buffer + job->size, &compressed_size, sizeof(int));
+            job->size += sizeof(int) + compressed_size;
+        }
+    }
+    else {
+        int offset = 0;
+        for (int i = 0; i < job->count; i++) {
+            int compressed_size;
+            memcpy(&compressed_size, job->buffer + offset, sizeof(int));
+            offset += sizeof(int);
+            if (job->delta[i]) {
+                char difference[4096];
+                if (LZ4_decompress_safe(job->buffer + offset, difference, compressed_size, 4096) != 4096)
+                    job->errors++;
+                else
+                    Utils::xorPage(job->addrs[i], difference);
+            }
+            else if (LZ4_decompress_safe(job->buffer + offset, job->addrs[i], compressed_size, 4096) != 4096)
+                job->errors++;
+            offset += compressed_size;
+        }
+    }
+}
+
+/* Pick the oldest queued job. Returns nullptr if another worker was faster */
+static WorkerPool::Job* pickJob()
+{
+    WorkerPool::Job* oldest = nullptr;
+    for (int j = 0; j < WorkerPool::JOB_COUNT; j++) {
+        if ((jobs[j].state.load() == WorkerPool::JOB_QUEUED) &&
+            (!oldest || (jobs[j].seq < oldest->seq)))
+            oldest = &jobs[j];
+    }
+
+    if (!oldest)
+        return nullptr;
+
+    int expected = WorkerPool::JOB_QUEUED;
+    if (!oldest->state.compare_exchange_strong(expected, WorkerPool::JOB_RUNNING))
+        return nullptr;
+
+    return oldest;
+}
+
+static void* workerLoop(void*)
+{
+    /* Workers only ever touch the reserved memory and the pages of a job, and
+     * must never call anything that relies on the game memory, because it may
+     * be overwritten at any time by a savestate loading. */
+    while (true) {
+        if (sem_wait(&control->pending) != 0)
+            continue;
+
+        /* Each post of the semaphore matches exactly one queued job, so we
+         * are guaranteed to find a job eventually. Another worker may be
+         * holding it for a short time, so give it a chance to run. Use the
+         * raw syscall, because our sched_yield() hook touches game memory. */
+        WorkerPool::Job* job;
+        while (!(job = pickJob())) {
+            syscall(SYS_sched_yield);
+        }
+
+        runJob(job);
+
+        job->state.store(WorkerPool::JOB_DONE);
+        sem_post(&job->done);
+    }
+
+    return nullptr;
+}
+
+void WorkerPool::init()
+{
+    if (control)
+        return;
+
+    control = static_cast<Control*>(ReservedMemory::getAddr(ReservedMemory::WORKER_CONTROL_ADDR));
+    jobs = static_cast<Job*>(ReservedMemory::getAddr(ReservedMemory::WORKER_JOBS_ADDR));
+
+    sem_init(&control->pending, 0, 0);
+    control->seq = 0;
+    control->worker_count = 0;
+    control->disabled = false;
+
+    for (int j = 0; j < JOB_COUNT; j++) {
+        jobs[j].state.store(JOB_FREE);
+        sem_init(&jobs[j].done, 0, 0);
+    }
+
+    /* Keep one core for the thread performing the checkpoint */
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = (cpu_count > 1) ? (cpu_count - 1) : 0;
+    if (count > MAX_WORKERS)
+        count = MAX_WORKERS;
+
+    char* stacks = static_cast<char*>(ReservedMemory::getAddr(ReservedMemory::WORKER_STACKS_ADDR));
+    for (int w = 0; w < count; w++) {
+        if (!createThread(workerLoop, nullptr, stacks + w * STACK_SIZE, STACK_SIZE))
+            break;
+        control->worker_count++;
+    }
+
+    LOG(LL_DEBUG, LCF_CHECKPOINT, "Created %d savestate worker threads", control->worker_count);
+}
+
+bool WorkerPool::createThread(void *(*routine)(void *), void* arg, void* stack, size_t stack_size)
+{
+    /* Threads must never handle signals, especially the ones used to suspend
+     * threads and to checkpoint. The signal mask is inherited from the
+     * creating thread. */
+    sigset_t mask, old_mask;
+    sigfillset(&mask);
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &mask, &old_mask));
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, stack_size);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t pthread_id;
+    int ret;
+    NATIVECALL(ret = pthread_create(&pthread_id, &attr, routine, arg));
+    pthread_attr_destroy(&attr);
+
+    NATIVECALL(pthread_sigmask(SIG_SETMASK, &old_mask, nullptr));
+
+    if (ret != 0) {
+        LOG(LL_WARN, LCF_CHECKPOINT, "Could not create savestate helper thread: %s", strerror(ret));
+        return false;
+    }
+    return true;
+}
+
+int WorkerPool::workerCount()
+{
+    if (!control || control->disabled)
+        return 0;
+    return control->worker_count;
+}
+
+void WorkerPool::disable()
+{
+    if (control)
+        control->disabled = true;
+}
+
+WorkerPool::Job* WorkerPool::acquire(JobType type)
+{
+    for (int j = 0; j < JOB_COUNT; j++) {
+        int expected = JOB_FREE;
+        if (jobs[j].state.compare_exchange_strong(expected, JOB_OWNED)) {
+            jobs[j].type = type;
+            jobs[j].count = 0;
+            jobs[j].size = 0;
+            jobs[j].errors = 0;
+            return &jobs[j];
+        }
+    }
+    return nullptr;
+}
+
+void WorkerPool::start(Job* job)
+{
+    if (workerCount() == 0) {
+        runJob(job);
+        job->state.store(JOB_DONE);
+        return;
+    }
+
+    job->seq = control->seq++;
+    job->state.store(JOB_QUEUED);
+    sem_post(&control->pending);
+}
+
+void WorkerPool::wait(Job* job)
+{
+    while (job->state.load() != JOB_DONE) {
+        sem_wait(&job->done);
+    }
+
+    /* Consume any remaining post, so that the semaphore starts at zero for
+     * the next use of this job. */
+    while (sem_trywait(&job->done) == 0) {}
+}
+
+void WorkerPool::release(Job* job)
+{
+    job->state.store(JOB_FREE);
+}
+
+}
@@ -0,0 +1,164 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_WORKERPOOL_H
+#define LIBTAS_WORKERPOOL_H
+
+#include "../external/lz4.h"
+
+#include <semaphore.h>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace libtas {
+
+/* Pool of threads used to compress and decompress memory pages while saving
+ * and loading a savestate.
+ *
+ * Worker threads are created once at startup, before any savestate is made,
+ * and are parked on a semaphore between jobs. Their stacks, the job array and
+ * the synchronization objects all live inside the reserved memory, which is
+ * never saved nor restored. This way, loading a savestate never overwrites
+ * the memory that a worker is currently using. Workers are created as native
+ * threads, so they are not registered in the thread list, and are not
+ * suspended during a checkpoint.
+ *
+ * A job is a batch of consecutive pages. Jobs are submitted and retired in
+ * order by their owner (SaveStateSaving or SaveStateLoading), which keeps the
+ * output file layout deterministic. */
+namespace WorkerPool
+{
+    enum {
+        /* Maximum number of worker threads */
+        MAX_WORKERS = 8,
+
+        /* Number of jobs that can be in flight at the same time */
+        JOB_COUNT = 2 * MAX_WORKERS,
+
+        /* Maximum number of jobs owned by a single saving/loading object, so
+         * that the base and saved states can never starve each other */
+        MAX_JOBS_PER_OWNER = JOB_COUNT / 2,
+
+        /* Number of memory pages inside a single job */
+        JOB_PAGES = 64,
+
+        /* Size of the buffer holding compressed pages of a job. Each page is
+         * stored as the compressed size followed by the compressed data. */
+        JOB_BUFFER_SIZE = JOB_PAGES * (LZ4_COMPRESSBOUND(4096) + sizeof(int)),
+
+        /* Size of the stack of each worker thread */
+        STACK_SIZE = 1024 * 1024,
+    };
+
+    enum JobType {
+        /* Compress `count` pages from `addrs` into `buffer`. Pages marked in
+         * `delta` are compressed as the xor of `addrs` with `pages`. */
+        JOB_COMPRESS,
+
+        /* Decompress `count` pages from `buffer` into `addrs`. Pages marked in
+         * `delta` are applied with a xor onto the content of `addrs`. */
+        JOB_DECOMPRESS,
+    };
+
+    enum JobState {
+        JOB_FREE,
+        JOB_OWNED,
+        JOB_QUEUED,
+        JOB_RUNNING,
+        JOB_DONE,
+    };
+
+    struct Job {
+        std::atomic<int> state;
+
+        /* Submission order, workers always pick the oldest queued job */
+        uint64_t seq;
+
+        int type;
+
+        /* Number of pages in the job */
+        int count;
+
+        /* Address of each memory page */
+        char* addrs[JOB_PAGES];
+
+        /* Page is stored as a difference with another page */
+        bool delta[JOB_PAGES];
+
+        /* Used size of the buffer */
+        int size;
+
+        /* Number of pages that failed to be processed */
+        int errors;
+
+        /* Posted when the job is done */
+        sem_t done;
+
+        char buffer[JOB_BUFFER_SIZE];
+
+        /* Reference pages of delta pages when compressing */
+        char pages[JOB_PAGES * 4096];
+    };
+
+    /* Shared state of the pool */
+    struct Control {
+        /* Number of queued jobs that were not picked by a worker yet */
+        sem_t pending;
+
+        /* Submission counter */
+        uint64_t seq;
+
+        /* Number of running workers */
+        int worker_count;
+
+        /* All jobs are processed inline */
+        bool disabled;
+    };
+
+    /* Spawn the worker threads. Must be called before any savestate is made */
+    void init();
+
+    /* Spawn a native thread running on the given stack, with all signals
+     * blocked. The stack must be located in reserved memory. This is also used
+     * for other savestate helper threads. */
+    bool createThread(void *(*routine)(void *), void* arg, void* stack, size_t stack_size);
+
+    /* Number of running workers. Zero means that jobs are processed inline */
+    int workerCount();
+
+    /* Process all further jobs inline. This is used by the forked process
+     * when saving a state, because worker threads are not duplicated. */
+    void disable();
+
+    /* Get a free job, or nullptr if all jobs are in use */
+    Job* acquire(JobType type);
+
+    /* Push the job to the workers */
+    void start(Job* job);
+
+    /* Wait for the job to be processed */
+    void wait(Job* job);
+
+    /* Give back the job to the pool */
+    void release(Job* job);
+}
+}
+
+#endif
@@ -35,6 +35,7 @@
 #include "WindowTitle.h"
 #include "BusyLoopDetection.h"
 #include "FPSMonitor.h"
+#include "WatchFeed.h"
 #include "hook.h"
 #include "PerfTimer.h"
 #include "audio/AudioContext.h"
@@ -231,6 +232,9 @@ void frameBoundary(std::function<void()> draw, RenderHUD& hud)
      * boundary.
      */
 
+    /* Copy ram watch values for the program */
+    WatchFeed::update(framecount);
+
     /* Other threads may send socket messages, so we lock the socket */
     lockSocket();
 
@@ -697,6 +701,8 @@ static void receive_messages(std::function<void()> draw, RenderHUD& hud)
                 break;
 
             case MSGN_EXPOSE:
+                /* Memory may have been modified or restored while paused */
+                WatchFeed::update(framecount);
                 screen_redraw(draw, hud, preview_ai, false);
                 break;
 
@@ -776,8 +782,9 @@ static void receive_messages(std::function<void()> draw, RenderHUD& hud)
                     /* Tell the program that the saving succeeded */
                     sendMessage(MSGB_SAVING_SUCCEEDED);
 
-                    /* Print the successful message, unless we are saving in a fork */
-                    if (!(Global::shared_config.savestate_settings & SharedConfig::SS_FORK)) {
+                    /* Print the successful message, unless we are saving in a
+                     * fork or in background */
+                    if (!(Global::shared_config.savestate_settings & (SharedConfig::SS_FORK | SharedConfig::SS_ASYNC))) {
                         std::string msg;
                         msg = "State ";
                         msg += std::to_string(slot);
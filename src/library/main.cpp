@@ -25,6 +25,7 @@
 #include "frame.h" // framecount
 #include "GlobalState.h"
 #include "UnityHacks.h"
+#include "WatchFeed.h"
 #include "audio/AudioContext.h"
 #include "encoding/AVEncoder.h"
 #include "steam/isteamuser/isteamuser.h" // SteamSetUserDataFolder
@@ -35,6 +36,8 @@
 #include "checkpoint/ThreadManager.h"
 #include "checkpoint/SaveStateManager.h"
 #include "checkpoint/Checkpoint.h"
+#include "checkpoint/AsyncSave.h"
+#include "checkpoint/PageStore.h"
 #include "sdl/sdldynapi.h"
 #include "../shared/sockethelpers.h"
 #include "../shared/messages.h"
@@ -103,6 +106,13 @@ void __attribute__((constructor)) init(void)
     int addr_size = sizeof(void*);
     sendData(&addr_size, sizeof(int));
 
+    /* Send the memory shared for ram watches */
+    int feed_fd = WatchFeed::init();
+    if (feed_fd >= 0) {
+        sendMessage(MSGB_RAMWATCH_FEED);
+        sendData(&feed_fd, sizeof(int));
+    }
+
     /* Send interim commit hash if one */
 #ifdef LIBTAS_INTERIM_COMMIT
     std::string commit_hash = LIBTAS_INTERIM_COMMIT;
@@ -145,6 +155,11 @@ void __attribute__((constructor)) init(void)
                 Checkpoint::setBaseSavestatePath(basesavestatepath);
                 break;                
             }
+            case MSGN_PAGESTORE_PATH: {
+                std::string pagestorepath = receiveString();
+                PageStore::setPath(pagestorepath);
+                break;
+            }
             case MSGN_BASE_SAVESTATE_INDEX: {
                 int index;
                 receiveData(&index, sizeof(int));
@@ -191,6 +206,9 @@ void __attribute__((constructor)) init(void)
         message = receiveMessage();
     }
 
+    /* The program has mapped the ram watch memory by now */
+    WatchFeed::closeFile();
+
     if (Global::shared_config.sigint_upon_launch) {
         raise(SIGINT);
     }
@@ -214,6 +232,9 @@ void __attribute__((destructor)) term(void)
 {
     if (Global::is_inited) {
         if (!Global::is_fork) {
+            /* Finish writing any savestate */
+            AsyncSave::wait();
+
             sendMessage(MSGB_QUIT);
             closeSocket();
         }
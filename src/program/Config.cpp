@@ -108,6 +108,7 @@ void Config::save(const std::string& gamepath) {
     settings.setValue("autosave_delay_sec", autosave_delay_sec);
     settings.setValue("autosave_frames", autosave_frames);
     settings.setValue("autosave_count", autosave_count);
+    settings.setValue("movie_binary_inputs", movie_binary_inputs);
     settings.setValue("auto_restart", auto_restart);
     settings.setValue("mouse_warp", mouse_warp);
     settings.setValue("use_proton", use_proton);
@@ -193,6 +194,7 @@ void Config::save(const std::string& gamepath) {
     settings.endArray();
 
     settings.setValue("savestate_settings", sc.savestate_settings);
+    settings.setValue("savestate_ram_budget", sc.savestate_ram_budget);
 
     settings.endGroup();
 }
@@ -310,6 +312,7 @@ void Config::load(const std::string& gamepath) {
     autosave_delay_sec = settings.value("autosave_delay_sec", autosave_delay_sec).toDouble();
     autosave_frames = settings.value("autosave_frames", autosave_frames).toInt();
     autosave_count = settings.value("autosave_count", autosave_count).toInt();
+    movie_binary_inputs = settings.value("movie_binary_inputs", movie_binary_inputs).toBool();
     auto_restart = settings.value("auto_restart", auto_restart).toBool();
     mouse_warp = settings.value("mouse_warp", mouse_warp).toBool();
     use_proton = settings.value("use_proton", use_proton).toBool();
@@ -389,6 +392,7 @@ void Config::load(const std::string& gamepath) {
     sc.audio_codec = settings.value("audio_codec", sc.audio_codec).toInt();
     sc.audio_bitrate = settings.value("audio_bitrate", sc.audio_bitrate).toInt();
     sc.savestate_settings = settings.value("savestate_settings", sc.savestate_settings).toInt();
+    sc.savestate_ram_budget = settings.value("savestate_ram_budget", sc.savestate_ram_budget).toInt();
     sc.opengl_soft = settings.value("opengl_soft", sc.opengl_soft).toBool();
     sc.opengl_performance = settings.value("opengl_performance", sc.opengl_performance).toBool();
 
@@ -119,6 +119,9 @@ public:
     /* Maximum number of autosaves for one movie */
     int autosave_count = 20;
 
+    /* Store movie inputs in the binary input track instead of the text format */
+    bool movie_binary_inputs = false;
+
     /* List of recent existing gamepaths */
     std::list<std::string> recent_gamepaths;
 
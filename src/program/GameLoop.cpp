@@ -41,6 +41,8 @@
 #include "lua/NamedLuaFunction.h"
 #include "ramsearch/MemAccess.h"
 #include "ramsearch/BaseAddresses.h"
+#include "ramsearch/WatchFeed.h"
+#include "ramsearch/MemTimelineRecorder.h"
 #include "ui/InputEditorView.h"
 
 #include "../shared/sockethelpers.h"
@@ -180,6 +182,7 @@ void GameLoop::init()
     /* Unvalidate the game pid */
     context->game_pid = 0;
     MemAccess::fini();
+    WatchFeed::fini();
     
     /* Unvalidate the game window id */
     context->game_window = 0;
@@ -319,6 +322,14 @@ void GameLoop::initProcessMessages()
                 break;
             }
 
+            /* Map the memory shared by the game for ram watches */
+            case MSGB_RAMWATCH_FEED: {
+                int feed_fd;
+                receiveData(&feed_fd, sizeof(int));
+                WatchFeed::init(context->game_pid, feed_fd);
+                break;
+            }
+
             case MSGB_GIT_COMMIT:
                 {
                     std::string lib_commit = receiveString();
@@ -386,6 +397,14 @@ void GameLoop::initProcessMessages()
         sendString(basesavestatepath);
     }
 
+    /* Send the page store path. The page store may be used by existing
+     * savestates even when disabled afterwards, so it is always sent. */
+    std::string pagestorepath = context->config.savestatedir + '/';
+    pagestorepath += context->gamename;
+    pagestorepath += ".pages";
+    sendMessage(MSGN_PAGESTORE_PATH);
+    sendString(pagestorepath);
+
     /* Send the Steam user data path and remote storage */
     if (context->config.sc.virtual_steam) {
         sendMessage(MSGN_STEAM_USER_DATA_PATH);
@@ -577,6 +596,9 @@ bool GameLoop::startFrameMessages()
         message = receiveMessage();
     }
 
+    /* Record memory changes of the frame */
+    MemTimelineRecorder::recordFrame(context->framecount);
+
     Lua::Callbacks::call(Lua::NamedLuaFunction::CallbackFrame);
 
     /* Store in movie and indicate the input editor if the current frame
@@ -844,6 +866,9 @@ void GameLoop::endFrameMessages(AllInputs &ai)
         context->config.sc_modified = true;
     }
 
+    /* All messages until the end of the frame boundary are sent at once */
+    bufferMessages();
+
     /* Send shared config if modified */
     if (context->config.sc_modified) {
         /* Send config */
@@ -868,10 +893,15 @@ void GameLoop::endFrameMessages(AllInputs &ai)
     }
 
     sendMessage(MSGN_END_FRAMEBOUNDARY);
+    sendBufferedMessages();
 }
 
 void GameLoop::loopExit()
 {
+    /* Write the memory timeline if still recording */
+    if (MemTimelineRecorder::isRecording())
+        MemTimelineRecorder::stop();
+
     /* Unvalidate the game pid */
     context->game_pid = 0;
 
@@ -942,6 +972,7 @@ void GameLoop::loopExit()
 
     /* Unvalidate game pid */
     MemAccess::init(0, 0);
+    WatchFeed::fini();
 
     /* Reset the frame count */
     context->framecount = 0;
@@ -20,6 +20,7 @@
 #include "Context.h"
 #include "SaveState.h"
 #include "utils.h"
+#include "ramsearch/MemTimelineRecorder.h"
 #include "../shared/sockethelpers.h"
 #include "../shared/SharedConfig.h"
 #include "../shared/messages.h"
@@ -117,9 +118,11 @@ int SaveState::load(Context* context, const MovieFile& m, bool branch, bool inpu
 {
     /* Check that the savestate exists (check for both savestate files and 
      * framecount, because there can be leftover savestate files from
-     * forked savestate of previous execution). */
-    if ((access(pagemap_path.c_str(), F_OK) != 0) || (access(pages_path.c_str(), F_OK) != 0) ||
-        (framecount == 0)) {
+     * forked savestate of previous execution). Savestates kept in memory by
+     * the game have no file. */
+    bool state_files = (context->config.sc.savestate_settings & SharedConfig::SS_RAM) ||
+        ((access(pagemap_path.c_str(), F_OK) == 0) && (access(pages_path.c_str(), F_OK) == 0));
+    if (!state_files || (framecount == 0)) {
         /* If there is no savestate but a movie file, offer to load
          * the movie and fast-forward to the savestate movie frame.
          */
@@ -180,8 +183,13 @@ int SaveState::load(Context* context, const MovieFile& m, bool branch, bool inpu
         }
         if (!isPrefix) {
             /* Not a prefix, we don't allow loading */
+            std::string msg = "Savestate inputs mismatch";
+            if (movie) {
+                uint64_t first_diff = m.inputs->firstDifference(movie->inputs, 0, framecount);
+                msg += " at frame " + std::to_string(first_diff);
+            }
             sendMessage(MSGN_OSD_MSG);
-            sendString(std::string("Savestate inputs mismatch"));
+            sendString(msg);
             return EINPUTMISMATCH;
         }
     }
@@ -221,6 +229,9 @@ int SaveState::postLoad(Context* context, MovieFile& m, bool branch, bool inputE
             m.copyFrom(*movie);
         }
 
+        /* Memory was restored without going through a frame */
+        MemTimelineRecorder::resync();
+
         /* If the movie was modified since last state load, increment
          * the rerecord count. */
         if (m.inputs->modifiedSinceLastStateLoad) {
@@ -118,10 +118,10 @@ __attribute__((target("avx2"))) uint8_t* SigSearch::FindAVX2(uint8_t* data, size
         // A little faster without wildcards
 
         // Scan 32 bytes at the time..
-        for (i = 0; i < (size-32); i += 32) {
+        for (i = 0; (i+32) < size; i += 32) {
             // Load in the next 32 bytes of input first and last
-            // Can use align 32 bit read for first since the input is page aligned
-            const __m256i block_first = _mm256_load_si256((const __m256i*) (data + i));
+            // Input is not aligned when searching again after a match
+            const __m256i block_first = _mm256_loadu_si256((const __m256i*) (data + i));
             const __m256i block_last = _mm256_loadu_si256((const __m256i*) (data + i + patLen1));
 
             // Compare first and last data to get 32byte masks
@@ -146,8 +146,8 @@ __attribute__((target("avx2"))) uint8_t* SigSearch::FindAVX2(uint8_t* data, size
         const uint8_t *msk = sig.mask.data();
 
         // We must be able to load a full m256i value, so skip the last bytes
-        for (i = 0; i < (size-32); i += 32) {
-            const __m256i block_first = _mm256_load_si256((const __m256i*) (data + i));
+        for (i = 0; (i+32) < size; i += 32) {
+            const __m256i block_first = _mm256_loadu_si256((const __m256i*) (data + i));
             const __m256i block_last = _mm256_loadu_si256((const __m256i*) (data + i + patLen1));
 
             const __m256i eq_first = _mm256_cmpeq_epi8(first, block_first);
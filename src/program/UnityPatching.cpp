@@ -798,9 +798,9 @@ void UnityPatching::sendAddressesFromSignatures(std::pair<uintptr_t,uintptr_t> e
         std::cerr << "Could not map a segment of size " << executable_size << " to host the executable memory" << std::endl;
     }
     else {
-        int ret = MemAccess::read(executable_local_addr, reinterpret_cast<void*>(executablefile_segment.first), executable_size);
+        size_t ret = MemAccess::readFile(executable_local_addr, reinterpret_cast<void*>(executablefile_segment.first), executable_size);
         
-        if (ret == -1)
+        if (ret != static_cast<size_t>(executable_size))
             std::cerr << "Could not read the executable segment memory" << std::endl;
         
         const usig_t* signatures = is_64bit ? UNITY_SIGNATURES_64 : UNITY_SIGNATURES_32;
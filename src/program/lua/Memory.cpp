@@ -21,8 +21,11 @@
 
 #include "ramsearch/MemAccess.h"
 #include "ramsearch/BaseAddresses.h"
+#include "ramsearch/MemTimeline.h"
+#include "ramsearch/MemTimelineRecorder.h"
 
 #include <iostream>
+#include <vector>
 extern "C" {
 #include <lua.h>
 #include <lauxlib.h>
@@ -49,6 +52,9 @@ static const luaL_Reg memory_functions[] =
     { "writef", Lua::Memory::writef},
     { "writed", Lua::Memory::writed},
     { "baseAddress", Lua::Memory::baseAddress},
+    { "timelineStart", Lua::Memory::timelineStart},
+    { "timelineStop", Lua::Memory::timelineStop},
+    { "timelineQuery", Lua::Memory::timelineQuery},
     { NULL, NULL }
 };
 
@@ -162,3 +168,49 @@ int Lua::Memory::baseAddress(lua_State *L)
     lua_pushinteger(L, static_cast<lua_Integer>(addr));
     return 1;
 }
+
+int Lua::Memory::timelineStart(lua_State *L)
+{
+    std::string file = luaL_checklstring(L, 1, nullptr);
+    bool words = lua_toboolean(L, 2);
+    int ret = MemTimelineRecorder::start(file, words);
+    lua_pushboolean(L, ret == 0);
+    return 1;
+}
+
+int Lua::Memory::timelineStop(lua_State *L)
+{
+    int ret = MemTimelineRecorder::stop();
+    lua_pushboolean(L, ret == 0);
+    return 1;
+}
+
+int Lua::Memory::timelineQuery(lua_State *L)
+{
+    static const char* const match_names[] = {"exactly", "always", "only", nullptr};
+
+    std::string file = luaL_checklstring(L, 1, nullptr);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    int match = luaL_checkoption(L, 3, "exactly", match_names);
+    bool words = lua_toboolean(L, 4);
+
+    std::vector<uint64_t> frames;
+    lua_Integer frame_count = luaL_len(L, 2);
+    for (lua_Integer i = 1; i <= frame_count; i++) {
+        lua_geti(L, 2, i);
+        frames.push_back(static_cast<uint64_t>(lua_tointeger(L, -1)));
+        lua_pop(L, 1);
+    }
+
+    MemTimeline timeline;
+    std::vector<uintptr_t> addresses;
+    if (timeline.load(file) == 0)
+        timeline.query(frames, match, words && (timeline.flags & MemTimeline::WORDS), addresses);
+
+    lua_createtable(L, addresses.size(), 0);
+    for (size_t i = 0; i < addresses.size(); i++) {
+        lua_pushinteger(L, static_cast<lua_Integer>(addresses[i]));
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
@@ -91,6 +91,16 @@ namespace Memory {
     
     /* Returns base address of a file */
     int baseAddress(lua_State *L);
+
+    /* Start recording memory changes of each frame into a timeline file */
+    int timelineStart(lua_State *L);
+
+    /* Stop recording memory changes and write the timeline file */
+    int timelineStop(lua_State *L);
+
+    /* Returns the addresses from a timeline file whose changes match a list
+     * of frames */
+    int timelineQuery(lua_State *L);
 }
 }
 
@@ -39,6 +39,8 @@ static const luaL_Reg runtime_functions[] =
     { "setFastForward", Lua::Runtime::setFastForward},
     { "sleepMS", Lua::Runtime::sleepMS},
     { "playPause", Lua::Runtime::playPause},
+    { "getSavestateSettings", Lua::Runtime::getSavestateSettings},
+    { "setSavestateSettings", Lua::Runtime::setSavestateSettings},
     { NULL, NULL }
 };
 
@@ -91,3 +93,22 @@ int Lua::Runtime::playPause(lua_State *L)
     context->hotkey_pressed_queue.push(HOTKEY_PLAYPAUSE);
     return 0;
 }
+
+int Lua::Runtime::getSavestateSettings(lua_State *L)
+{
+    lua_pushinteger(L, static_cast<lua_Integer>(context->config.sc.savestate_settings));
+    return 1;
+}
+
+int Lua::Runtime::setSavestateSettings(lua_State *L)
+{
+    int settings = static_cast<int>(lua_tointeger(L, 1));
+
+    /* Same restriction as in the settings window */
+    if (!context->is_soft_dirty)
+        settings &= ~SharedConfig::SS_INCREMENTAL;
+
+    context->config.sc.savestate_settings = settings;
+    context->config.sc_modified = true;
+    return 0;
+}
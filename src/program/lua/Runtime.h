@@ -50,6 +50,12 @@ namespace Runtime {
 
     /* Pause or resume the movie */
     int playPause(lua_State *L);
+
+    /* Get the savestate settings */
+    int getSavestateSettings(lua_State *L);
+
+    /* Set the savestate settings */
+    int setSavestateSettings(lua_State *L);
 }
 }
 
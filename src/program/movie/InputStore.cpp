@@ -0,0 +1,555 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "InputStore.h"
+
+#include "../shared/inputs/ControllerInputs.h"
+#include "../shared/inputs/MiscInputs.h"
+#include "../shared/inputs/MouseInputs.h"
+#include "../shared/inputs/SingleInput.h"
+#define XXH_INLINE_ALL
+#include "../external/xxhash.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+/* Base of the polynomial hash of frame sequences. It must be odd. */
+static const uint64_t HASH_BASE = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t hashPower(uint64_t exponent)
+{
+    uint64_t result = 1;
+    uint64_t base = HASH_BASE;
+    while (exponent) {
+        if (exponent & 1)
+            result *= base;
+        base *= base;
+        exponent >>= 1;
+    }
+    return result;
+}
+
+InputStore::InputStore(const InputStore& other)
+{
+    copyFrom(other);
+}
+
+InputStore& InputStore::operator=(const InputStore& other)
+{
+    if (this != &other)
+        copyFrom(other);
+    return *this;
+}
+
+void InputStore::copyFrom(const InputStore& other)
+{
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    std::unique_lock<std::mutex> other_lock(other.mutex, std::defer_lock);
+    std::lock(lock, other_lock);
+
+    chunks.clear();
+    chunks.resize(other.chunks.size());
+    for (size_t c = 0; c < other.chunks.size(); c++) {
+        other.pack(c);
+        chunks[c].count = other.chunks[c].count;
+        chunks[c].packed = other.chunks[c].packed;
+        /* Only modified chunks need to be hashed again */
+        chunks[c].hashes = other.chunks[c].hashes;
+    }
+
+    starts = other.starts;
+    unpacked_count = 0;
+
+    chunk_hashes = other.chunk_hashes;
+    chunk_powers = other.chunk_powers;
+    chunk_hashes_valid = other.chunk_hashes_valid;
+}
+
+uint64_t InputStore::size() const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return starts.back();
+}
+
+bool InputStore::empty() const
+{
+    return size() == 0;
+}
+
+void InputStore::clear()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    chunks.clear();
+    starts.assign(1, 0);
+    unpacked_count = 0;
+    chunk_hashes_valid = false;
+}
+
+AllInputs InputStore::operator[](uint64_t pos) const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t c = findChunk(pos);
+    return unpack(c)[pos - starts[c]];
+}
+
+AllInputs& InputStore::modify(uint64_t pos)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t c = findChunk(pos);
+    return unpackForWrite(c)[pos - starts[c]];
+}
+
+const AllInputs& InputStore::peek(uint64_t pos, std::vector<AllInputs>& buffer, uint64_t& chunk) const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t c = findChunk(pos);
+    const Chunk& ch = chunks[c];
+
+    /* Don't return a reference inside the chunk, which may be evicted */
+    if (ch.frames) {
+        if (chunk != c) {
+            buffer = *ch.frames;
+            chunk = c;
+        }
+        return buffer[pos - starts[c]];
+    }
+
+    return peekLocked(pos, buffer, chunk);
+}
+
+const AllInputs& InputStore::peekLocked(uint64_t pos, std::vector<AllInputs>& buffer, uint64_t& chunk) const
+{
+    size_t c = findChunk(pos);
+    const Chunk& ch = chunks[c];
+
+    if (ch.frames)
+        return (*ch.frames)[pos - starts[c]];
+
+    if (chunk != c) {
+        buffer.resize(ch.count);
+        if (!InputTrack::decodeBlock(ch.packed->data(), ch.packed->size(), ch.count, buffer.data(), ch.count)) {
+            std::cerr << "Could not unpack the inputs of frame " << pos << std::endl;
+            for (AllInputs& ai : buffer)
+                ai.clear();
+        }
+        chunk = c;
+    }
+
+    return buffer[pos - starts[c]];
+}
+
+void InputStore::push_back(const AllInputs& ai)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (chunks.empty() || (chunks.back().count >= CHUNK_FRAMES)) {
+        chunks.emplace_back();
+        starts.push_back(starts.back());
+    }
+
+    std::vector<AllInputs>& frames = unpackForWrite(chunks.size() - 1);
+    frames.push_back(ai);
+    chunks.back().count++;
+    starts.back()++;
+}
+
+void InputStore::appendBlock(const uint8_t* data, size_t size, uint32_t frames)
+{
+    if (frames == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    chunks.emplace_back();
+    chunks.back().count = frames;
+    chunks.back().packed = std::make_shared<const std::vector<uint8_t>>(data, data + size);
+    starts.push_back(starts.back() + frames);
+    chunk_hashes_valid = false;
+}
+
+void InputStore::insert(uint64_t pos, uint64_t count, const AllInputs& ai)
+{
+    if (count == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (chunks.empty()) {
+        chunks.emplace_back();
+        starts.push_back(0);
+    }
+
+    /* Inserting at the end goes into the last chunk */
+    size_t c = (pos >= starts.back()) ? chunks.size() - 1 : findChunk(pos);
+    std::vector<AllInputs>& frames = unpackForWrite(c);
+    frames.insert(frames.begin() + (pos - starts[c]), count, ai);
+    chunks[c].count = frames.size();
+
+    split(c);
+    updateStarts();
+}
+
+void InputStore::insert(uint64_t pos, const std::vector<AllInputs>& new_frames)
+{
+    if (new_frames.empty())
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (chunks.empty()) {
+        chunks.emplace_back();
+        starts.push_back(0);
+    }
+
+    size_t c = (pos >= starts.back()) ? chunks.size() - 1 : findChunk(pos);
+    std::vector<AllInputs>& frames = unpackForWrite(c);
+    frames.insert(frames.begin() + (pos - starts[c]), new_frames.begin(), new_frames.end());
+    chunks[c].count = frames.size();
+
+    split(c);
+    updateStarts();
+}
+
+void InputStore::erase(uint64_t pos, uint64_t count)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    uint64_t end = std::min(pos + count, starts.back());
+    if (pos >= end)
+        return;
+
+    for (size_t c = findChunk(pos); (c < chunks.size()) && (starts[c] < end); c++) {
+        uint64_t first = std::max(pos, starts[c]) - starts[c];
+        uint64_t last = std::min<uint64_t>(end - starts[c], chunks[c].count);
+
+        if (first == 0 && last == chunks[c].count) {
+            /* Whole chunk is removed */
+            if (chunks[c].frames)
+                unpacked_count--;
+            chunks[c].frames.reset();
+            chunks[c].packed.reset();
+            chunks[c].count = 0;
+        }
+        else {
+            std::vector<AllInputs>& frames = unpackForWrite(c);
+            frames.erase(frames.begin() + first, frames.begin() + last);
+            chunks[c].count = frames.size();
+        }
+    }
+
+    chunks.erase(std::remove_if(chunks.begin(), chunks.end(),
+        [](const Chunk& ch) { return ch.count == 0; }), chunks.end());
+
+    updateStarts();
+}
+
+void InputStore::resize(uint64_t count)
+{
+    uint64_t current = size();
+
+    if (count < current) {
+        erase(count, current - count);
+    }
+    else if (count > current) {
+        AllInputs ai;
+        ai.clear();
+        insert(current, count - current, ai);
+    }
+}
+
+bool InputStore::isEqual(const InputStore& other, uint64_t first_frame, uint64_t end_frame) const
+{
+    if (this == &other)
+        return end_frame <= size();
+
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    std::unique_lock<std::mutex> other_lock(other.mutex, std::defer_lock);
+    std::lock(lock, other_lock);
+
+    if ((end_frame > starts.back()) || (end_frame > other.starts.back()))
+        return false;
+
+    return firstDifferenceLocked(other, first_frame, end_frame) == end_frame;
+}
+
+uint64_t InputStore::firstDifference(const InputStore& other, uint64_t first_frame, uint64_t end_frame) const
+{
+    if (this == &other)
+        return std::min(end_frame, size());
+
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    std::unique_lock<std::mutex> other_lock(other.mutex, std::defer_lock);
+    std::lock(lock, other_lock);
+
+    return firstDifferenceLocked(other, first_frame, end_frame);
+}
+
+uint64_t InputStore::firstDifferenceLocked(const InputStore& other, uint64_t first_frame, uint64_t end_frame) const
+{
+    end_frame = std::min({end_frame, starts.back(), other.starts.back()});
+
+    updateChunkHashes();
+    other.updateChunkHashes();
+
+    std::vector<AllInputs> buffer, other_buffer;
+    uint64_t chunk = UINT64_MAX, other_chunk = UINT64_MAX;
+
+    uint64_t f = first_frame;
+    while (f < end_frame) {
+        /* Both stores have frames at the same positions, so hashes of ranges
+         * can be compared without normalizing them */
+        uint64_t base = prefixHash(f);
+        uint64_t other_base = other.prefixHash(f);
+        if ((prefixHash(end_frame) - base) == (other.prefixHash(end_frame) - other_base))
+            return end_frame;
+
+        /* Find the first frame whose hash differs */
+        uint64_t equal_end = f, diff_end = end_frame;
+        while (diff_end - equal_end > 1) {
+            uint64_t mid = equal_end + (diff_end - equal_end) / 2;
+            if ((prefixHash(mid) - base) == (other.prefixHash(mid) - other_base))
+                equal_end = mid;
+            else
+                diff_end = mid;
+        }
+
+        /* Frames with different hashes can still be equal, because a missing
+         * controller is equal to any controller */
+        if (!(peekLocked(equal_end, buffer, chunk) == other.peekLocked(equal_end, other_buffer, other_chunk)))
+            return equal_end;
+
+        f = equal_end + 1;
+    }
+
+    return end_frame;
+}
+
+size_t InputStore::findChunk(uint64_t pos) const
+{
+    auto it = std::upper_bound(starts.begin(), starts.end(), pos);
+    return std::distance(starts.begin(), it) - 1;
+}
+
+std::vector<AllInputs>& InputStore::unpack(size_t c) const
+{
+    Chunk& ch = chunks[c];
+    ch.last_use = ++use_counter;
+
+    if (ch.frames)
+        return *ch.frames;
+
+    ch.frames.reset(new std::vector<AllInputs>(ch.count));
+    if (ch.count > 0) {
+        if (!InputTrack::decodeBlock(ch.packed->data(), ch.packed->size(), ch.count, ch.frames->data(), ch.count)) {
+            std::cerr << "Could not unpack the inputs of frames " << starts[c] << " to " << starts[c] + ch.count - 1 << std::endl;
+            for (AllInputs& ai : *ch.frames)
+                ai.clear();
+        }
+    }
+    unpacked_count++;
+
+    /* Evict the least recently used chunks */
+    while (unpacked_count > MAX_UNPACKED_CHUNKS) {
+        size_t lru = c;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (chunks[i].frames && (i != c) && ((lru == c) || (chunks[i].last_use < chunks[lru].last_use)))
+                lru = i;
+        }
+        if (lru == c)
+            break;
+        evict(lru);
+    }
+
+    return *ch.frames;
+}
+
+void InputStore::pack(size_t c) const
+{
+    Chunk& ch = chunks[c];
+    if (ch.packed || !ch.frames)
+        return;
+
+    std::vector<uint8_t> buffer;
+    InputTrack::encodeBlock(ch.frames->data(), ch.count, buffer);
+    ch.packed = std::make_shared<const std::vector<uint8_t>>(std::move(buffer));
+}
+
+void InputStore::evict(size_t c) const
+{
+    Chunk& ch = chunks[c];
+    if (!ch.frames)
+        return;
+
+    pack(c);
+    ch.frames.reset();
+    unpacked_count--;
+}
+
+std::vector<AllInputs>& InputStore::unpackForWrite(size_t c)
+{
+    std::vector<AllInputs>& frames = unpack(c);
+    chunks[c].packed.reset();
+    chunks[c].hashes.reset();
+    chunk_hashes_valid = false;
+    return frames;
+}
+
+void InputStore::split(size_t c)
+{
+    std::vector<AllInputs>& frames = *chunks[c].frames;
+    if (frames.size() <= 2 * CHUNK_FRAMES)
+        return;
+
+    /* The first part stays unpacked, other parts are packed right away */
+    std::vector<Chunk> parts;
+    for (size_t offset = CHUNK_FRAMES; offset < frames.size(); offset += CHUNK_FRAMES) {
+        Chunk part;
+        part.count = std::min<size_t>(CHUNK_FRAMES, frames.size() - offset);
+        std::vector<uint8_t> buffer;
+        InputTrack::encodeBlock(&frames[offset], part.count, buffer);
+        part.packed = std::make_shared<const std::vector<uint8_t>>(std::move(buffer));
+        parts.push_back(std::move(part));
+    }
+
+    frames.erase(frames.begin() + CHUNK_FRAMES, frames.end());
+    chunks[c].count = CHUNK_FRAMES;
+    chunks.insert(chunks.begin() + c + 1, std::make_move_iterator(parts.begin()), std::make_move_iterator(parts.end()));
+}
+
+void InputStore::updateStarts()
+{
+    starts.resize(chunks.size() + 1);
+    starts[0] = 0;
+    for (size_t c = 0; c < chunks.size(); c++)
+        starts[c + 1] = starts[c] + chunks[c].count;
+
+    chunk_hashes_valid = false;
+}
+
+uint64_t InputStore::frameHash(const AllInputs& ai)
+{
+    /* Missing objects are hashed as cleared objects */
+    uint32_t data[AllInputs::MAXKEYS + 5 + AllInputs::MAXJOYS * (ControllerInputs::MAXAXES + 1) + 5] = {};
+    size_t i = 0;
+
+    for (int k = 0; k < AllInputs::MAXKEYS; k++)
+        data[i++] = ai.keyboard[k];
+
+    if (ai.pointer) {
+        data[i++] = ai.pointer->x;
+        data[i++] = ai.pointer->y;
+        data[i++] = ai.pointer->wheel;
+        data[i++] = ai.pointer->mode;
+        data[i++] = ai.pointer->mask;
+    }
+    else {
+        i += 3;
+        data[i++] = SingleInput::POINTER_MODE_ABSOLUTE;
+        i++;
+    }
+
+    for (int j = 0; j < AllInputs::MAXJOYS; j++) {
+        if (ai.controllers[j]) {
+            for (int axis = 0; axis < ControllerInputs::MAXAXES; axis++)
+                data[i++] = static_cast<uint16_t>(ai.controllers[j]->axes[axis]);
+            data[i++] = ai.controllers[j]->buttons;
+        }
+        else {
+            i += ControllerInputs::MAXAXES + 1;
+        }
+    }
+
+    if (ai.misc) {
+        data[i++] = ai.misc->flags;
+        data[i++] = ai.misc->framerate_num;
+        data[i++] = ai.misc->framerate_den;
+        data[i++] = ai.misc->realtime_sec;
+        data[i++] = ai.misc->realtime_nsec;
+    }
+
+    uint64_t hash = XXH3_64bits(data, sizeof(data));
+    if (!ai.events.empty())
+        hash = XXH3_64bits_withSeed(ai.events.data(), ai.events.size() * sizeof(InputEvent), hash);
+    return hash;
+}
+
+const std::vector<uint64_t>& InputStore::prefixHashes(size_t c) const
+{
+    Chunk& ch = chunks[c];
+    if (ch.hashes)
+        return *ch.hashes;
+
+    /* Don't unpack the chunk in the store, to not evict other chunks */
+    std::vector<AllInputs> buffer;
+    const AllInputs* frames;
+    if (ch.frames) {
+        frames = ch.frames->data();
+    }
+    else {
+        buffer.resize(ch.count);
+        if (!InputTrack::decodeBlock(ch.packed->data(), ch.packed->size(), ch.count, buffer.data(), ch.count)) {
+            for (AllInputs& ai : buffer)
+                ai.clear();
+        }
+        frames = buffer.data();
+    }
+
+    std::vector<uint64_t> hashes(ch.count + 1);
+    uint64_t power = 1;
+    hashes[0] = 0;
+    for (uint32_t f = 0; f < ch.count; f++) {
+        hashes[f + 1] = hashes[f] + power * frameHash(frames[f]);
+        power *= HASH_BASE;
+    }
+
+    ch.hashes = std::make_shared<const std::vector<uint64_t>>(std::move(hashes));
+    return *ch.hashes;
+}
+
+void InputStore::updateChunkHashes() const
+{
+    if (chunk_hashes_valid)
+        return;
+
+    chunk_hashes.resize(chunks.size() + 1);
+    chunk_powers.resize(chunks.size() + 1);
+
+    uint64_t hash = 0;
+    uint64_t power = 1;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        chunk_hashes[c] = hash;
+        chunk_powers[c] = power;
+        hash += power * prefixHashes(c).back();
+        power *= hashPower(chunks[c].count);
+    }
+    chunk_hashes.back() = hash;
+    chunk_powers.back() = power;
+
+    chunk_hashes_valid = true;
+}
+
+uint64_t InputStore::prefixHash(uint64_t pos) const
+{
+    if (pos >= starts.back())
+        return chunk_hashes.back();
+
+    size_t c = findChunk(pos);
+    return chunk_hashes[c] + chunk_powers[c] * prefixHashes(c)[pos - starts[c]];
+}
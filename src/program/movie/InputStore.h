@@ -0,0 +1,202 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_INPUTSTORE_H_INCLUDED
+#define LIBTAS_INPUTSTORE_H_INCLUDED
+
+#include "InputTrack.h"
+#include "../shared/inputs/AllInputs.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+/* Storage of all the inputs of a movie.
+ *
+ * Frames are split into chunks of variable size. Each chunk is stored packed,
+ * using the column encoding of input track blocks, which only costs a few
+ * bytes per frame. Packed chunks are immutable and shared between copies of
+ * the store, so that copying a movie for a savestate only copies one pointer
+ * per chunk.
+ *
+ * A chunk is unpacked into an array of AllInputs when one of its frames is
+ * accessed. Modifying a frame drops the packed data of its chunk, which is
+ * packed again when the chunk is evicted or when the store is copied. Only a
+ * few chunks are kept unpacked at the same time.
+ *
+ * Each chunk also keeps the hashes of all its prefixes, shared between copies
+ * like the packed data. Combined with the hash of the frames before each
+ * chunk, it gives the hash of any prefix of the store, so that comparing two
+ * stores only costs a few hash compares. The hash of a sequence of frames is
+ * the polynomial sum of frame hashes, which does not depend on how frames are
+ * split into chunks.
+ */
+class InputStore {
+public:
+    /* Number of frames in a chunk when building chunks. Chunks are split when
+     * reaching twice this size. */
+    static const uint32_t CHUNK_FRAMES = InputTrack::BLOCK_FRAMES;
+
+    /* Maximum number of chunks that are kept unpacked */
+    static const size_t MAX_UNPACKED_CHUNKS = 16;
+
+    InputStore() = default;
+
+    /* Copies share the packed chunks */
+    InputStore(const InputStore& other);
+    InputStore& operator=(const InputStore& other);
+
+    /* Number of frames */
+    uint64_t size() const;
+
+    bool empty() const;
+
+    void clear();
+
+    /* Get a copy of the inputs of a frame. A reference could not be returned,
+     * because the chunk may be evicted by another thread at any time */
+    AllInputs operator[](uint64_t pos) const;
+
+    /* Get the inputs of a frame to modify them */
+    AllInputs& modify(uint64_t pos);
+
+    /* Get the inputs of a frame without unpacking its chunk in the store.
+     * The chunk is decoded or copied into the buffer, which can be reused
+     * between calls with the same `chunk` value, which must be initialized to
+     * UINT64_MAX. The reference points inside the buffer. */
+    const AllInputs& peek(uint64_t pos, std::vector<AllInputs>& buffer, uint64_t& chunk) const;
+
+    /* Append a frame */
+    void push_back(const AllInputs& ai);
+
+    /* Append a block encoded by an input track */
+    void appendBlock(const uint8_t* data, size_t size, uint32_t frames);
+
+    /* Insert `count` copies of a frame before pos */
+    void insert(uint64_t pos, uint64_t count, const AllInputs& ai);
+
+    /* Insert an array of frames before pos */
+    void insert(uint64_t pos, const std::vector<AllInputs>& frames);
+
+    /* Remove `count` frames starting from pos */
+    void erase(uint64_t pos, uint64_t count);
+
+    /* Truncate the store, or extend it with empty frames */
+    void resize(uint64_t count);
+
+    /* Check if a range of frames is identical in both stores */
+    bool isEqual(const InputStore& other, uint64_t first_frame, uint64_t end_frame) const;
+
+    /* Return the first frame of the range that differs between both stores.
+     * Returns the end of the range, truncated to the size of the shortest
+     * store, if all frames are identical. Frames are located by comparing
+     * hashes of ranges, and only the located frames are compared directly. */
+    uint64_t firstDifference(const InputStore& other, uint64_t first_frame, uint64_t end_frame) const;
+
+private:
+    struct Chunk {
+        /* Number of frames */
+        uint32_t count = 0;
+
+        /* Packed frames, or null if the chunk was modified */
+        std::shared_ptr<const std::vector<uint8_t>> packed;
+
+        /* Unpacked frames, or null if not unpacked */
+        std::unique_ptr<std::vector<AllInputs>> frames;
+
+        /* Hash of the first k frames for each k from 0 to count, or null if
+         * not computed yet */
+        std::shared_ptr<const std::vector<uint64_t>> hashes;
+
+        /* Last access, for evicting unpacked chunks */
+        uint64_t last_use = 0;
+    };
+
+    /* Chunks are mutable because const accesses may unpack them */
+    mutable std::vector<Chunk> chunks;
+
+    /* First frame of each chunk, and total frame count at the end */
+    std::vector<uint64_t> starts = {0};
+
+    /* Number of chunks that are unpacked */
+    mutable size_t unpacked_count = 0;
+
+    /* Access counter for chunk eviction */
+    mutable uint64_t use_counter = 0;
+
+    /* Hash of all frames before each chunk, and of all frames at the end */
+    mutable std::vector<uint64_t> chunk_hashes;
+
+    /* Hash base to the power of the first frame of each chunk */
+    mutable std::vector<uint64_t> chunk_powers;
+
+    /* Chunk hashes must be recomputed after any modification */
+    mutable bool chunk_hashes_valid = false;
+
+    /* Unpacking and packing chunks can be triggered from const accesses, and
+     * from both the main and UI threads */
+    mutable std::mutex mutex;
+
+    /* The following functions must be called with the mutex locked. The
+     * const functions only modify the unpacked state of chunks. */
+
+    /* Index of the chunk containing a frame */
+    size_t findChunk(uint64_t pos) const;
+
+    /* Same as peek(), but may return a reference inside an unpacked chunk */
+    const AllInputs& peekLocked(uint64_t pos, std::vector<AllInputs>& buffer, uint64_t& chunk) const;
+
+    /* Unpack a chunk, and evict other chunks if needed */
+    std::vector<AllInputs>& unpack(size_t c) const;
+
+    /* Pack a modified chunk */
+    void pack(size_t c) const;
+
+    /* Drop the unpacked frames of a chunk, packing it if needed */
+    void evict(size_t c) const;
+
+    /* Unpack a chunk and mark it as modified */
+    std::vector<AllInputs>& unpackForWrite(size_t c);
+
+    /* Split a chunk that became too large */
+    void split(size_t c);
+
+    /* Recompute chunk starts after frames were inserted or removed */
+    void updateStarts();
+
+    /* Hash of a single frame */
+    static uint64_t frameHash(const AllInputs& ai);
+
+    /* Compute the prefix hashes of a chunk if needed */
+    const std::vector<uint64_t>& prefixHashes(size_t c) const;
+
+    /* Compute the hashes of frames before each chunk if needed */
+    void updateChunkHashes() const;
+
+    /* Hash of the first `pos` frames */
+    uint64_t prefixHash(uint64_t pos) const;
+
+    /* Same as firstDifference(), with both mutexes locked */
+    uint64_t firstDifferenceLocked(const InputStore& other, uint64_t first_frame, uint64_t end_frame) const;
+
+    void copyFrom(const InputStore& other);
+};
+
+#endif
@@ -0,0 +1,494 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "InputTrack.h"
+
+#include "../shared/inputs/AllInputs.h"
+#include "../shared/inputs/ControllerInputs.h"
+#include "../shared/inputs/MiscInputs.h"
+#include "../shared/inputs/MouseInputs.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char TRACK_MAGIC[8] = {'L','T','M','T','R','A','C','K'};
+static const uint32_t TRACK_VERSION = 1;
+
+/* Sanity limit when decoding, to not allocate huge arrays on corrupted files */
+static const int64_t MAX_FRAME_EVENTS = 4096;
+
+struct TrackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_frames;
+    uint64_t frame_count;
+    uint64_t index_offset;
+};
+
+/* Columns of a block, in the order they are stored. Pointer, controller and
+ * misc columns start with a presence column, and their values are zero on
+ * frames where the object is absent. Event columns are indexed by event
+ * instead of by frame. */
+enum {
+    COL_KEYBOARD = 0,
+    COL_POINTER = COL_KEYBOARD + AllInputs::MAXKEYS,
+    COL_POINTER_X = COL_POINTER + 1,
+    COL_POINTER_Y,
+    COL_POINTER_WHEEL,
+    COL_POINTER_MODE,
+    COL_POINTER_MASK,
+    COL_CONTROLLER,
+    COL_CONTROLLER_SIZE = ControllerInputs::MAXAXES + 2,
+    COL_MISC = COL_CONTROLLER + AllInputs::MAXJOYS * COL_CONTROLLER_SIZE,
+    COL_MISC_FLAGS,
+    COL_MISC_FRAMERATE_NUM,
+    COL_MISC_FRAMERATE_DEN,
+    COL_MISC_REALTIME_SEC,
+    COL_MISC_REALTIME_NSEC,
+    COL_EVENT_COUNT,
+    COL_EVENT_TYPE,
+    COL_EVENT_WHICH,
+    COL_EVENT_VALUE,
+    COL_COUNT
+};
+
+static void writeVarint(std::vector<uint8_t>& buffer, uint64_t value)
+{
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<uint8_t>(value));
+}
+
+static bool readVarint(const uint8_t*& ptr, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (ptr == end)
+            return false;
+        uint8_t byte = *ptr++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/* Encode a column as runs of identical values, with the delta from the
+ * previous run value. Runs are limited to max_run values. */
+static void encodeColumn(std::vector<uint8_t>& buffer, const std::vector<int64_t>& column, size_t max_run)
+{
+    int64_t previous = 0;
+    for (size_t i = 0; i < column.size(); ) {
+        size_t run = 1;
+        while ((run < max_run) && (i + run < column.size()) && (column[i + run] == column[i]))
+            run++;
+
+        int64_t delta = column[i] - previous;
+        writeVarint(buffer, run);
+        writeVarint(buffer, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+        previous = column[i];
+        i += run;
+    }
+}
+
+static bool decodeColumn(const uint8_t*& ptr, const uint8_t* end, std::vector<int64_t>& column, size_t count)
+{
+    column.resize(count);
+    int64_t previous = 0;
+    for (size_t i = 0; i < count; ) {
+        uint64_t run, zigzag;
+        if (!readVarint(ptr, end, run) || !readVarint(ptr, end, zigzag))
+            return false;
+        if ((run == 0) || (run > count - i))
+            return false;
+
+        previous += static_cast<int64_t>((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+        std::fill(column.begin() + i, column.begin() + i + run, previous);
+        i += run;
+    }
+    return true;
+}
+
+/* Append the fields of a frame to the columns of a block */
+static void pushColumns(std::vector<std::vector<int64_t>>& columns, const AllInputs& ai)
+{
+    for (int k = 0; k < AllInputs::MAXKEYS; k++)
+        columns[COL_KEYBOARD + k].push_back(ai.keyboard[k]);
+
+    const MouseInputs* mi = ai.pointer.get();
+    columns[COL_POINTER].push_back(mi != nullptr);
+    columns[COL_POINTER_X].push_back(mi ? mi->x : 0);
+    columns[COL_POINTER_Y].push_back(mi ? mi->y : 0);
+    columns[COL_POINTER_WHEEL].push_back(mi ? mi->wheel : 0);
+    columns[COL_POINTER_MODE].push_back(mi ? mi->mode : 0);
+    columns[COL_POINTER_MASK].push_back(mi ? mi->mask : 0);
+
+    for (int j = 0; j < AllInputs::MAXJOYS; j++) {
+        const ControllerInputs* ci = ai.controllers[j].get();
+        int col = COL_CONTROLLER + j * COL_CONTROLLER_SIZE;
+        columns[col].push_back(ci != nullptr);
+        for (int axis = 0; axis < ControllerInputs::MAXAXES; axis++)
+            columns[col + 1 + axis].push_back(ci ? ci->axes[axis] : 0);
+        columns[col + 1 + ControllerInputs::MAXAXES].push_back(ci ? ci->buttons : 0);
+    }
+
+    const MiscInputs* misc = ai.misc.get();
+    columns[COL_MISC].push_back(misc != nullptr);
+    columns[COL_MISC_FLAGS].push_back(misc ? misc->flags : 0);
+    columns[COL_MISC_FRAMERATE_NUM].push_back(misc ? misc->framerate_num : 0);
+    columns[COL_MISC_FRAMERATE_DEN].push_back(misc ? misc->framerate_den : 0);
+    columns[COL_MISC_REALTIME_SEC].push_back(misc ? misc->realtime_sec : 0);
+    columns[COL_MISC_REALTIME_NSEC].push_back(misc ? misc->realtime_nsec : 0);
+
+    columns[COL_EVENT_COUNT].push_back(ai.events.size());
+    for (const InputEvent& ie : ai.events) {
+        columns[COL_EVENT_TYPE].push_back(ie.type);
+        columns[COL_EVENT_WHICH].push_back(ie.which);
+        columns[COL_EVENT_VALUE].push_back(ie.value);
+    }
+}
+
+/* Encode all columns of a block and empty them */
+static void encodeColumns(std::vector<uint8_t>& buffer, std::vector<std::vector<int64_t>>& columns)
+{
+    for (int c = 0; c < COL_COUNT; c++) {
+        /* Events are stored with one run each, so that each event takes at
+         * least one byte, which bounds the number of events when decoding */
+        encodeColumn(buffer, columns[c], (c >= COL_EVENT_TYPE) ? 1 : SIZE_MAX);
+        columns[c].clear();
+    }
+}
+
+InputTrack::~InputTrack()
+{
+    close();
+}
+
+bool InputTrack::open(const std::string& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (static_cast<size_t>(st.st_size) < sizeof(TrackHeader))) {
+        ::close(fd);
+        return false;
+    }
+
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+
+    data = static_cast<const uint8_t*>(addr);
+    data_size = st.st_size;
+
+    TrackHeader header;
+    memcpy(&header, data, sizeof(TrackHeader));
+
+    if ((memcmp(header.magic, TRACK_MAGIC, sizeof(TRACK_MAGIC)) != 0) ||
+        (header.version != TRACK_VERSION) ||
+        (header.block_frames != BLOCK_FRAMES)) {
+        close();
+        return false;
+    }
+
+    frame_count = header.frame_count;
+    block_count = (frame_count + BLOCK_FRAMES - 1) / BLOCK_FRAMES;
+    index_offset = header.index_offset;
+
+    /* Check that the index fits in the file and points inside the block data */
+    if ((index_offset < sizeof(TrackHeader)) || (index_offset > data_size) ||
+        (block_count + 1 > (data_size - index_offset) / sizeof(uint64_t))) {
+        close();
+        return false;
+    }
+
+    uint64_t previous = sizeof(TrackHeader);
+    for (uint64_t b = 0; b <= block_count; b++) {
+        uint64_t offset;
+        memcpy(&offset, data + index_offset + b * sizeof(uint64_t), sizeof(uint64_t));
+        if ((offset < previous) || (offset > index_offset)) {
+            close();
+            return false;
+        }
+        previous = offset;
+    }
+
+    return true;
+}
+
+void InputTrack::close()
+{
+    if (data)
+        munmap(const_cast<uint8_t*>(data), data_size);
+
+    data = nullptr;
+    data_size = 0;
+    frame_count = 0;
+    block_count = 0;
+    index_offset = 0;
+}
+
+bool InputTrack::isOpen() const
+{
+    return data != nullptr;
+}
+
+uint64_t InputTrack::nbFrames() const
+{
+    return frame_count;
+}
+
+uint64_t InputTrack::nbBlocks() const
+{
+    return block_count;
+}
+
+const uint8_t* InputTrack::blockData(uint64_t block, size_t& size) const
+{
+    if (block >= block_count)
+        return nullptr;
+
+    uint64_t offsets[2];
+    memcpy(offsets, data + index_offset + block * sizeof(uint64_t), sizeof(offsets));
+    size = offsets[1] - offsets[0];
+    return data + offsets[0];
+}
+
+uint32_t InputTrack::blockFrames(uint64_t block) const
+{
+    if (block >= block_count)
+        return 0;
+
+    return std::min<uint64_t>(BLOCK_FRAMES, frame_count - block * BLOCK_FRAMES);
+}
+
+bool InputTrack::decodeBlock(uint64_t block, AllInputs* frames, uint32_t count) const
+{
+    size_t size;
+    const uint8_t* block_data = blockData(block, size);
+    if (!block_data)
+        return false;
+
+    return decodeBlock(block_data, size, blockFrames(block), frames, count);
+}
+
+void InputTrack::encodeBlock(const AllInputs* frames, uint32_t count, std::vector<uint8_t>& buffer)
+{
+    std::vector<std::vector<int64_t>> columns(COL_COUNT);
+    for (uint32_t f = 0; f < count; f++)
+        pushColumns(columns, frames[f]);
+
+    buffer.clear();
+    encodeColumns(buffer, columns);
+}
+
+bool InputTrack::decodeBlock(const uint8_t* block_data, size_t size, uint32_t block_frames, AllInputs* frames, uint32_t count)
+{
+    const uint8_t* ptr = block_data;
+    const uint8_t* end = block_data + size;
+
+    count = std::min(count, block_frames);
+
+    std::vector<int64_t> column;
+
+    for (int k = 0; k < AllInputs::MAXKEYS; k++) {
+        if (!decodeColumn(ptr, end, column, block_frames))
+            return false;
+        for (uint32_t f = 0; f < count; f++)
+            frames[f].keyboard[k] = column[f];
+    }
+
+    if (!decodeColumn(ptr, end, column, block_frames))
+        return false;
+    for (uint32_t f = 0; f < count; f++) {
+        if (!column[f])
+            frames[f].pointer.reset();
+        else if (!frames[f].pointer)
+            frames[f].pointer.reset(new MouseInputs{});
+    }
+
+    for (int c = COL_POINTER_X; c <= COL_POINTER_MASK; c++) {
+        if (!decodeColumn(ptr, end, column, block_frames))
+            return false;
+        for (uint32_t f = 0; f < count; f++) {
+            MouseInputs* mi = frames[f].pointer.get();
+            if (!mi) continue;
+            switch (c) {
+                case COL_POINTER_X: mi->x = column[f]; break;
+                case COL_POINTER_Y: mi->y = column[f]; break;
+                case COL_POINTER_WHEEL: mi->wheel = column[f]; break;
+                case COL_POINTER_MODE: mi->mode = column[f]; break;
+                case COL_POINTER_MASK: mi->mask = column[f]; break;
+            }
+        }
+    }
+
+    for (int j = 0; j < AllInputs::MAXJOYS; j++) {
+        if (!decodeColumn(ptr, end, column, block_frames))
+            return false;
+        for (uint32_t f = 0; f < count; f++) {
+            if (!column[f])
+                frames[f].controllers[j].reset();
+            else if (!frames[f].controllers[j])
+                frames[f].controllers[j].reset(new ControllerInputs{});
+        }
+
+        for (int axis = 0; axis <= ControllerInputs::MAXAXES; axis++) {
+            if (!decodeColumn(ptr, end, column, block_frames))
+                return false;
+            for (uint32_t f = 0; f < count; f++) {
+                ControllerInputs* ci = frames[f].controllers[j].get();
+                if (!ci) continue;
+                if (axis < ControllerInputs::MAXAXES)
+                    ci->axes[axis] = column[f];
+                else
+                    ci->buttons = column[f];
+            }
+        }
+    }
+
+    if (!decodeColumn(ptr, end, column, block_frames))
+        return false;
+    for (uint32_t f = 0; f < count; f++) {
+        if (!column[f])
+            frames[f].misc.reset();
+        else if (!frames[f].misc)
+            frames[f].misc.reset(new MiscInputs{});
+    }
+
+    for (int c = COL_MISC_FLAGS; c <= COL_MISC_REALTIME_NSEC; c++) {
+        if (!decodeColumn(ptr, end, column, block_frames))
+            return false;
+        for (uint32_t f = 0; f < count; f++) {
+            MiscInputs* mi = frames[f].misc.get();
+            if (!mi) continue;
+            switch (c) {
+                case COL_MISC_FLAGS: mi->flags = column[f]; break;
+                case COL_MISC_FRAMERATE_NUM: mi->framerate_num = column[f]; break;
+                case COL_MISC_FRAMERATE_DEN: mi->framerate_den = column[f]; break;
+                case COL_MISC_REALTIME_SEC: mi->realtime_sec = column[f]; break;
+                case COL_MISC_REALTIME_NSEC: mi->realtime_nsec = column[f]; break;
+            }
+        }
+    }
+
+    /* Events are stored after the number of events of each frame */
+    if (!decodeColumn(ptr, end, column, block_frames))
+        return false;
+    std::vector<int64_t> event_counts(column);
+    uint64_t event_total = 0;
+    for (size_t f = 0; f < block_frames; f++) {
+        if ((event_counts[f] < 0) || (event_counts[f] > MAX_FRAME_EVENTS))
+            return false;
+        event_total += event_counts[f];
+    }
+
+    /* Check the number of events before allocating them */
+    if (event_total > static_cast<uint64_t>(end - ptr))
+        return false;
+
+    std::vector<int64_t> event_columns[3];
+    for (int c = 0; c < 3; c++)
+        if (!decodeColumn(ptr, end, event_columns[c], event_total))
+            return false;
+
+    size_t e = 0;
+    for (uint32_t f = 0; f < count; f++) {
+        frames[f].events.resize(event_counts[f]);
+        for (InputEvent& ie : frames[f].events) {
+            ie.type = event_columns[0][e];
+            ie.which = event_columns[1][e];
+            ie.value = event_columns[2][e];
+            e++;
+        }
+    }
+
+    return true;
+}
+
+bool InputTrackWriter::open(const std::string& path)
+{
+    stream.open(path, std::ofstream::binary | std::ofstream::trunc);
+    if (!stream)
+        return false;
+
+    frame_count = 0;
+    block_offsets.clear();
+    columns.assign(COL_COUNT, std::vector<int64_t>());
+
+    /* Header is written again when closing, after the index offset is known */
+    TrackHeader header = {};
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(TrackHeader));
+    return true;
+}
+
+void InputTrackWriter::push(const AllInputs& ai)
+{
+    pushColumns(columns, ai);
+
+    frame_count++;
+    if (columns[COL_EVENT_COUNT].size() == InputTrack::BLOCK_FRAMES)
+        writeBlock();
+}
+
+void InputTrackWriter::writeBlock()
+{
+    if (columns[COL_EVENT_COUNT].empty())
+        return;
+
+    block_offsets.push_back(stream.tellp());
+
+    buffer.clear();
+    encodeColumns(buffer, columns);
+
+    stream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+}
+
+bool InputTrackWriter::close()
+{
+    writeBlock();
+
+    uint64_t index_offset = stream.tellp();
+    block_offsets.push_back(index_offset);
+    stream.write(reinterpret_cast<const char*>(block_offsets.data()), block_offsets.size() * sizeof(uint64_t));
+
+    TrackHeader header;
+    memcpy(header.magic, TRACK_MAGIC, sizeof(TRACK_MAGIC));
+    header.version = TRACK_VERSION;
+    header.block_frames = InputTrack::BLOCK_FRAMES;
+    header.frame_count = frame_count;
+    header.index_offset = index_offset;
+    stream.seekp(0);
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(TrackHeader));
+
+    stream.close();
+    return !stream.fail();
+}
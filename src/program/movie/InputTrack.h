@@ -0,0 +1,126 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_INPUTTRACK_H_INCLUDED
+#define LIBTAS_INPUTTRACK_H_INCLUDED
+
+#include "../shared/inputs/AllInputs.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/* Binary storage of movie inputs, as an alternative to the text format.
+ *
+ * Frames are grouped into blocks of BLOCK_FRAMES frames. Inside a block, each
+ * field of the inputs (each keyboard slot, pointer coordinates, each
+ * controller axis, etc.) is stored as a separate column, encoded as runs of
+ * identical values, each run storing the difference with the previous run
+ * value. An index of block offsets at the end of the file allows to decode any
+ * block without reading the previous ones, so that the file can be mapped and
+ * decoded on demand.
+ */
+class InputTrack {
+public:
+    static const uint32_t BLOCK_FRAMES = 4096;
+
+    InputTrack() = default;
+    ~InputTrack();
+
+    InputTrack(const InputTrack&) = delete;
+    InputTrack& operator=(const InputTrack&) = delete;
+
+    /* Map an input track file. Returns false if the file could not be opened
+     * or is not a valid input track */
+    bool open(const std::string& path);
+
+    /* Unmap the file */
+    void close();
+
+    bool isOpen() const;
+
+    /* Number of frames in the track */
+    uint64_t nbFrames() const;
+
+    /* Number of blocks in the track */
+    uint64_t nbBlocks() const;
+
+    /* Decode the first `count` frames of a block into the frames array.
+     * Returns false if the block is corrupted */
+    bool decodeBlock(uint64_t block, AllInputs* frames, uint32_t count) const;
+
+    /* Encoded data of a block, or nullptr if the block does not exist */
+    const uint8_t* blockData(uint64_t block, size_t& size) const;
+
+    /* Number of frames in a block */
+    uint32_t blockFrames(uint64_t block) const;
+
+    /* Encode frames into a block, as stored in the track */
+    static void encodeBlock(const AllInputs* frames, uint32_t count, std::vector<uint8_t>& buffer);
+
+    /* Decode the first `count` frames of an encoded block of `block_frames`
+     * frames. Returns false if the block is corrupted */
+    static bool decodeBlock(const uint8_t* block_data, size_t size, uint32_t block_frames, AllInputs* frames, uint32_t count);
+
+private:
+    /* Mapped file */
+    const uint8_t* data = nullptr;
+    size_t data_size = 0;
+
+    uint64_t frame_count = 0;
+    uint64_t block_count = 0;
+
+    /* Offset of the block index inside the file */
+    uint64_t index_offset = 0;
+};
+
+/* Write an input track file, one frame at a time */
+class InputTrackWriter {
+public:
+    /* Create the file. Returns false if it could not be created */
+    bool open(const std::string& path);
+
+    /* Append the inputs of the next frame */
+    void push(const AllInputs& ai);
+
+    /* Write the remaining frames and the block index. Returns false if an
+     * error occured while writing the file */
+    bool close();
+
+private:
+    std::ofstream stream;
+
+    uint64_t frame_count = 0;
+
+    /* Offsets of all written blocks */
+    std::vector<uint64_t> block_offsets;
+
+    /* Values of each column for the frames of the current block */
+    std::vector<std::vector<int64_t>> columns;
+
+    /* Encoded block */
+    std::vector<uint8_t> buffer;
+
+    /* Encode and write the frames of the current block */
+    void writeBlock();
+};
+
+#endif
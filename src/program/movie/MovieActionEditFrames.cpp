@@ -74,7 +74,7 @@ MovieActionEditFrames::MovieActionEditFrames(uint64_t edit_from, uint64_t edit_t
 void MovieActionEditFrames::storeOldInputs()
 {
     for (uint64_t frame = first_frame; frame <= last_frame; frame++) {
-        const AllInputs& ai = movie_inputs->getInputs(frame);
+        AllInputs ai = movie_inputs->getInputs(frame);
         old_frames.push_back(ai);
     }
 }
@@ -85,7 +85,8 @@ void MovieActionEditFrames::undo() {
     std::unique_lock<std::mutex> lock(movie_inputs->input_list_mutex);
 
     emit movie_inputs->inputsToBeEdited(first_frame, first_frame+old_frames.size()-1);
-    std::copy(old_frames.begin(), old_frames.end(), movie_inputs->input_list.begin() + first_frame);
+    for (size_t i = 0; i < old_frames.size(); i++)
+        movie_inputs->input_list.modify(first_frame+i) = old_frames[i];
     emit movie_inputs->inputsEdited(first_frame, first_frame+old_frames.size()-1);
 
     movie_inputs->wasModified();
@@ -99,10 +100,11 @@ void MovieActionEditFrames::redo() {
     emit movie_inputs->inputsToBeEdited(first_frame, last_frame);
     if (new_frames.empty()) {
         for (uint64_t i = first_frame; i <= last_frame; i++)
-            movie_inputs->input_list[i].clear();
+            movie_inputs->input_list.modify(i).clear();
     }
     else {
-        std::copy(new_frames.begin(), new_frames.end(), movie_inputs->input_list.begin() + first_frame);
+        for (size_t i = 0; i < new_frames.size(); i++)
+            movie_inputs->input_list.modify(first_frame+i) = new_frames[i];
     }
     emit movie_inputs->inputsEdited(first_frame, last_frame);
     movie_inputs->wasModified();
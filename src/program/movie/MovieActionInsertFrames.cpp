@@ -58,10 +58,7 @@ void MovieActionInsertFrames::undo() {
     
     emit movie_inputs->inputsToBeRemoved(first_frame, last_frame);
 
-    if ((last_frame + 1) == movie_inputs->input_list.size())
-        movie_inputs->input_list.resize(first_frame);
-    else
-        movie_inputs->input_list.erase(movie_inputs->input_list.begin() + first_frame, movie_inputs->input_list.begin() + last_frame + 1);
+    movie_inputs->input_list.erase(first_frame, last_frame - first_frame + 1);
 
     emit movie_inputs->inputsRemoved(first_frame, last_frame);
     movie_inputs->wasModified();
@@ -73,14 +70,14 @@ void MovieActionInsertFrames::redo() {
     std::unique_lock<std::mutex> lock(movie_inputs->input_list_mutex);
 
     emit movie_inputs->inputsToBeInserted(first_frame, last_frame);
-    
+
     if (new_frames.empty()) {
         AllInputs ai;
         ai.clear();
-        movie_inputs->input_list.insert(movie_inputs->input_list.begin() + first_frame, last_frame-first_frame+1, ai);
+        movie_inputs->input_list.insert(first_frame, last_frame-first_frame+1, ai);
     }
     else
-        movie_inputs->input_list.insert(movie_inputs->input_list.begin() + first_frame, new_frames.begin(), new_frames.end());
+        movie_inputs->input_list.insert(first_frame, new_frames);
     
     emit movie_inputs->inputsInserted(first_frame, last_frame);
     movie_inputs->wasModified();
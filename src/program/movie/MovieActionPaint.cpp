@@ -57,7 +57,7 @@ MovieActionPaint::MovieActionPaint(uint64_t start_frame, SingleInput si, const s
 void MovieActionPaint::storeOldInputs()
 {
     for (uint64_t frame = first_frame; frame <= last_frame; frame++) {
-        const AllInputs& ai = movie_inputs->getInputs(frame);
+        AllInputs ai = movie_inputs->getInputs(frame);
         old_values.push_back(ai.getInput(input));
     }
 }
@@ -71,7 +71,7 @@ void MovieActionPaint::undo() {
 
     emit movie_inputs->inputsToBeEdited(first_frame, last_frame);
     for (size_t i = 0; i < old_values.size(); i++) {
-        AllInputs& ai = movie_inputs->input_list[first_frame+i];
+        AllInputs& ai = movie_inputs->input_list.modify(first_frame+i);
         ai.setInput(input, old_values[i]);
     }
     emit movie_inputs->inputsEdited(first_frame, last_frame);
@@ -88,13 +88,13 @@ void MovieActionPaint::redo() {
     emit movie_inputs->inputsToBeEdited(first_frame, last_frame);
     if (new_values.empty()) {
         for (uint64_t i = first_frame; i <= last_frame; i++) {
-            AllInputs& ai = movie_inputs->input_list[i];
+            AllInputs& ai = movie_inputs->input_list.modify(i);
             ai.setInput(input, new_value);
         }
     }
     else {
         for (size_t i = 0; i < new_values.size(); i++) {
-            AllInputs& ai = movie_inputs->input_list[first_frame+i];
+            AllInputs& ai = movie_inputs->input_list.modify(first_frame+i);
             ai.setInput(input, new_values[i]);
         }
     }
@@ -29,7 +29,7 @@ MovieActionRemoveFrames::MovieActionRemoveFrames(uint64_t remove_from, uint64_t
     movie_inputs = mi;
     
     for (uint64_t frame = first_frame; frame <= last_frame; frame++) {
-        const AllInputs& ai = movie_inputs->getInputs(frame);
+        AllInputs ai = movie_inputs->getInputs(frame);
         old_frames.push_back(ai);
     }
     
@@ -39,7 +39,7 @@ MovieActionRemoveFrames::MovieActionRemoveFrames(uint64_t remove_from, uint64_t
 void MovieActionRemoveFrames::storeOldInputs()
 {
     for (uint64_t frame = first_frame; frame <= last_frame; frame++) {
-        const AllInputs& ai = movie_inputs->getInputs(frame);
+        AllInputs ai = movie_inputs->getInputs(frame);
         old_frames.push_back(ai);
     }
 }
@@ -49,7 +49,7 @@ void MovieActionRemoveFrames::undo() {
 
     std::unique_lock<std::mutex> lock(movie_inputs->input_list_mutex);
     emit movie_inputs->inputsToBeInserted(first_frame, first_frame+old_frames.size()-1);
-    movie_inputs->input_list.insert(movie_inputs->input_list.begin() + first_frame, old_frames.begin(), old_frames.end());
+    movie_inputs->input_list.insert(first_frame, old_frames);
     emit movie_inputs->inputsInserted(first_frame, first_frame+old_frames.size()-1);
     movie_inputs->wasModified();
 }
@@ -61,10 +61,7 @@ void MovieActionRemoveFrames::redo() {
     
     emit movie_inputs->inputsToBeRemoved(first_frame, last_frame);
 
-    if ((last_frame + 1) == movie_inputs->input_list.size())
-        movie_inputs->input_list.resize(first_frame);
-    else
-        movie_inputs->input_list.erase(movie_inputs->input_list.begin() + first_frame, movie_inputs->input_list.begin() + last_frame + 1);
+    movie_inputs->input_list.erase(first_frame, last_frame - first_frame + 1);
 
     emit movie_inputs->inputsRemoved(first_frame, last_frame);
     movie_inputs->wasModified();
@@ -0,0 +1,449 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MovieArchive.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
+
+static const size_t TAR_BLOCK = 512;
+
+/* Size of a tar record. Archives are padded to a multiple of this size, like
+ * GNU tar does by default */
+static const size_t TAR_RECORD = 20 * TAR_BLOCK;
+
+/* Size of the uncompressed data that each thread compresses into a separate
+ * gzip member */
+static const size_t COMPRESS_CHUNK = 1024 * 1024;
+
+struct TarHeader {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+static_assert(sizeof(TarHeader) == TAR_BLOCK, "Wrong tar header size");
+
+static bool readFile(const std::string& path, std::vector<char>& data)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        return false;
+    }
+
+    data.resize(st.st_size);
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t ret = ::read(fd, data.data() + offset, data.size() - offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            int err = (ret == 0) ? EIO : errno;
+            ::close(fd);
+            errno = err;
+            return false;
+        }
+        offset += ret;
+    }
+
+    ::close(fd);
+    return true;
+}
+
+static uint64_t parseNumber(const char* field, size_t len)
+{
+    /* GNU base-256 encoding for large values */
+    if (static_cast<unsigned char>(field[0]) & 0x80) {
+        uint64_t value = static_cast<unsigned char>(field[0]) & 0x7f;
+        for (size_t i = 1; i < len; i++)
+            value = (value << 8) | static_cast<unsigned char>(field[i]);
+        return value;
+    }
+
+    uint64_t value = 0;
+    size_t i = 0;
+    while (i < len && field[i] == ' ')
+        i++;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+        value = (value << 3) | (field[i] - '0');
+    return value;
+}
+
+static void writeNumber(char* field, size_t len, uint64_t value)
+{
+    /* Values that do not fit in octal digits (e.g. members of 8 GiB or more)
+     * use the GNU base-256 encoding, which parseNumber() accepts */
+    if ((3 * (len - 1) < 64) && (value >> (3 * (len - 1)))) {
+        field[0] = static_cast<char>(0x80);
+        for (size_t i = len - 1; i > 0; i--) {
+            field[i] = static_cast<char>(value & 0xff);
+            value >>= 8;
+        }
+        return;
+    }
+
+    /* Octal value padded with zeros and terminated by a null character */
+    field[len - 1] = '\0';
+    for (size_t i = len - 1; i > 0; i--) {
+        field[i - 1] = '0' + (value & 07);
+        value >>= 3;
+    }
+}
+
+static unsigned int headerChecksum(const TarHeader& header)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&header);
+    unsigned int sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK; i++) {
+        if (i >= offsetof(TarHeader, chksum) && i < offsetof(TarHeader, chksum) + sizeof(header.chksum))
+            sum += ' ';
+        else
+            sum += bytes[i];
+    }
+    return sum;
+}
+
+static std::string fieldString(const char* field, size_t len)
+{
+    return std::string(field, strnlen(field, len));
+}
+
+/* Uncompress a gzip stream, which may contain several concatenated members.
+ * Data after the last member is ignored, like `gzip -q` does. */
+static bool gunzip(const std::vector<char>& in, std::vector<char>& out)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 15 + 16) != Z_OK) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    strm.avail_in = in.size();
+
+    out.clear();
+    size_t out_size = 0;
+    int ret = Z_OK;
+
+    while (true) {
+        if (out.size() - out_size < 65536)
+            out.resize(std::max<size_t>(2 * out.size(), out_size + 65536));
+
+        strm.next_out = reinterpret_cast<Bytef*>(out.data() + out_size);
+        strm.avail_out = out.size() - out_size;
+
+        ret = inflate(&strm, Z_NO_FLUSH);
+        out_size = out.size() - strm.avail_out;
+
+        if (ret == Z_STREAM_END) {
+            /* Continue on the next member if any */
+            if (strm.avail_in >= 2 && strm.next_in[0] == 0x1f && strm.next_in[1] == 0x8b) {
+                inflateReset(&strm);
+                continue;
+            }
+            break;
+        }
+
+        if (ret == Z_BUF_ERROR && strm.avail_in == 0)
+            break;
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            break;
+    }
+
+    inflateEnd(&strm);
+    out.resize(out_size);
+
+    if (ret != Z_STREAM_END) {
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+/* Compress a buffer into a single gzip member */
+static bool gzipChunk(const char* data, size_t size, std::vector<char>& out)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out.resize(deflateBound(&strm, size));
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    strm.avail_in = size;
+    strm.next_out = reinterpret_cast<Bytef*>(out.data());
+    strm.avail_out = out.size();
+
+    int ret = deflate(&strm, Z_FINISH);
+    out.resize(out.size() - strm.avail_out);
+    deflateEnd(&strm);
+
+    return ret == Z_STREAM_END;
+}
+
+/* Compress a buffer into a gzip stream. Large buffers are split into chunks
+ * compressed in parallel into separate gzip members. */
+static bool gzip(const std::vector<char>& in, std::vector<char>& out)
+{
+    size_t chunk_count = std::max<size_t>(1, (in.size() + COMPRESS_CHUNK - 1) / COMPRESS_CHUNK);
+    std::vector<std::vector<char>> chunks(chunk_count);
+
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<bool> success(true);
+    auto worker = [&]() {
+        size_t c;
+        while ((c = next_chunk++) < chunk_count) {
+            size_t offset = c * COMPRESS_CHUNK;
+            size_t size = std::min(COMPRESS_CHUNK, in.size() - offset);
+            if (!gzipChunk(in.data() + offset, size, chunks[c]))
+                success = false;
+        }
+    };
+
+    size_t thread_count = std::min<size_t>(chunk_count, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < thread_count; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    if (!success) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    out.clear();
+    for (const auto& chunk : chunks)
+        out.insert(out.end(), chunk.begin(), chunk.end());
+    return true;
+}
+
+bool MovieArchive::read(const std::string& path)
+{
+    clear();
+
+    std::vector<char> file;
+    if (!readFile(path, file))
+        return false;
+
+    /* Old movie files may not be compressed */
+    if (file.size() >= 2 && static_cast<unsigned char>(file[0]) == 0x1f && static_cast<unsigned char>(file[1]) == 0x8b) {
+        std::vector<char> tar;
+        if (!gunzip(file, tar))
+            return false;
+        return parseTar(tar);
+    }
+
+    return parseTar(file);
+}
+
+bool MovieArchive::parseTar(const std::vector<char>& tar)
+{
+    std::string long_name;
+    size_t offset = 0;
+
+    while (offset + TAR_BLOCK <= tar.size()) {
+        const TarHeader* header = reinterpret_cast<const TarHeader*>(tar.data() + offset);
+        offset += TAR_BLOCK;
+
+        /* End of archive is marked by an empty block */
+        if (header->name[0] == '\0')
+            return true;
+
+        if (parseNumber(header->chksum, sizeof(header->chksum)) != headerChecksum(*header)) {
+            errno = EINVAL;
+            return false;
+        }
+
+        uint64_t size = parseNumber(header->size, sizeof(header->size));
+        if (size > tar.size() - offset) {
+            errno = EINVAL;
+            return false;
+        }
+        const char* data = tar.data() + offset;
+        offset += (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+
+        /* GNU long name for the next member */
+        if (header->typeflag == 'L') {
+            long_name = std::string(data, strnlen(data, size));
+            continue;
+        }
+
+        /* Only regular files are stored */
+        if (header->typeflag != '0' && header->typeflag != '\0') {
+            long_name.clear();
+            continue;
+        }
+
+        Member member;
+        if (!long_name.empty()) {
+            member.name = long_name;
+            long_name.clear();
+        }
+        else {
+            member.name = fieldString(header->name, sizeof(header->name));
+            if (memcmp(header->magic, "ustar", 5) == 0 && header->prefix[0] != '\0')
+                member.name = fieldString(header->prefix, sizeof(header->prefix)) + "/" + member.name;
+        }
+
+        while (member.name.compare(0, 2, "./") == 0)
+            member.name.erase(0, 2);
+
+        member.data.assign(data, data + size);
+        members.push_back(std::move(member));
+    }
+
+    /* Archives without the end blocks are accepted by tar */
+    return true;
+}
+
+void MovieArchive::buildTar(std::vector<char>& tar) const
+{
+    size_t size = 0;
+    for (const auto& member : members)
+        size += TAR_BLOCK + (member.data.size() + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    size += 2 * TAR_BLOCK;
+    size = (size + TAR_RECORD - 1) / TAR_RECORD * TAR_RECORD;
+
+    tar.assign(size, 0);
+
+    time_t now = time(nullptr);
+    size_t offset = 0;
+    for (const auto& member : members) {
+        TarHeader* header = reinterpret_cast<TarHeader*>(tar.data() + offset);
+        memcpy(header->name, member.name.data(), member.name.size());
+        writeNumber(header->mode, sizeof(header->mode), 0644);
+        writeNumber(header->uid, sizeof(header->uid), getuid() & 07777777);
+        writeNumber(header->gid, sizeof(header->gid), getgid() & 07777777);
+        writeNumber(header->size, sizeof(header->size), member.data.size());
+        writeNumber(header->mtime, sizeof(header->mtime), now);
+        header->typeflag = '0';
+        memcpy(header->magic, "ustar", 6);
+        memcpy(header->version, "00", 2);
+
+        /* Checksum is six octal digits, a null character and a space */
+        snprintf(header->chksum, sizeof(header->chksum), "%06o", headerChecksum(*header));
+        header->chksum[7] = ' ';
+
+        offset += TAR_BLOCK;
+        std::copy(member.data.begin(), member.data.end(), tar.begin() + offset);
+        offset += (member.data.size() + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    }
+}
+
+bool MovieArchive::write(const std::string& path) const
+{
+    for (const auto& member : members) {
+        if (member.name.size() >= sizeof(TarHeader::name)) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+    }
+
+    std::vector<char> tar;
+    buildTar(tar);
+
+    std::vector<char> file;
+    if (!gzip(tar, file))
+        return false;
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    size_t offset = 0;
+    while (offset < file.size()) {
+        ssize_t ret = ::write(fd, file.data() + offset, file.size() - offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            return false;
+        }
+        offset += ret;
+    }
+
+    return ::close(fd) == 0;
+}
+
+void MovieArchive::add(const std::string& name, std::vector<char> data)
+{
+    Member member;
+    member.name = name;
+    member.data = std::move(data);
+    members.push_back(std::move(member));
+}
+
+bool MovieArchive::addFile(const std::string& name, const std::string& path)
+{
+    std::vector<char> data;
+    if (!readFile(path, data))
+        return false;
+    add(name, std::move(data));
+    return true;
+}
+
+const MovieArchive::Member* MovieArchive::find(const std::string& name) const
+{
+    for (const auto& member : members)
+        if (member.name == name)
+            return &member;
+    return nullptr;
+}
+
+void MovieArchive::clear()
+{
+    members.clear();
+}
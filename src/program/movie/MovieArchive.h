@@ -0,0 +1,72 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_MOVIEARCHIVE_H_INCLUDED
+#define LIBTAS_MOVIEARCHIVE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/* Reader and writer of movie files, which are gzip-compressed tar archives.
+ *
+ * Members are read from and written to memory buffers, without calling the
+ * external tar and gzip programs. Large archives are compressed by several
+ * threads, each one producing a separate gzip member, and the members are
+ * concatenated, which is still a valid gzip file.
+ */
+class MovieArchive {
+public:
+    struct Member {
+        std::string name;
+        std::vector<char> data;
+    };
+
+    /* Archive members, in order */
+    std::vector<Member> members;
+
+    /* Read and uncompress an archive file. Uncompressed tar files are also
+     * accepted. Returns false if the file could not be read or is not a valid
+     * archive, with errno set */
+    bool read(const std::string& path);
+
+    /* Compress and write all members into an archive file. Returns false if
+     * the file could not be written, with errno set */
+    bool write(const std::string& path) const;
+
+    /* Add a member to the archive */
+    void add(const std::string& name, std::vector<char> data);
+
+    /* Add a member from a file. Returns false if the file could not be read */
+    bool addFile(const std::string& name, const std::string& path);
+
+    /* Return a member from its name, or nullptr if not present */
+    const Member* find(const std::string& name) const;
+
+    void clear();
+
+private:
+    /* Parse an uncompressed tar stream */
+    bool parseTar(const std::vector<char>& tar);
+
+    /* Build an uncompressed tar stream */
+    void buildTar(std::vector<char>& tar) const;
+};
+
+#endif
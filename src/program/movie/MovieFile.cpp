@@ -18,12 +18,14 @@
  */
 
 #include "MovieFile.h"
+#include "MovieArchive.h"
 
 #include "../shared/inputs/AllInputs.h"
 #include "Context.h"
 
-#include <sstream>
+#include <fstream>
 #include <iostream>
+#include <cstring>
 #include <fcntl.h> // O_RDONLY, O_WRONLY, O_CREAT
 #include <errno.h>
 #include <unistd.h>
@@ -80,31 +82,36 @@ int MovieFile::extractMovie(const std::string& moviefile)
     std::string configfile = context->config.tempmoviedir + "/config.ini";
     std::string editorfile = context->config.tempmoviedir + "/editor.ini";
     std::string inputfile = context->config.tempmoviedir + "/inputs";
+    std::string trackfile = context->config.tempmoviedir + "/inputs.bin";
     std::string annotationsfile = context->config.tempmoviedir + "/annotations.txt";
     unlink(configfile.c_str());
     unlink(editorfile.c_str());
     unlink(inputfile.c_str());
+    unlink(trackfile.c_str());
     unlink(annotationsfile.c_str());
 
-    /* Build the tar command */
-    std::ostringstream oss;
-    /* Piping gzip -> tar to avoid gzip warnings on old movie files */
-    oss << "gzip -dq < \"";
-    oss << moviefile;
-    oss << "\" | tar -xUf - -C ";
-    oss << context->config.tempmoviedir;
-
-    /* Execute the tar command */
-    // std::cout << oss.str() << std::endl;
-    int ret = system(oss.str().c_str());
-
-    if (!WIFEXITED(ret) || (WEXITSTATUS(ret) != 0))
+    /* Read the archive and write its members into the temp directory */
+    MovieArchive archive;
+    if (!archive.read(moviefile))
         return EBADARCHIVE;
 
+    for (const auto& member : archive.members) {
+        /* Movie members are all at the root of the archive */
+        if (member.name.find('/') != std::string::npos)
+            continue;
+
+        std::string memberfile = context->config.tempmoviedir + "/" + member.name;
+        std::ofstream member_stream(memberfile, std::ofstream::binary | std::ofstream::trunc);
+        member_stream.write(member.data.data(), member.data.size());
+        member_stream.close();
+        if (!member_stream)
+            return EBADARCHIVE;
+    }
+
     /* Check the presence of the inputs and config files */
     if (access(configfile.c_str(), F_OK) != 0)
         return ENOCONFIG;
-    if (access(inputfile.c_str(), F_OK) != 0)
+    if ((access(inputfile.c_str(), F_OK) != 0) && (access(trackfile.c_str(), F_OK) != 0))
         return ENOINPUTS;
 
     return 0;
@@ -181,19 +188,14 @@ int MovieFile::saveMovie(const std::string& moviefile, uint64_t nb_frames)
     annotations->save();
     editor->save();
 
-    /* Build the tar command */
-    std::ostringstream oss;
-    oss << "tar -czUf \"";
-    oss << moviefile;
-    oss << "\" -C ";
-    oss << context->config.tempmoviedir;
-    oss << " inputs config.ini editor.ini annotations.txt";
-
-    /* Execute the tar command */
-    // std::cout << oss.str() << std::endl;
-    int ret = system(oss.str().c_str());
+    /* Build the archive from the files of the temp directory */
+    MovieArchive archive;
+    for (const std::string& name : {inputs->fileName(), std::string("config.ini"), std::string("editor.ini"), std::string("annotations.txt")}) {
+        if (!archive.addFile(name, context->config.tempmoviedir + "/" + name))
+            return EBADARCHIVE;
+    }
 
-    if (!WIFEXITED(ret) || (WEXITSTATUS(ret) != 0))
+    if (!archive.write(moviefile))
         return EBADARCHIVE;
 
     return 0;
@@ -230,7 +232,7 @@ void MovieFile::copyFrom(const MovieFile& movie)
 
 void MovieFile::setLockedInputs(AllInputs& inp)
 {
-    const AllInputs& movie_inputs = inputs->getInputs();
+    AllInputs movie_inputs = inputs->getInputs();
     editor->setLockedInputs(inp, movie_inputs);
 }
 
@@ -259,7 +261,7 @@ void MovieFile::applyAutoHoldFire()
             
             /* When autohold an analog value, we take the previous value */
             if (si.isAnalog() && (context->framecount > 0)) {
-                const AllInputs& old_ai = inputs->getInputs(context->framecount - 1);
+                AllInputs old_ai = inputs->getInputs(context->framecount - 1);
                 value = old_ai.getInput(si);
             }
 
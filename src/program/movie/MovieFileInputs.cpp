@@ -38,6 +38,8 @@
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <cstdio>
+#include <unistd.h>
 
 MovieFileInputs::MovieFileInputs(Context* c) : context(c)
 {
@@ -84,14 +86,33 @@ void MovieFileInputs::load()
 
     /* Clear structures */
     input_list.clear();
-    
-    /* Open the input file and parse each line to fill our input list */
-    std::string input_file = context->config.tempmoviedir + "/inputs";
-    std::ifstream input_stream(input_file);
-    
-    InputSerialization::readInputs(input_stream, input_list);
 
-    input_stream.close();
+    /* Use the binary input track if present. Its blocks are stored as is,
+     * and only decoded when accessed. */
+    std::string track_file = context->config.tempmoviedir + "/inputs.bin";
+    InputTrack input_track;
+    if (input_track.open(track_file)) {
+        for (uint64_t b = 0; b < input_track.nbBlocks(); b++) {
+            size_t size;
+            const uint8_t* data = input_track.blockData(b, size);
+            input_list.appendBlock(data, size, input_track.blockFrames(b));
+        }
+        input_track.close();
+    }
+    else {
+        if (access(track_file.c_str(), F_OK) == 0)
+            std::cerr << "Could not read the input track " << track_file << std::endl;
+
+        /* Open the input file and parse each line to fill our input list */
+        std::string input_file = context->config.tempmoviedir + "/inputs";
+        std::ifstream input_stream(input_file);
+
+        std::vector<AllInputs> frames;
+        InputSerialization::readInputs(input_stream, frames);
+        input_list.insert(0, frames);
+
+        input_stream.close();
+    }
 
     movie_changelog->clear();
     emit inputsReset();
@@ -100,15 +121,44 @@ void MovieFileInputs::load()
 
 void MovieFileInputs::save()
 {
+    std::string input_file = context->config.tempmoviedir + "/" + fileName();
+    std::vector<AllInputs> block_inputs;
+    uint64_t block = UINT64_MAX;
+
+    if (context->config.movie_binary_inputs) {
+        /* Write into another file first, so that the previous track is kept
+         * if writing fails */
+        std::string tmp_file = input_file + ".tmp";
+        InputTrackWriter writer;
+        if (!writer.open(tmp_file)) {
+            std::cerr << "Could not create the input track " << tmp_file << std::endl;
+            return;
+        }
+
+        for (uint64_t f = 0; f < input_list.size(); f++)
+            writer.push(input_list.peek(f, block_inputs, block));
+
+        if (!writer.close() || (rename(tmp_file.c_str(), input_file.c_str()) != 0)) {
+            std::cerr << "Could not write the input track " << input_file << std::endl;
+            unlink(tmp_file.c_str());
+        }
+        return;
+    }
+
     /* Format and write input frames into the input file */
-    std::string input_file = context->config.tempmoviedir + "/inputs";
     std::ofstream input_stream(input_file, std::ofstream::trunc);
 
-    InputSerialization::writeInputs(input_stream, input_list);
+    for (uint64_t f = 0; f < input_list.size(); f++)
+        InputSerialization::writeFrame(input_stream, input_list.peek(f, block_inputs, block));
 
     input_stream.close();
 }
 
+std::string MovieFileInputs::fileName() const
+{
+    return context->config.movie_binary_inputs ? "inputs.bin" : "inputs";
+}
+
 uint64_t MovieFileInputs::nbFrames()
 {
     return input_list.size();
@@ -156,12 +206,12 @@ int MovieFileInputs::setInputs(const AllInputs& inputs, uint64_t pos, bool keep_
     }
 }
 
-const AllInputs& MovieFileInputs::getInputs()
+AllInputs MovieFileInputs::getInputs()
 {
     return getInputs(context->framecount);
 }
 
-const AllInputs& MovieFileInputs::getInputs(uint64_t pos)
+AllInputs MovieFileInputs::getInputs(uint64_t pos)
 {
     std::unique_lock<std::mutex> lock(input_list_mutex);
 
@@ -170,17 +220,20 @@ const AllInputs& MovieFileInputs::getInputs(uint64_t pos)
     }
 
     /* Special case for zero framerate */
-    if (input_list[pos].misc) {
-        if (!input_list[pos].misc->framerate_num)
-            input_list[pos].misc->framerate_num = framerate_num;
-        if (!input_list[pos].misc->framerate_den)
-            input_list[pos].misc->framerate_den = framerate_den;
+    AllInputs ai = input_list[pos];
+    if (ai.misc && (!ai.misc->framerate_num || !ai.misc->framerate_den)) {
+        AllInputs& modified_ai = input_list.modify(pos);
+        if (!modified_ai.misc->framerate_num)
+            modified_ai.misc->framerate_num = framerate_num;
+        if (!modified_ai.misc->framerate_den)
+            modified_ai.misc->framerate_den = framerate_den;
+        return modified_ai;
     }
 
-    return input_list[pos];
+    return ai;
 }
 
-const AllInputs& MovieFileInputs::getInputsUnprotected(uint64_t pos)
+AllInputs MovieFileInputs::getInputsUnprotected(uint64_t pos)
 {
     return input_list[pos];
 }
@@ -234,8 +287,11 @@ void MovieFileInputs::extractInputs(std::set<SingleInput> &set)
 {
     std::unique_lock<std::mutex> lock(input_list_mutex);
 
-    for (const AllInputs &ai : input_list) {
-        ai.extractInputs(set);
+    std::vector<AllInputs> block_inputs;
+    uint64_t block = UINT64_MAX;
+
+    for (uint64_t f = 0; f < input_list.size(); f++) {
+        input_list.peek(f, block_inputs, block).extractInputs(set);
     }
 }
 
@@ -244,8 +300,8 @@ void MovieFileInputs::copyFrom(const MovieFileInputs* movie_inputs)
     std::unique_lock<std::mutex> lock(input_list_mutex);
 
     emit inputsToBeReset();
-    input_list.resize(movie_inputs->input_list.size());
-    std::copy(movie_inputs->input_list.begin(), movie_inputs->input_list.end(), input_list.begin());
+    /* Only shares the packed chunks of inputs */
+    input_list = movie_inputs->input_list;
     movie_changelog->clear();
     emit inputsReset();
 }
@@ -257,14 +313,12 @@ void MovieFileInputs::close()
 
 bool MovieFileInputs::isEqual(const MovieFileInputs* movie, unsigned int start_frame, unsigned int end_frame) const
 {
-    /* Not equal if a size is greater */
-    if (end_frame > input_list.size())
-        return false;
-
-    if (end_frame > movie->input_list.size())
-        return false;
+    return input_list.isEqual(movie->input_list, start_frame, end_frame);
+}
 
-    return std::equal(movie->input_list.begin() + start_frame, movie->input_list.begin() + end_frame, input_list.begin() + start_frame);
+uint64_t MovieFileInputs::firstDifference(const MovieFileInputs* movie, uint64_t start_frame, uint64_t end_frame) const
+{
+    return input_list.firstDifference(movie->input_list, start_frame, end_frame);
 }
 
 void MovieFileInputs::wasModified()
@@ -325,8 +379,12 @@ void MovieFileInputs::updateLength()
     int64_t increment_tv_nsec = 1000000000LL * (int64_t)(cur_framerate_den % cur_framerate_num) / cur_framerate_num;
     int64_t fractional_increment = 1000000000LL * (int64_t)(cur_framerate_den % cur_framerate_num) % cur_framerate_num;
     int64_t fractional_part = 0;
-    
-    for (const AllInputs &ai : input_list) {
+
+    std::vector<AllInputs> block_inputs;
+    uint64_t block = UINT64_MAX;
+
+    for (uint64_t f = 0; f < input_list.size(); f++) {
+        const AllInputs &ai = input_list.peek(f, block_inputs, block);
 
         uint32_t new_framerate_num = framerate_num;
         uint32_t new_framerate_den = framerate_den;
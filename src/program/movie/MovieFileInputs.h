@@ -21,6 +21,7 @@
 #define LIBTAS_MOVIEFILEINPUTS_H_INCLUDED
 
 #include "ConcurrentQueue.h"
+#include "InputStore.h"
 #include "../shared/inputs/AllInputs.h"
 
 #include <QtCore/QObject>
@@ -72,12 +73,16 @@ public:
     void clear();
 
     /* Import the inputs into a list, and all the parameters.
-     * Returns 0 if no error, or a negative value if an error occured */
+     * Returns 0 if no error, or a negative value if an error occured.
+     * Blocks of a binary input track are stored without being decoded. */
     void load();
 
     /* Write the inputs into a file and compress to the whole moviefile */
     void save();
 
+    /* Name of the inputs file inside the moviefile, depending on the format */
+    std::string fileName() const;
+
     /* Get the number of frames of the current movie */
     uint64_t nbFrames();
 
@@ -91,13 +96,13 @@ public:
     int setInputs(const AllInputs& inputs);
 
     /* Load inputs from a certain frame */
-    const AllInputs& getInputs(uint64_t pos);
+    AllInputs getInputs(uint64_t pos);
 
     /* Load inputs from the current frame */
-    const AllInputs& getInputs();
+    AllInputs getInputs();
 
     /* Don't lock because it is locked already */
-    const AllInputs& getInputsUnprotected(uint64_t pos);
+    AllInputs getInputsUnprotected(uint64_t pos);
 
     /* Clear a range of frame inputs */
     void clearInputs(int minFrame, int maxFrame);
@@ -134,6 +139,10 @@ public:
      * specified range of frames */
     bool isEqual(const MovieFileInputs* movie, unsigned int start_frame, unsigned int end_frame) const;
 
+    /* Return the first frame inside a specified range where inputs differ
+     * from another movie, or the end of the range if there is none */
+    uint64_t firstDifference(const MovieFileInputs* movie, uint64_t start_frame, uint64_t end_frame) const;
+
     /* Helper function called when the movie has been modified */
     void wasModified();
 
@@ -158,7 +167,7 @@ private:
     unsigned int framerate_num, framerate_den;
     
     /* The list of inputs */
-    std::vector<AllInputs> input_list;
+    InputStore input_list;
 
     /* We need to protect the input list access, because both the main and UI
      * threads can read and write to the list */
@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <string>
 #include <cstdint>
+#include <map>
 
 /* Holds the base address for executable and each loaded library */
 namespace BaseAddresses {
@@ -46,6 +47,9 @@ namespace BaseAddresses {
     /* Return the memory section of the mapped game executable */    
     std::pair<uintptr_t,uintptr_t> getExecutableSection();
 
+    /* Return base and end addresses of all stored files */
+    const std::map<std::string,std::pair<uintptr_t,uintptr_t>>& getAllAddresses();
+
     /* Get the file and offset from an address */
     std::string getFileAndOffset(uintptr_t addr, off_t &offset);
 
@@ -24,6 +24,9 @@
 #include <cstdio>
 #include <inttypes.h>
 #include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 /* Cast once the compared values to the appropriate type */
 static MemValueType compare_value;
@@ -33,6 +36,12 @@ typedef bool (*compare_t)(const MemValueType*);
 static compare_t compare_method;
 
 static int value_type;
+static int value_size;
+static int alignment;
+
+/* Scan a sequence of values, see CompareOperations::scan() */
+typedef void (*scan_t)(const uint8_t* data, const uint8_t* old, int count, uint64_t* masks);
+static scan_t scan_method;
 
 #define DEFINE_CHECK_TYPED(T) \
 static bool check_equal_##T(const MemValueType* value) \
@@ -110,56 +119,343 @@ static bool check_equal_string(const MemValueType* value)
     return 0 == strncmp(value->v_cstr, compare_value.v_cstr, RAM_ARRAY_MAX_SIZE);
 }
 
-void CompareOperations::init(int vt, CompareOperator compare_operator, MemValueType compare_v, MemValueType different_v)
+/* Scan kernels are specialized at compile time for each value type, operator
+ * and alignment, so that the comparison is inlined inside the scan loop.
+ * Values are processed by blocks of 64, producing one bitmask per block. */
+
+template <typename T, CompareOperator op>
+static inline bool compare_scalar(T value, T compare, T different)
+{
+    switch (op) {
+        case CompareOperator::Equal:
+            return value == compare;
+        case CompareOperator::NotEqual:
+            return value != compare;
+        case CompareOperator::Less:
+            return value < compare;
+        case CompareOperator::Greater:
+            return value > compare;
+        case CompareOperator::LessEqual:
+            return value <= compare;
+        case CompareOperator::GreaterEqual:
+            return value >= compare;
+        case CompareOperator::Different:
+            return (value - compare) == different;
+    }
+    return false;
+}
+
+template <typename T, CompareOperator op, int Stride>
+static inline uint64_t scan_block(const uint8_t* data, const uint8_t* old, int n, T compare, T different)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < n; i++) {
+        T value;
+        memcpy(&value, data + i*Stride, sizeof(T));
+        if (old)
+            memcpy(&compare, old + i*Stride, sizeof(T));
+        mask |= static_cast<uint64_t>(compare_scalar<T, op>(value, compare, different)) << i;
+    }
+    return mask;
+}
+
+template <typename T, CompareOperator op, int Stride>
+static void scan_scalar(const uint8_t* data, const uint8_t* old, int count, uint64_t* masks)
+{
+    T compare, different;
+    memcpy(&compare, &compare_value, sizeof(T));
+    memcpy(&different, &different_value, sizeof(T));
+
+    for (int b = 0; b < count; b += 64) {
+        int n = (count - b) < 64 ? (count - b) : 64;
+        masks[b/64] = scan_block<T, op, Stride>(data + b*Stride, old ? (old + b*Stride) : nullptr, n, compare, different);
+    }
+}
+
+/* Vector comparison, written with the compiler vector extensions so that it
+ * can be shared between instruction sets. Vectors are passed by reference so
+ * that this function does not depend on the vector calling convention. */
+template <CompareOperator op, typename V, typename M>
+static inline __attribute__((always_inline)) void compare_vector(const V& value, const V& compare, const V& different, M& mask)
+{
+    switch (op) {
+        case CompareOperator::Equal:
+            mask = value == compare;
+            break;
+        case CompareOperator::NotEqual:
+            mask = value != compare;
+            break;
+        case CompareOperator::Less:
+            mask = value < compare;
+            break;
+        case CompareOperator::Greater:
+            mask = value > compare;
+            break;
+        case CompareOperator::LessEqual:
+            mask = value <= compare;
+            break;
+        case CompareOperator::GreaterEqual:
+            mask = value >= compare;
+            break;
+        case CompareOperator::Different:
+            mask = (value - compare) == different;
+            break;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Extract one bit per element of a comparison mask */
+__attribute__((target("avx2"))) static inline uint32_t movemask_avx2(__m256i mask, int size)
+{
+    switch (size) {
+        case 1:
+            return _mm256_movemask_epi8(mask);
+        case 2: {
+            /* Packing works on each 128-bit lane, so elements 0-7 end up in
+             * bytes 0-7 and elements 8-15 in bytes 16-23 */
+            uint32_t m = _mm256_movemask_epi8(_mm256_packs_epi16(mask, mask));
+            return (m & 0xff) | ((m >> 8) & 0xff00);
+        }
+        case 4:
+            return _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+        default:
+            return _mm256_movemask_pd(_mm256_castsi256_pd(mask));
+    }
+}
+
+__attribute__((target("sse2"))) static inline uint32_t movemask_sse2(__m128i mask, int size)
+{
+    switch (size) {
+        case 1:
+            return _mm_movemask_epi8(mask);
+        case 2:
+            return _mm_movemask_epi8(_mm_packs_epi16(mask, mask)) & 0xff;
+        case 4:
+            return _mm_movemask_ps(_mm_castsi128_ps(mask));
+        default:
+            return _mm_movemask_pd(_mm_castsi128_pd(mask));
+    }
+}
+
+/* Kernels for values that are aligned on their size, which are contiguous in
+ * memory, so that 32 or 16 bytes can be compared at once */
+template <typename T, CompareOperator op>
+__attribute__((target("avx2"))) static void scan_packed_avx2(const uint8_t* data, const uint8_t* old, int count, uint64_t* masks)
+{
+    typedef T V __attribute__((vector_size(32)));
+    const int N = 32 / sizeof(T);
+
+    T compare, different;
+    memcpy(&compare, &compare_value, sizeof(T));
+    memcpy(&different, &different_value, sizeof(T));
+
+    V compare_v, different_v;
+    for (int i = 0; i < N; i++) {
+        compare_v[i] = compare;
+        different_v[i] = different;
+    }
+
+    int b = 0;
+    for (; b + 64 <= count; b += 64) {
+        uint64_t mask = 0;
+        for (int k = 0; k < 64 / N; k++) {
+            V value_v;
+            memcpy(&value_v, data + (b + k*N)*sizeof(T), sizeof(V));
+            if (old)
+                memcpy(&compare_v, old + (b + k*N)*sizeof(T), sizeof(V));
+            decltype(value_v == compare_v) mask_v;
+            compare_vector<op>(value_v, compare_v, different_v, mask_v);
+            mask |= static_cast<uint64_t>(movemask_avx2(reinterpret_cast<__m256i>(mask_v), sizeof(T))) << (k*N);
+        }
+        masks[b/64] = mask;
+    }
+
+    if (b < count)
+        masks[b/64] = scan_block<T, op, sizeof(T)>(data + b*sizeof(T), old ? (old + b*sizeof(T)) : nullptr, count - b, compare, different);
+}
+
+template <typename T, CompareOperator op>
+__attribute__((target("sse2"))) static void scan_packed_sse2(const uint8_t* data, const uint8_t* old, int count, uint64_t* masks)
+{
+    typedef T V __attribute__((vector_size(16)));
+    const int N = 16 / sizeof(T);
+
+    T compare, different;
+    memcpy(&compare, &compare_value, sizeof(T));
+    memcpy(&different, &different_value, sizeof(T));
+
+    V compare_v, different_v;
+    for (int i = 0; i < N; i++) {
+        compare_v[i] = compare;
+        different_v[i] = different;
+    }
+
+    int b = 0;
+    for (; b + 64 <= count; b += 64) {
+        uint64_t mask = 0;
+        for (int k = 0; k < 64 / N; k++) {
+            V value_v;
+            memcpy(&value_v, data + (b + k*N)*sizeof(T), sizeof(V));
+            if (old)
+                memcpy(&compare_v, old + (b + k*N)*sizeof(T), sizeof(V));
+            decltype(value_v == compare_v) mask_v;
+            compare_vector<op>(value_v, compare_v, different_v, mask_v);
+            mask |= static_cast<uint64_t>(movemask_sse2(reinterpret_cast<__m128i>(mask_v), sizeof(T))) << (k*N);
+        }
+        masks[b/64] = mask;
+    }
+
+    if (b < count)
+        masks[b/64] = scan_block<T, op, sizeof(T)>(data + b*sizeof(T), old ? (old + b*sizeof(T)) : nullptr, count - b, compare, different);
+}
+
+#endif
+
+/* Fallback for array and string types, calling the comparison method on each value */
+static void scan_generic(const uint8_t* data, const uint8_t* old, int count, uint64_t* masks)
+{
+    /* Only copy the size of old values, so that we don't read past the end of
+     * the old memory, and keep the array size stored in the last byte */
+    MemValueType saved_value = compare_value;
+
+    for (int b = 0; b < count; b += 64) {
+        int n = (count - b) < 64 ? (count - b) : 64;
+        uint64_t mask = 0;
+        for (int i = 0; i < n; i++) {
+            int offset = (b + i)*alignment;
+            if (old)
+                memcpy(&compare_value, old + offset, value_size);
+            mask |= static_cast<uint64_t>(compare_method(reinterpret_cast<const MemValueType*>(data + offset))) << i;
+        }
+        masks[b/64] = mask;
+    }
+
+    compare_value = saved_value;
+}
+
+template <typename T, CompareOperator op>
+static scan_t select_scan()
+{
+    if (alignment == static_cast<int>(sizeof(T))) {
+        /* Vector subtraction wraps around for types smaller than int, while
+         * the scalar version promotes the operands, so keep the latter */
+        if ((op == CompareOperator::Different) && (sizeof(T) < sizeof(int)))
+            return &scan_scalar<T, op, sizeof(T)>;
+
+#if defined(__x86_64__) || defined(__i386__)
+        static bool isAVX2Supported = __builtin_cpu_supports("avx2");
+        if (isAVX2Supported)
+            return &scan_packed_avx2<T, op>;
+        return &scan_packed_sse2<T, op>;
+#else
+        return &scan_scalar<T, op, sizeof(T)>;
+#endif
+    }
+
+    switch (alignment) {
+        case 1:
+            return &scan_scalar<T, op, 1>;
+        case 2:
+            return &scan_scalar<T, op, 2>;
+        case 4:
+            return &scan_scalar<T, op, 4>;
+    }
+    return &scan_generic;
+}
+
+template <typename T>
+static scan_t select_scan(CompareOperator compare_operator)
+{
+    switch (compare_operator) {
+        case CompareOperator::Equal:
+            return select_scan<T, CompareOperator::Equal>();
+        case CompareOperator::NotEqual:
+            return select_scan<T, CompareOperator::NotEqual>();
+        case CompareOperator::Less:
+            return select_scan<T, CompareOperator::Less>();
+        case CompareOperator::Greater:
+            return select_scan<T, CompareOperator::Greater>();
+        case CompareOperator::LessEqual:
+            return select_scan<T, CompareOperator::LessEqual>();
+        case CompareOperator::GreaterEqual:
+            return select_scan<T, CompareOperator::GreaterEqual>();
+        case CompareOperator::Different:
+            return select_scan<T, CompareOperator::Different>();
+    }
+    return &scan_generic;
+}
+
+void CompareOperations::init(int vt, int align, CompareOperator compare_operator, MemValueType compare_v, MemValueType different_v)
 {
     value_type = vt;
+    alignment = align;
     compare_value = compare_v;
     different_value = different_v;
+
+    if (value_type == RamArray)
+        value_size = compare_value.v_array[RAM_ARRAY_MAX_SIZE];
+    else if (value_type == RamCString)
+        value_size = strlen(compare_value.v_cstr);
+    else
+        value_size = MemValue::type_size(value_type);
     
     /* Initialize the comparaison method and values */
     switch(value_type) {
         case RamChar:
             DEFINE_COMPARE_METHOD_TYPED(int8_t)
+            scan_method = select_scan<int8_t>(compare_operator);
             break;
         case RamUnsignedChar:
             DEFINE_COMPARE_METHOD_TYPED(uint8_t)
+            scan_method = select_scan<uint8_t>(compare_operator);
             break;
         case RamShort:
             DEFINE_COMPARE_METHOD_TYPED(int16_t)
+            scan_method = select_scan<int16_t>(compare_operator);
             break;
         case RamUnsignedShort:
             DEFINE_COMPARE_METHOD_TYPED(uint16_t)
+            scan_method = select_scan<uint16_t>(compare_operator);
             break;
         case RamInt:
             DEFINE_COMPARE_METHOD_TYPED(int32_t)
+            scan_method = select_scan<int32_t>(compare_operator);
             break;
         case RamUnsignedInt:
             DEFINE_COMPARE_METHOD_TYPED(uint32_t)
+            scan_method = select_scan<uint32_t>(compare_operator);
             break;
         case RamLong:
             DEFINE_COMPARE_METHOD_TYPED(int64_t)
+            scan_method = select_scan<int64_t>(compare_operator);
             break;
         case RamUnsignedLong:
             DEFINE_COMPARE_METHOD_TYPED(uint64_t)
+            scan_method = select_scan<uint64_t>(compare_operator);
             break;
         case RamFloat:
             DEFINE_COMPARE_METHOD_TYPED(float)
+            scan_method = select_scan<float>(compare_operator);
             break;
         case RamDouble:
             DEFINE_COMPARE_METHOD_TYPED(double)
+            scan_method = select_scan<double>(compare_operator);
             break;
         case RamArray:
             compare_method = check_equal_array;
+            scan_method = &scan_generic;
             break;
         case RamCString:
             compare_method = check_equal_string;
+            scan_method = &scan_generic;
             break;
     }
 }
 
 void CompareOperations::init(CompareOperator compare_operator, MemValueType compare_v, MemValueType different_v)
 {
-    init(value_type, compare_operator, compare_v, different_v);
+    init(value_type, alignment, compare_operator, compare_v, different_v);
 }
 
 bool CompareOperations::check_value(const void* value)
@@ -172,3 +468,8 @@ bool CompareOperations::check_previous(const void* value, const void* old_value)
     compare_value = *static_cast<const MemValueType*>(old_value);
     return compare_method(static_cast<const MemValueType*>(value));
 }
+
+void CompareOperations::scan(const void* value, const void* old_value, int count, uint64_t* masks)
+{
+    scan_method(static_cast<const uint8_t*>(value), static_cast<const uint8_t*>(old_value), count, masks);
+}
@@ -26,6 +26,7 @@
 enum class CompareType {
     Previous,
     Value,
+    Pattern, // byte pattern or struct template of the memory scanner
 };
 
 enum class CompareOperator {
@@ -40,7 +41,7 @@ enum class CompareOperator {
 
 namespace CompareOperations {
 
-    void init(int value_type, CompareOperator compare_operator, MemValueType compare_value_db, MemValueType different_value_db);
+    void init(int value_type, int alignment, CompareOperator compare_operator, MemValueType compare_value_db, MemValueType different_value_db);
     void init(CompareOperator compare_operator, MemValueType compare_value_db, MemValueType different_value_db);
 
     /* Compute the comparaison between the content of value and the stored contant value */
@@ -48,6 +49,12 @@ namespace CompareOperations {
 
     /* Compute the comparaison between the content of value and the old value */
     bool check_previous(const void* value, const void* old_value);
+
+    /* Compare `count` values spaced by the alignment, starting at `value`,
+     * with the stored constant value, or with the old values stored with the
+     * same layout if `old_value` is not null. Set one bit per matching value
+     * in `masks`, which must be able to hold (count+63)/64 elements */
+    void scan(const void* value, const void* old_value, int count, uint64_t* masks);
 }
 
 #endif
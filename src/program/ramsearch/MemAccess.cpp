@@ -21,6 +21,11 @@
 
 #include <stdint.h>
 #include <iostream>
+#include <string>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
 #ifdef __unix__
 #include <sys/uio.h>
 #elif defined(__APPLE__) && defined(__MACH__)
@@ -34,6 +39,7 @@ static task_t task;
 
 static pid_t game_pid;
 static int game_addr_size;
+static int mem_fd = -1;
 
 void MemAccess::init(pid_t pid, int addr_size)
 {
@@ -47,11 +53,28 @@ void MemAccess::init(pid_t pid, int addr_size)
 
     game_pid = pid;
     game_addr_size = addr_size;
+
+    if (mem_fd >= 0) {
+        close(mem_fd);
+        mem_fd = -1;
+    }
+
+#ifdef __linux__
+    if (pid) {
+        std::string mem_path = "/proc/" + std::to_string(pid) + "/mem";
+        mem_fd = open(mem_path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+#endif
 }
 
 void MemAccess::fini()
 {
     game_pid = 0;
+
+    if (mem_fd >= 0) {
+        close(mem_fd);
+        mem_fd = -1;
+    }
 }
 
 bool MemAccess::isInited()
@@ -92,6 +115,96 @@ size_t MemAccess::read(void* local_addr, void* remote_addr, size_t size)
 #endif
 }
 
+size_t MemAccess::readBatch(ReadSegment* segments, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        segments[i].read_size = 0;
+
+    if (!game_pid)
+        return 0;
+
+    size_t total_size = 0;
+
+#ifdef __unix__
+    static const int MAX_IOV = IOV_MAX;
+    struct iovec local[MAX_IOV], remote[MAX_IOV];
+
+    size_t first = 0;
+    while (first < count) {
+        /* Fill the vectors, merging contiguous segments */
+        int iov_count = 0;
+        size_t batch_size = 0;
+        size_t last;
+        for (last = first; last < count; last++) {
+            const ReadSegment& seg = segments[last];
+            if ((iov_count > 0) &&
+                (static_cast<char*>(local[iov_count-1].iov_base) + local[iov_count-1].iov_len == seg.local_addr) &&
+                (static_cast<char*>(remote[iov_count-1].iov_base) + remote[iov_count-1].iov_len == seg.remote_addr)) {
+                local[iov_count-1].iov_len += seg.size;
+                remote[iov_count-1].iov_len += seg.size;
+            }
+            else {
+                if (iov_count == MAX_IOV)
+                    break;
+                local[iov_count].iov_base = seg.local_addr;
+                local[iov_count].iov_len = seg.size;
+                remote[iov_count].iov_base = seg.remote_addr;
+                remote[iov_count].iov_len = seg.size;
+                iov_count++;
+            }
+            batch_size += seg.size;
+        }
+
+        ssize_t ret = process_vm_readv(game_pid, local, iov_count, remote, iov_count, 0);
+        if (ret < 0) {
+            /* Only an invalid address can be skipped */
+            if (errno != EFAULT)
+                return total_size;
+            ret = 0;
+        }
+        total_size += ret;
+
+        /* The read stops at the first unreadable address, so assign the read
+         * size to each segment until there */
+        size_t remaining_size = ret;
+        size_t i;
+        for (i = first; i < last; i++) {
+            if (remaining_size < segments[i].size) {
+                segments[i].read_size = remaining_size;
+                break;
+            }
+            segments[i].read_size = segments[i].size;
+            remaining_size -= segments[i].size;
+        }
+
+        /* Continue after the segment that could not be fully read */
+        first = (i < last) ? (i + 1) : last;
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        segments[i].read_size = read(segments[i].local_addr, segments[i].remote_addr, segments[i].size);
+        total_size += segments[i].read_size;
+    }
+#endif
+
+    return total_size;
+}
+
+size_t MemAccess::readFile(void* local_addr, void* remote_addr, size_t size)
+{
+    if (mem_fd < 0)
+        return read(local_addr, remote_addr, size);
+
+    size_t read_size = 0;
+    while (read_size < size) {
+        ssize_t ret = pread(mem_fd, static_cast<char*>(local_addr) + read_size, size - read_size, reinterpret_cast<off_t>(remote_addr) + read_size);
+        if (ret <= 0)
+            break;
+        read_size += ret;
+    }
+    return read_size;
+}
+
 uintptr_t MemAccess::readAddr(void* remote_addr, bool* valid)
 {
     if (game_addr_size == 4) {
@@ -37,6 +37,24 @@ namespace MemAccess {
     size_t read(void* local_addr, void* remote_addr, size_t size);
     size_t readAddr(void* local_addr, bool* valid);
 
+    /* Segment of game memory for batched reads */
+    struct ReadSegment {
+        void* local_addr;
+        void* remote_addr;
+        size_t size;
+        size_t read_size; // number of bytes that could be read
+    };
+
+    /* Read multiple segments of game memory with as few calls as possible,
+     * merging segments that are contiguous both locally and in the game. A
+     * segment that cannot be fully read does not prevent the next segments
+     * from being read. Returns the total number of bytes read */
+    size_t readBatch(ReadSegment* segments, size_t count);
+
+    /* Read a large range of game memory from the memory file of the game
+     * process, stopping at the first unreadable byte */
+    size_t readFile(void* local_addr, void* remote_addr, size_t size);
+
     size_t write(void* local_addr, void* remote_addr, size_t size);    
 }
 
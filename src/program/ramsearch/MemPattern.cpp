@@ -0,0 +1,305 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "MemPattern.h"
+#include "MemValue.h"
+
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
+/* Map a type name of a struct template field to a value type, or -1 */
+static int typeFromName(const std::string& name)
+{
+    if (name == "char" || name == "int8")
+        return RamChar;
+    if (name == "uchar" || name == "uint8" || name == "byte")
+        return RamUnsignedChar;
+    if (name == "short" || name == "int16")
+        return RamShort;
+    if (name == "ushort" || name == "uint16")
+        return RamUnsignedShort;
+    if (name == "int" || name == "int32")
+        return RamInt;
+    if (name == "uint" || name == "uint32")
+        return RamUnsignedInt;
+    if (name == "long" || name == "int64")
+        return RamLong;
+    if (name == "ulong" || name == "uint64")
+        return RamUnsignedLong;
+    if (name == "float")
+        return RamFloat;
+    if (name == "double")
+        return RamDouble;
+    return -1;
+}
+
+/* Parse a value of the given type. Returns false if the whole string is not
+ * a valid value */
+static bool parseValue(const std::string& str, int type, MemValueType& value)
+{
+    if (str.empty())
+        return false;
+
+    const char* begin = str.c_str();
+    char* end = nullptr;
+    value.v_uint64_t = 0;
+
+    switch (type) {
+        case RamFloat:
+            value.v_float = strtof(begin, &end);
+            break;
+        case RamDouble:
+            value.v_double = strtod(begin, &end);
+            break;
+        case RamUnsignedChar:
+        case RamUnsignedShort:
+        case RamUnsignedInt:
+        case RamUnsignedLong:
+            /* Values are little-endian, so that truncating them keeps the
+             * lower bytes */
+            value.v_uint64_t = strtoull(begin, &end, 0);
+            break;
+        default:
+            value.v_int64_t = strtoll(begin, &end, 0);
+            break;
+    }
+
+    return *end == '\0';
+}
+
+/* Parse an offset of a struct template field, with an optional `+` */
+static bool parseOffset(const std::string& str, size_t& offset)
+{
+    const char* begin = str.c_str();
+    if (*begin == '+')
+        begin++;
+    if (!isdigit(*begin))
+        return false;
+
+    char* end = nullptr;
+    offset = strtoull(begin, &end, 0);
+    return *end == '\0';
+}
+
+bool MemPattern::parse(const std::string& str)
+{
+    bytes.clear();
+    mask.clear();
+    default_alignment = 1;
+
+    /* Struct templates start with a type name */
+    std::string first_token;
+    std::istringstream first_iss(str);
+    first_iss >> first_token;
+    if (first_token == "unsigned" || typeFromName(first_token) >= 0) {
+        std::istringstream iss(str);
+        std::string field;
+        size_t offset = 0;
+        while (std::getline(iss, field, ',')) {
+            if (!parseField(field, offset))
+                return false;
+        }
+        return build();
+    }
+
+    /* Byte pattern, with `?` or `??` as wildcards */
+    std::istringstream iss(str);
+    std::string token;
+    while (iss >> token) {
+        if (token == "?" || token == "??") {
+            bytes.push_back(0);
+            mask.push_back(0);
+            continue;
+        }
+
+        if ((token.size() > 2) || !isxdigit(token[0]) || ((token.size() == 2) && !isxdigit(token[1])))
+            return false;
+
+        bytes.push_back(static_cast<uint8_t>(strtoul(token.c_str(), nullptr, 16)));
+        mask.push_back(0xFF);
+    }
+
+    return build();
+}
+
+bool MemPattern::parseField(const std::string& field, size_t& offset)
+{
+    std::istringstream iss(field);
+    std::string token;
+    if (!(iss >> token))
+        return false;
+
+    /* Type, which may be two words for unsigned types */
+    if (token == "unsigned") {
+        std::string type_token;
+        if (!(iss >> type_token))
+            return false;
+        token = "u" + type_token;
+    }
+
+    int type = typeFromName(token);
+    if (type < 0)
+        return false;
+    int type_size = MemValue::type_size(type);
+
+    /* Remaining tokens are the name, value and offset in any order */
+    bool has_name = false;
+    bool has_value = false;
+    bool has_offset = false;
+    MemValueType value;
+    size_t field_offset = 0;
+    while (iss >> token) {
+        if (token == "at") {
+            if (!(iss >> token) || !parseOffset(token, field_offset))
+                return false;
+            has_offset = true;
+        }
+        else if (token[0] == '@') {
+            token.erase(0, 1);
+            if (token.empty() && !(iss >> token))
+                return false;
+            if (!parseOffset(token, field_offset))
+                return false;
+            has_offset = true;
+        }
+        else if (token == "?") {
+            has_value = false;
+        }
+        else {
+            /* Name and value as `name=value` */
+            size_t equal = token.find('=');
+            if (equal != std::string::npos) {
+                if (has_name)
+                    return false;
+                has_name = true;
+                token.erase(0, equal + 1);
+                if (token == "?")
+                    continue;
+                if (!parseValue(token, type, value))
+                    return false;
+                has_value = true;
+            }
+            else if (parseValue(token, type, value)) {
+                has_value = true;
+            }
+            else {
+                if (has_name)
+                    return false;
+                has_name = true;
+            }
+        }
+    }
+
+    /* Place the field after the previous one with natural alignment */
+    if (!has_offset)
+        field_offset = (offset + type_size - 1) / type_size * type_size;
+    offset = field_offset + type_size;
+
+    if (offset > MAX_SIZE)
+        return false;
+
+    if (bytes.size() < offset) {
+        bytes.resize(offset, 0);
+        mask.resize(offset, 0);
+    }
+
+    if (has_value) {
+        const uint8_t* value_bytes = value.v_array;
+        for (int i = 0; i < type_size; i++) {
+            /* Overlapping fields must agree */
+            if (mask[field_offset+i] && (bytes[field_offset+i] != value_bytes[i]))
+                return false;
+            bytes[field_offset+i] = value_bytes[i];
+            mask[field_offset+i] = 0xFF;
+        }
+    }
+
+    default_alignment = std::max(default_alignment, type_size);
+    return true;
+}
+
+bool MemPattern::build()
+{
+    if (bytes.empty() || (bytes.size() > MAX_SIZE))
+        return false;
+
+    auto first = std::find(mask.begin(), mask.end(), 0xFF);
+    if (first == mask.end())
+        return false;
+    auto last = std::find(mask.rbegin(), mask.rend(), 0xFF);
+
+    signature_offset = first - mask.begin();
+    size_t signature_end = mask.rend() - last;
+
+    signature.bytes.assign(bytes.begin() + signature_offset, bytes.begin() + signature_end);
+    signature.mask.assign(mask.begin() + signature_offset, mask.begin() + signature_end);
+    has_wildcards = signature.hasMask();
+    return true;
+}
+
+bool MemPattern::match(const uint8_t* memory) const
+{
+    const uint8_t* signature_memory = memory + signature_offset;
+    size_t signature_size = signature.bytes.size();
+
+    if (!has_wildcards)
+        return memcmp(signature_memory, signature.bytes.data(), signature_size) == 0;
+
+    for (size_t i = 0; i < signature_size; i++)
+        if (signature.mask[i] && (signature_memory[i] != signature.bytes[i]))
+            return false;
+    return true;
+}
+
+const uint8_t* MemPattern::find(const uint8_t* data, size_t count) const
+{
+    static bool isAVX2Supported = __builtin_cpu_supports("avx2");
+
+    /* The searched signature is shifted by the leading wildcards, and the
+     * searchers only read the memory of the signature past their input */
+    uint8_t* input = const_cast<uint8_t*>(data) + signature_offset;
+    uint8_t* end = input + count;
+    size_t signature_size = signature.bytes.size();
+
+    while (input < end) {
+        uint8_t* found;
+        if (signature_size == 1)
+            found = static_cast<uint8_t*>(memchr(input, signature.bytes[0], end - input));
+        else if (isAVX2Supported)
+            found = SigSearch::FindAVX2(input, end - input, signature, has_wildcards);
+        else
+            found = SigSearch::FindCommon(input, end - input, signature, has_wildcards);
+
+        if (!found || (found >= end))
+            return nullptr;
+
+        /* Searchers only check the first and last bytes near the end of
+         * the input, so always check the whole pattern */
+        const uint8_t* position = found - signature_offset;
+        if (match(position))
+            return position;
+
+        input = found + 1;
+    }
+    return nullptr;
+}
@@ -0,0 +1,80 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_MEMPATTERN_H_INCLUDED
+#define LIBTAS_MEMPATTERN_H_INCLUDED
+
+#include "Signature.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/* Pattern of bytes searched in memory, with wildcards. It is built either from
+ * a byte pattern such as "8B 45 ?? 89", or from a struct template which is a
+ * comma-separated list of fields such as "float x, float y, int hp=100 @0x10".
+ * Each field has a type, an optional name, an optional value (unknown or `?`
+ * fields are wildcards) and an optional offset after `@` or `at`. Fields
+ * without offset are placed after the previous one, with natural alignment. */
+class MemPattern {
+    public:
+        /* Maximum size of a pattern, including wildcards */
+        static const size_t MAX_SIZE = 4096;
+
+        /* Build the pattern from a string. Returns false if invalid */
+        bool parse(const std::string& str);
+
+        /* Size of the pattern, including leading and trailing wildcards */
+        size_t size() const {return bytes.size();}
+
+        /* Default alignment of matches, which is the largest field alignment
+         * of a struct template, or one for byte patterns */
+        int alignment() const {return default_alignment;}
+
+        /* Check if the memory, which must hold size() bytes, matches */
+        bool match(const uint8_t* memory) const;
+
+        /* Return the first position in [data, data+count) where the pattern
+         * matches, or nullptr. Memory must be readable up to
+         * data+count+size()-1 */
+        const uint8_t* find(const uint8_t* data, size_t count) const;
+
+    private:
+        /* Parse a single field of a struct template, and add it to the
+         * pattern. Returns false if invalid */
+        bool parseField(const std::string& field, size_t& offset);
+
+        /* Compute the searched signature from the bytes and mask */
+        bool build();
+
+        std::vector<uint8_t> bytes;
+        std::vector<uint8_t> mask; // 0xFF = keep, 0 = wildcard
+
+        /* Searched signature without the leading and trailing wildcards,
+         * because the SIMD search requires its first and last bytes */
+        Signature signature;
+        size_t signature_offset = 0;
+        bool has_wildcards = false;
+
+        int default_alignment = 1;
+};
+
+#endif
@@ -17,39 +17,34 @@
     along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "MemAccess.h"
-#include "MemLayout.h"
 #include "MemScanner.h"
 #include "MemScannerThread.h"
 #include "MemValue.h"
 
-#include <sstream>
-#include <fstream>
+#include <cstring>
 #include <iostream>
+#include <sstream>
 #include <thread>
 
 std::string MemScanner::memscan_path;
-std::string MemScanner::addresses_path;
-std::string MemScanner::values_path;
 
 void MemScanner::init(std::string path)
 {
     memscan_path = path;
-    
-    std::ostringstream ossov;
-    ossov << memscan_path << "/memory.bin";
-    values_path = ossov.str();
-
-    std::ostringstream ossoa;
-    ossoa << memscan_path << "/addresses.bin";
-    addresses_path = ossoa.str();
 }
 
 int MemScanner::first_scan(int mem_flags, int type, int align, CompareType ct, CompareOperator co, MemValueType cv, MemValueType dv, uintptr_t begin_address, uintptr_t end_address)
 {
     value_type = type;
     alignment = align;
-    if (type == RamArray) {
+    if (ct == CompareType::Pattern) {
+        /* Results store the start of the pattern */
+        value_type = RamArray;
+        value_type_size = std::min(pattern.size(), static_cast<size_t>(RAM_ARRAY_MAX_SIZE));
+        if (alignment == 0)
+            alignment = pattern.alignment();
+    }
+    else if (type == RamArray) {
         value_type_size = cv.v_array[RAM_ARRAY_MAX_SIZE];
         if (alignment == 0)
             alignment = 1;
@@ -73,13 +68,13 @@ int MemScanner::first_scan(int mem_flags, int type, int align, CompareType ct, C
     end_address = (end_address + page_mask) & (~page_mask);
 
     /* Read the whole memory layout */
-    std::unique_ptr<MemLayout> memlayout (new MemLayout());
+    std::vector<MemSection> sections;
+    source->getSections(MemSection::MemAll, mem_flags, sections);
 
     memsections.clear();
     
-    MemSection section;
-    total_size = 0;
-    while (memlayout->nextSection(MemSection::MemAll, mem_flags, section)) {
+    uint64_t sections_size = 0;
+    for (MemSection& section : sections) {
         /* Filter for begin/end address here */
         if (section.addr >= end_address)
             continue;
@@ -91,10 +86,14 @@ int MemScanner::first_scan(int mem_flags, int type, int align, CompareType ct, C
         section.size = section.endaddr - section.addr;
             
         memsections.push_back(section);
-        total_size += section.size;
+        sections_size += section.size;
     }
         
-    if (total_size == 0) return MemScannerThread::ENOERROR;
+    /* A first scan starts a new history */
+    if (sections_size == 0) {
+        clear();
+        return MemScannerThread::ENOERROR;
+    }
 
     return scan(true, ct, co, cv, dv);
 }
@@ -108,216 +107,220 @@ int MemScanner::scan(bool first, CompareType ct, CompareOperator co, MemValueTyp
     compare_value = cv;
     different_value = dv;
 
-    CompareOperations::init(value_type, compare_operator, compare_value, different_value);
-
-    /* Split the work between threads */
-    std::vector<MemScannerThread> memscanners;
-    std::vector<std::thread> memscan_threads;
-    uint64_t block_size = (total_size / THREAD_COUNT) & 0xfffffffffffff000;
-
-    size_t beg_region = 0;
-    size_t end_region = 0;
-    uintptr_t beg_address = 0;
-    uintptr_t end_address = 0;
-    size_t cur_region_offset = 0;
-
-    int thread_count = THREAD_COUNT;
-    if (block_size == 0)
-        thread_count = 1;
-    
-    for (int t = 0; t < thread_count-1; t++) {
-        uint64_t cur_block_size = memsections[beg_region].size - cur_region_offset;    
-        while ((cur_block_size < block_size) && (end_region < memsections.size())) {
-            end_region++;
-            cur_block_size += memsections[end_region].size;
-        }
-        
-        cur_region_offset = memsections[end_region].size - (cur_block_size - block_size);
-        end_address = memsections[end_region].addr + cur_region_offset;
-        
-        /* Sanitize beg and end addresses */
-        if (beg_address < memsections[beg_region].addr)
-            beg_address = memsections[beg_region].addr;
-        if (end_address > memsections[end_region].endaddr)
-            end_address = memsections[end_region].endaddr;
-
-        /* Configure the scanner thread */
-        memscanners.emplace_back(*this, beg_region, end_region, beg_address, end_address, t*block_size, block_size);
-        
-        /* Set the beg variables for the next thread */
-        if (cur_block_size == block_size) {
-            /* Nothing left in this section, skip to the beginning of the next section */
-            beg_region = end_region + 1;
-            beg_address = memsections[beg_region].addr;
-        }
-        else {
-            beg_region = end_region;
-            beg_address = end_address;
+    if (compare_type != CompareType::Pattern)
+        CompareOperations::init(value_type, alignment, compare_operator, compare_value, different_value);
+
+    /* A pattern scan following an unknown value scan searches the memory
+     * sections again, which is faster than checking each address */
+    bool last_scan_was_region = (current >= 0) && history[current]->is_region;
+    bool from_sections = first || (last_scan_was_region && (compare_type == CompareType::Pattern));
+
+    /* Split the work into units, which are pulled by the scanner threads */
+    units.clear();
+    if (from_sections) {
+        for (const MemSection& section : memsections) {
+            for (uintptr_t addr = section.addr; addr < section.endaddr; addr += UNIT_SIZE) {
+                ScanUnit unit;
+                unit.begin_address = addr;
+                unit.end_address = std::min(addr + UNIT_SIZE, section.endaddr);
+                unit.section_end = section.endaddr;
+                unit.chunk = 0;
+                units.push_back(std::move(unit));
+            }
         }
     }
-    
-    /* Last scanner thread gets the remaining memory */
-    end_region = memsections.size() - 1;
-    end_address = memsections.back().endaddr;
-    memscanners.emplace_back(*this, beg_region, end_region, beg_address, end_address, (thread_count-1)*block_size, total_size-((thread_count-1)*block_size));
-    
-    /* Start all threads */
-    for (int t = 0; t < thread_count; t++) {
-        if (first) {
-            if (compare_type == CompareType::Previous)
-                memscan_threads.emplace_back(&MemScannerThread::first_region_scan, &memscanners[t]);
-            else
-                memscan_threads.emplace_back(&MemScannerThread::first_address_scan, &memscanners[t]);            
-        }
-        else {
-            if (last_scan_was_region)
-                memscan_threads.emplace_back(&MemScannerThread::next_scan_from_region, &memscanners[t]);
-            else
-                memscan_threads.emplace_back(&MemScannerThread::next_scan_from_address, &memscanners[t]);
+    else {
+        for (size_t c = 0; c < current_chunks().size(); c++) {
+            ScanUnit unit;
+            unit.begin_address = 0;
+            unit.end_address = 0;
+            unit.section_end = 0;
+            unit.chunk = c;
+            units.push_back(std::move(unit));
         }
     }
+    next_unit = 0;
+    processed_size = 0;
+
+    void (MemScannerThread::*scan_unit)(ScanUnit&);
+    if (from_sections) {
+        if (compare_type == CompareType::Previous)
+            scan_unit = &MemScannerThread::first_region_scan;
+        else if (compare_type == CompareType::Pattern)
+            scan_unit = &MemScannerThread::first_pattern_scan;
+        else
+            scan_unit = &MemScannerThread::first_address_scan;
+    }
+    else {
+        if (last_scan_was_region)
+            scan_unit = &MemScannerThread::next_scan_from_region;
+        else
+            scan_unit = &MemScannerThread::next_scan_from_address;
+    }
+
+    size_t thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+        thread_count = DEFAULT_THREAD_COUNT;
+    if (thread_count > units.size())
+        thread_count = units.size();
+    if (thread_count == 0)
+        thread_count = 1;
+
+    /* Start all threads */
+    std::vector<MemScannerThread> memscanners;
+    std::vector<std::thread> memscan_threads;
+    memscanners.reserve(thread_count);
+    for (size_t t = 0; t < thread_count; t++)
+        memscanners.emplace_back(*this);
+    for (size_t t = 0; t < thread_count; t++)
+        memscan_threads.emplace_back(&MemScannerThread::run, &memscanners[t], scan_unit);
 
     /* Update progress bar */
     /* We would normally just join all threads, but we need to update the scan
      * state periodically to update the progress bar. So we check if all
      * scan threads have finished. */
     bool scan_finished = false;
-    uint64_t total_processed_size = 0;
     while (!scan_finished) { 
         scan_finished = true;
-        total_processed_size = 0;
         for (const auto& ms : memscanners) {
-            total_processed_size += ms.processed_memory_size;
             scan_finished &= ms.finished;
         }
-        emit signalProgress(total_processed_size);
+        emit signalProgress(processed_size.load(std::memory_order_relaxed));
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
-    last_scan_was_region = (first && (compare_type == CompareType::Previous));
-
-    /* Wait for the thread to finish, and read error codes. */
-    total_size = 0;
-    total_processed_size = 0;
+    /* Wait for the thread to finish, and read error codes. Other threads
+     * are stopped when one encounters an error, so report the first one */
     int error = 0;
-    for (int t = 0; t < thread_count; t++) {
+    for (size_t t = 0; t < thread_count; t++) {
         memscan_threads[t].join();
 
-        /* If the scanner thread encounter an error, don't read the file */
-        if (memscanners[t].error < 0) {
+        if ((memscanners[t].error < 0) && ((error == 0) || (error == MemScannerThread::ESTOPPED)))
             error = memscanners[t].error;
-            continue;
-        }
-
-        /* Compute total size and processed size (for display) */
-        total_size += memscanners[t].new_memory_size;
-        total_processed_size += memscanners[t].processed_memory_size;
     }
 
-    /* If user requested a stop or an error occured, skip the file merging
-     * and report as if we didn't find any result */
-    if (is_stopped && (error < 0)) {
-        addresses.clear();
-        old_values.clear();
-        total_size = 0;
+    /* If user requested a stop or an error occured, keep the previous
+     * results, or report as if we didn't find any result for first scans */
+    if (error < 0) {
+        units.clear();
+        if (first)
+            clear();
         return error;
     }
 
-    /* Wait for each thread to finish and merge all individual files created
-     * by each thread into a single file, and inside vectors to be displayed. */
-    /* TODO: this can take a bit of time, do this in another thread if we don't
-     * need to display values (above threshold).
-     * Prevent a new search until the file merge is completed */
-    std::ofstream ovfs(values_path, std::ofstream::binary);
-    std::ofstream oafs;
-    if (!last_scan_was_region) {
-        oafs.open(addresses_path, std::ofstream::binary);
+    /* Gather the results of each unit, which are in increasing addresses */
+    std::unique_ptr<ScanResults> results(new ScanResults());
+    results->is_region = first && (compare_type == CompareType::Previous);
+    results->parent = first ? -1 : current;
+    results->description = describe(first);
+    for (auto& unit : units) {
+        for (auto& chunk : unit.results) {
+            results->total_size += chunk->is_region ? chunk->region_size : chunk->values.size();
+            results->chunks.push_back(std::move(chunk));
+        }
     }
+    units.clear();
 
-    /* Reset progress bar to show progression of file merging */
-    emit signalProgress(0);
-    uint64_t cur_size = 0;
+    if (first)
+        history.clear();
+    push_results(std::move(results));
 
-    for (int t = 0; t < thread_count; t++) {
-        const MemScannerThread& mst = memscanners[t];
-        
-        /* For some reason, trying to append an empty file messes up the stream */
-        if (memscanners[t].new_memory_size == 0)
-            continue;
-            
-        /* Append memscan_thread file to unique file */
-        if (!last_scan_was_region) {
-            std::ifstream iafs(mst.addresses_path, std::ios_base::binary);
-            oafs << iafs.rdbuf();
-            uint64_t recorded_size = memscanners[t].new_memory_size * sizeof(uintptr_t) / value_type_size;
-            if (iafs.tellg() != (std::streamoff) recorded_size) {
-                std::cerr << "Mismatch size between recorded (" << recorded_size << ") and file (" <<  iafs.tellg() << ") sizes" << std::endl;
-                error = MemScannerThread::EOUTPUT;
-                break;
-            }
-            if (!oafs) {
-                error = MemScannerThread::EOUTPUT;
-                break;
+    return MemScannerThread::ENOERROR;
+}
+
+void MemScanner::push_results(std::unique_ptr<ScanResults> results)
+{
+    history.push_back(std::move(results));
+    current = history.size() - 1;
+    load_display();
+}
+
+void MemScanner::load_display()
+{
+    /* If the total size is below threshold, load all data (except if region data) */
+    addresses.clear();
+    old_values.clear();
+
+    if ((current < 0) || history[current]->is_region)
+        return;
+
+    if (history[current]->total_size < (DISPLAY_THRESHOLD*value_type_size)) {
+        uint64_t bitmap[ScanChunk::PAGE_BITMAP_WORDS];
+        for (const auto& chunk : history[current]->chunks) {
+            ScanChunk::PageReader reader(*chunk);
+            uintptr_t page;
+            int count;
+            while (reader.next(page, bitmap, count)) {
+                for (int w = 0; w < ScanChunk::PAGE_BITMAP_WORDS; w++) {
+                    for (uint64_t mask = bitmap[w]; mask; mask &= mask - 1) {
+                        uintptr_t addr = page + (w*64 + __builtin_ctzll(mask)) * alignment;
+                        const char* addr_bytes = reinterpret_cast<const char*>(&addr);
+                        addresses.insert(addresses.end(), addr_bytes, addr_bytes + sizeof(uintptr_t));
+                    }
+                }
             }
+            const char* values = reinterpret_cast<const char*>(chunk->values.data());
+            old_values.insert(old_values.end(), values, values + chunk->values.size());
         }
-        std::ifstream ivfs(mst.values_path, std::ios_base::binary);
-        ovfs << ivfs.rdbuf();
-        if (ivfs.tellg() != (std::streamoff) memscanners[t].new_memory_size) {
-            std::cerr << "Mismatch size between recorded (" << memscanners[t].new_memory_size << ") and file (" <<  ivfs.tellg() << ") sizes" << std::endl;
-            error = MemScannerThread::EOUTPUT;
-            break;
-        }
-        if (!ovfs) {
-            error = MemScannerThread::EOUTPUT;
-            break;
-        }
-        
-        if (is_stopped) {
-            error = MemScannerThread::ESTOPPED;
-            break;
-        }
+    }
+}
+
+std::string MemScanner::describe(bool first) const
+{
+    std::ostringstream oss;
 
-        /* Some math to reuse progress bar that has the old size for total */
-        cur_size += memscanners[t].new_memory_size;
-        emit signalProgress(cur_size*total_processed_size/total_size);
+    if (compare_type == CompareType::Pattern) {
+        oss << "pattern";
+        return oss.str();
     }
-    
-    if (error < 0) {
-        addresses.clear();
-        old_values.clear();
-        total_size = 0;
-        return error;
+
+    if (first && (compare_type == CompareType::Previous)) {
+        oss << "unknown";
+        return oss.str();
     }
 
-    /* If the total size is below threshold, load all data (except if region data) */
-    if (last_scan_was_region) return MemScannerThread::ENOERROR;
+    switch (compare_operator) {
+        case CompareOperator::Equal:
+            oss << "== ";
+            break;
+        case CompareOperator::NotEqual:
+            oss << "!= ";
+            break;
+        case CompareOperator::Less:
+            oss << "< ";
+            break;
+        case CompareOperator::Greater:
+            oss << "> ";
+            break;
+        case CompareOperator::LessEqual:
+            oss << "<= ";
+            break;
+        case CompareOperator::GreaterEqual:
+            oss << ">= ";
+            break;
+        case CompareOperator::Different:
+            oss << "differs by " << MemValue::to_string(&different_value, value_type, false, value_type_size) << " from ";
+            break;
+    }
 
-    addresses.clear();
-    old_values.clear();
-    
-    if (total_size < (DISPLAY_THRESHOLD*value_type_size)) {
-        /* Close the streams before reading the files */
-        oafs.close();
-        ovfs.close();
-        
-        std::ifstream iafs(addresses_path, std::ios::in | std::ios::binary);
-        addresses = std::vector<char>(std::istreambuf_iterator<char>(iafs), std::istreambuf_iterator<char>());
+    if (compare_type == CompareType::Previous)
+        oss << "previous";
+    else
+        oss << MemValue::to_string(&compare_value, value_type, false, value_type_size);
 
-        std::ifstream ivfs(values_path, std::ios::in | std::ios::binary);
-        old_values = std::vector<char>(std::istreambuf_iterator<char>(ivfs), std::istreambuf_iterator<char>());
-    }
-    
-    return MemScannerThread::ENOERROR;
+    return oss.str();
 }
 
 uint64_t MemScanner::scan_size() const
 {
-    return total_size;
+    if (current < 0)
+        return 0;
+    return history[current]->total_size;
 }
 
 uint64_t MemScanner::scan_count() const
 {
-    return total_size / value_type_size;
+    return scan_size() / value_type_size;
 }
 
 uint64_t MemScanner::display_scan_count() const
@@ -347,7 +350,7 @@ MemValueType MemScanner::get_current_value(int index) const
 {
     uintptr_t addr = get_address(index);
     MemValueType value;
-    int readValues = MemAccess::read(&value, reinterpret_cast<void*>(addr), value_type_size);
+    int readValues = source->read(&value, reinterpret_cast<void*>(addr), value_type_size);
     if (readValues != value_type_size)
         value.v_uint64_t = 0;
 
@@ -356,8 +359,149 @@ MemValueType MemScanner::get_current_value(int index) const
 
 void MemScanner::clear()
 {
-    total_size = 0;
     addresses.clear();
     old_values.clear();
     memsections.clear();
+    history.clear();
+    current = -1;
+    units.clear();
+}
+
+int MemScanner::history_size() const
+{
+    return history.size();
+}
+
+int MemScanner::current_results() const
+{
+    return current;
+}
+
+const ScanResults& MemScanner::results(int index) const
+{
+    return *history[index];
+}
+
+const std::vector<std::unique_ptr<ScanChunk>>& MemScanner::current_chunks() const
+{
+    static const std::vector<std::unique_ptr<ScanChunk>> no_chunks;
+    if (current < 0)
+        return no_chunks;
+    return history[current]->chunks;
+}
+
+void MemScanner::select_results(int index)
+{
+    if ((index < 0) || (index >= static_cast<int>(history.size())))
+        return;
+
+    current = index;
+    load_display();
+}
+
+/* Read the pages of all result chunks of a scan, with their values */
+class ResultsPageReader {
+    public:
+        ResultsPageReader(const ScanResults& r) : results(r) {}
+
+        /* Decode the next page of results. Returns false at the end */
+        bool next(uintptr_t& page, uint64_t* bitmap, int& count, const uint8_t*& values)
+        {
+            while (chunk < results.chunks.size()) {
+                const ScanChunk& scan_chunk = *results.chunks[chunk];
+                if (!reader) {
+                    reader.reset(new ScanChunk::PageReader(scan_chunk));
+                    value_offset = 0;
+                }
+
+                if (reader->next(page, bitmap, count)) {
+                    values = scan_chunk.values.data() + value_offset;
+                    value_offset += count * scan_chunk.value_size;
+                    return true;
+                }
+
+                reader.reset();
+                chunk++;
+            }
+            return false;
+        }
+
+    private:
+        const ScanResults& results;
+        size_t chunk = 0;
+        std::unique_ptr<ScanChunk::PageReader> reader;
+        size_t value_offset = 0;
+};
+
+int MemScanner::combine_results(int other, bool common)
+{
+    if ((current < 0) || (other < 0) || (other >= static_cast<int>(history.size())) || (other == current))
+        return MemScannerThread::EINPUT;
+
+    const ScanResults& current_results = *history[current];
+    const ScanResults& other_results = *history[other];
+
+    /* Copies of the memory don't store addresses */
+    if (current_results.is_region || other_results.is_region)
+        return MemScannerThread::EINPUT;
+
+    std::unique_ptr<ScanResults> results(new ScanResults());
+    results->parent = current;
+    results->description = std::string(common ? "common with #" : "not in #") + std::to_string(other);
+
+    /* Both results are in increasing addresses, so pages are matched by
+     * reading both at the same time */
+    ResultsPageReader reader(current_results);
+    ResultsPageReader other_reader(other_results);
+
+    uint64_t bitmap[ScanChunk::PAGE_BITMAP_WORDS];
+    uint64_t other_bitmap[ScanChunk::PAGE_BITMAP_WORDS];
+    uint64_t new_bitmap[ScanChunk::PAGE_BITMAP_WORDS];
+    uint8_t memory[ScanChunk::PAGE_SIZE + RAM_ARRAY_MAX_SIZE + 1];
+    uintptr_t page, other_page = 0;
+    int count, other_count;
+    const uint8_t* values;
+    const uint8_t* other_values;
+    bool has_other = other_reader.next(other_page, other_bitmap, other_count, other_values);
+
+    while (reader.next(page, bitmap, count, values)) {
+        while (has_other && (other_page < page))
+            has_other = other_reader.next(other_page, other_bitmap, other_count, other_values);
+
+        bool same_page = has_other && (other_page == page);
+        for (int w = 0; w < ScanChunk::PAGE_BITMAP_WORDS; w++) {
+            uint64_t other_word = same_page ? other_bitmap[w] : 0;
+            new_bitmap[w] = common ? (bitmap[w] & other_word) : (bitmap[w] & ~other_word);
+        }
+
+        /* Place the packed values at their offset in the page. Overlapping
+         * values were read from the same memory, so they agree */
+        for (int w = 0; w < ScanChunk::PAGE_BITMAP_WORDS; w++) {
+            for (uint64_t mask = bitmap[w]; mask; mask &= mask - 1) {
+                int offset = (w*64 + __builtin_ctzll(mask)) * alignment;
+                memcpy(memory + offset, values, value_type_size);
+                values += value_type_size;
+            }
+        }
+
+        if (results->chunks.empty() || (results->chunks.back()->values.size() >= CHUNK_SIZE)) {
+            if (!results->chunks.empty() && (ScanBuffer::memory_usage() > SPILL_THRESHOLD)) {
+                if (!results->chunks.back()->spill(memscan_path))
+                    return MemScannerThread::EOUTPUT;
+            }
+            results->chunks.emplace_back(new ScanChunk(false, 0, value_type_size, alignment));
+        }
+
+        ScanChunk& chunk = *results->chunks.back();
+        size_t values_size = chunk.values.size();
+        chunk.add_page(page, new_bitmap, memory);
+        results->total_size += chunk.values.size() - values_size;
+    }
+
+    /* Remove an empty last chunk */
+    if (!results->chunks.empty() && results->chunks.back()->values.empty())
+        results->chunks.pop_back();
+
+    push_results(std::move(results));
+    return MemScannerThread::ENOERROR;
 }
@@ -21,13 +21,40 @@
 #define LIBTAS_MEMSCANNER_H_INCLUDED
 
 #include "CompareOperations.h"
+#include "MemPattern.h"
 #include "MemSection.h"
+#include "ScanChunk.h"
+#include "ScanSource.h"
 
 #include <QtCore/QObject>
 #include <string>
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <cstdint>
 
+/* Unit of work of a scan, which is a range of memory for first scans, or a
+ * result chunk of the previous scan for subsequent scans */
+struct ScanUnit {
+    uintptr_t begin_address;
+    uintptr_t end_address;
+    uintptr_t section_end; // end of the memory section, for unaligned values
+    size_t chunk; // index of the previous result chunk
+
+    std::vector<std::unique_ptr<ScanChunk>> results; // results of this unit
+};
+
+/* Results of a scan in the scan history. Results are never modified after
+ * the scan, so that the user can go back to any previous scan and filter it
+ * again, making a tree of scans */
+struct ScanResults {
+    std::vector<std::unique_ptr<ScanChunk>> chunks; // result chunks, in increasing addresses
+    uint64_t total_size = 0; // total size of results (in bytes)
+    bool is_region = false; // results are a copy of the memory
+    int parent = -1; // index of the filtered scan results, or -1 for first scans
+    std::string description; // comparison of the scan, shown to the user
+};
+
 /* Store a section of the game memory */
 class MemScanner : public QObject {
     Q_OBJECT
@@ -36,7 +63,9 @@ class MemScanner : public QObject {
         /* Initialize the memory scanner with the memory scan path */
         static void init(std::string path);
 
-        /* First memory scan. Returns 0 if no error, or error code */
+        /* First memory scan. Returns 0 if no error, or error code. When
+         * comparing with the pattern, results are byte arrays of the start of
+         * the pattern, and the value type is ignored */
         int first_scan(int mem_flags, int type, int align, CompareType ct, CompareOperator co, MemValueType cv, MemValueType dv, uintptr_t begin_address, uintptr_t end_address);
 
         /* Generic memory scan method. Returns 0 if no error, or error code */
@@ -64,15 +93,48 @@ class MemScanner : public QObject {
         /* Clear all results */
         void clear();
 
-        /* Array of all memory sections parsed from /proc/self/maps */
+        /* Number of scans in the history */
+        int history_size() const;
+
+        /* Index of the current scan in the history, or -1 if none */
+        int current_results() const;
+
+        /* Scan results of the history with index */
+        const ScanResults& results(int index) const;
+
+        /* Result chunks of the current scan */
+        const std::vector<std::unique_ptr<ScanChunk>>& current_chunks() const;
+
+        /* Make a previous scan of the history the current one. Next scans
+         * filter its results, and the following scans are kept */
+        void select_results(int index);
+
+        /* Filter the current results by keeping the addresses that are also
+         * present (`common` is true) or that are not present in the results
+         * of another scan of the history, without reading the memory.
+         * Returns 0 if no error, or error code */
+        int combine_results(int other, bool common);
+
+        /* Memory that is scanned, which can be changed between scans */
+        std::unique_ptr<ScanSource> source {new ProcessScanSource()};
+
+        /* Array of all memory sections of the scanned memory */
         std::vector<MemSection> memsections;
+
+        /* Work units of the current scan. Threads pull the next unit to
+         * process from `next_unit`, and accumulate the processed size of
+         * memory in `processed_size` for the progress bar */
+        std::vector<ScanUnit> units;
+        std::atomic<size_t> next_unit;
+        std::atomic<uint64_t> processed_size;
         
-        const int THREAD_COUNT = 4;
+        const int DEFAULT_THREAD_COUNT = 4; // when the number of cores is unknown
+        const uintptr_t UNIT_SIZE = 1024*1024; // size of memory ranges of first scans
         const uint64_t DISPLAY_THRESHOLD = 10000; // don't display results when above threshold
+        const uint64_t SPILL_THRESHOLD = 1024*1024*1024; // move results to files when using more memory
+        const size_t CHUNK_SIZE = 1024*1024; // size of values of address result chunks
         
-        static std::string memscan_path; // directory containing all scan files
-        static std::string addresses_path; // output file containing all scan addresses
-        static std::string values_path; // output file containing all scan values
+        static std::string memscan_path; // directory containing files of results that don't fit in memory
         
         int value_type;
         int value_type_size;
@@ -81,11 +143,26 @@ class MemScanner : public QObject {
         MemValueType compare_value;
         MemValueType different_value;
         int alignment;
+
+        /* Pattern searched when comparing with CompareType::Pattern. Later
+         * pattern scans keep the value type of the results */
+        MemPattern pattern;
         bool is_stopped = false;
         
     private:
-        bool last_scan_was_region = true;
-        uint64_t total_size = 0; // total size of the last scan (in bytes)
+        /* History of scan results, and index of the current scan */
+        std::vector<std::unique_ptr<ScanResults>> history;
+        int current = -1;
+
+        /* Add scan results to the history as the current scan */
+        void push_results(std::unique_ptr<ScanResults> results);
+
+        /* Load the addresses and values of the current scan to show to the
+         * user, if below threshold */
+        void load_display();
+
+        /* Description of the comparison of the scan */
+        std::string describe(bool first) const;
 
         std::vector<char> addresses; // scan addresses shown to the user
         std::vector<char> old_values; // scan previous values shown to the user
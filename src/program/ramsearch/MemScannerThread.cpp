@@ -20,481 +20,372 @@
 #include "MemSection.h"
 #include "MemScanner.h"
 #include "MemScannerThread.h"
-#include "MemAccess.h"
 #include "CompareOperations.h"
 
 #include <cstring>
-#include <sstream>
-#include <fstream>
 #include <iostream>
 #include <vector>
-#include <thread>
+#include <algorithm>
 
-#define MEMORY_CHUNK_SIZE 1024*1024
-#define OUTPUT_CHUNK_SIZE 4096
-#define MAX_TYPE_SIZE 8
+#define MAX_TYPE_SIZE (RAM_ARRAY_MAX_SIZE+1)
+#define PAGE_BATCH 128
 
-MemScannerThread::MemScannerThread(MemScanner& ms, int br, int er, uintptr_t ba, uintptr_t ea, off_t mo, uint64_t mem) : memscanner(ms), beg_region(br), end_region(er), beg_address(ba), end_address(ea), memory_offset(mo), memory_size(mem), error(ENOERROR)
+MemScannerThread::MemScannerThread(MemScanner& ms) : memscanner(ms), error(ENOERROR)
 {
     finished = false;
 }
 
-MemScannerThread::~MemScannerThread()
+void MemScannerThread::run(void (MemScannerThread::*scan_unit)(ScanUnit&))
 {
-    if (!addresses_path.empty())
-        std::remove(addresses_path.c_str());
-    if (!values_path.empty())
-        std::remove(values_path.c_str());
+    new_memory.resize(memscanner.UNIT_SIZE+std::max(static_cast<size_t>(MAX_TYPE_SIZE), memscanner.pattern.size()));
+    masks.resize(memscanner.UNIT_SIZE/64);
+
+    /* Units have similar sizes, so pulling them from a shared index keeps
+     * all threads busy until the end */
+    while (true) {
+        size_t u = memscanner.next_unit.fetch_add(1, std::memory_order_relaxed);
+        if (u >= memscanner.units.size())
+            break;
+
+        ScanUnit& unit = memscanner.units[u];
+        (this->*scan_unit)(unit);
+        if (error == ENOERROR)
+            finish_chunk(unit);
+
+        /* Stop the other threads on error */
+        if (error < 0) {
+            memscanner.is_stopped = true;
+            break;
+        }
+
+        if (memscanner.is_stopped) {
+            error = ESTOPPED;
+            break;
+        }
+    }
+    finished = true;
 }
 
-void MemScannerThread::create_output_files()
+int MemScannerThread::value_scan_count(int read_size) const
 {
-    /* Create the files with names from the thread tid */
-    std::ostringstream ossa;
-    ossa << memscanner.memscan_path << "/addresses-" << std::this_thread::get_id() << ".tmp";    
-    addresses_path = ossa.str();
-
-    std::ostringstream ossv;
-    ossv << memscanner.memscan_path << "/memory-" << std::this_thread::get_id() << ".tmp";
-    values_path = ossv.str();
+    /* Values must fit entirely inside the read memory */
+    int last = read_size - memscanner.value_type_size;
+    if (last < 0)
+        return 0;
+    return last / memscanner.alignment + 1;
 }
 
-void MemScannerThread::first_region_scan()
+ScanChunk* MemScannerThread::new_chunk(ScanUnit& unit, bool region, uintptr_t begin_address)
 {
-    create_output_files();    
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-    
-    /* Start searching from beg_address to end_address, which were split evenly
-     * between all threads. Read memory by chunks */
-    uintptr_t cur_beg_addr = beg_address;
-    uintptr_t cur_end_addr;
-    for (int r = beg_region; r <= end_region; r++) {
-        const MemSection& ms = memscanner.memsections[r];
-
-        /* Determine region start and end addresses */
-        if (r > beg_region) cur_beg_addr = ms.addr;
-    
-        if (r == end_region) {
-            if ((end_address <= ms.addr) || (end_address > ms.endaddr)) {
-                error = EPROCESS;
-                finished = true;
-                std::cerr << "Wrong end address" << std::endl;
-                return;
-            }
-            cur_end_addr = end_address;
-        }
-        else {
-            cur_end_addr = ms.endaddr;
-        }
-        
-        /* Write data */
-        uint8_t chunk[4096];
-        
-        for (uintptr_t ca = cur_beg_addr; ca < cur_end_addr; ca += 4096) {
-            int readValues = MemAccess::read(chunk, reinterpret_cast<void*>(ca), 4096);
-            if (readValues < 0) {
-                std::cerr << "Cound not read game process at address " << std::hex << ca << std::endl;
-                ms.print();
-            }
-            vfs.write((char*)chunk, 4096);
-            if (!vfs) {
-                finished = true;
-                error = EOUTPUT;
-                return;
-            }
-            new_memory_size += 4096;
-            processed_memory_size += 4096;
-            
-            if (memscanner.is_stopped) {
-                finished = true;
-                error = ESTOPPED;
-                return;                
-            }
-        }
-    }
-    finished = true;
+    unit.results.emplace_back(new ScanChunk(region, begin_address, memscanner.value_type_size, memscanner.alignment));
+    return unit.results.back().get();
 }
 
-void MemScannerThread::first_address_scan()
+bool MemScannerThread::finish_chunk(ScanUnit& unit)
 {
-    create_output_files();    
-    std::ofstream afs(addresses_path, std::ofstream::binary);
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-
-    /* Save in files by batches */
-    uintptr_t batch_addresses[OUTPUT_CHUNK_SIZE];
-    uint8_t batch_values[OUTPUT_CHUNK_SIZE*MAX_TYPE_SIZE];
-    int batch_index = 0;
-    
-    /* Start searching from beg_address to end_address, which were split evenly
-     * between all threads. Read memory by chunks */
-    uintptr_t cur_beg_addr = beg_address;
-    uintptr_t cur_end_addr;
-    for (int r = beg_region; r <= end_region; r++) {
-        const MemSection& ms = memscanner.memsections[r];
-
-        /* Determine region start and end addresses */
-        if (r > beg_region) cur_beg_addr = ms.addr;
-    
-        if (r == end_region) {
-            if ((end_address <= ms.addr) || (end_address > ms.endaddr)) {
-                error = EPROCESS;
-                finished = true;
-                std::cerr << "Wrong end address" << std::endl;
-                return;
-            }
-            cur_end_addr = end_address;
-        }
-        else {
-            cur_end_addr = ms.endaddr;
-        }
-        
-        /* Write data */
-        uint8_t chunk[4096+MAX_TYPE_SIZE]; // extra size for unaligned search
-        
-        for (uintptr_t ca = cur_beg_addr; ca < cur_end_addr; ca += 4096) {
-            processed_memory_size += 4096;
-
-            /* Compute how much extra data we need to read to account for unaligned
-             * search, which does not apply for the end of the region */
-            int extra_read = (4096+ca)<cur_end_addr ? memscanner.value_type_size-memscanner.alignment : 0;
-            
-            int readValues = MemAccess::read(chunk, reinterpret_cast<void*>(ca), 4096+extra_read);
-            if (readValues < 0)
-                continue;
-            for (int v = 0; v < readValues-(memscanner.value_type_size-memscanner.alignment); v += memscanner.alignment) {
-                if (CompareOperations::check_value(chunk+v)) {
-                    batch_addresses[batch_index] = ca + v;
-                    memcpy(batch_values+(batch_index*memscanner.value_type_size), chunk+v, memscanner.value_type_size);
-                    batch_index++;
-                    if (batch_index == OUTPUT_CHUNK_SIZE) {
-                        afs.write((char*)batch_addresses, OUTPUT_CHUNK_SIZE*sizeof(uintptr_t));
-                        vfs.write((char*)batch_values, OUTPUT_CHUNK_SIZE*memscanner.value_type_size);
-                        if (!afs || !vfs) {
-                            error = EOUTPUT;
-                            finished = true;
-                            return;
-                        }
-                        new_memory_size += OUTPUT_CHUNK_SIZE*memscanner.value_type_size;
-                        batch_index = 0;
-                    }
-                }
+    if (unit.results.empty())
+        return true;
 
-                if (memscanner.is_stopped) {
-                    error = ESTOPPED;
-                    finished = true;
-                    return;                
-                }
-            }
+    ScanChunk* chunk = unit.results.back().get();
+    if (chunk->values.empty()) {
+        unit.results.pop_back();
+        return true;
+    }
+
+    if (ScanBuffer::memory_usage() > memscanner.SPILL_THRESHOLD) {
+        if (!chunk->spill(memscanner.memscan_path)) {
+            error = EOUTPUT;
+            return false;
         }
     }
-    
-    /* Flush the remaining values on the batch */
-    afs.write((char*)batch_addresses, batch_index*sizeof(uintptr_t));
-    vfs.write((char*)batch_values, batch_index*memscanner.value_type_size);
-    if (!afs || !vfs) {
-        error = EOUTPUT;
-        finished = true;
-        return;
+    return true;
+}
+
+ScanChunk* MemScannerThread::address_chunk(ScanUnit& unit)
+{
+    if (!unit.results.empty() && (unit.results.back()->values.size() < memscanner.CHUNK_SIZE))
+        return unit.results.back().get();
+
+    if (!finish_chunk(unit))
+        return nullptr;
+    return new_chunk(unit, false, 0);
+}
+
+void MemScannerThread::first_region_scan(ScanUnit& unit)
+{
+    size_t size = unit.end_address - unit.begin_address;
+
+    /* Also store the beginning of the next memory for the unaligned values
+     * at the end of the unit */
+    size_t extra_size = std::min(static_cast<uintptr_t>(memscanner.value_type_size - memscanner.alignment), unit.section_end - unit.end_address);
+
+    int readValues = memscanner.source->read(new_memory.data(), reinterpret_cast<void*>(unit.begin_address), size + extra_size);
+    if (readValues < 0)
+        readValues = 0;
+    if ((size_t)readValues < size + extra_size) {
+        if ((size_t)readValues < size)
+            std::cerr << "Could only read " << readValues << " bytes from address range " << std::hex << unit.begin_address << " - " << std::hex << unit.end_address << std::endl;
+        memset(new_memory.data() + readValues, 0, size + extra_size - readValues);
     }
-    new_memory_size += batch_index*memscanner.value_type_size;
-    finished = true;
+
+    ScanChunk* region = new_chunk(unit, true, unit.begin_address);
+    region->add_memory(new_memory.data(), size);
+    region->add_extra_memory(new_memory.data() + size, extra_size);
+
+    memscanner.processed_size.fetch_add(size, std::memory_order_relaxed);
 }
 
-void MemScannerThread::next_scan_from_region()
+void MemScannerThread::first_address_scan(ScanUnit& unit)
 {
-    create_output_files();    
-    std::ofstream afs(addresses_path, std::ofstream::binary);
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-
-    std::vector<uint8_t> new_memory;
-    new_memory.resize(MEMORY_CHUNK_SIZE+memscanner.value_type_size-memscanner.alignment);
-
-    /* If we compare from previous memory, read and process saved memory by
-     * chunks and by region, because all threads access to the same file. */
-    std::vector<char> old_memory;
-    std::ifstream ivfs;
-    if (memscanner.compare_type == CompareType::Previous) {
-        old_memory.resize(MEMORY_CHUNK_SIZE+memscanner.value_type_size-memscanner.alignment);
-        
-        ivfs.open(memscanner.values_path, std::ofstream::binary);
-        ivfs.seekg(memory_offset);
+    int bitmap_words = (4096 / memscanner.alignment + 63) / 64;
+    size_t size = unit.end_address - unit.begin_address;
+    int page_count = size / 4096;
+
+    /* Compute how much extra data we need to read to account for unaligned
+     * search, which does not apply for the end of the section */
+    size_t extra_size = std::min(static_cast<uintptr_t>(memscanner.value_type_size - memscanner.alignment), unit.section_end - unit.end_address);
+
+    /* Read the whole unit with one segment per page, so that an unreadable
+     * page does not prevent reading the next ones */
+    segments.resize(page_count + 1);
+    for (int p = 0; p < page_count; p++)
+        segments[p] = {new_memory.data() + p*4096, reinterpret_cast<void*>(unit.begin_address + p*4096), 4096, 0};
+    segments[page_count] = {new_memory.data() + size, reinterpret_cast<void*>(unit.end_address), extra_size, 0};
+    memscanner.source->readBatch(segments.data(), page_count + 1);
+
+    for (int p = 0; p < page_count; p++) {
+        int readValues = segments[p].read_size;
+        if (readValues == 0)
+            continue;
+        if (readValues == 4096)
+            readValues += std::min(segments[p+1].read_size, extra_size);
+
+        const uint8_t* chunk = new_memory.data() + p*4096;
+        int value_count = value_scan_count(readValues);
+        CompareOperations::scan(chunk, nullptr, value_count, masks.data());
+
+        /* Clear the bitmap past the compared values */
+        int mask_count = (value_count+63)/64;
+        memset(masks.data()+mask_count, 0, (bitmap_words-mask_count)*sizeof(uint64_t));
+
+        ScanChunk* output = address_chunk(unit);
+        if (!output)
+            return;
+        output->add_page(unit.begin_address + p*4096, masks.data(), chunk);
     }
-    
-    /* Save in files by batches */
-    uintptr_t batch_addresses[OUTPUT_CHUNK_SIZE];
-    uint8_t batch_values[OUTPUT_CHUNK_SIZE*MAX_TYPE_SIZE];
-    int batch_index = 0;
-
-    uintptr_t cur_beg_addr = beg_address;
-    uintptr_t cur_end_addr;
-    for (int r = beg_region; r <= end_region; r++) {
-        const MemSection& ms = memscanner.memsections[r];
-
-        /* Determine region start and end addresses */
-        if (r > beg_region) cur_beg_addr = ms.addr;
-    
-        if (r == end_region) {
-            if ((end_address <= ms.addr) || (end_address > ms.endaddr)) {
-                error = EPROCESS;
-                finished = true;
-                std::cerr << "Wrong end address" << std::endl;
-                return;
-            }
-            cur_end_addr = end_address;
+
+    memscanner.processed_size.fetch_add(size, std::memory_order_relaxed);
+}
+
+void MemScannerThread::first_pattern_scan(ScanUnit& unit)
+{
+    const MemPattern& pattern = memscanner.pattern;
+    int bitmap_words = ScanChunk::PAGE_BITMAP_WORDS;
+    size_t size = unit.end_address - unit.begin_address;
+    int page_count = size / 4096;
+
+    /* Matches can end in the next memory, and stored values may be larger
+     * than the pattern when refining previous results */
+    size_t match_size = std::max(pattern.size(), static_cast<size_t>(memscanner.value_type_size));
+    size_t extra_size = std::min(static_cast<uintptr_t>(match_size - 1), unit.section_end - unit.end_address);
+
+    segments.resize(page_count + 1);
+    for (int p = 0; p < page_count; p++)
+        segments[p] = {new_memory.data() + p*4096, reinterpret_cast<void*>(unit.begin_address + p*4096), 4096, 0};
+    segments[page_count] = {new_memory.data() + size, reinterpret_cast<void*>(unit.end_address), extra_size, 0};
+    memscanner.source->readBatch(segments.data(), page_count + 1);
+
+    memset(masks.data(), 0, page_count*bitmap_words*sizeof(uint64_t));
+
+    /* Search each run of consecutive readable pages, so that matches don't
+     * span over unreadable memory */
+    int p = 0;
+    while (p < page_count) {
+        if (segments[p].read_size == 0) {
+            p++;
+            continue;
         }
-        else {
-            cur_end_addr = ms.endaddr;
+
+        int run_begin = p;
+        size_t run_size = 0;
+        while ((p < page_count) && (segments[p].read_size == 4096)) {
+            run_size += 4096;
+            p++;
         }
-        
-        /* Read chunks of memory */
-        while (cur_beg_addr < cur_end_addr) {
-            uint64_t chunk_size = MEMORY_CHUNK_SIZE;
-            uint64_t chunk_size_with_extra = chunk_size + memscanner.value_type_size-memscanner.alignment;
-            if ((cur_end_addr - cur_beg_addr) < chunk_size_with_extra) {
-                chunk_size = cur_end_addr - cur_beg_addr;
-                chunk_size_with_extra = chunk_size;
-            }
-            
-            processed_memory_size += chunk_size;
-
-            if (memscanner.compare_type == CompareType::Previous) {
-                /* We need to seek each time, because we may need to read data
-                 * multiple times due to unaligned search */ 
-                ivfs.seekg(memory_offset);
-                ivfs.read(old_memory.data(), chunk_size_with_extra);
-                memory_offset += chunk_size;
-            }
-            
-            int readValues = MemAccess::read(new_memory.data(), reinterpret_cast<void*>(cur_beg_addr), chunk_size_with_extra);
-            if (readValues < 0) {
-                std::cerr << "Cound not read game process at address " << cur_beg_addr << std::endl;
-                ms.print();
-                cur_beg_addr += chunk_size;
-                continue;
-            }
-            if ((uint64_t)readValues < chunk_size_with_extra) {
-                std::cerr << "Could only read " << readValues << " bytes from address range " << std::hex << cur_beg_addr << " - " << std::hex << (cur_beg_addr+chunk_size_with_extra) << std::endl;
-                ms.print();
-            }
-            
-            for (unsigned int v = 0; v < readValues-(memscanner.value_type_size-memscanner.alignment); v += memscanner.alignment) {
-                if (((memscanner.compare_type == CompareType::Previous) && 
-                    CompareOperations::check_previous(&new_memory[v], &old_memory[v])) ||
-                    ((memscanner.compare_type == CompareType::Value) && 
-                    CompareOperations::check_value(&new_memory[v]))) {
-                    batch_addresses[batch_index] = cur_beg_addr + v;
-                    memcpy(batch_values+(batch_index*memscanner.value_type_size), &new_memory[v], memscanner.value_type_size);
-                    batch_index++;
-                    if (batch_index == OUTPUT_CHUNK_SIZE) {
-                        afs.write((char*)batch_addresses, OUTPUT_CHUNK_SIZE*sizeof(uintptr_t));
-                        vfs.write((char*)batch_values, OUTPUT_CHUNK_SIZE*memscanner.value_type_size);
-                        if (!afs || !vfs) {
-                            error = EOUTPUT;
-                            finished = true;
-                            return;
-                        }
-                        new_memory_size += OUTPUT_CHUNK_SIZE*memscanner.value_type_size;
-                        batch_index = 0;
-                    }
-                }
-                
-                if (memscanner.is_stopped) {
-                    error = ESTOPPED;
-                    finished = true;
-                    return;                
-                }
+        if (p == page_count) {
+            run_size += segments[page_count].read_size;
+        }
+        else if (segments[p].read_size > 0) {
+            run_size += segments[p].read_size;
+            p++;
+        }
+
+        if (run_size < match_size)
+            continue;
+
+        /* Matches must start inside the pages of the run */
+        const uint8_t* run_memory = new_memory.data() + run_begin*4096;
+        uintptr_t run_address = unit.begin_address + run_begin*4096;
+        size_t count = std::min(run_size - match_size + 1, static_cast<size_t>(p - run_begin) * 4096);
+
+        const uint8_t* match = pattern.find(run_memory, count);
+        while (match) {
+            size_t offset = match - run_memory;
+            uintptr_t address = run_address + offset;
+            if ((address % memscanner.alignment) == 0) {
+                int bit = (address % 4096) / memscanner.alignment;
+                masks[(run_begin + offset / 4096) * bitmap_words + bit / 64] |= 1ull << (bit % 64);
             }
-            
-            cur_beg_addr += chunk_size;
+            match = pattern.find(match + 1, count - offset - 1);
         }
     }
-    
-    /* Flush the remaining values on the batch */
-    afs.write((char*)batch_addresses, batch_index*sizeof(uintptr_t));
-    vfs.write((char*)batch_values, batch_index*memscanner.value_type_size);
-    if (!afs || !vfs) {
-        error = EOUTPUT;
-        finished = true;
-        return;
+
+    for (int p = 0; p < page_count; p++) {
+        if (segments[p].read_size == 0)
+            continue;
+
+        ScanChunk* output = address_chunk(unit);
+        if (!output)
+            return;
+        output->add_page(unit.begin_address + p*4096, masks.data() + p*bitmap_words, new_memory.data() + p*4096);
     }
-    new_memory_size += batch_index*memscanner.value_type_size;
-    finished = true;
+
+    memscanner.processed_size.fetch_add(size, std::memory_order_relaxed);
 }
 
-void MemScannerThread::next_scan_from_address()
+void MemScannerThread::next_scan_from_region(ScanUnit& unit)
 {
-    create_output_files();
-    std::ofstream afs(addresses_path, std::ofstream::binary);
-    std::ofstream vfs(values_path, std::ofstream::binary);
-    
-    new_memory_size = 0;
-    processed_memory_size = 0;
-
-    int size_ratio = sizeof(uintptr_t)/memscanner.value_type_size;
-
-    std::vector<uint8_t> new_memory;
-    new_memory.resize(4096+memscanner.value_type_size-memscanner.alignment);
-
-    /* If we compare from previous memory, read and process saved memory by
-     * chunks and by region, because all threads access to the same file. */
-    uint64_t max_chunk_size = MEMORY_CHUNK_SIZE;
-    if (memory_size < max_chunk_size)
-        max_chunk_size = memory_size;
-
-    std::vector<char> old_memory;
-
-    std::ifstream ivfs;
-    if (memscanner.compare_type == CompareType::Previous) {
-        old_memory.resize(max_chunk_size+memscanner.value_type_size-memscanner.alignment);
-        
-        ivfs.open(memscanner.values_path, std::ifstream::binary);
+    int page_words = 4096 / memscanner.alignment / 64;
+
+    /* Previous result chunk is a copy of a contiguous range of memory */
+    const ScanChunk& old_chunk = *memscanner.current_chunks()[unit.chunk];
+    size_t old_size = old_chunk.values.size();
+
+    memscanner.processed_size.fetch_add(old_chunk.region_size, std::memory_order_relaxed);
+
+    int readValues = memscanner.source->read(new_memory.data(), reinterpret_cast<void*>(old_chunk.begin_address), old_size);
+    if (readValues < 0) {
+        std::cerr << "Cound not read game process at address " << std::hex << old_chunk.begin_address << std::endl;
+        return;
+    }
+    if ((size_t)readValues < old_size) {
+        std::cerr << "Could only read " << readValues << " bytes from address range " << std::hex << old_chunk.begin_address << " - " << std::hex << (old_chunk.begin_address+old_size) << std::endl;
     }
 
-    std::vector<uintptr_t> old_addresses;
-    old_addresses.resize(max_chunk_size/memscanner.value_type_size);
-
-    std::ifstream iafs(memscanner.addresses_path, std::ifstream::binary);
-    if (!iafs)
-        std::cerr << "error: could not open file " << memscanner.addresses_path << std::endl;
-    
-    /* Save in files by batches */
-    uintptr_t batch_addresses[OUTPUT_CHUNK_SIZE];
-    uint8_t batch_values[OUTPUT_CHUNK_SIZE*MAX_TYPE_SIZE];
-    int batch_index = 0;
-
-    /* Read chunks of memory */
-    uint64_t remaining_memory_size = memory_size;
-    while (remaining_memory_size > 0) {
-        uint64_t chunk_size = MEMORY_CHUNK_SIZE;
-        uint64_t chunk_size_with_extra = chunk_size + memscanner.value_type_size-memscanner.alignment;
-        if (remaining_memory_size < chunk_size_with_extra) {
-            chunk_size = remaining_memory_size;
-            chunk_size_with_extra = chunk_size;
-        }
-        
-        if (memscanner.compare_type == CompareType::Previous) {
-            /* We need to seek each time, because we may need to read data
-             * multiple times due to unaligned search */ 
-            ivfs.seekg(memory_offset);
-            if (!ivfs)
-                std::cerr << "error: could not seek to offset " << memory_offset << std::endl;
-            ivfs.read(old_memory.data(), chunk_size_with_extra);
-            if (!ivfs) {
-                std::cerr << "error: only " << ivfs.gcount() << " could be read from " << chunk_size << std::endl;
-                error = EINPUT;
-                finished = true;
-                return;
-            }
-        }
-        iafs.seekg(memory_offset*size_ratio);
-        if (!iafs)
-            std::cerr << "error: could not seek to offset " << memory_offset*size_ratio << std::endl;
-
-        iafs.read((char*)old_addresses.data(), chunk_size_with_extra*size_ratio);
-        if (!iafs) {
-            std::cerr << "error: only " << iafs.gcount() << " could be read from " << chunk_size << std::endl;
-            error = EINPUT;
-            finished = true;
+    int value_count = value_scan_count(readValues);
+    CompareOperations::scan(new_memory.data(),
+        (memscanner.compare_type == CompareType::Previous) ? old_chunk.values.data() : nullptr,
+        value_count, masks.data());
+
+    /* Clear the bitmap past the compared values */
+    int page_count = (old_chunk.region_size + 4095) / 4096;
+    int mask_count = (value_count+63)/64;
+    if (mask_count < page_count*page_words)
+        memset(masks.data()+mask_count, 0, (page_count*page_words-mask_count)*sizeof(uint64_t));
+
+    /* Store the results of each memory page */
+    for (int p = 0; p < page_count; p++) {
+        ScanChunk* output = address_chunk(unit);
+        if (!output)
             return;
-        }
-        
-        memory_offset += chunk_size;
-        
-        int addr_beg_index = 0;
-        int addr_end_index = chunk_size / memscanner.value_type_size;
-
-        // std::cout << "Index " << addr_beg_index << " to " << addr_end_index << " for thread " << std::this_thread::get_id() << std::endl;
-        // std::cout << "Chunk " << old_addresses[addr_beg_index] << " to " << old_addresses[addr_end_index-1] << " for thread " << std::this_thread::get_id() << std::endl;
-        
-        while (addr_beg_index < addr_end_index) {
-            
-            /* Look at all old addresses that are inside the same memory page.
-             * From cheatengine source code comments, it is faster to load an 
-             * entire memory page and look at the specific addresses than loading
-             * each individual addresses (because caching), except if you only
-             * need one address in the memory page.
-             */
-            uintptr_t beg_addr = old_addresses[addr_beg_index];
-            uintptr_t beg_page = beg_addr & 0xfffffffffffff000;
-            
-            int addr_cur_index;
-            for (addr_cur_index = addr_beg_index+1; addr_cur_index < addr_end_index; addr_cur_index++) {
-                if ((old_addresses[addr_cur_index] & 0xfffffffffffff000) != beg_page)
-                    break;
+        output->add_page(old_chunk.begin_address + p*4096, masks.data() + p*page_words, new_memory.data() + p*4096);
+    }
+}
+
+void MemScannerThread::next_scan_from_address(ScanUnit& unit)
+{
+    int value_size = memscanner.value_type_size;
+    int bitmap_words = (4096 / memscanner.alignment + 63) / 64;
+
+    /* Pattern scans compare more memory than the stored values */
+    bool is_pattern = (memscanner.compare_type == CompareType::Pattern);
+    int compare_size = is_pattern ? std::max(value_size, static_cast<int>(memscanner.pattern.size())) : value_size;
+
+    /* Keep the array size stored in the last byte of the compared value */
+    MemValueType old_value = memscanner.compare_value;
+
+    const ScanChunk& old_chunk = *memscanner.current_chunks()[unit.chunk];
+    const uint8_t* old_values = old_chunk.values.data();
+
+    memscanner.processed_size.fetch_add(old_chunk.values.size(), std::memory_order_relaxed);
+
+    /* Pages of the previous results are read by batches, each page having
+     * its own slot in the memory buffer */
+    const int page_slot = 4096 + std::max(compare_size, MAX_TYPE_SIZE);
+    const int max_batch_pages = std::min(static_cast<size_t>(PAGE_BATCH), new_memory.size() / page_slot);
+    pages.resize(max_batch_pages);
+    segments.resize(max_batch_pages);
+
+    uint64_t new_bitmap[ScanChunk::PAGE_BITMAP_WORDS];
+
+    ScanChunk::PageReader reader(old_chunk);
+    bool has_pages = true;
+    while (has_pages) {
+        /* Decode a batch of pages, and read from the first to the last value
+         * of each page. From cheatengine source code comments, it is faster
+         * to load an entire memory page and look at the specific addresses
+         * than loading each individual addresses (because caching) */
+        int batch_pages = 0;
+        while (batch_pages < max_batch_pages) {
+            PageResults& pr = pages[batch_pages];
+            if (!reader.next(pr.page, pr.bitmap, pr.count)) {
+                has_pages = false;
+                break;
             }
-            
-            processed_memory_size += (addr_cur_index-addr_beg_index)*memscanner.value_type_size;
 
-            int readValues;
+            pr.first_word = 0;
+            while (!pr.bitmap[pr.first_word])
+                pr.first_word++;
+            pr.last_word = bitmap_words - 1;
+            while (!pr.bitmap[pr.last_word])
+                pr.last_word--;
+            int first_offset = (pr.first_word*64 + __builtin_ctzll(pr.bitmap[pr.first_word])) * memscanner.alignment;
+            int last_offset = (pr.last_word*64 + 63 - __builtin_clzll(pr.bitmap[pr.last_word])) * memscanner.alignment;
+
+            pr.memory = new_memory.data() + batch_pages*page_slot;
+            pr.first_offset = first_offset;
+            segments[batch_pages] = {pr.memory + first_offset, reinterpret_cast<void*>(pr.page + first_offset), static_cast<size_t>(last_offset - first_offset + compare_size), 0};
+            batch_pages++;
+        }
+
+        memscanner.source->readBatch(segments.data(), batch_pages);
 
-            /* If only one address in page, load that address */
-            if ((addr_cur_index-addr_beg_index) == 1) {
-                readValues = MemAccess::read(new_memory.data(), reinterpret_cast<void*>(beg_addr), memscanner.value_type_size);
-            }
-            else {
-                /* Load all values from first to last address */
-                uintptr_t last_addr = old_addresses[addr_cur_index-1];
-                readValues = MemAccess::read(new_memory.data(), reinterpret_cast<void*>(beg_addr), (last_addr-beg_addr)+memscanner.value_type_size);
-            }
-            if (readValues < 0) {
-                addr_beg_index = addr_cur_index;
+        for (int b = 0; b < batch_pages; b++) {
+            const PageResults& pr = pages[b];
+            if (segments[b].read_size == 0) {
+                old_values += pr.count*value_size;
                 continue;
             }
-            
-            for (int i = addr_beg_index; i < addr_cur_index; i++) {
-                uintptr_t addr = old_addresses[i];
-                int mem_index = addr-beg_addr;
-                
-                if (((memscanner.compare_type == CompareType::Previous) && 
-                    CompareOperations::check_previous(&new_memory[mem_index], &old_memory[i*memscanner.value_type_size])) ||
-                    ((memscanner.compare_type == CompareType::Value) && 
-                    CompareOperations::check_value(&new_memory[mem_index]))) {
-                    batch_addresses[batch_index] = addr;
-                    memcpy(batch_values+(batch_index*memscanner.value_type_size), &new_memory[mem_index], memscanner.value_type_size);
-                    batch_index++;
-                    if (batch_index == OUTPUT_CHUNK_SIZE) {
-                        afs.write((char*)batch_addresses, OUTPUT_CHUNK_SIZE*sizeof(uintptr_t));
-                        vfs.write((char*)batch_values, OUTPUT_CHUNK_SIZE*memscanner.value_type_size);
-                        if (!afs || !vfs) {
-                            error = EOUTPUT;
-                            finished = true;
-                            return;
+            int read_end = pr.first_offset + segments[b].read_size;
+
+            memset(new_bitmap, 0, sizeof(new_bitmap));
+            for (int w = pr.first_word; w <= pr.last_word; w++) {
+                for (uint64_t mask = pr.bitmap[w]; mask; mask &= mask - 1) {
+                    int bit = w*64 + __builtin_ctzll(mask);
+                    int offset = bit * memscanner.alignment;
+                    bool match = false;
+                    if ((offset + compare_size) <= read_end) {
+                        if (is_pattern) {
+                            match = memscanner.pattern.match(pr.memory + offset);
+                        }
+                        else if (memscanner.compare_type == CompareType::Previous) {
+                            memcpy(&old_value, old_values, value_size);
+                            match = CompareOperations::check_previous(pr.memory + offset, &old_value);
+                        }
+                        else {
+                            match = CompareOperations::check_value(pr.memory + offset);
                         }
-                        new_memory_size += OUTPUT_CHUNK_SIZE*memscanner.value_type_size;
-                        batch_index = 0;
                     }
-                }
-                
-                if (memscanner.is_stopped) {
-                    error = ESTOPPED;
-                    finished = true;
-                    return;                
+                    if (match)
+                        new_bitmap[w] |= 1ull << (bit % 64);
+                    old_values += value_size;
                 }
             }
-            
-            addr_beg_index = addr_cur_index;
+
+            ScanChunk* output = address_chunk(unit);
+            if (!output)
+                return;
+            output->add_page(pr.page, new_bitmap, pr.memory);
         }
-        remaining_memory_size -= chunk_size;
     }
-    
-    /* Flush the remaining values on the batch */
-    afs.write((char*)batch_addresses, batch_index*sizeof(uintptr_t));
-    vfs.write((char*)batch_values, batch_index*memscanner.value_type_size);
-    if (!afs || !vfs) {
-        error = EOUTPUT;
-        finished = true;
-        return;
-    }
-    new_memory_size += batch_index*memscanner.value_type_size;
-    finished = true;
 }
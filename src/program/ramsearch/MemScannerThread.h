@@ -21,8 +21,11 @@
 #define LIBTAS_MEMSCANNERTHREAD_H_INCLUDED
 
 #include "MemScanner.h"
+#include "MemAccess.h"
+#include "ScanChunk.h"
 
-#include <string>
+#include <vector>
+#include <memory>
 #include <cstdint>
 
 /* Store a section of the game memory */
@@ -37,40 +40,63 @@ class MemScannerThread {
             EPROCESS = -4
         };
         
-        MemScannerThread(MemScanner& ms, int br, int er, uintptr_t ba, uintptr_t ea, off_t mo, uint64_t mem);
-        ~MemScannerThread();
+        MemScannerThread(MemScanner& ms);
+
+        /* Pull and process work units until there is none left */
+        void run(void (MemScannerThread::*scan_unit)(ScanUnit&));
 
-        /* Create the output files that are named based on the scanning thread id */
-        void create_output_files();
-        
         /* First scan that will store the full memory when user set 'unknown value' */
-        void first_region_scan();
+        void first_region_scan(ScanUnit& unit);
 
         /* First scan that will store memory and addresses because user compare
          * to some value */
-        void first_address_scan();
+        void first_address_scan(ScanUnit& unit);
+
+        /* First scan that will store memory and addresses where the pattern
+         * matches */
+        void first_pattern_scan(ScanUnit& unit);
 
         /* Subsequent scan when previous was unknown (full memory) */
-        void next_scan_from_region();
+        void next_scan_from_region(ScanUnit& unit);
 
         /* Subsequent scan when previous had memory and addresses (common case) */
-        void next_scan_from_address();
+        void next_scan_from_address(ScanUnit& unit);
 
-        const MemScanner& memscanner; // Reference to the scanner controller
-        int beg_region, end_region; // Range of memory regions to search into
-        uintptr_t beg_address, end_address; // Range of memory addresses to search into
-        
-        off_t memory_offset; // Offset in the memory file pointed by the starting address
-        uint64_t memory_size; // Size of the memory file portion to process (in bytes)
-        
-        uint64_t new_memory_size; // New size after the scan (in bytes)
-        volatile uint64_t processed_memory_size; // Current processed size (in bytes), used for progress bar
-        
-        std::string addresses_path; // Output file of addresses
-        std::string values_path; // Output file of values
+        /* Number of values to compare in a chunk of read memory */
+        int value_scan_count(int read_size) const;
+
+        MemScanner& memscanner; // Reference to the scanner controller
         
         volatile bool finished; // indicate if scan is finished, used for progress bar
         int error;
+
+    private:
+        /* Start a new result chunk for the unit */
+        ScanChunk* new_chunk(ScanUnit& unit, bool region, uintptr_t begin_address);
+
+        /* Complete the current result chunk of the unit, and move it to a
+         * file if too much memory is used by results. Returns false on error */
+        bool finish_chunk(ScanUnit& unit);
+
+        /* Get the current address result chunk of the unit, starting a new
+         * one when full */
+        ScanChunk* address_chunk(ScanUnit& unit);
+
+        /* Results of a page from the previous scan */
+        struct PageResults {
+            uintptr_t page;
+            int count;
+            int first_word, last_word; // range of non-zero bitmap words
+            int first_offset; // offset of the first value in the page
+            uint8_t* memory; // slot of the memory buffer for this page
+            uint64_t bitmap[ScanChunk::PAGE_BITMAP_WORDS];
+        };
+
+        /* Buffers reused between units */
+        std::vector<uint8_t> new_memory;
+        std::vector<uint64_t> masks;
+        std::vector<MemAccess::ReadSegment> segments;
+        std::vector<PageResults> pages;
 };
 
 #endif
@@ -0,0 +1,276 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "MemTimeline.h"
+#include "../external/lz4.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+static const char timeline_magic[4] = {'L', 'T', 'T', 'L'};
+
+/* Write a column compressed with LZ4 */
+template <typename T>
+static bool writeColumn(std::ofstream& ofs, const std::vector<T>& column)
+{
+    uint64_t raw_size = column.size() * sizeof(T);
+    if (raw_size > LZ4_MAX_INPUT_SIZE) {
+        std::cerr << "Memory timeline column is too large to be saved" << std::endl;
+        return false;
+    }
+
+    std::vector<char> compressed(LZ4_compressBound(raw_size));
+    uint64_t compressed_size = 0;
+    if (raw_size > 0)
+        compressed_size = LZ4_compress_default(reinterpret_cast<const char*>(column.data()), compressed.data(), raw_size, compressed.size());
+
+    ofs.write(reinterpret_cast<const char*>(&raw_size), sizeof(raw_size));
+    ofs.write(reinterpret_cast<const char*>(&compressed_size), sizeof(compressed_size));
+    ofs.write(compressed.data(), compressed_size);
+    return static_cast<bool>(ofs);
+}
+
+/* Read a column compressed with LZ4 */
+template <typename T>
+static bool readColumn(std::ifstream& ifs, std::vector<T>& column)
+{
+    uint64_t raw_size, compressed_size;
+    ifs.read(reinterpret_cast<char*>(&raw_size), sizeof(raw_size));
+    ifs.read(reinterpret_cast<char*>(&compressed_size), sizeof(compressed_size));
+    if (!ifs || (raw_size % sizeof(T)) || (raw_size > LZ4_MAX_INPUT_SIZE) || (compressed_size > static_cast<uint64_t>(LZ4_compressBound(raw_size))))
+        return false;
+
+    std::vector<char> compressed(compressed_size);
+    ifs.read(compressed.data(), compressed_size);
+    if (!ifs)
+        return false;
+
+    column.resize(raw_size / sizeof(T));
+    if (raw_size == 0)
+        return true;
+
+    int size = LZ4_decompress_safe(compressed.data(), reinterpret_cast<char*>(column.data()), compressed_size, raw_size);
+    return (size >= 0) && (static_cast<uint64_t>(size) == raw_size);
+}
+
+/* Encode the addresses of each frame as differences of page or word numbers */
+static std::vector<uint64_t> encodeAddresses(const std::vector<uintptr_t>& addresses, const std::vector<size_t>& begin, int unit)
+{
+    std::vector<uint64_t> column(addresses.size());
+    for (size_t f = 0; f + 1 < begin.size(); f++) {
+        uint64_t previous = 0;
+        for (size_t i = begin[f]; i < begin[f+1]; i++) {
+            uint64_t number = addresses[i] / unit;
+            column[i] = number - previous;
+            previous = number;
+        }
+    }
+    return column;
+}
+
+/* Decode the addresses of each frame. Returns false if counts don't match */
+static bool decodeAddresses(const std::vector<uint64_t>& column, const std::vector<uint32_t>& counts, int unit, std::vector<uintptr_t>& addresses, std::vector<size_t>& begin)
+{
+    addresses.resize(column.size());
+    begin.assign(1, 0);
+    for (uint32_t count : counts) {
+        size_t end = begin.back() + count;
+        if (end > column.size())
+            return false;
+
+        uint64_t number = 0;
+        for (size_t i = begin.back(); i < end; i++) {
+            number += column[i];
+            addresses[i] = static_cast<uintptr_t>(number * unit);
+        }
+        begin.push_back(end);
+    }
+    return begin.back() == column.size();
+}
+
+int MemTimeline::load(const std::string& file)
+{
+    std::ifstream ifs(file, std::ios::binary);
+
+    if (!ifs) return -1;
+
+    MemTimelineHeader header;
+    ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!ifs || (memcmp(header.magic, timeline_magic, sizeof(header.magic)) != 0) ||
+        (header.version != VERSION) || (header.column_count != COLUMN_COUNT)) {
+        std::cerr << "Memory timeline " << file << " has an unknown format" << std::endl;
+        return -1;
+    }
+
+    std::vector<uint32_t> page_counts, word_counts;
+    std::vector<uint64_t> page_column, word_column;
+    if (!readColumn(ifs, frames) || !readColumn(ifs, page_counts) || !readColumn(ifs, word_counts) ||
+        !readColumn(ifs, page_column) || !readColumn(ifs, word_column) ||
+        (frames.size() != header.frame_count) || (page_counts.size() != frames.size()) || (word_counts.size() != frames.size()) ||
+        !decodeAddresses(page_column, page_counts, PAGE_SIZE, pages, page_begin) ||
+        !decodeAddresses(word_column, word_counts, WORD_SIZE, words, word_begin)) {
+        std::cerr << "Memory timeline " << file << " is corrupted" << std::endl;
+        clear();
+        return -1;
+    }
+
+    flags = header.flags;
+    return 0;
+}
+
+int MemTimeline::save(const std::string& file) const
+{
+    std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+
+    if (!ofs) return -1;
+
+    MemTimelineHeader header;
+    memcpy(header.magic, timeline_magic, sizeof(header.magic));
+    header.version = VERSION;
+    header.flags = flags;
+    header.column_count = COLUMN_COUNT;
+    header.frame_count = frames.size();
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<uint32_t> page_counts(frames.size()), word_counts(frames.size());
+    for (size_t f = 0; f < frames.size(); f++) {
+        page_counts[f] = page_begin[f+1] - page_begin[f];
+        word_counts[f] = word_begin[f+1] - word_begin[f];
+    }
+
+    if (!writeColumn(ofs, frames) || !writeColumn(ofs, page_counts) || !writeColumn(ofs, word_counts) ||
+        !writeColumn(ofs, encodeAddresses(pages, page_begin, PAGE_SIZE)) ||
+        !writeColumn(ofs, encodeAddresses(words, word_begin, WORD_SIZE)))
+        return -1;
+
+    return 0;
+}
+
+void MemTimeline::addFrame(uint64_t framecount)
+{
+    frames.push_back(framecount);
+    page_begin.push_back(pages.size());
+    word_begin.push_back(words.size());
+}
+
+void MemTimeline::addPage(uintptr_t addr)
+{
+    pages.push_back(addr);
+    page_begin.back() = pages.size();
+}
+
+void MemTimeline::addWord(uintptr_t addr)
+{
+    words.push_back(addr);
+    word_begin.back() = words.size();
+}
+
+void MemTimeline::clear()
+{
+    frames.clear();
+    page_begin.assign(1, 0);
+    word_begin.assign(1, 0);
+    pages.clear();
+    words.clear();
+}
+
+size_t MemTimeline::frameCount() const
+{
+    return frames.size();
+}
+
+uint64_t MemTimeline::frame(size_t index) const
+{
+    return frames[index];
+}
+
+void MemTimeline::changedAddresses(size_t index, bool w, std::vector<uintptr_t>& addresses) const
+{
+    const std::vector<uintptr_t>& changes = w ? words : pages;
+    const std::vector<size_t>& begin = w ? word_begin : page_begin;
+    addresses.assign(changes.begin() + begin[index], changes.begin() + begin[index+1]);
+}
+
+void MemTimeline::query(const std::vector<uint64_t>& framecounts, int match, bool w, std::vector<uintptr_t>& addresses) const
+{
+    addresses.clear();
+
+    const std::vector<uintptr_t>& changes = w ? words : pages;
+    const std::vector<size_t>& begin = w ? word_begin : page_begin;
+
+    std::vector<uint64_t> selected_frames(framecounts);
+    std::sort(selected_frames.begin(), selected_frames.end());
+
+    /* Gather all changes, with whether they happened on a selected frame */
+    struct Change {
+        uintptr_t address;
+        bool selected;
+
+        bool operator<(const Change& other) const {
+            return address < other.address;
+        }
+    };
+
+    std::vector<Change> all_changes;
+    all_changes.reserve(changes.size());
+    size_t selected_count = 0;
+    for (size_t f = 0; f < frames.size(); f++) {
+        bool selected = std::binary_search(selected_frames.begin(), selected_frames.end(), frames[f]);
+        if (selected)
+            selected_count++;
+        for (size_t i = begin[f]; i < begin[f+1]; i++)
+            all_changes.push_back({changes[i], selected});
+    }
+
+    if (selected_count == 0)
+        return;
+
+    std::stable_sort(all_changes.begin(), all_changes.end());
+
+    /* Count the changes of each address on selected and other frames */
+    for (size_t i = 0; i < all_changes.size(); ) {
+        uintptr_t address = all_changes[i].address;
+        size_t in_count = 0, out_count = 0;
+        for (; (i < all_changes.size()) && (all_changes[i].address == address); i++) {
+            if (all_changes[i].selected)
+                in_count++;
+            else
+                out_count++;
+        }
+
+        bool matched = false;
+        switch (match) {
+            case MATCH_EXACTLY:
+                matched = (in_count == selected_count) && (out_count == 0);
+                break;
+            case MATCH_ALWAYS:
+                matched = (in_count == selected_count);
+                break;
+            case MATCH_ONLY:
+                matched = (out_count == 0);
+                break;
+        }
+
+        if (matched)
+            addresses.push_back(address);
+    }
+}
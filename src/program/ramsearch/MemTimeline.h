@@ -0,0 +1,122 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_MEMTIMELINE_H_INCLUDED
+#define LIBTAS_MEMTIMELINE_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/* Header of memory timeline files. The header is followed by columns, each
+ * one compressed separately with LZ4 and preceded by its raw and compressed
+ * sizes as two uint64_t. Columns are, for each recorded frame:
+ * - the frame count (uint64_t)
+ * - the number of changed pages (uint32_t)
+ * - the number of changed words (uint32_t)
+ * and for all frames, one after the other:
+ * - the page numbers of changed pages, as a difference with the previous
+ *   page of the same frame (uint64_t)
+ * - the word numbers of changed words, as a difference with the previous word
+ *   of the same frame (uint64_t)
+ */
+struct MemTimelineHeader {
+    char magic[4]; // Always "LTTL"
+    uint32_t version;
+    uint32_t flags;
+    uint32_t column_count;
+    uint64_t frame_count;
+};
+
+/* Changes of game memory recorded on a range of frames, and queries about
+ * which addresses changed on which frames */
+class MemTimeline {
+    public:
+        enum Flags {
+            WORDS = 0x01, // changed words were recorded
+        };
+
+        enum Match {
+            MATCH_EXACTLY, // changed on all selected frames, and only them
+            MATCH_ALWAYS, // changed on all selected frames
+            MATCH_ONLY, // changed on some selected frames, and only them
+        };
+
+        enum Column {
+            COLUMN_FRAMES,
+            COLUMN_PAGE_COUNTS,
+            COLUMN_WORD_COUNTS,
+            COLUMN_PAGES,
+            COLUMN_WORDS,
+            COLUMN_COUNT,
+        };
+
+        static const int PAGE_SIZE = 4096;
+        static const int WORD_SIZE = 8;
+        static const uint32_t VERSION = 1;
+
+        /* Load a timeline file. Returns 0 if no error */
+        int load(const std::string& file);
+
+        /* Write a timeline file. Returns 0 if no error */
+        int save(const std::string& file) const;
+
+        /* Start a new recorded frame */
+        void addFrame(uint64_t framecount);
+
+        /* Add a changed page or word to the last recorded frame. Addresses
+         * must be added in increasing order */
+        void addPage(uintptr_t addr);
+        void addWord(uintptr_t addr);
+
+        /* Remove all recorded frames */
+        void clear();
+
+        /* Number of recorded frames */
+        size_t frameCount() const;
+
+        /* Frame count of a recorded frame */
+        uint64_t frame(size_t index) const;
+
+        /* Get the addresses of pages or words that changed on a recorded
+         * frame */
+        void changedAddresses(size_t index, bool words, std::vector<uintptr_t>& addresses) const;
+
+        /* Get the addresses of pages or words whose changes match the list of
+         * selected frame counts, using one of the Match modes. Only recorded
+         * frames are taken into account */
+        void query(const std::vector<uint64_t>& framecounts, int match, bool words, std::vector<uintptr_t>& addresses) const;
+
+        int flags = 0;
+
+    private:
+        std::vector<uint64_t> frames;
+
+        /* Index of the first change of each frame, with an extra element at
+         * the end */
+        std::vector<size_t> page_begin {0};
+        std::vector<size_t> word_begin {0};
+
+        /* Addresses of all changes */
+        std::vector<uintptr_t> pages;
+        std::vector<uintptr_t> words;
+};
+
+#endif
@@ -0,0 +1,258 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "MemTimelineRecorder.h"
+#include "MemTimeline.h"
+#include "MemLayout.h"
+#include "MemAccess.h"
+#define XXH_INLINE_ALL
+#include "../external/xxhash.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Shadow copy of a memory section */
+struct ShadowRegion {
+    uintptr_t endaddr;
+    std::vector<uint64_t> hashes; // hash of each page, when not recording words
+    std::vector<uint64_t> data; // copy of all pages, when recording words
+};
+
+static const int PAGE_SIZE = MemTimeline::PAGE_SIZE;
+static const int PAGE_WORDS = MemTimeline::PAGE_SIZE / MemTimeline::WORD_SIZE;
+static const size_t BATCH_PAGES = 256; // number of pages read at once
+static const uint64_t PAGEMAP_SOFT_DIRTY = 1ULL << 55;
+
+static const int type_flag = (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemHeap | MemSection::MemAnonymousMappingRW | MemSection::MemFileMappingRW | MemSection::MemStack);
+
+static bool recording = false;
+static bool record_words = false;
+static bool use_soft_dirty = false;
+static int pagemap_fd = -1;
+static uint64_t zero_page_hash = 0;
+static std::string timeline_file;
+static MemTimeline timeline;
+static std::map<uintptr_t, ShadowRegion> regions;
+
+/* Read the pagemap entries of a range of pages. If not available, all pages
+ * are marked as soft-dirty */
+static void readPagemap(uintptr_t addr, size_t page_count, std::vector<uint64_t>& entries)
+{
+    entries.resize(page_count);
+    size_t size = page_count * sizeof(uint64_t);
+    off_t offset = static_cast<off_t>(addr / PAGE_SIZE) * sizeof(uint64_t);
+    ssize_t ret = (pagemap_fd >= 0) ? pread(pagemap_fd, entries.data(), size, offset) : -1;
+    if (ret < 0)
+        ret = 0;
+    std::fill(entries.begin() + ret / sizeof(uint64_t), entries.end(), PAGEMAP_SOFT_DIRTY);
+}
+
+/* Compare pages of a region with its shadow copy and update the shadow.
+ * Pages before `known_pages` are only compared if soft-dirty, other pages
+ * are always compared. Changes are added to the timeline if `record` */
+static void scanRegion(uintptr_t addr, ShadowRegion& region, size_t known_pages, bool record)
+{
+    size_t page_count = (region.endaddr - addr) / PAGE_SIZE;
+
+    std::vector<uint64_t> entries;
+    if (use_soft_dirty && (known_pages > 0))
+        readPagemap(addr, known_pages, entries);
+
+    std::vector<uint64_t> buffer(BATCH_PAGES * PAGE_WORDS);
+    std::vector<MemAccess::ReadSegment> segments;
+    std::vector<size_t> segment_pages;
+    segments.reserve(BATCH_PAGES);
+    segment_pages.reserve(BATCH_PAGES);
+
+    size_t p = 0;
+    while (p < page_count) {
+        /* Gather a batch of pages to compare */
+        segments.clear();
+        segment_pages.clear();
+        for (; (p < page_count) && (segments.size() < BATCH_PAGES); p++) {
+            if (use_soft_dirty && (p < known_pages) && !(entries[p] & PAGEMAP_SOFT_DIRTY))
+                continue;
+
+            segments.push_back({&buffer[segments.size() * PAGE_WORDS], reinterpret_cast<void*>(addr + p * PAGE_SIZE), static_cast<size_t>(PAGE_SIZE), 0});
+            segment_pages.push_back(p);
+        }
+
+        MemAccess::readBatch(segments.data(), segments.size());
+
+        for (size_t s = 0; s < segments.size(); s++) {
+            /* Unreadable pages are considered unchanged */
+            if (segments[s].read_size != static_cast<size_t>(PAGE_SIZE))
+                continue;
+
+            size_t page = segment_pages[s];
+            uintptr_t page_addr = addr + page * PAGE_SIZE;
+            const uint64_t* current = &buffer[s * PAGE_WORDS];
+
+            if (record_words) {
+                uint64_t* shadow = &region.data[page * PAGE_WORDS];
+                if (memcmp(current, shadow, PAGE_SIZE) == 0)
+                    continue;
+
+                if (record) {
+                    timeline.addPage(page_addr);
+                    for (int w = 0; w < PAGE_WORDS; w++)
+                        if (current[w] != shadow[w])
+                            timeline.addWord(page_addr + w * MemTimeline::WORD_SIZE);
+                }
+                memcpy(shadow, current, PAGE_SIZE);
+            }
+            else {
+                uint64_t hash = XXH3_64bits(current, PAGE_SIZE);
+                if (hash == region.hashes[page])
+                    continue;
+
+                if (record)
+                    timeline.addPage(page_addr);
+                region.hashes[page] = hash;
+            }
+        }
+    }
+}
+
+/* Update the shadow copy of all game memory, and record changes if `record` */
+static void scanMemory(bool record)
+{
+    std::unique_ptr<MemLayout> memlayout (new MemLayout(MemAccess::getPid()));
+    std::map<uintptr_t, ShadowRegion> new_regions;
+
+    MemSection section;
+    while (memlayout->nextSection(type_flag, 0, section)) {
+        /* Reuse the shadow copy of a section starting at the same address.
+         * New pages are compared with zero-filled pages */
+        ShadowRegion region;
+        size_t known_pages = 0;
+        auto it = regions.find(section.addr);
+        if (it != regions.end()) {
+            region = std::move(it->second);
+            known_pages = std::min(region.endaddr, section.endaddr) - section.addr;
+            known_pages /= PAGE_SIZE;
+        }
+
+        region.endaddr = section.endaddr;
+        size_t page_count = section.size / PAGE_SIZE;
+        if (record_words)
+            region.data.resize(page_count * PAGE_WORDS, 0);
+        else
+            region.hashes.resize(page_count, zero_page_hash);
+
+        /* Without recording, the whole section is read */
+        scanRegion(section.addr, region, record ? known_pages : 0, record);
+        new_regions[section.addr] = std::move(region);
+    }
+
+    regions = std::move(new_regions);
+}
+
+int MemTimelineRecorder::start(const std::string& file, bool words)
+{
+    if (recording)
+        stop();
+
+    if (!MemAccess::isInited())
+        return -1;
+
+    timeline_file = file;
+    record_words = words;
+    timeline.clear();
+    timeline.flags = words ? MemTimeline::WORDS : 0;
+    regions.clear();
+
+    std::vector<uint64_t> zero_page(PAGE_WORDS, 0);
+    zero_page_hash = XXH3_64bits(zero_page.data(), PAGE_SIZE);
+
+    std::string pagemap_path = "/proc/" + std::to_string(MemAccess::getPid()) + "/pagemap";
+    pagemap_fd = open(pagemap_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (pagemap_fd < 0)
+        std::cerr << "Could not open " << pagemap_path << ", all pages will be compared" << std::endl;
+
+    /* Take the first snapshot */
+    use_soft_dirty = false;
+    scanMemory(false);
+
+    /* Soft-dirty bits are only usable if the kernel supports them. Any
+     * recently written page is soft-dirty, so we check for at least one */
+    if (pagemap_fd >= 0) {
+        std::vector<uint64_t> entries;
+        for (const auto& region : regions) {
+            readPagemap(region.first, (region.second.endaddr - region.first) / PAGE_SIZE, entries);
+            if (std::any_of(entries.begin(), entries.end(), [](uint64_t e) { return e & PAGEMAP_SOFT_DIRTY; })) {
+                use_soft_dirty = true;
+                break;
+            }
+        }
+        if (!use_soft_dirty)
+            std::cerr << "Soft-dirty bits are not available, all pages will be compared" << std::endl;
+    }
+
+    recording = true;
+    return 0;
+}
+
+int MemTimelineRecorder::stop()
+{
+    if (!recording)
+        return -1;
+
+    recording = false;
+    regions.clear();
+    if (pagemap_fd >= 0) {
+        close(pagemap_fd);
+        pagemap_fd = -1;
+    }
+
+    int ret = timeline.save(timeline_file);
+    if (ret < 0)
+        std::cerr << "Could not write memory timeline " << timeline_file << std::endl;
+    timeline.clear();
+    return ret;
+}
+
+bool MemTimelineRecorder::isRecording()
+{
+    return recording;
+}
+
+void MemTimelineRecorder::recordFrame(uint64_t framecount)
+{
+    if (!recording)
+        return;
+
+    timeline.addFrame(framecount);
+    scanMemory(true);
+}
+
+void MemTimelineRecorder::resync()
+{
+    if (!recording)
+        return;
+
+    scanMemory(false);
+}
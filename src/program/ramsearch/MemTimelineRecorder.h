@@ -0,0 +1,56 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_MEMTIMELINERECORDER_H_INCLUDED
+#define LIBTAS_MEMTIMELINERECORDER_H_INCLUDED
+
+#include <string>
+#include <cstdint>
+
+/* Record which memory pages, and optionally which words, changed on each
+ * frame. Pages that are not soft-dirty cannot have changed since the last
+ * savestate, so only soft-dirty pages are compared with a shadow copy. The
+ * soft-dirty bits are never cleared here, because incremental savestates
+ * rely on them. */
+namespace MemTimelineRecorder {
+
+    /* Start recording into a timeline file, using a snapshot of the current
+     * game memory. If `words` is set, a full copy of the memory is kept to
+     * record changed words, otherwise only a hash of each page is kept.
+     * Returns 0 if no error */
+    int start(const std::string& file, bool words);
+
+    /* Stop recording and write the timeline file. Returns 0 if no error */
+    int stop();
+
+    bool isRecording();
+
+    /* Record the changes since the last call, must be called at each frame
+     * boundary */
+    void recordFrame(uint64_t framecount);
+
+    /* Take a new snapshot of the game memory without recording changes,
+     * after a savestate was loaded. Saving a state also clears soft-dirty
+     * bits, but only after the frame was recorded, so it does not need a new
+     * snapshot */
+    void resync();
+}
+
+#endif
@@ -0,0 +1,467 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "PointerScanner.h"
+#include "MemAccess.h"
+#include "MemLayout.h"
+#include "BaseAddresses.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <map>
+#include <cstring>
+
+/* Header of pointer map files */
+struct PointerMapHeader {
+    char magic[4]; // Always "LTPM"
+    uint32_t version;
+    uint32_t pointer_size;
+    uint32_t module_count;
+    uint64_t target;
+    uint64_t static_count;
+    uint64_t dynamic_count;
+};
+
+static const char pointer_map_magic[4] = {'L', 'T', 'P', 'M'};
+static const uint32_t pointer_map_version = 1;
+
+/* Link from an address of a chain level to an address of the previous level */
+struct ChainLink {
+    uint32_t parent; // index of the address in the previous level
+    int offset;
+};
+
+/* Link found during the search of a level, before the addresses of the
+ * level are deduplicated */
+struct PendingLink {
+    uintptr_t address;
+    ChainLink link;
+
+    bool operator<(const PendingLink& other) const {
+        return address < other.address;
+    }
+};
+
+/* Static pointer that starts a chain */
+struct ChainRoot {
+    uintptr_t base_address;
+    int level;
+    uint32_t node;
+    int offset;
+};
+
+/* Addresses of a chain level, with the links of each address to the
+ * previous level, stored contiguously */
+struct ChainLevel {
+    std::vector<uintptr_t> addresses;
+    std::vector<size_t> link_begin; // links of address i are [link_begin[i], link_begin[i+1])
+    std::vector<ChainLink> links;
+};
+
+/* Execute `f(thread, begin, end)` on blocks of `count` items from all threads,
+ * each thread pulling the next block when done */
+template <typename F>
+static void parallelBlocks(size_t thread_count, size_t count, size_t block_size, F f)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&](size_t t) {
+        size_t begin;
+        while ((begin = next.fetch_add(block_size, std::memory_order_relaxed)) < count)
+            f(t, begin, std::min(begin + block_size, count));
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < thread_count; t++)
+        threads.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+/* Merge sorted runs into a single sorted array */
+template <typename T>
+static void mergeRuns(std::vector<std::vector<T>>& runs, std::vector<T>& output)
+{
+    output.clear();
+    std::vector<size_t> bounds(1, 0);
+    for (auto& run : runs) {
+        output.insert(output.end(), run.begin(), run.end());
+        bounds.push_back(output.size());
+        std::vector<T>().swap(run);
+    }
+
+    /* Merge runs two by two, until there is one run left */
+    while (bounds.size() > 2) {
+        std::vector<size_t> merged_bounds(1, 0);
+        for (size_t i = 0; i + 2 < bounds.size(); i += 2) {
+            std::inplace_merge(output.begin() + bounds[i], output.begin() + bounds[i+1], output.begin() + bounds[i+2]);
+            merged_bounds.push_back(bounds[i+2]);
+        }
+        /* Odd number of runs, the last one is kept as is */
+        if ((bounds.size() % 2) == 0)
+            merged_bounds.push_back(bounds.back());
+        bounds = std::move(merged_bounds);
+    }
+}
+
+size_t PointerScanner::threadCount(size_t work_count) const
+{
+    size_t thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+        thread_count = DEFAULT_THREAD_COUNT;
+    if (thread_count > work_count)
+        thread_count = work_count;
+    if (thread_count == 0)
+        thread_count = 1;
+    return thread_count;
+}
+
+void PointerScanner::locatePointers()
+{
+    static_pointers.clear();
+    dynamic_pointers.clear();
+
+    std::unique_ptr<MemLayout> memlayout (new MemLayout());
+
+    int type_flag = (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemHeap | MemSection::MemAnonymousMappingRW | MemSection::MemFileMappingRW | MemSection::MemStack);
+    int static_flag = (MemSection::MemDataRW | MemSection::MemBSS | MemSection::MemStack);
+
+    /* Split sections that could contain pointers into blocks, and keep the
+     * ranges of sections that pointers can point to. Pointers to a static
+     * section are skipped. */
+    struct Block {
+        uintptr_t begin;
+        uintptr_t end;
+        bool is_static;
+    };
+    std::vector<Block> blocks;
+    std::vector<std::pair<uintptr_t, uintptr_t>> targets;
+    uint64_t total_size = 0;
+
+    MemSection section;
+    while (memlayout->nextSection(type_flag, 0, section)) {
+        bool is_static = section.type & static_flag;
+        if (!is_static)
+            targets.emplace_back(section.addr, section.endaddr);
+
+        for (uintptr_t addr = section.addr; addr < section.endaddr; addr += UNIT_SIZE)
+            blocks.push_back({addr, std::min(addr + UNIT_SIZE, section.endaddr), is_static});
+        total_size += section.size;
+    }
+
+    if (blocks.empty())
+        return;
+
+    size_t thread_count = threadCount(blocks.size());
+    std::vector<std::vector<PointerEntry>> local_static(thread_count);
+    std::vector<std::vector<PointerEntry>> local_dynamic(thread_count);
+    std::atomic<size_t> next_block(0);
+    std::atomic<uint64_t> processed_size(0);
+    std::atomic<size_t> finished_count(0);
+
+    auto worker = [&](size_t t) {
+        int game_addr_size = MemAccess::getAddrSize();
+
+        /* The following code is a bit awkward to support both 32-bit and
+         * 64-bit pointers while conforming aliasing rules */
+        std::vector<uint64_t> chunk64;
+        std::vector<uint32_t> chunk32;
+        uint8_t* block_memory;
+        if (game_addr_size == 4) {
+            chunk32.resize(UNIT_SIZE/sizeof(uint32_t));
+            block_memory = reinterpret_cast<uint8_t*>(chunk32.data());
+        }
+        else {
+            chunk64.resize(UNIT_SIZE/sizeof(uint64_t));
+            block_memory = reinterpret_cast<uint8_t*>(chunk64.data());
+        }
+        std::vector<MemAccess::ReadSegment> segments(UNIT_SIZE/4096);
+
+        size_t b;
+        while ((b = next_block.fetch_add(1, std::memory_order_relaxed)) < blocks.size()) {
+            const Block& block = blocks[b];
+            std::vector<PointerEntry>& output = block.is_static ? local_static[t] : local_dynamic[t];
+
+            /* Read the whole block with one segment per page, so that an
+             * unreadable page does not prevent reading the next ones */
+            size_t page_count = (block.end - block.begin) / 4096;
+            for (size_t p = 0; p < page_count; p++)
+                segments[p] = {block_memory + p*4096, reinterpret_cast<void*>(block.begin + p*4096), 4096, 0};
+
+            MemAccess::readBatch(segments.data(), page_count);
+
+            for (size_t p = 0; p < page_count; p++) {
+                size_t page_index = p*4096/game_addr_size;
+                size_t value_count = segments[p].read_size/game_addr_size;
+
+                for (size_t i = 0; i < value_count; i++) {
+                    uintptr_t value;
+                    if (game_addr_size == 4)
+                        value = static_cast<uintptr_t>(chunk32[page_index + i]);
+                    else
+                        value = static_cast<uintptr_t>(chunk64[page_index + i]);
+
+                    /* Check if the value could be a pointer, using the fact
+                     * that sections are ordered */
+                    auto it = std::upper_bound(targets.begin(), targets.end(), std::make_pair(value, UINTPTR_MAX));
+                    if ((it == targets.begin()) || (value >= (it-1)->second))
+                        continue;
+
+                    output.push_back({value, block.begin + p*4096 + i*game_addr_size});
+                }
+            }
+
+            processed_size.fetch_add(block.end - block.begin, std::memory_order_relaxed);
+        }
+
+        std::sort(local_static[t].begin(), local_static[t].end());
+        std::sort(local_dynamic[t].begin(), local_dynamic[t].end());
+        finished_count++;
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; t++)
+        threads.emplace_back(worker, t);
+
+    /* Update the progress bar until all threads have finished */
+    while (finished_count.load() < thread_count) {
+        emit signalProgress(static_cast<int>(100 * (static_cast<float>(processed_size.load()) / total_size)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    mergeRuns(local_static, static_pointers);
+    mergeRuns(local_dynamic, dynamic_pointers);
+}
+
+/* Get all chains from a static pointer, following links back to the
+ * searched address */
+static void enumerateChains(const std::vector<ChainLevel>& levels, int level, uint32_t node, uintptr_t base_address, std::vector<int>& offsets, std::vector<PointerChain>& chains)
+{
+    if (level == 0) {
+        chains.emplace_back(base_address, offsets);
+        return;
+    }
+
+    const ChainLevel& chain_level = levels[level];
+    for (size_t l = chain_level.link_begin[node]; l < chain_level.link_begin[node+1]; l++) {
+        offsets[level-1] = chain_level.links[l].offset;
+        enumerateChains(levels, level-1, chain_level.links[l].parent, base_address, offsets, chains);
+    }
+}
+
+void PointerScanner::findChains(uintptr_t addr, int max_level, int max_offset, std::vector<PointerChain>& chains)
+{
+    chains.clear();
+    if (max_level < 1)
+        max_level = 1;
+
+    /* Search is done breadth-first: each level contains the distinct
+     * addresses that lead to the searched address with one more pointer, so
+     * that chains sharing an address are only explored once. */
+    std::vector<ChainLevel> levels(1);
+    levels[0].addresses.push_back(addr);
+
+    size_t thread_count = threadCount(std::thread::hardware_concurrency());
+    std::vector<std::vector<ChainRoot>> local_roots(thread_count);
+    std::vector<std::vector<PendingLink>> local_links(thread_count);
+
+    for (int level = 0; level < max_level; level++) {
+        const std::vector<uintptr_t>& addresses = levels[level].addresses;
+
+        /* The last level only looks for static pointers */
+        bool last_level = (level == (max_level-1));
+
+        parallelBlocks(thread_count, addresses.size(), 1024, [&](size_t t, size_t begin, size_t end) {
+            for (size_t n = begin; n < end; n++) {
+                uintptr_t address = addresses[n];
+                uintptr_t lowest = (address > static_cast<uintptr_t>(max_offset)) ? (address - max_offset) : 0;
+                PointerEntry lowest_entry = {lowest, 0};
+
+                for (auto it = std::lower_bound(static_pointers.begin(), static_pointers.end(), lowest_entry);
+                    (it != static_pointers.end()) && (it->value <= address); it++)
+                    local_roots[t].push_back({it->address, level, static_cast<uint32_t>(n), static_cast<int>(address - it->value)});
+
+                if (last_level)
+                    continue;
+
+                for (auto it = std::lower_bound(dynamic_pointers.begin(), dynamic_pointers.end(), lowest_entry);
+                    (it != dynamic_pointers.end()) && (it->value <= address); it++)
+                    local_links[t].push_back({it->address, {static_cast<uint32_t>(n), static_cast<int>(address - it->value)}});
+            }
+        });
+
+        if (last_level)
+            break;
+
+        /* Build the next level from the distinct addresses of all links */
+        for (auto& links : local_links)
+            std::sort(links.begin(), links.end());
+        std::vector<PendingLink> pending_links;
+        mergeRuns(local_links, pending_links);
+        local_links.assign(thread_count, std::vector<PendingLink>());
+
+        if (pending_links.empty())
+            break;
+
+        levels.emplace_back();
+        ChainLevel& next_level = levels.back();
+        next_level.links.reserve(pending_links.size());
+        for (const PendingLink& pending_link : pending_links) {
+            if (next_level.addresses.empty() || (next_level.addresses.back() != pending_link.address)) {
+                next_level.addresses.push_back(pending_link.address);
+                next_level.link_begin.push_back(next_level.links.size());
+            }
+            next_level.links.push_back(pending_link.link);
+        }
+        next_level.link_begin.push_back(next_level.links.size());
+    }
+
+    /* Build all chains from static pointers */
+    std::vector<ChainRoot> roots;
+    for (const auto& r : local_roots)
+        roots.insert(roots.end(), r.begin(), r.end());
+
+    std::vector<std::vector<PointerChain>> local_chains(thread_count);
+    parallelBlocks(thread_count, roots.size(), 256, [&](size_t t, size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const ChainRoot& root = roots[r];
+            std::vector<int> offsets(root.level + 1);
+            offsets[root.level] = root.offset;
+            enumerateChains(levels, root.level, root.node, root.base_address, offsets, local_chains[t]);
+        }
+    });
+
+    for (auto& c : local_chains)
+        std::sort(c.begin(), c.end());
+    mergeRuns(local_chains, chains);
+}
+
+int PointerScanner::saveMap(const std::string& file, uintptr_t target) const
+{
+    std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+
+    if (!ofs) return -1;
+
+    /* Save the address range of each file, to relocate static pointers */
+    const std::map<std::string,std::pair<uintptr_t, uintptr_t>>& modules = BaseAddresses::getAllAddresses();
+
+    PointerMapHeader header;
+    memcpy(header.magic, pointer_map_magic, sizeof(header.magic));
+    header.version = pointer_map_version;
+    header.pointer_size = sizeof(uintptr_t);
+    header.module_count = modules.size();
+    header.target = target;
+    header.static_count = static_pointers.size();
+    header.dynamic_count = dynamic_pointers.size();
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const auto& module : modules) {
+        uint64_t begin = module.second.first;
+        uint64_t end = module.second.second;
+        uint32_t name_size = module.first.size();
+        ofs.write(reinterpret_cast<const char*>(&begin), sizeof(begin));
+        ofs.write(reinterpret_cast<const char*>(&end), sizeof(end));
+        ofs.write(reinterpret_cast<const char*>(&name_size), sizeof(name_size));
+        ofs.write(module.first.data(), name_size);
+    }
+
+    ofs.write(reinterpret_cast<const char*>(static_pointers.data()), static_pointers.size()*sizeof(PointerEntry));
+    ofs.write(reinterpret_cast<const char*>(dynamic_pointers.data()), dynamic_pointers.size()*sizeof(PointerEntry));
+
+    return ofs ? 0 : -1;
+}
+
+int PointerScanner::filterChains(const std::string& file, std::vector<PointerChain>& chains) const
+{
+    std::ifstream ifs(file, std::ios::binary);
+
+    if (!ifs) return -1;
+
+    PointerMapHeader header;
+    ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!ifs || (memcmp(header.magic, pointer_map_magic, sizeof(header.magic)) != 0))
+        return 1;
+
+    if ((header.version != pointer_map_version) || (header.pointer_size != sizeof(uintptr_t))) {
+        std::cerr << "Pointer map " << file << " has an unknown format" << std::endl;
+        return -1;
+    }
+
+    std::map<std::string,std::pair<uintptr_t, uintptr_t>> modules;
+    for (uint32_t m = 0; m < header.module_count; m++) {
+        uint64_t begin, end;
+        uint32_t name_size;
+        ifs.read(reinterpret_cast<char*>(&begin), sizeof(begin));
+        ifs.read(reinterpret_cast<char*>(&end), sizeof(end));
+        ifs.read(reinterpret_cast<char*>(&name_size), sizeof(name_size));
+        if (!ifs || (name_size > 4096))
+            return -1;
+        std::string name(name_size, '\0');
+        ifs.read(&name[0], name_size);
+        modules[name] = std::make_pair(begin, end);
+    }
+
+    /* Static and dynamic pointers are followed the same way, sorted by the
+     * address where they are stored */
+    std::vector<PointerEntry> pointers(header.static_count + header.dynamic_count);
+    ifs.read(reinterpret_cast<char*>(pointers.data()), pointers.size()*sizeof(PointerEntry));
+    if (!ifs)
+        return -1;
+
+    std::sort(pointers.begin(), pointers.end(), [](const PointerEntry& a, const PointerEntry& b) {
+        return a.address < b.address;
+    });
+
+    auto is_stable = [&](const PointerChain& chain) {
+        /* Relocate the base address to the saved map */
+        off_t offset;
+        std::string base_file = BaseAddresses::getFileAndOffset(chain.first, offset);
+        auto module = modules.find(base_file);
+        if (base_file.empty() || (module == modules.end()))
+            return false;
+
+        uintptr_t address = ((offset < 0) ? module->second.second : module->second.first) + offset;
+
+        /* Follow the chain with the saved pointers */
+        for (auto it = chain.second.rbegin(); it != chain.second.rend(); it++) {
+            auto pointer = std::lower_bound(pointers.begin(), pointers.end(), address, [](const PointerEntry& p, uintptr_t a) {
+                return p.address < a;
+            });
+            if ((pointer == pointers.end()) || (pointer->address != address))
+                return false;
+            address = pointer->value + *it;
+        }
+
+        return address == header.target;
+    };
+
+    chains.erase(std::remove_if(chains.begin(), chains.end(), [&](const PointerChain& chain) {
+        return !is_stable(chain);
+    }), chains.end());
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_POINTERSCANNER_H_INCLUDED
+#define LIBTAS_POINTERSCANNER_H_INCLUDED
+
+#include <QtCore/QObject>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/* Pointer stored in the game memory */
+struct PointerEntry {
+    uintptr_t value; // address pointed to
+    uintptr_t address; // address where the pointer is stored
+
+    bool operator<(const PointerEntry& other) const {
+        return (value < other.value) || ((value == other.value) && (address < other.address));
+    }
+};
+
+/* Chain of pointers, from a static base address to the searched address.
+ * Offsets are stored from the last pointer to the first one. */
+typedef std::pair<uintptr_t, std::vector<int>> PointerChain;
+
+/* Index of all pointers of the game memory, and search of pointer chains */
+class PointerScanner : public QObject {
+    Q_OBJECT
+
+    public:
+        /* Store all pointers from the game memory that point into a
+         * non-static section, sorted by pointed address */
+        void locatePointers();
+
+        /* Find all chains of pointers that start from a static address and
+         * end with the specified address, in maximum `max_level` levels and
+         * with a maximum offset of `max_offset` */
+        void findChains(uintptr_t addr, int max_level, int max_offset, std::vector<PointerChain>& chains);
+
+        /* Save the pointer index and the searched address into a pointer map
+         * file. Returns 0 if no error */
+        int saveMap(const std::string& file, uintptr_t target) const;
+
+        /* Keep only the chains that also lead to the searched address of the
+         * pointer map file, following pointers from the saved map. Static
+         * base addresses are relocated using the file they belong to, so
+         * that the map can come from another execution of the game. Returns
+         * 0 if no error, 1 if the file uses the old format of saved chains,
+         * or -1 on error */
+        int filterChains(const std::string& file, std::vector<PointerChain>& chains) const;
+
+        /* Pointers stored inside static sections (data, bss and stack) */
+        std::vector<PointerEntry> static_pointers;
+
+        /* Pointers stored inside other sections */
+        std::vector<PointerEntry> dynamic_pointers;
+
+        const int DEFAULT_THREAD_COUNT = 4; // when the number of cores is unknown
+        const uintptr_t UNIT_SIZE = 1024*1024; // size of memory blocks read at once
+
+    private:
+        /* Number of threads for parallel work */
+        size_t threadCount(size_t work_count) const;
+
+    signals:
+        /* Update the scan progress bar */
+        void signalProgress(int);
+};
+
+#endif
@@ -22,6 +22,7 @@
 #include "MemLayout.h"
 #include "MemAccess.h"
 #include "BaseAddresses.h"
+#include "WatchFeed.h"
 
 #include "utils.h"
 
@@ -29,59 +30,205 @@
 #include <fstream>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 
-MemValueType RamWatchDetailed::get_value(bool& is_valid)
+void RamWatchDetailed::update_base_address()
 {
-    MemValueType value;
-    value.v_uint64_t = 0;
+    /* Update the base address from the file and file offset */
+    if (!base_address) {
 
-    if (!MemAccess::isInited()) {
-        is_valid = false;
-        return value;
+        /* If file is empty, address is absolute */
+        if (base_file.empty()) {
+            base_address = base_file_offset;
+        }
+        else {
+            base_address = BaseAddresses::getAddress(base_file, base_file_offset);
+        }
     }
+}
+
+size_t RamWatchDetailed::value_size() const
+{
+    if (value_type == RamType::RamArray)
+        return array_size;
+    if (value_type == RamType::RamCString)
+        return RAM_ARRAY_MAX_SIZE;
+    return MemValue::type_size(value_type);
+}
+
+void RamWatchDetailed::read_values(RamWatchDetailed* const* watches, size_t count)
+{
+    for (size_t w = 0; w < count; w++) {
+        watches[w]->cached_value.v_uint64_t = 0;
+        watches[w]->cached_valid = MemAccess::isInited();
+        watches[w]->has_cached_value = true;
+    }
+
+    if (!MemAccess::isInited())
+        return;
+
+    std::vector<MemAccess::ReadSegment> segments;
+    std::vector<RamWatchDetailed*> segment_watches;
+    segments.reserve(count);
+    segment_watches.reserve(count);
 
-    is_valid = true;
-    
     /* Update the actual address to look at (in case of pointer chain) */
-    if (is_pointer) {
-        /* Update the base address from the file and file offset */
-        if (!base_address) {
+    size_t max_level = 0;
+    for (size_t w = 0; w < count; w++) {
+        RamWatchDetailed* watch = watches[w];
+        if (!watch->is_pointer)
+            continue;
 
-            /* If file is empty, address is absolute */
-            if (base_file.empty()) {
-                base_address = base_file_offset;
+        watch->update_base_address();
+        watch->pointer_addresses.assign(watch->pointer_offsets.size(), 0);
+        watch->address = watch->base_address;
+        max_level = std::max(max_level, watch->pointer_offsets.size());
+    }
+
+    /* Follow all pointer chains one level at a time, so that each level is
+     * read in a single batch */
+    int game_addr_size = MemAccess::getAddrSize();
+    std::vector<uint64_t> next_addresses(count);
+    for (size_t level = 0; level < max_level; level++) {
+        segments.clear();
+        segment_watches.clear();
+        for (size_t w = 0; w < count; w++) {
+            RamWatchDetailed* watch = watches[w];
+            if (!watch->is_pointer || !watch->cached_valid || (level >= watch->pointer_offsets.size()))
+                continue;
+
+            next_addresses[w] = 0;
+            segments.push_back({&next_addresses[w], reinterpret_cast<void*>(watch->address), static_cast<size_t>(game_addr_size), 0});
+            segment_watches.push_back(watch);
+        }
+
+        MemAccess::readBatch(segments.data(), segments.size());
+
+        for (size_t s = 0; s < segments.size(); s++) {
+            RamWatchDetailed* watch = segment_watches[s];
+            if (segments[s].read_size != static_cast<size_t>(game_addr_size)) {
+                watch->cached_valid = false;
+                continue;
+            }
+
+            uintptr_t next_address;
+            if (game_addr_size == 4) {
+                uint32_t value32;
+                memcpy(&value32, segments[s].local_addr, sizeof(uint32_t));
+                next_address = static_cast<uintptr_t>(value32);
             }
             else {
-                base_address = BaseAddresses::getAddress(base_file, base_file_offset);
+                next_address = static_cast<uintptr_t>(*static_cast<uint64_t*>(segments[s].local_addr));
             }
-        }
-        
-        pointer_addresses.assign(pointer_offsets.size(), 0);
-
-        address = base_address;
-        int i=0;
-        for (auto offset : pointer_offsets) {
-            uintptr_t next_address = MemAccess::readAddr(reinterpret_cast<void*>(address), &is_valid);
-            if (is_valid)
-                pointer_addresses[i++] = next_address;
-            else
-                return value;
-
-            address = next_address + offset;
+
+            watch->pointer_addresses[level] = next_address;
+            watch->address = next_address + watch->pointer_offsets[level];
         }
     }
-    
+
+    /* Read all values */
+    segments.clear();
+    segment_watches.clear();
+    for (size_t w = 0; w < count; w++) {
+        RamWatchDetailed* watch = watches[w];
+        if (!watch->cached_valid)
+            continue;
+
+        segments.push_back({&watch->cached_value, reinterpret_cast<void*>(watch->address), watch->value_size(), 0});
+        segment_watches.push_back(watch);
+    }
+
+    MemAccess::readBatch(segments.data(), segments.size());
+
+    for (size_t s = 0; s < segments.size(); s++)
+        segment_watches[s]->set_read_size(segments[s].read_size);
+}
+
+void RamWatchDetailed::set_read_size(size_t read_size)
+{
     if (value_type == RamType::RamArray) {
-        is_valid = (MemAccess::read(value.v_array, reinterpret_cast<void*>(address), array_size) == (size_t)array_size);
-        value.v_array[RAM_ARRAY_MAX_SIZE] = array_size;
+        cached_valid = (read_size == value_size());
+        cached_value.v_array[RAM_ARRAY_MAX_SIZE] = array_size;
     }
     else if (value_type == RamType::RamCString) {
-        is_valid = (MemAccess::read(value.v_cstr, reinterpret_cast<void*>(address), RAM_ARRAY_MAX_SIZE) > 0); 
-        value.v_cstr[RAM_ARRAY_MAX_SIZE] = 0;
+        cached_valid = (read_size > 0);
+        cached_value.v_cstr[RAM_ARRAY_MAX_SIZE] = 0;
     }
     else
-        is_valid = (MemAccess::read(&value, reinterpret_cast<void*>(address), MemValue::type_size(value_type)) == (size_t)MemValue::type_size(value_type));
-    return value;
+        cached_valid = (read_size == value_size());
+}
+
+bool RamWatchDetailed::read_feed_values(RamWatchDetailed* const* watches, size_t count)
+{
+    if (!WatchFeed::isInited() || (count > RamWatchFeed::MAX_WATCHES))
+        return false;
+
+    /* Send the list of watches to the game */
+    std::vector<RamWatchFeed::Watch> feed_watches(count);
+    for (size_t w = 0; w < count; w++) {
+        RamWatchDetailed* watch = watches[w];
+        RamWatchFeed::Watch& feed_watch = feed_watches[w];
+        memset(&feed_watch, 0, sizeof(RamWatchFeed::Watch));
+        feed_watch.size = watch->value_size();
+
+        if (watch->is_pointer) {
+            if (watch->pointer_offsets.size() > RamWatchFeed::MAX_LEVELS)
+                return false;
+
+            watch->update_base_address();
+            feed_watch.base_address = watch->base_address;
+            feed_watch.level_count = watch->pointer_offsets.size();
+            std::copy(watch->pointer_offsets.begin(), watch->pointer_offsets.end(), feed_watch.offsets);
+        }
+        else {
+            feed_watch.base_address = watch->address;
+        }
+    }
+
+    WatchFeed::setWatches(feed_watches);
+
+    /* Get the values copied by the game, which are only available after the
+     * game received the list */
+    std::vector<RamWatchFeed::Value> values;
+    uint64_t framecount;
+    if (!WatchFeed::readValues(values, framecount))
+        return false;
+
+    for (size_t w = 0; w < count; w++) {
+        RamWatchDetailed* watch = watches[w];
+        watch->has_cached_value = true;
+        watch->cached_value.v_uint64_t = 0;
+
+        if (watch->is_pointer)
+            watch->address = values[w].address;
+
+        memcpy(&watch->cached_value, values[w].data, std::min(sizeof(MemValueType), sizeof(values[w].data)));
+        watch->set_read_size(values[w].read_size);
+    }
+
+    return true;
+}
+
+void RamWatchDetailed::update_values(const std::vector<std::unique_ptr<RamWatchDetailed>>& watches)
+{
+    std::vector<RamWatchDetailed*> watch_ptrs;
+    watch_ptrs.reserve(watches.size());
+    for (const std::unique_ptr<RamWatchDetailed>& w : watches)
+        if (w)
+            watch_ptrs.push_back(w.get());
+
+    /* Values are copied by the game at each frame boundary when possible, or
+     * read from the game memory otherwise */
+    if (!read_feed_values(watch_ptrs.data(), watch_ptrs.size()))
+        read_values(watch_ptrs.data(), watch_ptrs.size());
+}
+
+MemValueType RamWatchDetailed::get_value(bool& is_valid)
+{
+    RamWatchDetailed* watch = this;
+    read_values(&watch, 1);
+    is_valid = cached_valid;
+    return cached_value;
 }
 
 const char* RamWatchDetailed::value_str()
@@ -90,8 +237,11 @@ const char* RamWatchDetailed::value_str()
         return "";
     }
 
-    bool is_valid = true;
-    MemValueType value = get_value(is_valid);
+    bool is_valid = cached_valid;
+    MemValueType value = cached_value;
+    if (!has_cached_value)
+        value = get_value(is_valid);
+
     if (!is_valid)
         return "??????";
 
@@ -110,6 +260,10 @@ int RamWatchDetailed::poke_value(MemValueType value)
         return 0;
     }
 
+    /* Next displayed value must be read from the game */
+    has_cached_value = false;
+    WatchFeed::invalidate();
+
     /* Write value into the game process address */
     if (value_type == RamType::RamArray)
         return MemAccess::write(value.v_array, reinterpret_cast<void*>(address), value.v_array[RAM_ARRAY_MAX_SIZE]);
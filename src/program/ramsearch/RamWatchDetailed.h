@@ -22,6 +22,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdint>
 
 #include "MemValue.h"
@@ -30,9 +31,14 @@ class RamWatchDetailed {
 public:
     RamWatchDetailed(uintptr_t addr, int type) : value_type(type), address(addr) {is_frozen = false;};
 
-    /* Return the current value of the ram watch as a string */
+    /* Return the value of the ram watch as a string, from the last batched
+     * update if any, or from reading the game memory */
     const char* value_str();
 
+    /* Read the values of all ram watches with batched memory reads, one for
+     * each level of pointer chains and one for all final values */
+    static void update_values(const std::vector<std::unique_ptr<RamWatchDetailed>>& watches);
+
     /* Poke a value (given as a string) into the ram watch address. Return
      * the result of process_vm_writev call */
     int poke_value(const char* str_value);
@@ -58,6 +64,27 @@ public:
     MemValueType frozen_value;
 
 private:
+    /* Value from the last batched update */
+    MemValueType cached_value;
+    bool cached_valid;
+    bool has_cached_value = false;
+
+    /* Read the values of an array of ram watches and store them in cache */
+    static void read_values(RamWatchDetailed* const* watches, size_t count);
+
+    /* Get the values of an array of ram watches from the last frame copied
+     * by the game, and store them in cache. Returns false if not available */
+    static bool read_feed_values(RamWatchDetailed* const* watches, size_t count);
+
+    /* Compute the base address of a pointer chain if not known */
+    void update_base_address();
+
+    /* Number of bytes to read for the value */
+    size_t value_size() const;
+
+    /* Set the validity of the cached value from the number of bytes read */
+    void set_read_size(size_t read_size);
+
     /* Return the current value of the ram watch as a MemValueType */
     MemValueType get_value(bool& is_valid);
 
@@ -0,0 +1,371 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "SavestateScanSource.h"
+#include "../library/checkpoint/PageStore.h"
+#include "../external/lz4.h"
+#define XXH_INLINE_ALL
+#include "../external/xxhash.h"
+
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+SavestateScanSource::SavestateScanSource(const std::string& path, const std::string& bp, const std::string& sp) : base_path(bp), store_path(sp)
+{
+    sfd = -1;
+    pfd = -1;
+
+    std::string pagemap_path = path + ".pm";
+    std::string pages_path = path + ".p";
+
+    pmfd = open(pagemap_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (pmfd == -1)
+        return;
+
+    pfd = open(pages_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    /* Savestates from another version or not completed are ignored */
+    if ((pfd == -1) ||
+        (pread(pmfd, &header, sizeof(header), 0) != sizeof(header)) ||
+        !header.isValid() || (header.index_offset == 0)) {
+        std::cerr << "Savestate " << pagemap_path << " has an unknown format or was not completed" << std::endl;
+        close(pmfd);
+        pmfd = -1;
+        return;
+    }
+
+    /* Read all memory areas from the area index */
+    std::vector<libtas::StateAreaIndex> index(header.memory_area_count);
+    size_t index_size = index.size() * sizeof(libtas::StateAreaIndex);
+    if (pread(pmfd, index.data(), index_size, header.index_offset) != static_cast<ssize_t>(index_size)) {
+        std::cerr << "Could not read the area index of savestate " << pagemap_path << std::endl;
+        close(pmfd);
+        pmfd = -1;
+        return;
+    }
+
+    for (const libtas::StateAreaIndex& entry : index) {
+        std::unique_ptr<StateArea> state_area(new StateArea);
+
+        /* The area must match its index entry, which is not the case for
+         * savestates of a game with a different pointer size */
+        if ((pread(pmfd, &state_area->area, sizeof(libtas::Area), entry.area_offset) != sizeof(libtas::Area)) ||
+            (reinterpret_cast<uintptr_t>(state_area->area.addr) != entry.addr) ||
+            (state_area->area.size != entry.size)) {
+            std::cerr << "Savestate " << pagemap_path << " was made by an incompatible game architecture" << std::endl;
+            areas.clear();
+            close(pmfd);
+            pmfd = -1;
+            return;
+        }
+
+        state_area->flags_offset = entry.area_offset + sizeof(libtas::Area);
+        areas.push_back(std::move(state_area));
+    }
+}
+
+SavestateScanSource::~SavestateScanSource()
+{
+    if (pmfd != -1)
+        close(pmfd);
+    if (pfd != -1)
+        close(pfd);
+    if (sfd != -1)
+        close(sfd);
+}
+
+void SavestateScanSource::getSections(int types, int flags, std::vector<MemSection>& sections)
+{
+    MemSection::reset();
+
+    for (const auto& state_area : areas) {
+        const libtas::Area& area = state_area->area;
+
+        /* Skipped areas don't have their content saved */
+        if (area.skip)
+            continue;
+
+        /* Build the /proc/pid/maps line of the area, so that the section type
+         * is determined the same way as for the game process */
+        std::ostringstream oss;
+        oss << std::hex << reinterpret_cast<uintptr_t>(area.addr) << '-' << reinterpret_cast<uintptr_t>(area.endAddr) << ' ';
+        oss << ((area.prot & PROT_READ) ? 'r' : '-');
+        oss << ((area.prot & PROT_WRITE) ? 'w' : '-');
+        oss << ((area.prot & PROT_EXEC) ? 'x' : '-');
+        oss << ((area.flags & libtas::Area::AREA_SHARED) ? 's' : 'p') << ' ';
+        oss << area.offset << ' ' << area.devmajor << ':' << area.devminor << ' ';
+        oss << std::dec << area.inodenum << ' ' << area.name;
+
+        std::string line = oss.str();
+        MemSection section;
+        section.readMap(line);
+
+        if (!section.followFlags(flags))
+            continue;
+
+        if (section.type & types)
+            sections.push_back(section);
+    }
+}
+
+SavestateScanSource::StateArea* SavestateScanSource::findArea(uintptr_t addr)
+{
+    auto it = std::upper_bound(areas.begin(), areas.end(), addr,
+        [](uintptr_t a, const std::unique_ptr<StateArea>& sa) {
+            return a < reinterpret_cast<uintptr_t>(sa->area.endAddr);
+        });
+
+    if ((it == areas.end()) || (addr < reinterpret_cast<uintptr_t>((*it)->area.addr)))
+        return nullptr;
+
+    return it->get();
+}
+
+void SavestateScanSource::loadArea(StateArea& state_area)
+{
+    const libtas::Area& area = state_area.area;
+    if (area.skip || area.uncommitted)
+        return;
+
+    size_t page_count = (area.size + 4095) / 4096;
+    state_area.flags.resize(page_count);
+    if (pread(pmfd, state_area.flags.data(), page_count, state_area.flags_offset) != static_cast<ssize_t>(page_count)) {
+        std::cerr << "Could not read the page flags of area " << area.name << std::endl;
+        state_area.flags.assign(page_count, libtas::Area::NONE);
+        return;
+    }
+
+    /* Pages are stored in order inside the pages file, and the size of a
+     * compressed page is stored before its content, so all previous pages
+     * must be visited to find a page. Only sizes are read, through a buffer. */
+    state_area.page_offsets.resize(page_count);
+    std::vector<char> buffer(65536);
+    off_t buffer_offset = 0;
+    size_t buffer_size = 0;
+
+    off_t offset = area.page_offset;
+    for (size_t p = 0; p < page_count; p++) {
+        state_area.page_offsets[p] = offset;
+        switch (state_area.flags[p]) {
+            case libtas::Area::FULL_PAGE:
+                offset += 4096;
+                break;
+            case libtas::Area::COMPRESSED_PAGE:
+            case libtas::Area::DELTA_PAGE: {
+                if ((buffer_size == 0) || (offset < buffer_offset) ||
+                    (offset + static_cast<off_t>(sizeof(int)) > buffer_offset + static_cast<off_t>(buffer_size))) {
+                    ssize_t ret = pread(pfd, buffer.data(), buffer.size(), offset);
+                    if (ret < static_cast<ssize_t>(sizeof(int))) {
+                        std::cerr << "Could not read the pages of area " << area.name << std::endl;
+                        state_area.flags.resize(p);
+                        return;
+                    }
+                    buffer_offset = offset;
+                    buffer_size = ret;
+                }
+                int compressed_length;
+                memcpy(&compressed_length, buffer.data() + (offset - buffer_offset), sizeof(int));
+                offset += sizeof(int) + compressed_length;
+                break;
+            }
+            case libtas::Area::STORE_PAGE:
+                offset += sizeof(libtas::PageStore::Key);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+bool SavestateScanSource::readPage(uintptr_t addr, char* buffer)
+{
+    StateArea* state_area = findArea(addr);
+    if (!state_area)
+        return false;
+
+    const libtas::Area& area = state_area->area;
+    if (area.skip)
+        return false;
+
+    /* Nothing was committed inside the area */
+    if (area.uncommitted) {
+        memset(buffer, 0, 4096);
+        return true;
+    }
+
+    std::call_once(state_area->loaded, &SavestateScanSource::loadArea, this, std::ref(*state_area));
+
+    size_t p = (addr - reinterpret_cast<uintptr_t>(area.addr)) / 4096;
+    if (p >= state_area->flags.size())
+        return false;
+
+    off_t offset = state_area->page_offsets[p];
+    switch (state_area->flags[p]) {
+        case libtas::Area::NO_PAGE:
+        case libtas::Area::ZERO_PAGE:
+            memset(buffer, 0, 4096);
+            return true;
+        case libtas::Area::FULL_PAGE:
+            return pread(pfd, buffer, 4096, offset) == 4096;
+        case libtas::Area::COMPRESSED_PAGE:
+            return readCompressedPage(offset, buffer);
+        case libtas::Area::BASE_PAGE:
+            return readBasePage(addr, buffer);
+        case libtas::Area::DELTA_PAGE: {
+            /* Delta pages are the xor of the page with the base savestate page */
+            char difference[4096];
+            if (!readBasePage(addr, buffer) || !readCompressedPage(offset, difference))
+                return false;
+            for (int i = 0; i < 4096; i++)
+                buffer[i] ^= difference[i];
+            return true;
+        }
+        case libtas::Area::STORE_PAGE:
+            return readStoredPage(offset, buffer);
+        case libtas::Area::FILE_PAGE: {
+            /* Page is identical to the content of the mapped file */
+            int fd = open(area.name, O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+                return false;
+            ssize_t ret = pread(fd, buffer, 4096, area.offset + p * 4096);
+            close(fd);
+            if (ret < 0)
+                return false;
+            memset(buffer + ret, 0, 4096 - ret);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool SavestateScanSource::readCompressedPage(off_t offset, char* buffer)
+{
+    char compressed[sizeof(int) + LZ4_COMPRESSBOUND(4096)];
+    ssize_t ret = pread(pfd, compressed, sizeof(compressed), offset);
+    if (ret < static_cast<ssize_t>(sizeof(int)))
+        return false;
+
+    int compressed_length;
+    memcpy(&compressed_length, compressed, sizeof(int));
+    if ((compressed_length <= 0) || (compressed_length > ret - static_cast<ssize_t>(sizeof(int))))
+        return false;
+
+    return LZ4_decompress_safe(compressed + sizeof(int), buffer, compressed_length, 4096) == 4096;
+}
+
+bool SavestateScanSource::readBasePage(uintptr_t addr, char* buffer)
+{
+    std::call_once(base_opened, [this]() {
+        if (!base_path.empty())
+            base_state.reset(new SavestateScanSource(base_path, "", store_path));
+    });
+
+    if (!base_state || !(*base_state))
+        return false;
+
+    return base_state->readPage(addr, buffer);
+}
+
+void SavestateScanSource::loadStore()
+{
+    /* The index of the page store lives inside the game process, so we build
+     * our own index by hashing every page of the store file, the same way
+     * pages are identified when they are stored. */
+    sfd = open(store_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (sfd == -1) {
+        std::cerr << "Could not open the page store " << store_path << std::endl;
+        return;
+    }
+
+    std::vector<char> pages(256 * 4096);
+    int64_t slot = 0;
+    ssize_t ret;
+    while ((ret = pread(sfd, pages.data(), pages.size(), slot * 4096)) >= 4096) {
+        for (ssize_t i = 0; i + 4096 <= ret; i += 4096, slot++) {
+            XXH128_hash_t hash = XXH3_128bits(pages.data() + i, 4096);
+            stored_pages.push_back({hash.low64, hash.high64, slot});
+        }
+    }
+
+    std::sort(stored_pages.begin(), stored_pages.end());
+}
+
+bool SavestateScanSource::readStoredPage(off_t offset, char* buffer)
+{
+    libtas::PageStore::Key key;
+    if (pread(pfd, &key, sizeof(key), offset) != sizeof(key))
+        return false;
+
+    std::call_once(store_loaded, &SavestateScanSource::loadStore, this);
+
+    StoredPage stored_page = {key.low, key.high, 0};
+    auto it = std::lower_bound(stored_pages.begin(), stored_pages.end(), stored_page);
+    if ((it == stored_pages.end()) || (it->low != key.low) || (it->high != key.high))
+        return false;
+
+    return pread(sfd, buffer, 4096, it->slot * 4096) == 4096;
+}
+
+size_t SavestateScanSource::read(void* local_addr, void* remote_addr, size_t size)
+{
+    uintptr_t addr = reinterpret_cast<uintptr_t>(remote_addr);
+    char* local = static_cast<char*>(local_addr);
+    size_t read_size = 0;
+
+    while (read_size < size) {
+        uintptr_t page = (addr + read_size) & ~static_cast<uintptr_t>(4095);
+        size_t page_offset = (addr + read_size) - page;
+        size_t count = std::min(static_cast<size_t>(4096) - page_offset, size - read_size);
+
+        /* Whole pages are decoded directly into the output */
+        if (count == 4096) {
+            if (!readPage(page, local + read_size))
+                break;
+        }
+        else {
+            char buffer[4096];
+            if (!readPage(page, buffer))
+                break;
+            memcpy(local + read_size, buffer + page_offset, count);
+        }
+        read_size += count;
+    }
+
+    if ((read_size == 0) && (size > 0))
+        return -1;
+    return read_size;
+}
+
+size_t SavestateScanSource::readBatch(MemAccess::ReadSegment* segments, size_t count)
+{
+    size_t total_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t ret = read(segments[i].local_addr, segments[i].remote_addr, segments[i].size);
+        segments[i].read_size = (ret == static_cast<size_t>(-1)) ? 0 : ret;
+        total_size += segments[i].read_size;
+    }
+    return total_size;
+}
@@ -0,0 +1,118 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_SAVESTATESCANSOURCE_H_INCLUDED
+#define LIBTAS_SAVESTATESCANSOURCE_H_INCLUDED
+
+#include "ScanSource.h"
+#include "../library/checkpoint/MemArea.h"
+#include "../library/checkpoint/StateHeader.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+/* Memory saved inside a savestate, read directly from the savestate files
+ * without loading the savestate. Only the pages that are read are
+ * decompressed. Pages that the savestate does not store itself are read from
+ * the base savestate, from the page store or from the mapped file. */
+class SavestateScanSource : public ScanSource {
+    public:
+        /* Open the savestate files of `path` (without the .pm/.p extension),
+         * with the path of the base savestate and of the page store */
+        SavestateScanSource(const std::string& path, const std::string& base_path, const std::string& store_path);
+        ~SavestateScanSource();
+
+        /* Indicate if the savestate could be opened */
+        explicit operator bool() const {
+            return (pmfd != -1);
+        }
+
+        void getSections(int types, int flags, std::vector<MemSection>& sections) override;
+        size_t read(void* local_addr, void* remote_addr, size_t size) override;
+        size_t readBatch(MemAccess::ReadSegment* segments, size_t count) override;
+
+        /* Read the content of the page at `addr`. Returns false if the page
+         * is not saved inside the savestate */
+        bool readPage(uintptr_t addr, char* buffer);
+
+    private:
+        /* Memory area of the savestate */
+        struct StateArea {
+            libtas::Area area;
+
+            /* Offset of the page flags inside the pagemap file */
+            off_t flags_offset;
+
+            /* Flag of each page, and offset of its content inside the pages
+             * file, which are only read when a page of the area is needed */
+            std::vector<char> flags;
+            std::vector<off_t> page_offsets;
+            std::once_flag loaded;
+        };
+
+        /* Page of the page store */
+        struct StoredPage {
+            uint64_t low;
+            uint64_t high;
+            int64_t slot;
+
+            bool operator<(const StoredPage& other) const {
+                return (high < other.high) || ((high == other.high) && (low < other.low));
+            }
+        };
+
+        /* Read the page flags and compute the position of each page */
+        void loadArea(StateArea& state_area);
+
+        /* Get the area containing the address, or nullptr */
+        StateArea* findArea(uintptr_t addr);
+
+        /* Read a compressed page and decompress it */
+        bool readCompressedPage(off_t offset, char* buffer);
+
+        /* Read a page from the page store */
+        bool readStoredPage(off_t offset, char* buffer);
+
+        /* Hash all pages of the page store to find stored pages */
+        void loadStore();
+
+        /* Read a page from the base savestate */
+        bool readBasePage(uintptr_t addr, char* buffer);
+
+        int pmfd, pfd;
+        libtas::StateHeader header;
+
+        /* Memory areas, sorted by address */
+        std::vector<std::unique_ptr<StateArea>> areas;
+
+        std::string base_path;
+        std::unique_ptr<SavestateScanSource> base_state;
+        std::once_flag base_opened;
+
+        std::string store_path;
+        int sfd;
+        std::vector<StoredPage> stored_pages;
+        std::once_flag store_loaded;
+};
+
+#endif
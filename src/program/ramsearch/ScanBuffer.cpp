@@ -0,0 +1,123 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScanBuffer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+std::atomic<uint64_t> ScanBuffer::memory_size(0);
+
+ScanBuffer::~ScanBuffer()
+{
+    clear();
+}
+
+void ScanBuffer::append(const void* data, size_t size)
+{
+    uint8_t* dest = extend(size);
+    if (dest)
+        memcpy(dest, data, size);
+}
+
+uint8_t* ScanBuffer::extend(size_t size)
+{
+    if (spilled) {
+        std::cerr << "Cannot append to a spilled scan buffer" << std::endl;
+        return nullptr;
+    }
+
+    if (buf_size + size > capacity) {
+        size_t new_capacity = capacity ? capacity : 4096;
+        while (new_capacity < buf_size + size)
+            new_capacity *= 2;
+
+        uint8_t* new_buf = static_cast<uint8_t*>(realloc(buf, new_capacity));
+        if (!new_buf) {
+            std::cerr << "Could not allocate " << new_capacity << " bytes for scan results" << std::endl;
+            return nullptr;
+        }
+        buf = new_buf;
+        memory_size += new_capacity - capacity;
+        capacity = new_capacity;
+    }
+
+    uint8_t* end = buf + buf_size;
+    buf_size += size;
+    return end;
+}
+
+bool ScanBuffer::spill(const std::string& dir)
+{
+    if (spilled || (buf_size == 0))
+        return true;
+
+    std::string path = dir + "/results-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        std::cerr << "Could not create file " << path << std::endl;
+        return false;
+    }
+
+    /* The file is only accessed through the mapping */
+    unlink(path.c_str());
+
+    size_t written = 0;
+    while (written < buf_size) {
+        ssize_t ret = write(fd, buf + written, buf_size - written);
+        if (ret <= 0) {
+            std::cerr << "Could not write scan results to " << path << std::endl;
+            close(fd);
+            return false;
+        }
+        written += ret;
+    }
+
+    void* addr = mmap(nullptr, buf_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Could not map scan results from " << path << std::endl;
+        return false;
+    }
+
+    free(buf);
+    memory_size -= capacity;
+    buf = static_cast<uint8_t*>(addr);
+    capacity = buf_size;
+    spilled = true;
+    return true;
+}
+
+void ScanBuffer::clear()
+{
+    if (spilled) {
+        munmap(buf, buf_size);
+    }
+    else {
+        free(buf);
+        memory_size -= capacity;
+    }
+    buf = nullptr;
+    buf_size = 0;
+    capacity = 0;
+    spilled = false;
+}
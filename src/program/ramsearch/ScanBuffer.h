@@ -0,0 +1,69 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SCANBUFFER_H_INCLUDED
+#define LIBTAS_SCANBUFFER_H_INCLUDED
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/* Growable buffer holding scan results. It stays in memory while it is being
+ * filled, and can then be moved into a file mapping to release memory, after
+ * which it becomes read-only. */
+class ScanBuffer {
+    public:
+        ScanBuffer() = default;
+        ~ScanBuffer();
+
+        ScanBuffer(const ScanBuffer&) = delete;
+        ScanBuffer& operator=(const ScanBuffer&) = delete;
+
+        /* Append data at the end of the buffer */
+        void append(const void* data, size_t size);
+
+        /* Reserve space at the end of the buffer and return a pointer to it */
+        uint8_t* extend(size_t size);
+
+        const uint8_t* data() const {return buf;}
+        size_t size() const {return buf_size;}
+        bool empty() const {return buf_size == 0;}
+        bool is_spilled() const {return spilled;}
+
+        /* Move the content into an unlinked file inside the directory, and
+         * map it. Returns false if the file could not be created */
+        bool spill(const std::string& dir);
+
+        /* Free the buffer */
+        void clear();
+
+        /* Memory currently used by all buffers that are not spilled */
+        static uint64_t memory_usage() {return memory_size;}
+
+    private:
+        uint8_t* buf = nullptr;
+        size_t buf_size = 0;
+        size_t capacity = 0;
+        bool spilled = false;
+
+        static std::atomic<uint64_t> memory_size;
+};
+
+#endif
@@ -0,0 +1,152 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScanChunk.h"
+
+#include <cstring>
+
+/* Variable-length encoding of unsigned integers, 7 bits per byte */
+static int write_varint(uint8_t* out, uint64_t value)
+{
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+static uint64_t read_varint(const uint8_t* in, size_t& pos)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = in[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+ScanChunk::ScanChunk(bool region, uintptr_t ba, int vs, int align) : is_region(region), begin_address(ba), value_size(vs), alignment(align) {}
+
+void ScanChunk::add_memory(const void* memory, size_t size)
+{
+    values.append(memory, size);
+    region_size += size;
+}
+
+void ScanChunk::add_extra_memory(const void* memory, size_t size)
+{
+    values.append(memory, size);
+}
+
+void ScanChunk::add_page(uintptr_t page, const uint64_t* bitmap, const uint8_t* memory)
+{
+    int bits = bitmap_bits();
+    int words = (bits + 63) / 64;
+
+    int page_count = 0;
+    for (int w = 0; w < words; w++)
+        page_count += __builtin_popcountll(bitmap[w]);
+    if (page_count == 0)
+        return;
+
+    /* Encode offsets as deltas, and keep them if smaller than the bitmap */
+    uint8_t offsets[PAGE_SIZE * 2];
+    int offsets_size = 0;
+    int last_bit = 0;
+    for (int w = 0; w < words; w++) {
+        for (uint64_t mask = bitmap[w]; mask; mask &= mask - 1) {
+            int bit = w*64 + __builtin_ctzll(mask);
+            offsets_size += write_varint(offsets + offsets_size, bit - last_bit);
+            last_bit = bit;
+        }
+    }
+
+    int bitmap_size = (bits + 7) / 8;
+    bool use_bitmap = bitmap_size < offsets_size;
+
+    /* Reserve the values first, so that a page is never added without its
+     * values */
+    uint8_t* out = values.extend(page_count * value_size);
+    if (!out)
+        return;
+
+    uint8_t header[32];
+    uintptr_t page_number = page / PAGE_SIZE;
+    int header_size = write_varint(header, page_number - last_page_number);
+    header_size += write_varint(header + header_size, (static_cast<uint64_t>(page_count) << 1) | use_bitmap);
+    last_page_number = page_number;
+
+    addresses.append(header, header_size);
+    if (use_bitmap)
+        addresses.append(bitmap, bitmap_size);
+    else
+        addresses.append(offsets, offsets_size);
+
+    /* Pack values */
+    for (int w = 0; w < words; w++) {
+        for (uint64_t mask = bitmap[w]; mask; mask &= mask - 1) {
+            int bit = w*64 + __builtin_ctzll(mask);
+            memcpy(out, memory + bit*alignment, value_size);
+            out += value_size;
+        }
+    }
+
+    count += page_count;
+}
+
+bool ScanChunk::spill(const std::string& dir)
+{
+    return addresses.spill(dir) && values.spill(dir);
+}
+
+ScanChunk::PageReader::PageReader(const ScanChunk& c) : chunk(c) {}
+
+bool ScanChunk::PageReader::next(uintptr_t& page, uint64_t* bitmap, int& count)
+{
+    if (pos >= chunk.addresses.size())
+        return false;
+
+    const uint8_t* data = chunk.addresses.data();
+    page_number += read_varint(data, pos);
+    uint64_t header = read_varint(data, pos);
+    count = header >> 1;
+    page = page_number * PAGE_SIZE;
+
+    int bits = chunk.bitmap_bits();
+    memset(bitmap, 0, PAGE_BITMAP_WORDS * sizeof(uint64_t));
+
+    if (header & 1) {
+        int bitmap_size = (bits + 7) / 8;
+        memcpy(bitmap, data + pos, bitmap_size);
+        pos += bitmap_size;
+    }
+    else {
+        int bit = 0;
+        for (int i = 0; i < count; i++) {
+            bit += read_varint(data, pos);
+            bitmap[bit / 64] |= 1ull << (bit % 64);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTAS_SCANCHUNK_H_INCLUDED
+#define LIBTAS_SCANCHUNK_H_INCLUDED
+
+#include "ScanBuffer.h"
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/* A chunk of scan results over increasing addresses. Results of a region scan
+ * are a copy of a contiguous memory range. Results of an address scan are the
+ * matching addresses, encoded for each memory page either as a bitmap of
+ * aligned offsets or as a list of offset deltas, and their packed values. */
+class ScanChunk {
+    public:
+        static const int PAGE_SIZE = 4096;
+
+        /* Maximum number of 64-bit words of a page bitmap */
+        static const int PAGE_BITMAP_WORDS = PAGE_SIZE / 64;
+
+        ScanChunk(bool region, uintptr_t begin_address, int value_size, int alignment);
+
+        /* Append memory to a region chunk. The extra memory is located after
+         * the region, and is only used to compare the unaligned values at the
+         * end of the region */
+        void add_memory(const void* memory, size_t size);
+        void add_extra_memory(const void* memory, size_t size);
+
+        /* Append the results of a memory page to an address chunk, as a bitmap
+         * with one bit per aligned offset. Values are copied from `memory`,
+         * which holds the content of the page */
+        void add_page(uintptr_t page, const uint64_t* bitmap, const uint8_t* memory);
+
+        /* Move the chunk content into files. Returns false on error */
+        bool spill(const std::string& dir);
+
+        /* Decode the pages of an address chunk */
+        class PageReader {
+            public:
+                PageReader(const ScanChunk& chunk);
+
+                /* Decode the next page of results, filling the bitmap of
+                 * PAGE_BITMAP_WORDS words with one bit per aligned offset.
+                 * Returns false at the end */
+                bool next(uintptr_t& page, uint64_t* bitmap, int& count);
+
+            private:
+                const ScanChunk& chunk;
+                size_t pos = 0;
+                uintptr_t page_number = 0;
+        };
+
+        bool is_region;
+        uintptr_t begin_address; // start of the memory range of a region chunk
+        size_t region_size = 0; // size of the memory range of a region chunk
+        uint64_t count = 0; // number of results of an address chunk
+
+        int value_size;
+        int alignment;
+
+        ScanBuffer addresses; // encoded addresses of an address chunk
+        ScanBuffer values; // memory of a region chunk or packed values
+
+    private:
+        /* Number of bits of a page bitmap */
+        int bitmap_bits() const {return PAGE_SIZE / alignment;}
+
+        uintptr_t last_page_number = 0;
+};
+
+#endif
@@ -0,0 +1,43 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScanSource.h"
+#include "MemLayout.h"
+
+#include <memory>
+
+void ProcessScanSource::getSections(int types, int flags, std::vector<MemSection>& sections)
+{
+    std::unique_ptr<MemLayout> memlayout (new MemLayout());
+
+    MemSection section;
+    while (memlayout->nextSection(types, flags, section))
+        sections.push_back(section);
+}
+
+size_t ProcessScanSource::read(void* local_addr, void* remote_addr, size_t size)
+{
+    return MemAccess::read(local_addr, remote_addr, size);
+}
+
+size_t ProcessScanSource::readBatch(MemAccess::ReadSegment* segments, size_t count)
+{
+    return MemAccess::readBatch(segments, count);
+}
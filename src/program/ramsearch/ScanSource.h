@@ -0,0 +1,57 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_SCANSOURCE_H_INCLUDED
+#define LIBTAS_SCANSOURCE_H_INCLUDED
+
+#include "MemSection.h"
+#include "MemAccess.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/* Memory that the ram search can scan. Reads may be performed by several
+ * scanner threads at the same time. */
+class ScanSource {
+    public:
+        virtual ~ScanSource() {}
+
+        /* Get all memory sections within the selected `types` and following
+         * the selected `flags`, in increasing addresses */
+        virtual void getSections(int types, int flags, std::vector<MemSection>& sections) = 0;
+
+        /* Read a range of memory, stopping at the first unreadable byte.
+         * Returns the number of read bytes, or -1 if nothing could be read */
+        virtual size_t read(void* local_addr, void* remote_addr, size_t size) = 0;
+
+        /* Read multiple segments of memory, same as MemAccess::readBatch() */
+        virtual size_t readBatch(MemAccess::ReadSegment* segments, size_t count) = 0;
+};
+
+/* Memory of the running game process */
+class ProcessScanSource : public ScanSource {
+    public:
+        void getSections(int types, int flags, std::vector<MemSection>& sections) override;
+        size_t read(void* local_addr, void* remote_addr, size_t size) override;
+        size_t readBatch(MemAccess::ReadSegment* segments, size_t count) override;
+};
+
+#endif
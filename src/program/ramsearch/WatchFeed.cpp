@@ -0,0 +1,146 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "WatchFeed.h"
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static std::atomic<RamWatchFeed*> feed(nullptr);
+
+/* Feed of the previous game process. It is only unmapped when the next game
+ * is started, so that a concurrent read from the UI does not fault */
+static RamWatchFeed* old_feed = nullptr;
+
+static std::vector<RamWatchFeed::Watch> current_watches;
+static uint64_t list_generation = 0;
+static uint64_t min_frame_count = 0;
+
+bool WatchFeed::init(pid_t pid, int fd)
+{
+    fini();
+    if (old_feed) {
+        munmap(old_feed, sizeof(RamWatchFeed));
+        old_feed = nullptr;
+    }
+
+#ifdef __linux__
+    std::string fd_path = "/proc/" + std::to_string(pid) + "/fd/" + std::to_string(fd);
+    int local_fd = open(fd_path.c_str(), O_RDWR | O_CLOEXEC);
+    if (local_fd < 0) {
+        std::cerr << "Could not open the ram watch memory of the game" << std::endl;
+        return false;
+    }
+
+    void* addr = mmap(nullptr, sizeof(RamWatchFeed), PROT_READ | PROT_WRITE, MAP_SHARED, local_fd, 0);
+    close(local_fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Could not map the ram watch memory of the game" << std::endl;
+        return false;
+    }
+
+    current_watches.clear();
+    list_generation = 0;
+    min_frame_count = 0;
+    feed.store(static_cast<RamWatchFeed*>(addr));
+    return true;
+#else
+    return false;
+#endif
+}
+
+void WatchFeed::fini()
+{
+    RamWatchFeed* f = feed.exchange(nullptr);
+    if (f)
+        old_feed = f;
+}
+
+bool WatchFeed::isInited()
+{
+    return feed.load() != nullptr;
+}
+
+void WatchFeed::setWatches(const std::vector<RamWatchFeed::Watch>& watches)
+{
+    RamWatchFeed* f = feed.load();
+    if (!f || (watches.size() > RamWatchFeed::MAX_WATCHES))
+        return;
+
+    if ((watches.size() == current_watches.size()) &&
+        (memcmp(watches.data(), current_watches.data(), watches.size() * sizeof(RamWatchFeed::Watch)) == 0))
+        return;
+
+    current_watches = watches;
+    list_generation++;
+
+    uint64_t sequence = f->list_sequence.load(std::memory_order_relaxed);
+    f->list_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    f->list_generation = list_generation;
+    f->watch_count = watches.size();
+    memcpy(f->watches, watches.data(), watches.size() * sizeof(RamWatchFeed::Watch));
+
+    f->list_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool WatchFeed::readValues(std::vector<RamWatchFeed::Value>& values, uint64_t& framecount)
+{
+    RamWatchFeed* f = feed.load();
+    if (!f)
+        return false;
+
+    /* Retry if the game overwrote the frame while we were reading it */
+    for (int retry = 0; retry < 4; retry++) {
+        uint64_t frame_count = f->frame_count.load(std::memory_order_acquire);
+        if ((frame_count == 0) || (frame_count <= min_frame_count))
+            return false;
+
+        const RamWatchFeed::Frame& frame = f->frames[(frame_count - 1) % RamWatchFeed::RING_SIZE];
+        uint64_t sequence = frame.sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+            continue;
+
+        if ((frame.list_generation != list_generation) || (frame.watch_count != current_watches.size()))
+            return false;
+
+        framecount = frame.framecount;
+        values.assign(frame.values, frame.values + frame.watch_count);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (frame.sequence.load(std::memory_order_relaxed) == sequence)
+            return true;
+    }
+
+    return false;
+}
+
+void WatchFeed::invalidate()
+{
+    RamWatchFeed* f = feed.load();
+    if (f)
+        min_frame_count = f->frame_count.load(std::memory_order_acquire);
+}
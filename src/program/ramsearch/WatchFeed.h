@@ -0,0 +1,52 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_WATCHFEED_H_INCLUDED
+#define LIBTAS_WATCHFEED_H_INCLUDED
+
+#include "../shared/RamWatchFeed.h"
+
+#include <sys/types.h>
+#include <vector>
+#include <cstdint>
+
+/* Access to the memory shared with the game, in which the game copies the
+ * values of all ram watches at each frame boundary */
+namespace WatchFeed {
+
+    /* Map the shared memory from its file descriptor in the game process */
+    bool init(pid_t pid, int fd);
+    void fini();
+    bool isInited();
+
+    /* Write the list of watches, if it changed since the last call */
+    void setWatches(const std::vector<RamWatchFeed::Watch>& watches);
+
+    /* Copy the values of the last written frame. Returns false if there is
+     * no frame written from the current list of watches, or if the frame
+     * predates the last call to invalidate() */
+    bool readValues(std::vector<RamWatchFeed::Value>& values, uint64_t& framecount);
+
+    /* Ignore all frames written so far, after game memory was modified by
+     * the program */
+    void invalidate();
+}
+
+#endif
@@ -93,7 +93,7 @@ Qt::ItemFlags InputEditorModel::flags(const QModelIndex &index) const
     if (row >= frameCount())
         return index_flags;
 
-    const AllInputs& ai = movie->inputs->getInputs(row);
+    AllInputs ai = movie->inputs->getInputs(row);
     const SingleInput si = movie->editor->input_set[index.column()-COLUMN_SPECIAL_SIZE];
 
     /* Don't edit locked input */
@@ -198,7 +198,7 @@ QVariant InputEditorModel::data(const QModelIndex &index, int role) const
 
         QColor color = QGuiApplication::palette().text().color();
         const SingleInput si = movie->editor->input_set[col-COLUMN_SPECIAL_SIZE];
-        const AllInputs& ai = movie->inputs->getInputs(row);
+        AllInputs ai = movie->inputs->getInputs(row);
         int current_value = ai.getInput(si);
 
         /* Show inputs with transparancy when they are pending due to rewind */
@@ -255,7 +255,7 @@ QVariant InputEditorModel::data(const QModelIndex &index, int role) const
                 (int)col == hoveredIndex.column() &&
                 (int)row == hoveredIndex.row() &&
                 !si.isAnalog()) {
-            const AllInputs& ai = movie->inputs->getInputs(row);
+            AllInputs ai = movie->inputs->getInputs(row);
             int value = ai.getInput(si);
             if (!value) {
                 color.setAlpha(128);
@@ -387,7 +387,7 @@ QVariant InputEditorModel::data(const QModelIndex &index, int role) const
             }
         }
 
-        const AllInputs& ai = movie->inputs->getInputs(row);
+        AllInputs ai = movie->inputs->getInputs(row);
 //        return QBrush(color, ai.events.empty()?Qt::SolidPattern:Qt::Dense3Pattern);
         return QBrush(color, ai.events.empty()?Qt::SolidPattern:Qt::BDiagPattern);
     }
@@ -433,7 +433,7 @@ QVariant InputEditorModel::data(const QModelIndex &index, int role) const
             return row;
         }
 
-        const AllInputs& ai = movie->inputs->getInputs(row);
+        AllInputs ai = movie->inputs->getInputs(row);
         const SingleInput si = movie->editor->input_set[col-COLUMN_SPECIAL_SIZE];
 
         /* Get the value of the single input in movie inputs */
@@ -519,7 +519,7 @@ QVariant InputEditorModel::data(const QModelIndex &index, int role) const
         if (movie->editor->locked_inputs.find(si) != movie->editor->locked_inputs.end())
             return QVariant();
 
-        const AllInputs& ai = movie->inputs->getInputs(row);
+        AllInputs ai = movie->inputs->getInputs(row);
 
         /* Get the value of the single input in movie inputs */
         int value = ai.getInput(si);
@@ -555,7 +555,7 @@ bool InputEditorModel::setData(const QModelIndex &index, const QVariant &value,
                 return false;
         }
 
-        const AllInputs& ai = movie->inputs->getInputs(row);
+        AllInputs ai = movie->inputs->getInputs(row);
         
         /* Don't modify inputs when frame has events */
         if (!ai.events.empty())
@@ -819,7 +819,7 @@ void InputEditorModel::copyInputs(int row, int count, std::ostringstream& inputS
 {
     /* Translate inputs into a string */
     for (int r=row; r < row+count; r++) {
-        const AllInputs& ai = movie->inputs->getInputs(r);
+        AllInputs ai = movie->inputs->getInputs(r);
         InputSerialization::writeFrame(inputString, ai);
     }
 }
@@ -961,7 +961,7 @@ void InputEditorModel::addUniqueInputs(int minRow, int maxRow)
     AllInputs newais;
     newais.clear();
     for (int row = minRow; row <= maxRow; row++) {
-        const AllInputs& ai = movie->inputs->getInputsUnprotected(row);
+        AllInputs ai = movie->inputs->getInputsUnprotected(row);
         newais |= ai;
     }
     addUniqueInputs(newais);
@@ -1000,7 +1000,7 @@ bool InputEditorModel::removeUniqueInput(int column)
 
     /* Check if the input is set in past frames */
     for (unsigned int f = 0; f < context->framecount; f++) {
-        const AllInputs& ai = movie->inputs->getInputs(f);
+        AllInputs ai = movie->inputs->getInputs(f);
         if (ai.getInput(si))
             return false;
     }
@@ -1030,7 +1030,7 @@ void InputEditorModel::columnFactor(int column, double factor)
     std::vector<int> new_values;
 
     for (unsigned int f = context->framecount; f < movie->inputs->nbFrames(); f++) {
-        const AllInputs& ai = movie->inputs->getInputs(f);
+        AllInputs ai = movie->inputs->getInputs(f);
         int value = ai.getInput(si);
         new_values.push_back(factor*value);
     }
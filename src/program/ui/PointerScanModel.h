@@ -20,12 +20,10 @@
 #ifndef LIBTAS_POINTERSCANMODEL_H_INCLUDED
 #define LIBTAS_POINTERSCANMODEL_H_INCLUDED
 
-#include "ramsearch/MemSection.h"
+#include "ramsearch/PointerScanner.h"
 
 #include <QtCore/QAbstractTableModel>
 #include <vector>
-#include <map>
-#include <memory>
 #include <string>
 #include <sys/types.h>
 #include <stdint.h>
@@ -39,19 +37,16 @@ class PointerScanModel : public QAbstractTableModel {
 public:
     PointerScanModel(Context* c, QObject *parent = Q_NULLPTR);
 
-    /* Map of pointers (key) and addresses (value) */
-    std::multimap<uintptr_t,uintptr_t> pointer_map;
-
-    /* Map of pointers (key) and addresses (value) that are in a static area */
-    std::multimap<uintptr_t,uintptr_t> static_pointer_map;
+    /* Index of all pointers and search of pointer chains */
+    PointerScanner pointerscanner;
 
     /* Results of pointer scan */
-    std::vector<std::pair<uintptr_t, std::vector<int>>> pointer_chains;
+    std::vector<PointerChain> pointer_chains;
 
     /* Max size of pointer chain */
     int max_level = 5;
 
-    /* Store all pointers from the game memory into a map */
+    /* Store all pointers from the game memory into the index */
     void locatePointers();
 
     /* Find all chains of pointers that start from a static address and
@@ -60,18 +55,20 @@ public:
      */
     void findPointerChain(uintptr_t addr, int ml, int max_offset);
 
+    /* Save the pointer map of the current scan */
     int saveChains(const std::string& file);
 
+    /* Keep only the chains that are also valid in a saved pointer map */
     int loadChains(const std::string& file);
 
 private:
     Context *context;
 
-    /* File mapping sections */
-    std::vector<MemSection> file_mapping_sections;
+    /* Address of the last pointer scan */
+    uintptr_t last_address = 0;
 
-    /* Recursive call for the pointer chain search */
-    void recursiveFind(uintptr_t addr, int level, int offsets[], int max_offset);
+    /* Intersect with chains saved in the old format */
+    int loadLegacyChains(const std::string& file);
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
 
@@ -21,8 +21,8 @@
 
 #include "Context.h"
 #include "qtutils.h"
-#include "ramsearch/MemLayout.h"
 #include "ramsearch/MemSection.h"
+#include "ramsearch/SavestateScanSource.h"
 
 #include <QtWidgets/QMessageBox>
 #include <memory>
@@ -67,16 +67,19 @@ QVariant RamSearchModel::data(const QModelIndex &index, int role) const
     MemValueType new_v;
     const MemValueType* old_v;
 
+    /* Array values don't store their size */
+    int array_size = (value_type == RamArray) ? memscanner.value_type_size : RAM_ARRAY_MAX_SIZE;
+
     if (role == Qt::DisplayRole) {
         switch(index.column()) {
             case 0:
                 return QString("%1").arg(memscanner.get_address(index.row()), 0, 16);
             case 1:
                 new_v = memscanner.get_current_value(index.row());
-                return QString(MemValue::to_string(&new_v, value_type, hex));
+                return QString(MemValue::to_string(&new_v, value_type, hex, array_size));
             case 2:
                 old_v = memscanner.get_previous_value(index.row());
-                return QString(MemValue::to_string(old_v, value_type, hex));
+                return QString(MemValue::to_string(old_v, value_type, hex, array_size));
             default:
                 return QString();
         }
@@ -88,7 +91,7 @@ QVariant RamSearchModel::data(const QModelIndex &index, int role) const
             if (!CompareOperations::check_previous(&new_v, old_v))
                 return QBrush(unmatchedColor);
         }
-        else {
+        else if (compare_type == CompareType::Value) {
             new_v = memscanner.get_current_value(index.row());
             if (!CompareOperations::check_value(&new_v))
                 return QBrush(unmatchedColor);
@@ -97,10 +100,33 @@ QVariant RamSearchModel::data(const QModelIndex &index, int role) const
     return QVariant();
 }
 
+bool RamSearchModel::setSource(int state)
+{
+    if (state == 0) {
+        memscanner.source.reset(new ProcessScanSource());
+        return true;
+    }
+
+    std::string prefix = context->config.savestatedir + '/';
+    prefix += context->gamename;
+
+    std::unique_ptr<SavestateScanSource> source(new SavestateScanSource(prefix + ".state" + std::to_string(state), prefix + ".state0", prefix + ".pages"));
+    if (!(*source))
+        return false;
+
+    memscanner.source = std::move(source);
+    return true;
+}
+
 int RamSearchModel::predictScanCount(int mem_flags)
 {
-    std::unique_ptr<MemLayout> memlayout (new MemLayout(context->game_pid));
-    return memlayout->totalSize(MemSection::MemAll, mem_flags);
+    std::vector<MemSection> sections;
+    memscanner.source->getSections(MemSection::MemAll, mem_flags, sections);
+
+    uint64_t total_size = 0;
+    for (const MemSection& section : sections)
+        total_size += section.size;
+    return total_size;
 }
 
 uint64_t RamSearchModel::scanCount()
@@ -115,12 +141,12 @@ uint64_t RamSearchModel::scanSize()
 
 int RamSearchModel::newWatches(int mem_flags, int type, int alignment, CompareType ct, CompareOperator co, MemValueType cv, MemValueType dv, uintptr_t ba, uintptr_t ea)
 {
-    value_type = type;
     compare_type = ct;
 
     beginResetModel();
 
     int err = memscanner.first_scan(mem_flags, type, alignment, ct, co, cv, dv, ba, ea);
+    value_type = memscanner.value_type;
 
     endResetModel();
     
@@ -162,6 +188,22 @@ void RamSearchModel::clear()
     endResetModel();
 }
 
+void RamSearchModel::selectResults(int index)
+{
+    beginResetModel();
+    memscanner.select_results(index);
+    endResetModel();
+}
+
+int RamSearchModel::combineResults(int other, bool common)
+{
+    beginResetModel();
+    int err = memscanner.combine_results(other, common);
+    endResetModel();
+
+    return err;
+}
+
 void RamSearchModel::stopSearch()
 {
     memscanner.is_stopped = true;
@@ -60,6 +60,11 @@ public:
     /* Perform a new search and returns the error code */
     int newWatches(int mem_flags, int type, int alignment, CompareType ct, CompareOperator co, MemValueType cv, MemValueType dv, uintptr_t ba, uintptr_t ea);
 
+    /* Select the scanned memory: the game process if `state` is zero, or
+     * the savestate of that slot. Returns false if the savestate could not
+     * be read */
+    bool setSource(int state);
+
     /* Precompute the size of the next scan (for progress bar) */
     int predictScanCount(int mem_flags);
     
@@ -80,6 +85,13 @@ public:
     /* Clear all scan results */
     void clear();
 
+    /* Go back to a previous scan of the history */
+    void selectResults(int index);
+
+    /* Keep the current results that are also present (or not present) in
+     * another scan of the history. Returns the error code */
+    int combineResults(int other, bool common);
+
     /* Force stop the search */
     void stopSearch();
 
@@ -99,6 +99,18 @@ RamSearchWindow::RamSearchWindow(Context* c, HexViewWindow* view, RamWatchWindow
     watchLayout->addWidget(watchCount);
     watchLayout->addWidget(buttonBox);
 
+    /* Scanned memory */
+    sourceBox = new QComboBox();
+    sourceBox->addItem("Game process", 0);
+    for (int i = 1; i <= 10; i++)
+        sourceBox->addItem(QString("Savestate %1").arg(i), i);
+    sourceBox->setToolTip("Scan the memory saved inside a savestate instead of the game memory, without loading the savestate");
+
+    QGroupBox *sourceGroupBox = new QGroupBox(tr("Scanned Memory"));
+    QVBoxLayout *sourceLayout = new QVBoxLayout;
+    sourceLayout->addWidget(sourceBox);
+    sourceGroupBox->setLayout(sourceLayout);
+
     /* Memory regions */
     memSpecialBox = new QCheckBox("Exclude special regions");
     memSpecialBox->setChecked(true);
@@ -130,16 +142,23 @@ RamSearchWindow::RamSearchWindow(Context* c, HexViewWindow* view, RamWatchWindow
     compareValueButton = new QRadioButton("Specific Value:");
     comparingValueBox = new QLineEdit();
     comparingValueBox->setFont(fixedFont);
+    comparePatternButton = new QRadioButton("Byte Pattern/Struct:");
+    patternBox = new QLineEdit();
+    patternBox->setFont(fixedFont);
+    patternBox->setToolTip("Byte pattern with wildcards such as \"8B 45 ?? 89\", or struct template such as \"float x, float y, int hp=100 @0x10\"");
 
     connect(comparePreviousButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotCompareChanged);
     connect(compareValueButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotCompareChanged);
     connect(comparingValueBox, &QLineEdit::textChanged, this, &RamSearchWindow::slotCompareChanged);
+    connect(comparePatternButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotCompareChanged);
 
     QGroupBox *compareGroupBox = new QGroupBox(tr("Compare To"));
     QVBoxLayout *compareLayout = new QVBoxLayout;
     compareLayout->addWidget(comparePreviousButton);
     compareLayout->addWidget(compareValueButton);
     compareLayout->addWidget(comparingValueBox);
+    compareLayout->addWidget(comparePatternButton);
+    compareLayout->addWidget(patternBox);
     compareGroupBox->setLayout(compareLayout);
 
     /* Operators */
@@ -203,12 +222,42 @@ RamSearchWindow::RamSearchWindow(Context* c, HexViewWindow* view, RamWatchWindow
     formatLayout->addRow(new QLabel(tr("Alignment:")), alignmentBox);
     formatGroupBox->setLayout(formatLayout);
 
+    /* Scan history */
+    historyBox = new QComboBox();
+    historyBox->setToolTip("Go back to a previous scan, and filter its results again");
+    connect(historyBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::activated), this, &RamSearchWindow::slotHistory);
+
+    undoButton = new QPushButton(tr("Undo"));
+    connect(undoButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotUndo);
+
+    otherResultsBox = new QComboBox();
+    commonButton = new QPushButton(tr("Keep Common"));
+    commonButton->setToolTip("Keep the results that are also in the other scan");
+    connect(commonButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotCommon);
+    excludeButton = new QPushButton(tr("Remove Common"));
+    excludeButton->setToolTip("Remove the results that are also in the other scan");
+    connect(excludeButton, &QAbstractButton::clicked, this, &RamSearchWindow::slotExclude);
+
+    QGroupBox *historyGroupBox = new QGroupBox(tr("Scan History"));
+    QGridLayout *historyLayout = new QGridLayout;
+    historyLayout->addWidget(historyBox, 0, 0, 1, 1);
+    historyLayout->addWidget(undoButton, 0, 1, 1, 1);
+    historyLayout->addWidget(new QLabel(tr("Compare with:")), 1, 0, 1, 2);
+    historyLayout->addWidget(otherResultsBox, 2, 0, 1, 2);
+    historyLayout->addWidget(commonButton, 3, 0, 1, 1);
+    historyLayout->addWidget(excludeButton, 3, 1, 1, 1);
+    historyGroupBox->setLayout(historyLayout);
+
+    connect(this, &RamSearchWindow::scanFinished, this, &RamSearchWindow::slotUpdateHistory);
+
     /* Create the options layout */
     QVBoxLayout *optionLayout = new QVBoxLayout;
+    optionLayout->addWidget(sourceGroupBox);
     optionLayout->addWidget(memGroupBox);
     optionLayout->addWidget(compareGroupBox);
     optionLayout->addWidget(operatorGroupBox);
     optionLayout->addWidget(formatGroupBox);
+    optionLayout->addWidget(historyGroupBox);
 
     QHBoxLayout *mainLayout = new QHBoxLayout;
 
@@ -227,6 +276,8 @@ RamSearchWindow::RamSearchWindow(Context* c, HexViewWindow* view, RamWatchWindow
     connect(callTimer, &QTimer::timeout, this, &RamSearchWindow::update);
     
     isSearching = false;
+
+    slotUpdateHistory();
 }
 
 void RamSearchWindow::update()
@@ -252,6 +303,8 @@ void RamSearchWindow::getCompareParameters(CompareType& compare_type, CompareOpe
         compare_type = CompareType::Value;
         compare_value = MemValue::from_string(qPrintable(comparingValueBox->text()), typeBox->currentIndex(), false);
     }
+    if (comparePatternButton->isChecked())
+        compare_type = CompareType::Pattern;
 
     compare_operator = CompareOperator::Equal;
     if (operatorNotEqualButton->isChecked())
@@ -270,6 +323,18 @@ void RamSearchWindow::getCompareParameters(CompareType& compare_type, CompareOpe
     }
 }
 
+bool RamSearchWindow::setPattern()
+{
+    if (!comparePatternButton->isChecked())
+        return true;
+
+    if (!ramSearchModel->memscanner.pattern.parse(patternBox->text().toStdString())) {
+        watchCount->setText(tr("The pattern is invalid"));
+        return false;
+    }
+    return true;
+}
+
 void RamSearchWindow::slotNew()
 {
     if (isSearching)
@@ -284,12 +349,25 @@ void RamSearchWindow::slotNew()
         memGroupBox->setDisabled(false);
         formatGroupBox->setDisabled(false);
         ramSearchModel->clear();
+        slotUpdateHistory();
         watchCount->setText("");
         searchProgress->reset();
         searchButton->setDisabled(true);
         return;
     }
 
+    if (!ramSearchModel->setSource(sourceBox->currentData().toInt())) {
+        watchCount->setText(tr("The savestate could not be read"));
+        return;
+    }
+
+    if (!setPattern())
+        return;
+
+    /* Pattern results are byte arrays of the start of the pattern */
+    if (comparePatternButton->isChecked())
+        typeBox->setCurrentIndex(RamArray);
+
     isSearching = true;
 
     /* Disable buttons during the process */
@@ -349,11 +427,7 @@ void RamSearchWindow::threadedNew(int memflags)
             watchCount->setText(tr("There was an error in the search process"));
             break;
         default:
-            /* Don't display values if too many results */
-            if ((ramSearchModel->memscanner.display_scan_count() == 0) && (ramSearchModel->scanCount() != 0))
-                watchCount->setText(QString("%1 addresses (results are not shown above %2)").arg(ramSearchModel->scanCount()).arg(ramSearchModel->memscanner.DISPLAY_THRESHOLD));
-            else
-                watchCount->setText(QString("%1 addresses").arg(ramSearchModel->scanCount()));
+            showScanCount();
             break;
     }
 
@@ -374,6 +448,8 @@ void RamSearchWindow::threadedNew(int memflags)
     stopButton->setDisabled(true);
     
     isSearching = false;
+
+    emit scanFinished();
 }
 
 void RamSearchWindow::slotSearch()
@@ -381,6 +457,15 @@ void RamSearchWindow::slotSearch()
     if (isSearching)
         return;
 
+    /* Each search may compare with another savestate */
+    if (!ramSearchModel->setSource(sourceBox->currentData().toInt())) {
+        watchCount->setText(tr("The savestate could not be read"));
+        return;
+    }
+
+    if (!setPattern())
+        return;
+
     isSearching = true;
 
     /* Disable buttons during the process */
@@ -423,16 +508,13 @@ void RamSearchWindow::threadedSearch()
             watchCount->setText(tr("There was an error in the search process"));
             break;
         default:
-            /* Don't display values if too many results */
-            if ((ramSearchModel->memscanner.display_scan_count() == 0) && (ramSearchModel->scanCount() != 0))
-                watchCount->setText(QString("%1 addresses (results are not shown above %2)").arg(ramSearchModel->scanCount()).arg(ramSearchModel->memscanner.DISPLAY_THRESHOLD));
-            else
-                watchCount->setText(QString("%1 addresses").arg(ramSearchModel->scanCount()));
+            showScanCount();
             break;
     }
 
-    /* Change the button to "New" if no results */
-    if (ramSearchModel->scanCount() == 0 || err < 0) {
+    /* Change the button to "New" if no results. Previous results are kept
+     * when the search was interrupted */
+    if (ramSearchModel->scanCount() == 0) {
         newButton->setText(tr("New"));
         memGroupBox->setDisabled(false);
         formatGroupBox->setDisabled(false);
@@ -444,6 +526,107 @@ void RamSearchWindow::threadedSearch()
     stopButton->setDisabled(true);
 
     isSearching = false;
+
+    emit scanFinished();
+}
+
+void RamSearchWindow::showScanCount()
+{
+    /* Don't display values if too many results */
+    if ((ramSearchModel->memscanner.display_scan_count() == 0) && (ramSearchModel->scanCount() != 0))
+        watchCount->setText(QString("%1 addresses (results are not shown above %2)").arg(ramSearchModel->scanCount()).arg(ramSearchModel->memscanner.DISPLAY_THRESHOLD));
+    else
+        watchCount->setText(QString("%1 addresses").arg(ramSearchModel->scanCount()));
+}
+
+void RamSearchWindow::slotUpdateHistory()
+{
+    const MemScanner& memscanner = ramSearchModel->memscanner;
+
+    historyBox->clear();
+    otherResultsBox->clear();
+
+    for (int i = 0; i < memscanner.history_size(); i++) {
+        const ScanResults& results = memscanner.results(i);
+
+        /* Indent scans by their depth in the tree of scans */
+        int depth = 0;
+        for (int p = results.parent; p >= 0; p = memscanner.results(p).parent)
+            depth++;
+
+        QString text = QString("%1#%2: %3 (%4)").arg(QString(2*depth, ' ')).arg(i).arg(results.description.c_str()).arg(results.total_size / memscanner.value_type_size);
+        historyBox->addItem(text, i);
+        otherResultsBox->addItem(text, i);
+    }
+
+    historyBox->setCurrentIndex(memscanner.current_results());
+
+    bool has_history = memscanner.history_size() > 1;
+    historyBox->setEnabled(has_history);
+    undoButton->setEnabled(has_history && (memscanner.results(memscanner.current_results()).parent >= 0));
+    otherResultsBox->setEnabled(has_history);
+    commonButton->setEnabled(has_history);
+    excludeButton->setEnabled(has_history);
+}
+
+void RamSearchWindow::showHistoryResults()
+{
+    showScanCount();
+
+    /* Results can be filtered again */
+    newButton->setText(tr("Stop"));
+    memGroupBox->setDisabled(true);
+    formatGroupBox->setDisabled(true);
+    searchButton->setDisabled(false);
+
+    slotUpdateHistory();
+}
+
+void RamSearchWindow::slotHistory(int index)
+{
+    if (isSearching)
+        return;
+
+    ramSearchModel->selectResults(historyBox->itemData(index).toInt());
+    showHistoryResults();
+}
+
+void RamSearchWindow::slotUndo()
+{
+    if (isSearching)
+        return;
+
+    const MemScanner& memscanner = ramSearchModel->memscanner;
+    int current = memscanner.current_results();
+    if ((current < 0) || (memscanner.results(current).parent < 0))
+        return;
+
+    ramSearchModel->selectResults(memscanner.results(current).parent);
+    showHistoryResults();
+}
+
+void RamSearchWindow::slotCommon()
+{
+    if (isSearching)
+        return;
+
+    if (ramSearchModel->combineResults(otherResultsBox->currentData().toInt(), true) < 0) {
+        watchCount->setText(tr("The results of these scans cannot be compared"));
+        return;
+    }
+    showHistoryResults();
+}
+
+void RamSearchWindow::slotExclude()
+{
+    if (isSearching)
+        return;
+
+    if (ramSearchModel->combineResults(otherResultsBox->currentData().toInt(), false) < 0) {
+        watchCount->setText(tr("The results of these scans cannot be compared"));
+        return;
+    }
+    showHistoryResults();
 }
 
 void RamSearchWindow::slotAdd()
@@ -494,7 +677,8 @@ void RamSearchWindow::slotCompareChanged()
 void RamSearchWindow::slotTypeChanged(int index)
 {
     if (index == RamArray || index == RamCString) {
-        compareValueButton->setChecked(true);
+        if (!comparePatternButton->isChecked())
+            compareValueButton->setChecked(true);
         comparePreviousButton->setEnabled(false);
         operatorEqualButton->setChecked(true);
         operatorNotEqualButton->setEnabled(false);
@@ -62,6 +62,8 @@ private:
     QProgressBar *searchProgress;
     QLabel *watchCount;
 
+    QComboBox *sourceBox;
+
     QGroupBox *memGroupBox;
     QCheckBox *memSpecialBox;
     QCheckBox *memROBox;
@@ -72,6 +74,8 @@ private:
     QRadioButton *comparePreviousButton;
     QRadioButton *compareValueButton;
     QLineEdit *comparingValueBox;
+    QRadioButton *comparePatternButton;
+    QLineEdit *patternBox;
 
     QRadioButton *operatorEqualButton;
     QRadioButton *operatorNotEqualButton;
@@ -90,6 +94,12 @@ private:
     QPushButton *newButton;
     QPushButton *searchButton;
     QPushButton *stopButton;
+
+    QComboBox *historyBox;
+    QPushButton *undoButton;
+    QComboBox *otherResultsBox;
+    QPushButton *commonButton;
+    QPushButton *excludeButton;
     
     /* Timer to limit the number of update calls */
     QElapsedTimer* updateTimer;
@@ -101,11 +111,30 @@ private:
 
     void getCompareParameters(CompareType& compare_type, CompareOperator& compare_operator, MemValueType& compare_value, MemValueType& different_value);
 
+    /* Build the searched pattern if comparing with a pattern. Returns false
+     * if the pattern is invalid */
+    bool setPattern();
+
     /* Actual RAM search done in another thread */
     void threadedNew(int memflags);
     void threadedSearch();
 
+    /* Show the number of results */
+    void showScanCount();
+
+    /* Show the results of a scan from the history, and allow to filter them */
+    void showHistoryResults();
+
+signals:
+    /* A scan done in another thread has finished */
+    void scanFinished();
+
 private slots:
+    void slotUpdateHistory();
+    void slotHistory(int index);
+    void slotUndo();
+    void slotCommon();
+    void slotExclude();
     void slotNew();
     void slotSearch();
     void slotAdd();
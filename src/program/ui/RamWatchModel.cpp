@@ -298,6 +298,7 @@ void RamWatchModel::loadSettings(QSettings& watchSettings)
 
 void RamWatchModel::update()
 {
+    RamWatchDetailed::update_values(ramwatches);
     emit dataChanged(index(0,0), index(rowCount()-1,1), QVector<int>(Qt::DisplayRole));
 }
 
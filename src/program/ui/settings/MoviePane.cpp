@@ -19,6 +19,7 @@
 
 #include "MoviePane.h"
 #include "tooltip/ToolTipComboBox.h"
+#include "tooltip/ToolTipCheckBox.h"
 
 #include "Context.h"
 
@@ -72,6 +73,9 @@ void MoviePane::initLayout()
 
     generalLayout->addRow(new QLabel(tr("On Movie End:")), endChoice);
 
+    binaryInputsBox = new ToolTipCheckBox(tr("Store inputs in binary format"));
+    generalLayout->addRow(binaryInputsBox);
+
     QVBoxLayout* const mainLayout = new QVBoxLayout;
     mainLayout->addWidget(generalBox);
     mainLayout->addWidget(autosaveBox);
@@ -87,6 +91,7 @@ void MoviePane::initSignals()
     connect(autosaveFrames, QOverload<int>::of(&QSpinBox::valueChanged), this, &MoviePane::saveConfig);
     connect(autosaveCount, QOverload<int>::of(&QSpinBox::valueChanged), this, &MoviePane::saveConfig);
     connect(endChoice, static_cast<void (QComboBox::*)(int)>(&QComboBox::activated), this, &MoviePane::saveConfig);    
+    connect(binaryInputsBox, &QAbstractButton::clicked, this, &MoviePane::saveConfig);
 }
 
 void MoviePane::initToolTips()
@@ -97,6 +102,13 @@ void MoviePane::initToolTips()
     "<b>Keep Reading:</b> Stay in playback mode, and send blank inputs on each frame."
     "A blank input is defined as all bool inputs set to false, all value inputs set to 0.<br><br>"
     "<b>Switch to Writing:</b> Switch to writing mode.");
+
+    binaryInputsBox->setTitle("Binary Inputs");
+    binaryInputsBox->setDescription("Store the inputs of saved movies in a "
+    "binary format instead of the text format. Long movies are much faster to "
+    "open and use less memory, because inputs are only decoded when needed.<br><br>"
+    "Movies saved this way cannot be opened by older versions of libTAS. "
+    "Both formats can always be opened.");
 }
 
 
@@ -122,6 +134,8 @@ void MoviePane::loadConfig()
 
     int index = endChoice->findData(context->config.on_movie_end);
     if (index != -1) endChoice->setCurrentIndex(index);
+
+    binaryInputsBox->setChecked(context->config.movie_binary_inputs);
 }
 
 void MoviePane::saveConfig()
@@ -132,6 +146,7 @@ void MoviePane::saveConfig()
     context->config.autosave_count = autosaveCount->value();
 
     context->config.on_movie_end = endChoice->itemData(endChoice->currentIndex()).toInt();
+    context->config.movie_binary_inputs = binaryInputsBox->isChecked();
     context->config.sc_modified = true;
 }
 
@@ -25,6 +25,7 @@
 class Context;
 class QGroupBox;
 class ToolTipComboBox;
+class ToolTipCheckBox;
 class QSpinBox;
 class QDoubleSpinBox;
 
@@ -50,6 +51,7 @@ private:
     QSpinBox *autosaveCount;
 
     ToolTipComboBox* endChoice;
+    ToolTipCheckBox* binaryInputsBox;
 
 public slots:
     void loadConfig();
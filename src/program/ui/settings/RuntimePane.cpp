@@ -31,6 +31,7 @@
 #include <QtWidgets/QFormLayout>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QCheckBox>
+#include <QtWidgets/QSpinBox>
 
 RuntimePane::RuntimePane(Context* c) : context(c)
 {
@@ -85,11 +86,31 @@ void RuntimePane::initLayout()
     stateCompressedBox = new ToolTipCheckBox(tr("Compressed savestates"));
     stateUnmappedBox = new ToolTipCheckBox(tr("Skip unmapped pages"));
     stateForkBox = new ToolTipCheckBox(tr("Fork to save states"));
+    stateAsyncBox = new ToolTipCheckBox(tr("Write states in background"));
+    stateDedupBox = new ToolTipCheckBox(tr("Share identical pages between states"));
+    stateRamBox = new ToolTipCheckBox(tr("Keep states in memory"));
+    stateDeltaBox = new ToolTipCheckBox(tr("Store differences with base state"));
+    stateLazyBox = new ToolTipCheckBox(tr("Restore states in background"));
+
+    stateRamBudget = new QSpinBox();
+    stateRamBudget->setMinimum(0);
+    stateRamBudget->setMaximum(1024 * 1024);
+    stateRamBudget->setSuffix(tr(" MB"));
+
+    QFormLayout* ramBudgetLayout = new QFormLayout;
+    ramBudgetLayout->setFormAlignment(Qt::AlignLeft | Qt::AlignTop);
+    ramBudgetLayout->addRow(new QLabel(tr("Memory budget:")), stateRamBudget);
 
     savestateLayout->addWidget(stateIncrementalBox, 0, 0);
     savestateLayout->addWidget(stateCompressedBox, 0, 1);
     savestateLayout->addWidget(stateUnmappedBox, 1, 0);
     savestateLayout->addWidget(stateForkBox, 1, 1);
+    savestateLayout->addWidget(stateAsyncBox, 2, 0);
+    savestateLayout->addWidget(stateDedupBox, 2, 1);
+    savestateLayout->addWidget(stateRamBox, 3, 0);
+    savestateLayout->addLayout(ramBudgetLayout, 3, 1);
+    savestateLayout->addWidget(stateDeltaBox, 4, 0);
+    savestateLayout->addWidget(stateLazyBox, 4, 1);
 
     timingBox = new QGroupBox(tr("Timing"));
     QVBoxLayout* timingMainLayout = new QVBoxLayout;
@@ -183,6 +204,12 @@ void RuntimePane::initSignals()
     connect(stateCompressedBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
     connect(stateUnmappedBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
     connect(stateForkBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateAsyncBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateDedupBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateRamBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateDeltaBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateLazyBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
+    connect(stateRamBudget, QOverload<int>::of(&QSpinBox::valueChanged), this, &RuntimePane::saveConfig);
 
     connect(trackingTimeBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
     connect(trackingGettimeofdayBox, &QAbstractButton::clicked, this, &RuntimePane::saveConfig);
@@ -247,6 +274,42 @@ void RuntimePane::initToolTips()
     "Linux copy-on-write magic. Useful for games that take a long time to save."
     "<br><br><em>If unsure, leave this unchecked</em>");
 
+    stateAsyncBox->setDescription("Only copy the memory pages to save when "
+    "saving a state, and let a background thread compress and write them to disk "
+    "while the game is running. Loading a state waits for any pending write "
+    "to finish. This uses as much additional memory as the size of the state "
+    "until it is written. Has no effect when forking to save states."
+    "<br><br><em>If unsure, leave this unchecked</em>");
+
+    stateDedupBox->setDescription("Store memory pages in a single file shared "
+    "by all savestates, so that a page which is identical in several states "
+    "is only stored once. This greatly reduces disk usage when saving many "
+    "states of the same game area. Pages are stored uncompressed. "
+    "Has no effect when forking to save states."
+    "<br><br><em>If unsure, leave this unchecked</em>");
+
+    stateRamBox->setDescription("Keep savestates in memory instead of writing "
+    "them to disk, which makes saving and loading faster. Savestates in memory "
+    "are always compressed. When their total size exceeds the memory budget, "
+    "the least recently used savestates are moved to disk. "
+    "Has no effect when forking to save states."
+    "<br><br><em>If unsure, leave this unchecked</em>");
+
+    stateDeltaBox->setDescription("When using incremental savestates, store "
+    "each modified memory page as its difference with the same page in the "
+    "base savestate, which is compressed into a few bytes when the page was "
+    "only slightly modified. Loading such a page requires reading the base "
+    "savestate page as well. Has no effect when writing states in background."
+    "<br><br><em>If unsure, leave this unchecked</em>");
+
+    stateLazyBox->setDescription("When loading a state, only restore the "
+    "memory layout and let a background thread restore the content of memory "
+    "pages, so that the game resumes immediately. Pages accessed by the game "
+    "are restored first. Saving or loading another state waits for all pages "
+    "to be restored. This requires userfaultfd to be allowed for regular users "
+    "(sysctl vm.unprivileged_userfaultfd=1), otherwise states are loaded normally."
+    "<br><br><em>If unsure, leave this unchecked</em>");
+
     trackingBox->setDescription("By checking a specific function, time will advance "
     "a bit when too many calls of that function have been made from the main thread. "
     "This prevents softlocks when a game wait in a loop for time to advance.<br><br>"
@@ -346,6 +409,14 @@ void RuntimePane::loadConfig()
     stateCompressedBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_COMPRESSED);
     stateUnmappedBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_PRESENT);
     stateForkBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_FORK);
+    stateAsyncBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_ASYNC);
+    stateDedupBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_DEDUP);
+    stateRamBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_RAM);
+    stateDeltaBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_DELTA);
+    stateLazyBox->setChecked(context->config.sc.savestate_settings & SharedConfig::SS_LAZY);
+    stateRamBudget->blockSignals(true);
+    stateRamBudget->setValue(context->config.sc.savestate_ram_budget);
+    stateRamBudget->blockSignals(false);
 
     trackingTimeBox->setChecked(context->config.sc.main_gettimes_threshold[SharedConfig::TIMETYPE_TIME] != -1);
     trackingGettimeofdayBox->setChecked(context->config.sc.main_gettimes_threshold[SharedConfig::TIMETYPE_GETTIMEOFDAY] != -1);
@@ -388,6 +459,12 @@ void RuntimePane::saveConfig()
     context->config.sc.savestate_settings |= stateCompressedBox->isChecked() ? SharedConfig::SS_COMPRESSED : 0;
     context->config.sc.savestate_settings |= stateUnmappedBox->isChecked() ? SharedConfig::SS_PRESENT : 0;
     context->config.sc.savestate_settings |= stateForkBox->isChecked() ? SharedConfig::SS_FORK : 0;
+    context->config.sc.savestate_settings |= stateAsyncBox->isChecked() ? SharedConfig::SS_ASYNC : 0;
+    context->config.sc.savestate_settings |= stateDedupBox->isChecked() ? SharedConfig::SS_DEDUP : 0;
+    context->config.sc.savestate_settings |= stateRamBox->isChecked() ? SharedConfig::SS_RAM : 0;
+    context->config.sc.savestate_settings |= stateDeltaBox->isChecked() ? SharedConfig::SS_DELTA : 0;
+    context->config.sc.savestate_settings |= stateLazyBox->isChecked() ? SharedConfig::SS_LAZY : 0;
+    context->config.sc.savestate_ram_budget = stateRamBudget->value();
 
     context->config.sc.main_gettimes_threshold[SharedConfig::TIMETYPE_TIME] = trackingTimeBox->isChecked() ? 100 : -1;
     context->config.sc.main_gettimes_threshold[SharedConfig::TIMETYPE_GETTIMEOFDAY] = trackingGettimeofdayBox->isChecked() ? 100 : -1;
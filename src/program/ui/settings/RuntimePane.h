@@ -29,6 +29,7 @@ class ToolTipComboBox;
 class ToolTipCheckBox;
 class ToolTipGroupBox;
 class QGroupBox;
+class QSpinBox;
 
 class RuntimePane : public QWidget {
     Q_OBJECT
@@ -60,6 +61,12 @@ private:
     ToolTipCheckBox* stateCompressedBox;
     ToolTipCheckBox* stateUnmappedBox;
     ToolTipCheckBox* stateForkBox;
+    ToolTipCheckBox* stateAsyncBox;
+    ToolTipCheckBox* stateDedupBox;
+    ToolTipCheckBox* stateRamBox;
+    ToolTipCheckBox* stateDeltaBox;
+    ToolTipCheckBox* stateLazyBox;
+    QSpinBox* stateRamBudget;
 
     ToolTipGroupBox* trackingBox;
 
@@ -0,0 +1,83 @@
+/*
+    Copyright 2015-2024 Clément Gallet <clement.gallet@ens-lyon.org>
+
+    This file is part of libTAS.
+
+    libTAS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libTAS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libTAS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBTAS_RAMWATCHFEED_H_INCLUDED
+#define LIBTAS_RAMWATCHFEED_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Layout of the memory shared between the program and the game for ram
+ * watches. The program writes the list of watches, and the game copies the
+ * value of each watch into a ring of frames at each frame boundary, so that
+ * the program can read all values without any system call.
+ *
+ * The same layout is used by 32-bit games and 64-bit programs, so all fields
+ * are placed on their natural alignment.
+ */
+struct alignas(8) RamWatchFeed {
+    enum {
+        MAX_WATCHES = 1024,
+        MAX_LEVELS = 10,
+        VALUE_SIZE = 16,
+        RING_SIZE = 8,
+    };
+
+    /* Watch description, written by the program */
+    struct Watch {
+        uint64_t base_address; // address of the value, or of the first pointer
+        int32_t offsets[MAX_LEVELS]; // offsets of pointer chain, from the base address
+        uint32_t level_count; // length of pointer chain, 0 if not a pointer
+        uint32_t size; // size of the value
+    };
+
+    /* Watch value, written by the game */
+    struct Value {
+        uint64_t address; // address of the value, after following pointers
+        uint8_t data[VALUE_SIZE];
+        uint32_t read_size; // number of bytes that could be read
+        uint32_t padding;
+    };
+
+    /* Values of all watches at a frame boundary */
+    struct Frame {
+        std::atomic<uint64_t> sequence; // odd while the game writes the frame
+        uint64_t framecount;
+        uint64_t list_generation; // generation of the watch list that was used
+        uint32_t watch_count;
+        uint32_t padding;
+        Value values[MAX_WATCHES];
+    };
+
+    /* Watch list */
+    std::atomic<uint64_t> list_sequence; // odd while the program writes the list
+    uint64_t list_generation; // increased at each list change
+    uint32_t watch_count;
+    uint32_t padding;
+    Watch watches[MAX_WATCHES];
+
+    /* Number of frames written so far, the last one being at index
+     * (frame_count-1) % RING_SIZE */
+    std::atomic<uint64_t> frame_count;
+    Frame frames[RING_SIZE];
+};
+
+#endif
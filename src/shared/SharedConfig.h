@@ -252,11 +252,19 @@ struct __attribute__((packed, aligned(8))) SharedConfig {
         SS_COMPRESSED = 0x08, /* Compress savestates */
         SS_PRESENT = 0x10, /* Skip unmapped pages */
         SS_FORK = 0x20, /* Use a forked process to save the state */
+        SS_ASYNC = 0x40, /* Write the state files in a background thread */
+        SS_DEDUP = 0x80, /* Store identical pages of all states only once */
+        SS_RAM = 0x100, /* Keep states in memory */
+        SS_DELTA = 0x200, /* Store modified pages as a difference with the base state */
+        SS_LAZY = 0x400, /* Restore memory pages in background after loading a state */
     };
 
     /* Savestate settings */
     int savestate_settings = SS_COMPRESSED;
 
+    /* Maximum size of states kept in memory, in MB */
+    int savestate_ram_budget = 2048;
+
     /* Stacktrace hash to advance time */
     uint64_t busy_loop_hash = 0;
 
@@ -113,6 +113,14 @@ enum {
      */
     MSGN_END_FRAMEBOUNDARY,
 
+    /*
+     * Several messages sent at once, which must be read before any other
+     * message. Messages are framed by sockethelpers, and this message is
+     * never returned by receiveMessage()
+     * Argument: unsigned int size, followed by the messages
+     */
+    MSGN_FRAMED_MESSAGES,
+
     /*
      * The game tells the program that he has quit
      * Argument: none
@@ -215,6 +223,12 @@ enum {
      */
     MSGN_BASE_SAVESTATE_INDEX,
 
+    /*
+     * Send to the game the path of the page store, shared by all savestates
+     * Argument: size_t (string length) then char[len]
+     */
+    MSGN_PAGESTORE_PATH,
+
     /*
      * Notify the program that encoding failed
      * Arguments: none
@@ -387,6 +401,12 @@ enum {
      * Arguments: int, uint64_t addr
      */
     MSGN_UNITY_ADDR,
+
+    /* Send the file descriptor of the memory shared for ram watches, so that
+     * the program can map it from the game process
+     * Argument: int
+     */
+    MSGB_RAMWATCH_FEED,
 };
 
 #endif
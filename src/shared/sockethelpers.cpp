@@ -18,6 +18,7 @@
  */
 
 #include "sockethelpers.h"
+#include "messages.h"
 
 #ifdef LIBTAS_LIBRARY
 #include "lcf.h"
@@ -31,6 +32,7 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 #include <sys/un.h>
 #include <iostream>
@@ -54,6 +56,19 @@ static int socket_fd = 0;
 
 static std::mutex mutex;
 
+/* Data being buffered before being sent, starting with the frame header */
+static bool buffering = false;
+static std::vector<char> send_buffer;
+
+/* Framed data that was received, and position of the data to read next */
+static std::vector<char> receive_buffer;
+static size_t receive_pos = 0;
+
+struct FrameHeader {
+    int message;
+    unsigned int size;
+};
+
 int removeSocket(void) {
     int ret = unlink(SOCKET_FILENAME);
     if ((ret == -1) && (errno != ENOENT))
@@ -184,6 +199,12 @@ int sendData(const void* elem, unsigned int size)
     LOG(LL_DEBUG, LCF_SOCKET, "Send socket data of size %u", size);
 #endif
 
+    if (buffering) {
+        const char* data = static_cast<const char*>(elem);
+        send_buffer.insert(send_buffer.end(), data, data + size);
+        return size;
+    }
+
     ssize_t ret = 0;
     do {
         ret = send(socket_fd, elem, size, MSG_NOSIGNAL);
@@ -215,6 +236,40 @@ int sendMessage(int message)
     return sendData(&message, sizeof(int));
 }
 
+void bufferMessages(void)
+{
+    /* Keep the allocated memory between frames */
+    send_buffer.resize(sizeof(FrameHeader));
+    buffering = true;
+}
+
+int sendBufferedMessages(void)
+{
+    buffering = false;
+
+    FrameHeader header = {MSGN_FRAMED_MESSAGES, static_cast<unsigned int>(send_buffer.size() - sizeof(FrameHeader))};
+    memcpy(send_buffer.data(), &header, sizeof(FrameHeader));
+
+    /* A signal can interrupt the call after some data was sent */
+    size_t sent = 0;
+    while (sent < send_buffer.size()) {
+        ssize_t ret = send(socket_fd, send_buffer.data() + sent, send_buffer.size() - sent, MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+#ifdef LIBTAS_LIBRARY
+            LOG(LL_ERROR, LCF_SOCKET, "send() returns -1 with error %s", strerror(errno));
+#else
+            std::cerr << "send() returns -1 with error " << strerror(errno) << std::endl;
+#endif
+            return -1;
+        }
+        sent += ret;
+    }
+
+    return sent;
+}
+
 void sendString(const std::string& str)
 {
 #ifdef LIBTAS_LIBRARY
@@ -232,6 +287,21 @@ int receiveData(void* elem, unsigned int size)
     LOG(LL_DEBUG, LCF_SOCKET, "Receive socket data of size %u", size);
 #endif
 
+    /* Read framed data from memory */
+    if (receive_pos < receive_buffer.size()) {
+        if (size > receive_buffer.size() - receive_pos) {
+#ifdef LIBTAS_LIBRARY
+            LOG(LL_ERROR, LCF_SOCKET, "Reading %u bytes past the end of framed messages", size);
+#else
+            std::cerr << "Reading " << size << " bytes past the end of framed messages" << std::endl;
+#endif
+            size = receive_buffer.size() - receive_pos;
+        }
+        memcpy(elem, receive_buffer.data() + receive_pos, size);
+        receive_pos += size;
+        return size;
+    }
+
     ssize_t ret = 0;
     do {
         ret = recv(socket_fd, elem, size, MSG_WAITALL);
@@ -261,6 +331,30 @@ int receiveData(void* elem, unsigned int size)
     return ret;
 }
 
+/* Receive all framed messages at once, after the MSGN_FRAMED_MESSAGES message
+ * was received */
+static int receiveFrame()
+{
+    unsigned int size;
+    int ret = receiveData(&size, sizeof(unsigned int));
+    if (ret <= 0)
+        return ret;
+
+    /* Mark the buffer as read, so that the frame is received from the socket */
+    receive_buffer.resize(size);
+    receive_pos = size;
+    if (size == 0)
+        return 1;
+
+    ret = receiveData(receive_buffer.data(), size);
+    if (ret != static_cast<int>(size)) {
+        receive_buffer.clear();
+        return (ret < 0) ? ret : 0;
+    }
+    receive_pos = 0;
+    return ret;
+}
+
 int receiveMessage()
 {
     int msg;
@@ -274,11 +368,25 @@ int receiveMessage()
         
     if (ret < 0)
         return ret;
+
+    if (msg == MSGN_FRAMED_MESSAGES) {
+        ret = receiveFrame();
+        if (ret == 0)
+            return -2;
+        if (ret < 0)
+            return ret;
+        return receiveMessage();
+    }
+
     return msg;
 }
 
 int receiveMessageNonBlocking()
 {
+    /* Framed messages are already available */
+    if (receive_pos < receive_buffer.size())
+        return receiveMessage();
+
     int msg;
     int ret = recv(socket_fd, &msg, sizeof(int), MSG_WAITALL | MSG_DONTWAIT);
     if (ret < 0)
@@ -291,6 +399,16 @@ int receiveMessageNonBlocking()
     if (ret == 0)
         return -2;
 
+    /* The whole frame was sent at once, so it can be received right away */
+    if (msg == MSGN_FRAMED_MESSAGES) {
+        ret = receiveFrame();
+        if (ret == 0)
+            return -2;
+        if (ret < 0)
+            return ret;
+        return receiveMessageNonBlocking();
+    }
+
     return msg;
 }
 
@@ -57,6 +57,16 @@ void sendString(const std::string& str);
 /* Helper function to send a message over the socket */
 int sendMessage(int message);
 
+/* Start buffering all data that is sent over the socket, instead of sending
+ * each piece of data with a separate call. Nothing must be received from the
+ * socket until the buffered data is sent. */
+void bufferMessages(void);
+
+/* Send all buffered data in a single call, framed in a MSGN_FRAMED_MESSAGES
+ * message, and stop buffering. The receiving side reads the whole frame at
+ * once, and the framed messages are then received from memory. */
+int sendBufferedMessages(void);
+
 /* Receive data from the socket. Same arguments as sendData() */
 int receiveData(void* elem, unsigned int size);
 
@@ -0,0 +1,143 @@
+-- Savestate benchmark, to be used with the checkpoint_workload program.
+--
+-- Run with:
+--   LIBTAS_CHECKPOINT_STATS=/tmp/libtas_stats.txt libTAS -l checkpoint_bench.lua checkpoint_workload 64 64 16 16 5
+-- then start the game. For each combination of savestate settings below, the
+-- script saves and loads a state a number of times, then prints the latency
+-- percentiles, the size written and the compression ratio of each operation.
+-- The game prints a message if a state was not fully restored.
+
+local stats_path = os.getenv("LIBTAS_CHECKPOINT_STATS")
+
+-- Savestate setting flags, see runtime.getSavestateSettings()
+local SS_INCREMENTAL = 1
+local SS_COMPRESSED = 8
+local SS_PRESENT = 16
+local SS_ASYNC = 64
+local SS_DEDUP = 128
+local SS_RAM = 256
+local SS_DELTA = 512
+local SS_LAZY = 1024
+
+local combinations = {
+    {name = "raw", settings = 0},
+    {name = "compressed", settings = SS_COMPRESSED},
+    {name = "compressed unmapped", settings = SS_COMPRESSED + SS_PRESENT},
+    {name = "incremental", settings = SS_INCREMENTAL + SS_COMPRESSED},
+    {name = "incremental delta", settings = SS_INCREMENTAL + SS_COMPRESSED + SS_DELTA},
+    {name = "background write", settings = SS_COMPRESSED + SS_ASYNC},
+    {name = "shared pages", settings = SS_COMPRESSED + SS_DEDUP},
+    {name = "memory", settings = SS_COMPRESSED + SS_RAM},
+    {name = "memory lazy", settings = SS_INCREMENTAL + SS_COMPRESSED + SS_RAM + SS_LAZY},
+}
+
+-- Number of save and load cycles for each combination
+local cycles = 20
+
+-- Frames to run between operations, so that memory gets modified
+local frames_between = 2
+
+local combination = 0
+local cycle = 0
+local wait = 0
+local saving = true
+local original_settings = nil
+local done = false
+
+local function percentile(values, p)
+    local index = math.max(1, math.ceil(#values * p))
+    return values[index]
+end
+
+local function report()
+    local file = io.open(stats_path, "r")
+    if not file then
+        print("Could not open " .. stats_path)
+        return
+    end
+
+    -- Gather durations and sizes by settings and operation
+    local results = {}
+    for line in file:lines() do
+        local op, slot, settings, seconds, stored, raw = line:match("(%S+) (%S+) (%S+) (%S+) (%S+) (%S+)")
+        if op then
+            local key = settings .. " " .. op
+            local r = results[key]
+            if not r then
+                r = {times = {}, stored = 0, raw = 0}
+                results[key] = r
+            end
+            table.insert(r.times, tonumber(seconds) * 1000)
+            r.stored = r.stored + tonumber(stored)
+            r.raw = r.raw + tonumber(raw)
+        end
+    end
+    file:close()
+
+    print(string.format("%-22s %-6s %5s %9s %9s %9s %9s %10s %7s",
+        "settings", "op", "count", "p50 ms", "p90 ms", "p99 ms", "max ms", "MB/op", "ratio"))
+    for _, c in ipairs(combinations) do
+        for _, op in ipairs({"base", "save", "copy", "write", "load"}) do
+            local r = results[c.settings .. " " .. op]
+            if r then
+                table.sort(r.times)
+                local ratio = (r.stored > 0 and r.raw > 0) and string.format("%.2f", r.raw / r.stored) or "-"
+                print(string.format("%-22s %-6s %5d %9.2f %9.2f %9.2f %9.2f %10.2f %7s",
+                    c.name, op, #r.times, percentile(r.times, 0.5), percentile(r.times, 0.9),
+                    percentile(r.times, 0.99), r.times[#r.times],
+                    r.stored / #r.times / (1024 * 1024), ratio))
+            end
+        end
+    end
+end
+
+function onFrame()
+    if done then
+        return
+    end
+
+    if not stats_path then
+        print("LIBTAS_CHECKPOINT_STATS must be set to the path of the statistics file")
+        done = true
+        return
+    end
+
+    if wait > 0 then
+        wait = wait - 1
+        return
+    end
+
+    if combination == 0 then
+        -- Start from an empty statistics file
+        local file = io.open(stats_path, "w")
+        if file then file:close() end
+        original_settings = runtime.getSavestateSettings()
+    end
+
+    -- Settings are changed on the frame after the last operation, so that
+    -- the operation is performed with the previous settings
+    if combination == 0 or cycle == cycles then
+        combination = combination + 1
+        cycle = 0
+        if combination > #combinations then
+            runtime.setSavestateSettings(original_settings)
+            report()
+            done = true
+            return
+        end
+        runtime.setSavestateSettings(combinations[combination].settings)
+        wait = frames_between
+        return
+    end
+
+    if saving then
+        runtime.saveState(1)
+    else
+        runtime.loadState(1)
+        cycle = cycle + 1
+    end
+    saving = not saving
+    wait = frames_between
+end
+
+callback.onFrame(onFrame)
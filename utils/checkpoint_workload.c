@@ -0,0 +1,188 @@
+/* This code is a synthetic game used to benchmark savestates, together with
+ * the checkpoint_bench.lua script. It allocates memory of each kind that
+ * savestates handle differently, and modifies a fraction of it each frame.
+ *
+ * It also checks that loading a state restores all modified memory: a few
+ * pages of a separate area, most of them far from the start of the area, are
+ * stamped with the frame count each frame, and are checked on the next frame.
+ * As the frame count is restored together with the pages, any mismatch means
+ * that a modified page was not restored.
+ *
+ * Compile with `gcc -O2 checkpoint_workload.c -lSDL2 -o checkpoint_workload`
+ * Arguments are `checkpoint_workload [heap MB] [mmap MB] [file MB] [shared MB] [dirty percent]`,
+ * by default `64 64 16 16 5`
+ */
+
+#include <SDL2/SDL.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define PAGE_SIZE 4096
+
+/* Size of the checked area, and pages that are stamped each frame. Other
+ * pages of the area are never modified. */
+#define CHECK_PAGES 4096
+static const size_t check_pages[] = {0, 255, 300, 1000, 2047, 2048, 2100, 4095};
+#define CHECK_COUNT (sizeof(check_pages) / sizeof(check_pages[0]))
+
+struct Region {
+    const char *name;
+    char *addr;
+    size_t pages;
+};
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Fill a page with data that compresses roughly like game memory: a part of
+ * random bytes followed by repeated values */
+static void fillPage(char *page, uint64_t frame)
+{
+    uint64_t *words = (uint64_t*)page;
+    for (int i = 0; i < 128; i++)
+        words[i] = rng();
+    for (int i = 128; i < PAGE_SIZE / 8; i++)
+        words[i] = frame + (i & 0xf);
+}
+
+static char *allocRegion(const char *name, size_t mb, int flags, int fd)
+{
+    if (mb == 0)
+        return NULL;
+
+    char *addr = mmap(NULL, mb * 1024 * 1024, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (addr == MAP_FAILED) {
+        printf("Could not allocate %zu MB of %s memory\n", mb, name);
+        exit(1);
+    }
+    return addr;
+}
+
+int main(int argc, char **argv)
+{
+    size_t heap_mb = (argc > 1) ? strtoul(argv[1], NULL, 10) : 64;
+    size_t mmap_mb = (argc > 2) ? strtoul(argv[2], NULL, 10) : 64;
+    size_t file_mb = (argc > 3) ? strtoul(argv[3], NULL, 10) : 16;
+    size_t shared_mb = (argc > 4) ? strtoul(argv[4], NULL, 10) : 16;
+    int dirty_percent = (argc > 5) ? atoi(argv[5]) : 5;
+
+    struct Region regions[4];
+    int region_count = 0;
+
+    /* Heap memory, the allocation is large enough to be a separate mapping
+     * made by malloc, so we touch it right away */
+    if (heap_mb > 0) {
+        regions[region_count].name = "heap";
+        regions[region_count].addr = malloc(heap_mb * 1024 * 1024);
+        regions[region_count].pages = heap_mb * 1024 * 1024 / PAGE_SIZE;
+        region_count++;
+    }
+
+    if (mmap_mb > 0) {
+        regions[region_count].name = "anonymous";
+        regions[region_count].addr = allocRegion("anonymous", mmap_mb, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+        regions[region_count].pages = mmap_mb * 1024 * 1024 / PAGE_SIZE;
+        region_count++;
+    }
+
+    /* Private mapping of a file, which is only saved where modified */
+    if (file_mb > 0) {
+        int fd = open("checkpoint_workload.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if ((fd == -1) || (ftruncate(fd, file_mb * 1024 * 1024) == -1)) {
+            printf("Could not create the file to map\n");
+            return 1;
+        }
+        regions[region_count].name = "file";
+        regions[region_count].addr = allocRegion("file", file_mb, MAP_PRIVATE, fd);
+        regions[region_count].pages = file_mb * 1024 * 1024 / PAGE_SIZE;
+        region_count++;
+        close(fd);
+    }
+
+    if (shared_mb > 0) {
+        regions[region_count].name = "shared";
+        regions[region_count].addr = allocRegion("shared", shared_mb, MAP_SHARED | MAP_ANONYMOUS, -1);
+        regions[region_count].pages = shared_mb * 1024 * 1024 / PAGE_SIZE;
+        region_count++;
+    }
+
+    /* Fill all regions once, except the file mapping which is only modified
+     * by frames */
+    for (int r = 0; r < region_count; r++) {
+        if (strcmp(regions[r].name, "file") == 0)
+            continue;
+        for (size_t p = 0; p < regions[r].pages; p++)
+            fillPage(regions[r].addr + p * PAGE_SIZE, 0);
+    }
+
+    char *check_area = allocRegion("checked", CHECK_PAGES * PAGE_SIZE / (1024 * 1024), MAP_PRIVATE | MAP_ANONYMOUS, -1);
+    for (size_t i = 0; i < CHECK_COUNT; i++)
+        *(uint64_t*)(check_area + check_pages[i] * PAGE_SIZE) = 0;
+
+    printf("Allocated %zu MB of heap, %zu MB of anonymous memory, %zu MB of file mapping and %zu MB of shared memory, modifying %d%% each frame\n",
+        heap_mb, mmap_mb, file_mb, shared_mb, dirty_percent);
+
+    SDL_Init(SDL_INIT_VIDEO);
+
+    SDL_Window* window = SDL_CreateWindow("Checkpoint workload",SDL_WINDOWPOS_UNDEFINED,
+            SDL_WINDOWPOS_UNDEFINED,
+            320,
+            240,
+            SDL_WINDOW_SHOWN);
+
+    SDL_Renderer *renderer = SDL_CreateRenderer(window,-1,SDL_RENDERER_SOFTWARE);
+
+    int run = 1;
+    uint64_t frame = 0;
+    while (run) {
+        for (size_t i = 0; i < CHECK_COUNT; i++) {
+            uint64_t stamp = *(uint64_t*)(check_area + check_pages[i] * PAGE_SIZE);
+            if (stamp != frame)
+                printf("Frame %llu: page %zu of the checked area was not restored, it contains frame %llu\n",
+                    (unsigned long long)frame, check_pages[i], (unsigned long long)stamp);
+        }
+
+        /* Modify random pages of each region */
+        for (int r = 0; r < region_count; r++) {
+            size_t count = regions[r].pages * dirty_percent / 100;
+            for (size_t i = 0; i < count; i++)
+                fillPage(regions[r].addr + (rng() % regions[r].pages) * PAGE_SIZE, frame);
+        }
+
+        SDL_SetRenderDrawColor(renderer, frame%256, 0, 0, 255);
+        SDL_RenderClear(renderer);
+        SDL_RenderPresent(renderer);
+
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+            if ((event.type == SDL_QUIT) ||
+                ((event.type == SDL_KEYDOWN) && (event.key.keysym.sym == SDLK_ESCAPE)))
+                run = 0;
+        }
+
+        frame++;
+
+        for (size_t i = 0; i < CHECK_COUNT; i++)
+            *(uint64_t*)(check_area + check_pages[i] * PAGE_SIZE) = frame;
+    }
+
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+
+    SDL_Quit();
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+/* This code measures the number of frames per second that the socket between
+ * the program and the game can sustain in fast-forward. For each frame, the
+ * game tells the program that it reached the frame boundary, and the program
+ * sends the inputs and ends the frame boundary, either with one call per
+ * message and struct (the previous protocol) or with all messages framed in a
+ * single buffer (the current protocol).
+ *
+ * Compile with `gcc -O2 frame_messages.c -o frame_messages`
+ * Run with `./frame_messages [frames]`, by default 200000 frames
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Message ids, only need to be distinct */
+enum {
+    START_FRAMEBOUNDARY,
+    ALL_INPUTS,
+    POINTER_INPUTS,
+    CONTROLLER_INPUTS,
+    MISC_INPUTS,
+    END_INPUTS,
+    END_FRAMEBOUNDARY,
+    FRAMED_MESSAGES,
+};
+
+/* Same sizes as the input structs */
+struct Inputs {
+    uint32_t keyboard[16];
+    int pointer[5];
+    short controller_axes[6];
+    unsigned short controller_buttons;
+    uint32_t misc[5];
+};
+
+static double now()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec + tp.tv_nsec / 1000000000.0;
+}
+
+static void sendAll(int fd, const void *data, size_t size)
+{
+    if (send(fd, data, size, 0) != (ssize_t)size) {
+        perror("send");
+        exit(1);
+    }
+}
+
+static void recvAll(int fd, void *data, size_t size)
+{
+    if (recv(fd, data, size, MSG_WAITALL) != (ssize_t)size) {
+        perror("recv");
+        exit(1);
+    }
+}
+
+static void sendMessage(int fd, int message)
+{
+    sendAll(fd, &message, sizeof(int));
+}
+
+/* Append data to the frame buffer */
+static char *append(char *buffer, const void *data, size_t size)
+{
+    memcpy(buffer, data, size);
+    return buffer + size;
+}
+
+static void sendInputs(int fd, const struct Inputs *ai, int framed)
+{
+    int controller = 0;
+
+    if (!framed) {
+        sendMessage(fd, ALL_INPUTS);
+        sendAll(fd, ai->keyboard, sizeof(ai->keyboard));
+        sendMessage(fd, POINTER_INPUTS);
+        sendAll(fd, ai->pointer, sizeof(ai->pointer));
+        sendMessage(fd, CONTROLLER_INPUTS);
+        sendAll(fd, &controller, sizeof(int));
+        sendAll(fd, ai->controller_axes, sizeof(ai->controller_axes) + sizeof(ai->controller_buttons));
+        sendMessage(fd, MISC_INPUTS);
+        sendAll(fd, ai->misc, sizeof(ai->misc));
+        sendMessage(fd, END_INPUTS);
+        sendMessage(fd, END_FRAMEBOUNDARY);
+        return;
+    }
+
+    char buffer[512];
+    int messages[] = {ALL_INPUTS, POINTER_INPUTS, CONTROLLER_INPUTS, MISC_INPUTS, END_INPUTS, END_FRAMEBOUNDARY};
+
+    /* Leave room for the header */
+    char *p = buffer + 2 * sizeof(int);
+    p = append(p, &messages[0], sizeof(int));
+    p = append(p, ai->keyboard, sizeof(ai->keyboard));
+    p = append(p, &messages[1], sizeof(int));
+    p = append(p, ai->pointer, sizeof(ai->pointer));
+    p = append(p, &messages[2], sizeof(int));
+    p = append(p, &controller, sizeof(int));
+    p = append(p, ai->controller_axes, sizeof(ai->controller_axes) + sizeof(ai->controller_buttons));
+    p = append(p, &messages[3], sizeof(int));
+    p = append(p, ai->misc, sizeof(ai->misc));
+    p = append(p, &messages[4], sizeof(int));
+    p = append(p, &messages[5], sizeof(int));
+
+    int header[2] = {FRAMED_MESSAGES, (int)(p - buffer - sizeof(header))};
+    memcpy(buffer, header, sizeof(header));
+    sendAll(fd, buffer, p - buffer);
+}
+
+/* Read the data of a message, either from the socket or from the frame */
+static void readData(int fd, const char **frame, void *data, size_t size)
+{
+    if (*frame) {
+        memcpy(data, *frame, size);
+        *frame += size;
+    }
+    else {
+        recvAll(fd, data, size);
+    }
+}
+
+static void game(int fd, long frames, int framed)
+{
+    struct Inputs ai;
+    char buffer[512];
+
+    for (long f = 0; f < frames; f++) {
+        sendMessage(fd, START_FRAMEBOUNDARY);
+
+        const char *frame = NULL;
+        if (framed) {
+            int header[2];
+            recvAll(fd, header, sizeof(header));
+            recvAll(fd, buffer, header[1]);
+            frame = buffer;
+        }
+
+        int message, controller;
+        do {
+            readData(fd, &frame, &message, sizeof(int));
+            switch (message) {
+                case ALL_INPUTS:
+                    readData(fd, &frame, ai.keyboard, sizeof(ai.keyboard));
+                    break;
+                case POINTER_INPUTS:
+                    readData(fd, &frame, ai.pointer, sizeof(ai.pointer));
+                    break;
+                case CONTROLLER_INPUTS:
+                    readData(fd, &frame, &controller, sizeof(int));
+                    readData(fd, &frame, ai.controller_axes, sizeof(ai.controller_axes) + sizeof(ai.controller_buttons));
+                    break;
+                case MISC_INPUTS:
+                    readData(fd, &frame, ai.misc, sizeof(ai.misc));
+                    break;
+            }
+        } while (message != END_FRAMEBOUNDARY);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long frames = 200000;
+    if (argc > 1)
+        frames = atol(argv[1]);
+
+    struct Inputs ai;
+    memset(&ai, 0, sizeof(ai));
+
+    for (int framed = 0; framed < 2; framed++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+            perror("socketpair");
+            return 1;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            game(fds[1], frames, framed);
+            exit(0);
+        }
+        close(fds[1]);
+
+        double t = now();
+        for (long f = 0; f < frames; f++) {
+            int message;
+            recvAll(fds[0], &message, sizeof(int));
+            ai.keyboard[0] = f & 0xff;
+            sendInputs(fds[0], &ai, framed);
+        }
+        waitpid(pid, NULL, 0);
+        double elapsed = now() - t;
+
+        printf("%-24s %10.0f frames/s\n", framed ? "framed messages:" : "one call per message:",
+            frames / elapsed);
+        /* Don't duplicate the output in the next forked process */
+        fflush(stdout);
+
+        close(fds[0]);
+    }
+
+    return 0;
+}
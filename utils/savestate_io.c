@@ -0,0 +1,160 @@
+/* This code measures the throughput of the file access patterns used when
+ * saving and loading savestates: runs of memory pages that are contiguous in
+ * the savestate file but scattered in memory, written and read either with
+ * one call per run (the previous savestate code) or with vectored calls of up
+ * to 64 runs (the current savestate code).
+ *
+ * Compile with `gcc -O2 savestate_io.c -o savestate_io`
+ * Run with `./savestate_io [file] [size in MB]`, the file is deleted at exit
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_SIZE 4096
+#define BATCH_SEGMENTS 64
+
+static double now()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec + tp.tv_nsec / 1000000000.0;
+}
+
+/* Build runs of 1 to 4 pages separated by unsaved pages, like a memory area
+ * where only some pages were modified */
+static int buildRuns(size_t nb_pages, size_t *run_start, size_t *run_size)
+{
+    int count = 0;
+    size_t p = 0;
+    srand(1234);
+    while (p < nb_pages) {
+        size_t size = 1 + rand() % 4;
+        if (p + size > nb_pages)
+            size = nb_pages - p;
+        run_start[count] = p;
+        run_size[count] = size;
+        count++;
+        p += size + 1 + rand() % 2;
+    }
+    return count;
+}
+
+static size_t writeRuns(int fd, char *mem, int count, size_t *run_start, size_t *run_size)
+{
+    size_t total = 0;
+    for (int r = 0; r < count; r++) {
+        size_t size = run_size[r] * PAGE_SIZE;
+        if (write(fd, mem + run_start[r] * PAGE_SIZE, size) != (ssize_t)size)
+            perror("write");
+        total += size;
+    }
+    return total;
+}
+
+static size_t writeBatched(int fd, char *mem, int count, size_t *run_start, size_t *run_size)
+{
+    struct iovec iov[BATCH_SEGMENTS];
+    size_t total = 0;
+    for (int r = 0; r < count; r += BATCH_SEGMENTS) {
+        int n = (count - r) > BATCH_SEGMENTS ? BATCH_SEGMENTS : (count - r);
+        size_t size = 0;
+        for (int i = 0; i < n; i++) {
+            iov[i].iov_base = mem + run_start[r + i] * PAGE_SIZE;
+            iov[i].iov_len = run_size[r + i] * PAGE_SIZE;
+            size += iov[i].iov_len;
+        }
+        if (writev(fd, iov, n) != (ssize_t)size)
+            perror("writev");
+        total += size;
+    }
+    return total;
+}
+
+static size_t readRuns(int fd, char *mem, int count, size_t *run_start, size_t *run_size)
+{
+    size_t total = 0;
+    for (int r = 0; r < count; r++) {
+        size_t size = run_size[r] * PAGE_SIZE;
+        lseek(fd, total, SEEK_SET);
+        if (read(fd, mem + run_start[r] * PAGE_SIZE, size) != (ssize_t)size)
+            perror("read");
+        total += size;
+    }
+    return total;
+}
+
+static size_t readBatched(int fd, char *mem, int count, size_t *run_start, size_t *run_size)
+{
+    struct iovec iov[BATCH_SEGMENTS];
+    size_t total = 0;
+    for (int r = 0; r < count; r += BATCH_SEGMENTS) {
+        int n = (count - r) > BATCH_SEGMENTS ? BATCH_SEGMENTS : (count - r);
+        size_t size = 0;
+        for (int i = 0; i < n; i++) {
+            iov[i].iov_base = mem + run_start[r + i] * PAGE_SIZE;
+            iov[i].iov_len = run_size[r + i] * PAGE_SIZE;
+            size += iov[i].iov_len;
+        }
+        if (preadv(fd, iov, n, total) != (ssize_t)size)
+            perror("preadv");
+        total += size;
+    }
+    return total;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = (argc > 1) ? argv[1] : "/tmp/savestate_io.bin";
+    size_t mb = (argc > 2) ? strtoul(argv[2], NULL, 10) : 512;
+    size_t nb_pages = mb * 1024 * 1024 / PAGE_SIZE;
+
+    char *mem = mmap(NULL, nb_pages * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(mem, 0x5a, nb_pages * PAGE_SIZE);
+
+    size_t *run_start = malloc(nb_pages * sizeof(size_t));
+    size_t *run_size = malloc(nb_pages * sizeof(size_t));
+    int count = buildRuns(nb_pages, run_start, run_size);
+
+    printf("%d runs of pages over %zu MB of memory\n", count, mb);
+
+    for (int batched = 0; batched < 2; batched++) {
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            perror("open");
+            return 1;
+        }
+
+        double t = now();
+        size_t size = batched ? writeBatched(fd, mem, count, run_start, run_size) :
+                                writeRuns(fd, mem, count, run_start, run_size);
+        double write_time = now() - t;
+
+        t = now();
+        size = batched ? readBatched(fd, mem, count, run_start, run_size) :
+                         readRuns(fd, mem, count, run_start, run_size);
+        double read_time = now() - t;
+
+        printf("%-16s write %8.1f MB/s, read %8.1f MB/s\n", batched ? "vectored calls:" : "one call per run:",
+            size / write_time / (1024 * 1024), size / read_time / (1024 * 1024));
+
+        close(fd);
+        unlink(path);
+    }
+
+    munmap(mem, nb_pages * PAGE_SIZE);
+    free(run_start);
+    free(run_size);
+    return 0;
+}